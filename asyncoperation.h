@@ -0,0 +1,185 @@
+#pragma once
+
+#include "waffle.h"
+#include "awaitable.h"
+
+#include <atomic>
+#include <optional>
+#include <type_traits>
+
+namespace waffle
+{
+	// WUA の Begin/End の組を co_await で待つ
+	//
+	// 完了の通知を受けるオブジェクトは参照を数え、WUA が持つ間は待っているフレームが無くなっても生き続ける。
+
+	template<class Worker, class Job, class Result, class BeginArg, class Callback, class CallbackArgs>
+	class AsyncOperation
+	{
+		typedef HRESULT(STDMETHODCALLTYPE Worker:: * BeginMethod)(BeginArg, IUnknown *, VARIANT, Job **);
+		typedef HRESULT(STDMETHODCALLTYPE Worker:: * EndMethod)(Job *, Result **);
+		typedef HRESULT(STDMETHODCALLTYPE Callback:: * CompletedMethod)(Job *, CallbackArgs *);
+
+		// 完了の通知を受けるオブジェクト。WUA が参照を持つ間は生き続ける
+		class Completed : public Callback
+		{
+			std::atomic<ULONG> m_references;
+
+			Scheduler & m_scheduler;
+			std::coroutine_handle<> m_handle;
+
+		public:
+			Completed(Scheduler & scheduler, std::coroutine_handle<> handle) : m_references(1), m_scheduler(scheduler), m_handle(handle)
+			{}
+
+			HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void ** ppvObject) override
+			{
+				if (ppvObject == nullptr)
+				{
+					return E_POINTER;
+				}
+
+				if (riid == __uuidof(IUnknown) || riid == __uuidof(Callback))
+				{
+					*ppvObject = this;
+					AddRef();
+					return S_OK;
+				}
+
+				return E_NOINTERFACE;
+			}
+
+			ULONG STDMETHODCALLTYPE AddRef(void) override
+			{
+				return ++m_references;
+			}
+
+			ULONG STDMETHODCALLTYPE Release(void) override
+			{
+				auto references = --m_references;
+
+				if (references == 0)
+				{
+					delete this;
+				}
+
+				return references;
+			}
+
+			HRESULT STDMETHODCALLTYPE Invoke(Job *, CallbackArgs *) override
+			{
+				try
+				{
+					m_scheduler.Post(m_handle);
+
+					return S_OK;
+				}
+				catch (...)
+				{
+					return E_FAIL;
+				}
+			}
+		};
+
+		Scheduler & m_scheduler;
+		Worker * m_worker;
+		BeginMethod m_beginMethod;
+		EndMethod m_endMethod;
+		BeginArg m_arg;
+		unsigned long m_timeout;
+		Cancellation * m_cancellation;
+
+		com_ptr_t<Job> m_job;
+		HRESULT m_hr;
+		bool m_timedOut;
+
+		std::optional<Scheduler::Timer> m_timer;
+		std::optional<Cancellation::Registration> m_registration;
+
+	public:
+		AsyncOperation(Scheduler & scheduler, BeginMethod begin, EndMethod end, CompletedMethod comp, std::type_identity_t<Worker> * worker, std::type_identity_t<BeginArg> arg, unsigned long timeout = INFINITE, Cancellation * cancellation = nullptr)
+			: m_scheduler(scheduler), m_worker(worker), m_beginMethod(begin), m_endMethod(end), m_arg(arg), m_timeout(timeout), m_cancellation(cancellation), m_hr(S_OK), m_timedOut(false)
+		{}
+
+		AsyncOperation(const AsyncOperation &) = delete;
+		AsyncOperation & operator=(const AsyncOperation &) = delete;
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			if (m_cancellation != nullptr && m_cancellation->Cancelled())
+			{
+				m_hr = E_ABORT;
+				return false;
+			}
+
+			com_ptr_t<Callback> callback;
+			callback.Attach(new Completed(m_scheduler, handle));
+
+			_variant_t state;
+
+			// Begin の中で完了が通知されても、再開は Run() のループに戻ってからなので問題ない
+			if (auto hr = (m_worker->*m_beginMethod)(m_arg, callback, state, &m_job); FAILED(hr))
+			{
+				m_hr = hr;
+				return false;
+			}
+
+			if (m_timeout != INFINITE)
+			{
+				m_timer = m_scheduler.AddTimer(Scheduler::clock::now() + std::chrono::milliseconds(m_timeout), [this]()
+				{
+					m_timedOut = true;
+					m_job->RequestAbort();
+				});
+			}
+
+			if (m_cancellation != nullptr)
+			{
+				m_registration = m_cancellation->Register([this]() { m_job->RequestAbort(); });
+			}
+
+			return true;
+		}
+
+		com_ptr_t<Result> await_resume()
+		{
+			if (m_timer && !m_timedOut)
+			{
+				m_scheduler.CancelTimer(*m_timer);
+			}
+
+			if (m_registration)
+			{
+				m_cancellation->Unregister(*m_registration);
+			}
+
+			if (FAILED(m_hr))
+			{
+				throw std::system_error(m_hr, WUACategory());
+			}
+
+			com_ptr_t<Result> result;
+
+			auto hr = (m_worker->*m_endMethod)(m_job, &result);
+
+			m_job->CleanUp();
+
+			if (m_timedOut)
+			{
+				throw std::runtime_error("timeout");
+			}
+
+			if (FAILED(hr))
+			{
+				throw std::system_error(hr, WUACategory());
+			}
+
+			return result;
+		}
+	};
+}
@@ -0,0 +1,121 @@
+#include "awaitable.h"
+
+namespace waffle
+{
+	Scheduler::Scheduler() : m_tasks(0)
+	{}
+
+	void Scheduler::Post(std::coroutine_handle<> handle)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+
+			m_ready.push_back(handle);
+		}
+
+		m_posted.notify_one();
+	}
+
+	Scheduler::Timer Scheduler::AddTimer(clock::time_point due, std::function<void()> function)
+	{
+		return m_timers.emplace(due, std::move(function));
+	}
+
+	void Scheduler::CancelTimer(Timer timer)
+	{
+		m_timers.erase(timer);
+	}
+
+	void Scheduler::Spawn(Task<> task)
+	{
+		++m_tasks;
+
+		Start(std::move(task));
+	}
+
+	detail::Detached Scheduler::Start(Task<> task)
+	{
+		try
+		{
+			co_await task;
+		}
+		catch (...)
+		{
+			if (!m_failure)
+			{
+				m_failure = std::current_exception();
+			}
+		}
+
+		--m_tasks;
+	}
+
+	void Scheduler::Run()
+	{
+		while (m_tasks > 0)
+		{
+			std::deque<std::coroutine_handle<>> ready;
+
+			{
+				std::unique_lock lock(m_mutex);
+
+				auto posted = [this]() { return !m_ready.empty(); };
+
+				if (m_timers.empty())
+					m_posted.wait(lock, posted);
+				else
+					m_posted.wait_until(lock, m_timers.begin()->first, posted);
+
+				ready.swap(m_ready);
+			}
+
+			// 完了した操作を先に再開して、同時に期限の来たタイマーを取り消せるようにする
+			for (auto handle : ready)
+			{
+				handle.resume();
+			}
+
+			for (auto now = clock::now(); !m_timers.empty() && m_timers.begin()->first <= now; )
+			{
+				auto function = std::move(m_timers.begin()->second);
+
+				m_timers.erase(m_timers.begin());
+
+				function();
+			}
+		}
+
+		if (m_failure)
+		{
+			std::rethrow_exception(std::exchange(m_failure, nullptr));
+		}
+	}
+
+	Cancellation::Cancellation() : m_cancelled(false)
+	{}
+
+	void Cancellation::Cancel()
+	{
+		if (m_cancelled)
+		{
+			return;
+		}
+
+		m_cancelled = true;
+
+		for (auto & handler : m_handlers)
+		{
+			handler();
+		}
+	}
+
+	Cancellation::Registration Cancellation::Register(std::function<void()> handler)
+	{
+		return m_handlers.insert(m_handlers.end(), std::move(handler));
+	}
+
+	void Cancellation::Unregister(Registration registration)
+	{
+		m_handlers.erase(registration);
+	}
+}
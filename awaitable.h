@@ -0,0 +1,294 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <utility>
+#include <optional>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace waffle
+{
+	// co_await で非同期操作を待つ
+	//
+	// 完了の通知は別のスレッドから Scheduler::Post() で届け、コルーチンの再開は Scheduler::Run() を回すスレッドに戻して行う。
+	// 一つのスレッドで複数の検索やダウンロード、タイムアウトを同時に進められる。WUA の操作を待つのは asyncoperation.h。
+
+	template<class T = void>
+	class Task;
+
+	namespace detail
+	{
+		class PromiseBase
+		{
+			std::coroutine_handle<> m_continuation;
+			std::exception_ptr m_exception;
+
+		public:
+			struct FinalAwaiter
+			{
+				bool await_ready() noexcept
+				{
+					return false;
+				}
+
+				template<class Promise>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+				{
+					if (auto continuation = handle.promise().m_continuation)
+					{
+						return continuation;
+					}
+
+					return std::noop_coroutine();
+				}
+
+				void await_resume() noexcept
+				{}
+			};
+
+			std::suspend_always initial_suspend() noexcept
+			{
+				return {};
+			}
+
+			FinalAwaiter final_suspend() noexcept
+			{
+				return {};
+			}
+
+			void unhandled_exception() noexcept
+			{
+				m_exception = std::current_exception();
+			}
+
+			void SetContinuation(std::coroutine_handle<> continuation) noexcept
+			{
+				m_continuation = continuation;
+			}
+
+			void Rethrow()
+			{
+				if (m_exception)
+				{
+					std::rethrow_exception(m_exception);
+				}
+			}
+		};
+
+		template<class T>
+		class Promise : public PromiseBase
+		{
+			std::optional<T> m_value;
+
+		public:
+			Task<T> get_return_object() noexcept;
+
+			void return_value(T value)
+			{
+				m_value.emplace(std::move(value));
+			}
+
+			T Value()
+			{
+				Rethrow();
+
+				return std::move(*m_value);
+			}
+		};
+
+		template<>
+		class Promise<void> : public PromiseBase
+		{
+		public:
+			Task<void> get_return_object() noexcept;
+
+			void return_void() noexcept
+			{}
+
+			void Value()
+			{
+				Rethrow();
+			}
+		};
+
+		// Scheduler::Spawn() で起動したタスクを最後まで回すだけのコルーチン
+		struct Detached
+		{
+			struct promise_type
+			{
+				Detached get_return_object() noexcept
+				{
+					return {};
+				}
+
+				std::suspend_never initial_suspend() noexcept
+				{
+					return {};
+				}
+
+				std::suspend_never final_suspend() noexcept
+				{
+					return {};
+				}
+
+				void return_void() noexcept
+				{}
+
+				void unhandled_exception() noexcept
+				{
+					std::terminate();
+				}
+			};
+		};
+	}
+
+	template<class T>
+	class Task
+	{
+	public:
+		using promise_type = detail::Promise<T>;
+
+	private:
+		std::coroutine_handle<promise_type> m_handle;
+
+	public:
+		explicit Task(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle)
+		{}
+
+		Task(Task && other) noexcept : m_handle(std::exchange(other.m_handle, nullptr))
+		{}
+
+		~Task()
+		{
+			if (m_handle)
+			{
+				m_handle.destroy();
+			}
+		}
+
+		Task(const Task &) = delete;
+		Task & operator=(const Task &) = delete;
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+		{
+			m_handle.promise().SetContinuation(continuation);
+
+			return m_handle;
+		}
+
+		T await_resume()
+		{
+			return m_handle.promise().Value();
+		}
+	};
+
+	template<class T>
+	Task<T> detail::Promise<T>::get_return_object() noexcept
+	{
+		return Task<T>(std::coroutine_handle<Promise>::from_promise(*this));
+	}
+
+	inline Task<void> detail::Promise<void>::get_return_object() noexcept
+	{
+		return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
+	}
+
+	class Scheduler
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+		using Timer = std::multimap<clock::time_point, std::function<void()>>::iterator;
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_posted;
+		std::deque<std::coroutine_handle<>> m_ready;
+
+		std::multimap<clock::time_point, std::function<void()>> m_timers;
+
+		size_t m_tasks;
+		std::exception_ptr m_failure;
+
+		detail::Detached Start(Task<> task);
+
+	public:
+		Scheduler();
+		~Scheduler() = default;
+
+		Scheduler(const Scheduler &) = delete;
+		Scheduler & operator=(const Scheduler &) = delete;
+
+		// どのスレッドから呼んでもよい
+		void Post(std::coroutine_handle<> handle);
+
+		// 以下は Run() を回すスレッドからだけ呼ぶ
+		Timer AddTimer(clock::time_point due, std::function<void()> function);
+		void CancelTimer(Timer timer);
+
+		void Spawn(Task<> task);
+
+		// 起動したタスクがすべて終わるまで回す。最初に失敗したタスクの例外を投げ直す
+		void Run();
+
+		auto Delay(std::chrono::milliseconds delay)
+		{
+			struct Awaiter
+			{
+				Scheduler & scheduler;
+				std::chrono::milliseconds delay;
+
+				bool await_ready() const noexcept
+				{
+					return delay.count() <= 0;
+				}
+
+				void await_suspend(std::coroutine_handle<> handle)
+				{
+					scheduler.AddTimer(clock::now() + delay, [handle]() { handle.resume(); });
+				}
+
+				void await_resume() noexcept
+				{}
+			};
+
+			return Awaiter{ *this, delay };
+		}
+	};
+
+	// Cancel() を呼ぶと、登録された操作を中止する (Scheduler のスレッドから使う)
+	class Cancellation
+	{
+		bool m_cancelled;
+		std::list<std::function<void()>> m_handlers;
+
+	public:
+		using Registration = std::list<std::function<void()>>::iterator;
+
+		Cancellation();
+		~Cancellation() = default;
+
+		Cancellation(const Cancellation &) = delete;
+		Cancellation & operator=(const Cancellation &) = delete;
+
+		bool Cancelled() const noexcept
+		{
+			return m_cancelled;
+		}
+
+		void Cancel();
+
+		Registration Register(std::function<void()> handler);
+		void Unregister(Registration registration);
+	};
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "platform.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+
+namespace waffle
+{
+	// 1 件分の結果
+	struct UpdateResult
+	{
+		OperationResultCode code;
+		LONG hresult;
+	};
+
+	// ジョブ全体の結果。updates はジョブに渡した順
+	struct JobResult
+	{
+		OperationResultCode code;
+		LONG hresult;
+		std::vector<UpdateResult> updates;
+		bool rebootRequired;
+	};
+
+	// 進捗の通知で渡す、今の更新の結果と進み具合
+	//
+	// WUA では値ごとに COM の呼び出しになるので、使う側が要るものだけを引く。
+
+	class Progress
+	{
+	public:
+		// 今の更新の結果 (終わっていなければ S_OK)
+		virtual LONG HResult() const = 0;
+
+		virtual LONG PercentComplete() const = 0;
+
+		// 今の更新だけの進み具合
+		virtual LONG CurrentUpdatePercentComplete() const = 0;
+
+	protected:
+		~Progress() = default;
+	};
+
+	class DownloadProgress : public Progress
+	{
+	public:
+		// (合計, ダウンロード済み) のバイト数
+		virtual std::pair<ULONGLONG, ULONGLONG> TotalBytes() const = 0;
+
+	protected:
+		~DownloadProgress() = default;
+	};
+
+	class InstallationProgress : public Progress
+	{
+	protected:
+		~InstallationProgress() = default;
+	};
+
+	// 値をそのまま持つ進捗 (WUA を使わない Backend で使う)
+
+	class DownloadProgressValues : public DownloadProgress
+	{
+		LONG m_hresult;
+		LONG m_percent;
+		LONG m_currentPercent;
+		ULONGLONG m_total;
+		ULONGLONG m_bytes;
+
+	public:
+		DownloadProgressValues(LONG hresult, LONG percent, LONG currentPercent, ULONGLONG total, ULONGLONG bytes) : m_hresult(hresult), m_percent(percent), m_currentPercent(currentPercent), m_total(total), m_bytes(bytes)
+		{}
+
+		LONG HResult() const override
+		{
+			return m_hresult;
+		}
+
+		LONG PercentComplete() const override
+		{
+			return m_percent;
+		}
+
+		LONG CurrentUpdatePercentComplete() const override
+		{
+			return m_currentPercent;
+		}
+
+		std::pair<ULONGLONG, ULONGLONG> TotalBytes() const override
+		{
+			return { m_total, m_bytes };
+		}
+	};
+
+	class InstallationProgressValues : public InstallationProgress
+	{
+		LONG m_hresult;
+		LONG m_percent;
+		LONG m_currentPercent;
+
+	public:
+		InstallationProgressValues(LONG hresult, LONG percent, LONG currentPercent) : m_hresult(hresult), m_percent(percent), m_currentPercent(currentPercent)
+		{}
+
+		LONG HResult() const override
+		{
+			return m_hresult;
+		}
+
+		LONG PercentComplete() const override
+		{
+			return m_percent;
+		}
+
+		LONG CurrentUpdatePercentComplete() const override
+		{
+			return m_currentPercent;
+		}
+	};
+
+	// (ジョブの中の位置, 今の更新の結果のコード, 進捗)
+	using DownloadProgressCallback = std::function<void(LONG, OperationResultCode, const DownloadProgress &)>;
+	using InstallationProgressCallback = std::function<void(LONG, OperationResultCode, const InstallationProgress &)>;
+
+	// ダウンロードの完了を待つ間、(合計, ダウンロード済み) のバイト数で定期的に呼ばれる。true を返したらジョブを中止する
+	using DownloadPoll = std::function<bool(ULONGLONG, ULONGLONG)>;
+
+	// WUA の検索、ダウンロード、インストールを 1 回ずつ呼ぶ部分
+	//
+	// やり直しや止まったジョブの扱い、パイプラインは Orchestrator が受け持つ。更新は Backend の中の番号で指す。
+	// テストやベンチマークでは、偽物や記録の再生に差し替える。
+
+	class Backend
+	{
+	public:
+		virtual ~Backend() = default;
+
+		// 見つかった更新の数を返す
+		virtual LONG Search(const std::wstring & criteria, unsigned long timeout) = 0;
+
+		virtual JobResult Download(const std::vector<LONG> & updates, const DownloadProgressCallback & progress, const DownloadPoll & poll) = 0;
+		virtual JobResult Install(const std::vector<LONG> & updates, const InstallationProgressCallback & progress) = 0;
+
+		virtual bool IsDownloaded(LONG update) = 0;
+		virtual bool IsInstalled(LONG update) = 0;
+	};
+}
@@ -0,0 +1,878 @@
+#include "core.h"
+#include "retry.h"
+#include "throughput.h"
+#include "trace.h"
+#include "renderer.h"
+#include "snapshot.h"
+#include "filter.h"
+#include "governor.h"
+#include "orchestrator.h"
+#include "replay.h"
+#include "plan.h"
+#include "scanstate.h"
+
+#include <array>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <clocale>
+#include <optional>
+#include <functional>
+#include <string_view>
+
+// core の処理 (進捗の通知ごとに呼ばれるもの) を、WUA の代わりの偽物で測る
+//
+// 1 行に 1 件、JSON Lines で「名前, 回数, 1 回あたりのナノ秒」を書き出す。
+// 使い方: waffle_benchmark [--iterations=N] [--filter=名前の一部]
+//
+// --replay=<記録したファイル|synthetic> を付けると、WUA とのやり取りを再生して、検索から計画どおりのダウンロードとインストール、
+// 進捗の表示までを 1 回通して測る。
+// --scale=N で更新を N 件に増やし、--speed=X で X 倍に縮めて (既定の 0 は待たずに) 再生する。
+//
+// --snapshot=N を付けると、N 件の偽の更新からスナップショットを作り、その後の絞り込みや並べ替えを測る。
+// --workers=N でプロパティを引くスレッドの数を、--latency=マイクロ秒 で 1 件あたりの COM の呼び出しにかかる時間を変える。
+//
+// --load=<負荷の記録 (1 行に cpu,disk,network)|synthetic> を付けると、--threshold=% (既定は 70) の優先度の決め方に
+// 負荷を 1 標本ずつ流しながら偽のダウンロードを進め、優先度が変わるたびに 1 行と、最後にまとめを書き出す。
+// 閾値を超えた標本の間にダウンロードが進んでいたら、終了コードを 1 にする。
+//
+// --scan-package=MB を付けると、MB の大きさの cab で、スキャンパッケージを登録し直す場合と使い回す場合を比べる。
+// 登録にかかる時間は --registration=ミリ秒 (既定は 2000) で変える。
+
+namespace
+{
+	volatile size_t sink;
+
+	// IUpdateDownloadResult などの代わり
+	struct FakeResult
+	{
+		OperationResultCode code;
+		unsigned long * calls;
+
+		HRESULT get_ResultCode(OperationResultCode * value)
+		{
+			++*calls;
+			*value = code;
+			return S_OK;
+		}
+	};
+
+	// IDownloadProgress (と IDownloadResult) などの代わり。COM の呼び出しの回数を数える
+	struct FakeProgress
+	{
+		LONG index;
+		std::array<FakeResult, 64> results;
+		unsigned long calls;
+
+		FakeProgress() : index(0), calls(0)
+		{
+			for (auto & result : results)
+			{
+				result = { orcSucceeded, &calls };
+			}
+		}
+
+		HRESULT get_CurrentUpdateIndex(LONG * value)
+		{
+			++calls;
+			*value = index;
+			return S_OK;
+		}
+
+		HRESULT GetUpdateResult(LONG index, FakeResult ** value)
+		{
+			++calls;
+			*value = &results[index];
+			return S_OK;
+		}
+	};
+
+	// IDownloadJob などの代わり
+	struct FakeJob
+	{
+		unsigned long cleanUps = 0;
+		unsigned long aborts = 0;
+
+		void CleanUp()
+		{
+			++cleanUps;
+		}
+
+		void RequestAbort()
+		{
+			++aborts;
+		}
+	};
+
+	// IUpdate の代わり。行を引くたびに latency だけ (COM の呼び出しの代わりに) 待つ
+	struct FakeUpdate
+	{
+		LONG index;
+		std::chrono::microseconds latency;
+
+		waffle::UpdateSnapshot::Row GetRow() const
+		{
+			// WUA のサービスとのやり取りは、ほとんどが相手を待つ時間
+			if (latency > std::chrono::microseconds::zero())
+			{
+				std::this_thread::sleep_for(latency);
+			}
+
+			auto severity = (index % 17 == 0) ? waffle::UpdateSeverity::Critical : (waffle::UpdateSeverity) (1 + index % 4);
+
+			return waffle::UpdateSnapshot::Row
+			{
+				L"Synthetic Update " + std::to_wstring(index),
+				L"00000000-0000-0000-0000-" + std::to_wstring(100000000000LL + index),
+				1,
+				(ULONGLONG) (index % 97) << 20,
+				(ULONGLONG) (index % 97 + 1) << 20,
+				severity,
+				index % 3,
+				index % 3,
+				index % 5 == 0,
+				{ 5000000 + index, 5000000 + index / 2 },
+				{ L"Security Updates", L"Windows 11" },
+			};
+		}
+	};
+
+	// 1 文字ずつ変換して書き出す、以前の operator<<(std::wostream &, const char *) (stream_mbs と比べるため)
+	std::wostream & StreamPerCharacter(std::wostream & out, const char * mbs)
+	{
+		wchar_t wc{};
+
+		for (auto count = std::mbtowc(&wc, mbs, MB_CUR_MAX); count > 0; count = std::mbtowc(&wc, mbs += count, MB_CUR_MAX))
+		{
+			out << wc;
+		}
+
+		return out;
+	}
+
+	// WUA のサービスマネージャーの代わり。スキャンパッケージの登録 (AddScanPackageService) は registration だけかかる
+	struct FakeServiceManager
+	{
+		std::chrono::milliseconds registration;
+		std::vector<std::wstring> services;
+		unsigned long registrations = 0;
+
+		std::wstring Register()
+		{
+			std::this_thread::sleep_for(registration);
+
+			++registrations;
+
+			return services.emplace_back(L"{00000000-0000-0000-0000-" + std::to_wstring(100000000000LL + registrations) + L"}");
+		}
+
+		bool IsRegistered(const WCHAR * serviceID) const
+		{
+			return std::find(services.begin(), services.end(), serviceID) != services.end();
+		}
+	};
+
+	// ScanPackage と同じ決め方で、cab を登録し直す場合と使い回す場合を比べる
+	//
+	// cab は megabytes の大きさのメモリ上のバッファで、ハッシュ (SHA-256 の代わりの FNV-1a) は毎回全体を読む。
+	// cold は記録が無いとき、touched は更新日時だけが変わったとき (ハッシュは計算するが登録は使い回す)、warm は何も変わっていないとき。
+	void ScanPackageReuse(long megabytes, std::chrono::milliseconds registration)
+	{
+		std::vector<BYTE> cab((size_t) megabytes << 20);
+
+		for (size_t i = 0; i < cab.size(); ++i)
+		{
+			cab[i] = (BYTE) (i * 2654435761u >> 24);
+		}
+
+		FakeServiceManager manager{ registration };
+		std::optional<waffle::ScanPackageState> saved;
+
+		for (auto scenario : { "cold", "touched", "warm" })
+		{
+			if (std::string_view(scenario) == "cold")
+			{
+				saved.reset();
+			}
+
+			waffle::ScanPackageState current{};
+
+			current.size = cab.size();
+			current.lastWriteTime = std::string_view(scenario) == "cold" ? 1 : 2;
+
+			unsigned long hashes = 0;
+			auto registrations = manager.registrations;
+			auto start = std::chrono::steady_clock::now();
+
+			auto hash = [&]()
+			{
+				++hashes;
+
+				std::array<BYTE, 32> digest{};
+				std::uint64_t value = 14695981039346656037ULL;
+
+				for (auto byte : cab)
+				{
+					value = (value ^ byte) * 1099511628211ULL;
+				}
+
+				std::copy_n(reinterpret_cast<const BYTE *>(&value), sizeof(value), digest.begin());
+
+				return digest;
+			};
+
+			std::wstring serviceID;
+
+			if (waffle::ReuseScanPackage(saved, current, hash, [&](const WCHAR * id) { return manager.IsRegistered(id); }))
+				serviceID = saved->serviceID;
+			else
+				serviceID = manager.Register();
+
+			auto elapsed = std::chrono::steady_clock::now() - start;
+
+			std::wstring_view(serviceID).copy(current.serviceID, std::size(current.serviceID) - 1);
+			saved = current;
+
+			std::printf("{\"benchmark\":\"scan_package\",\"scenario\":\"%s\",\"megabytes\":%ld,\"hashes\":%lu,\"registrations\":%lu,\"elapsed_ms\":%.3f}\n",
+				scenario, megabytes, hashes, manager.registrations - registrations, std::chrono::duration<double, std::milli>(elapsed).count());
+		}
+	}
+
+	struct Benchmark
+	{
+		const char * name;
+		std::function<void(unsigned long)> run;
+	};
+
+	void Report(const char * name, unsigned long iterations, std::chrono::nanoseconds elapsed)
+	{
+		std::printf("{\"benchmark\":\"%s\",\"iterations\":%lu,\"ns_per_op\":%.3f}\n", name, iterations, (double) elapsed.count() / iterations);
+	}
+
+	// 記録を ReplayBackend で再生し、wmain と同じ道 (検索、DownloadPlan のバッチごとのダウンロード、InstallPlan のバッチごとの
+	// インストール) を Orchestrator で進める。一時的なエラーのやり直しと止まったジョブのやり直しも、記録のとおりに通る。
+	//
+	// 進捗は wmain の Callback と同じように、進行中の更新は状態の行を描き直し、終わった更新は 1 行を書き足す。
+	void Replay(const waffle::TraceReplay & replay, double speed)
+	{
+		size_t written = 0;
+		unsigned long lines = 0;
+
+		waffle::ProgressRenderer renderer([&written](std::wstring_view text) { written += text.size(); }, true);
+
+		std::wostringstream text;
+
+		auto render = [&](waffle::ProgressPhase phase, LONG position, std::wstring_view title, OperationResultCode code, const waffle::Progress & progress, ULONGLONG bytes, ULONGLONG total)
+		{
+			if (code < orcSucceeded)
+			{
+				renderer.Update(phase, position, title, progress.PercentComplete(), bytes, total, 0);
+				return;
+			}
+
+			text.str(std::wstring());
+
+			if (phase == waffle::ProgressPhase::Download)
+				text << waffle::FormatToatalBytes(bytes, total) << title;
+			else
+				text << progress.PercentComplete() << L"% " << title;
+
+			if (code != orcSucceeded)
+			{
+				auto msg = waffle::GetWUAErrorMessage(progress.HResult());
+
+				text << L'\n' << L" !!! " << (msg != nullptr ? msg : "Unknown error.");
+			}
+
+			renderer.Complete(phase, position, text.str());
+			++lines;
+		};
+
+		auto start = std::chrono::steady_clock::now();
+
+		waffle::ReplayBackend backend(replay, speed);
+		waffle::Orchestrator orchestrator;
+
+		// 記録の中の待ち時間は再生の速さで決まるので、やり直しは待たない
+		// 止まったジョブは、縮めた時間で 10 分 (待たずに再生するなら 100 ミリ秒) 進まなければやり直す
+		orchestrator.SetRetryPolicy(waffle::RetryPolicy(3, std::chrono::milliseconds(0), std::chrono::milliseconds(0)));
+		orchestrator.SetStallTimeout(speed > 0 ? (unsigned long) std::max(100.0, 10 * 60 * 1000 / speed) : 100);
+
+		auto count = orchestrator.Search(backend, L"IsInstalled=0", INFINITE);
+		auto & snapshot = backend.Snapshot();
+
+		waffle::DownloadPlan downloadPlan(snapshot, ~0ULL, 1ULL << 30);
+
+		for (size_t i = 0; i < downloadPlan.Batches().size(); ++i)
+		{
+			auto batch = downloadPlan.Batch(i);
+
+			orchestrator.Download(backend, batch, [&](LONG position, OperationResultCode code, const waffle::DownloadProgress & progress)
+			{
+				auto [total, bytes] = progress.TotalBytes();
+
+				render(waffle::ProgressPhase::Download, position, snapshot.Title(batch[position]), code, progress, bytes, total);
+			});
+		}
+
+		std::vector<LONG> downloaded;
+
+		for (auto index : downloadPlan.Selected())
+		{
+			if (backend.IsDownloaded(index))
+			{
+				downloaded.push_back(index);
+			}
+		}
+
+		// InstallPlan の番号は downloaded の中の位置
+		waffle::InstallPlan installPlan(snapshot.Select(downloaded));
+
+		for (size_t i = 0; i < installPlan.Batches().size(); ++i)
+		{
+			std::vector<LONG> batch;
+
+			for (auto position : installPlan.Batch(i))
+			{
+				batch.push_back(downloaded[position]);
+			}
+
+			orchestrator.Install(backend, batch, [&](LONG position, OperationResultCode code, const waffle::InstallationProgress & progress)
+			{
+				render(waffle::ProgressPhase::Install, position, snapshot.Title(batch[position]), code, progress, 0, 0);
+			});
+		}
+
+		LONG installed = 0;
+
+		for (auto index : downloaded)
+		{
+			installed += backend.IsInstalled(index) ? 1 : 0;
+		}
+
+		renderer.Flush();
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		std::printf("{\"benchmark\":\"replay\",\"updates\":%ld,\"records\":%zu,\"downloaded\":%zu,\"installed\":%ld,\"download_batches\":%zu,\"install_batches\":%zu,\"retries\":%lu,\"stalls\":%lu,\"reboot\":%s,\"lines\":%lu,\"frames\":%lu,\"dropped\":%lu,\"written\":%zu,\"elapsed_ms\":%.3f,\"ns_per_record\":%.3f}\n",
+			(long) count, replay.Records().size(), downloaded.size(), (long) installed, downloadPlan.Batches().size(), installPlan.Batches().size(), orchestrator.Retries(), orchestrator.Stalls(), orchestrator.RebootRequired() ? "true" : "false",
+			lines, renderer.Frames(), renderer.Dropped(), written, std::chrono::duration<double, std::milli>(elapsed).count(), (double) std::chrono::nanoseconds(elapsed).count() / std::max<size_t>(replay.Records().size(), 1));
+	}
+
+	// Session::Collect と同じように行を引いてスナップショットを作り、DownloadPlan などと同じ使い方で引く
+	void Snapshot(long updates, unsigned workers, std::chrono::microseconds latency)
+	{
+		std::vector<FakeUpdate> fakes;
+
+		for (long index = 0; index < updates; ++index)
+		{
+			fakes.push_back({ (LONG) index, latency });
+		}
+
+		auto report = [updates](const char * name, unsigned workers, std::chrono::steady_clock::duration elapsed)
+		{
+			std::printf("{\"benchmark\":\"%s\",\"updates\":%ld,\"workers\":%u,\"elapsed_ms\":%.3f,\"ns_per_update\":%.3f}\n",
+				name, updates, workers, std::chrono::duration<double, std::milli>(elapsed).count(), (double) std::chrono::nanoseconds(elapsed).count() / std::max(updates, 1L));
+		};
+
+		std::vector<waffle::UpdateSnapshot::Row> rows(updates);
+
+		auto start = std::chrono::steady_clock::now();
+
+		waffle::ParallelFor(updates, 1, [&](LONG index) { rows[index] = fakes[index].GetRow(); });
+
+		report("snapshot_fetch_serial", 1, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+
+		waffle::ParallelFor(updates, workers, [&](LONG index) { rows[index] = fakes[index].GetRow(); });
+
+		report("snapshot_fetch_parallel", workers, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+
+		waffle::UpdateSnapshot snapshot(std::move(rows));
+
+		report("snapshot_build", 1, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+
+		waffle::DownloadPlan plan(snapshot, ~0ULL, ~0ULL);
+
+		auto order = plan.Selected();
+
+		report("snapshot_plan_sort", 1, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+
+		sink = sink + snapshot.PendingDownloadSize();
+
+		report("snapshot_pending_size", 1, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+
+		sink = sink + snapshot.FindKb(5000000 + updates / 2).size();
+
+		report("snapshot_find_kb", 1, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+
+		order.resize(order.size() / 2);
+		sink = sink + snapshot.Select(order).size();
+
+		report("snapshot_select_half", 1, std::chrono::steady_clock::now() - start);
+	}
+
+	// 1 標本 (1 秒) ごとに、ジョブを作ったときの優先度の速さでダウンロードが進む偽の WUA
+	//
+	// 標本は poll の前に流し、LoadGovernor と同じく止めるときと戻すときだけ Orchestrator にジョブを作り直させる。
+	// 記録を流し終えたら、残りは一度に終わらせる。
+
+	class GovernedBackend : public waffle::Backend
+	{
+		const std::vector<waffle::LoadSample> & m_samples;
+		waffle::PriorityGovernor & m_governor;
+		waffle::Orchestrator & m_orchestrator;
+
+		std::vector<bool> m_downloaded;
+		size_t m_next;
+		double m_peak;
+
+	public:
+		static constexpr ULONGLONG UpdateBytes = 64ULL << 20;
+
+		size_t changes = 0;
+		size_t violations = 0;
+		size_t jobs = 0;
+		std::array<size_t, 4> levels{};
+
+		GovernedBackend(const std::vector<waffle::LoadSample> & samples, waffle::PriorityGovernor & governor, waffle::Orchestrator & orchestrator, LONG count) : m_samples(samples), m_governor(governor), m_orchestrator(orchestrator), m_downloaded(count), m_next(0), m_peak(0)
+		{}
+
+		// 標本を 1 つ流す。流し終えていたら false
+		bool Tick()
+		{
+			if (m_next == m_samples.size())
+			{
+				return false;
+			}
+
+			auto & sample = m_samples[m_next++];
+
+			m_peak = sample.Peak();
+
+			auto previous = m_governor.Level();
+
+			if (m_governor.Sample(sample))
+			{
+				++changes;
+
+				std::printf("{\"sample\":%zu,\"level\":\"%s\",\"cpu\":%.1f,\"disk\":%.1f,\"network\":%.1f,\"load\":%.1f}\n",
+					m_next - 1, waffle::GetDownloadLevelName(m_governor.Level()), sample.cpu, sample.disk, sample.network, m_governor.Load());
+
+				if (waffle::RestartsDownload(previous, m_governor.Level()))
+				{
+					m_orchestrator.Interrupt();
+				}
+			}
+
+			++levels[(size_t) m_governor.Level()];
+
+			return true;
+		}
+
+		// Paused の間は標本だけを流す (LoadGovernor::WaitWhilePaused)
+		void Wait()
+		{
+			while (m_governor.Level() == waffle::DownloadLevel::Paused && Tick())
+			{}
+		}
+
+		LONG Search(const std::wstring &, unsigned long) override
+		{
+			return (LONG) m_downloaded.size();
+		}
+
+		waffle::JobResult Download(const std::vector<LONG> & updates, const waffle::DownloadProgressCallback & progress, const waffle::DownloadPoll & poll) override
+		{
+			++jobs;
+
+			// 優先度はジョブを作るときに決まる (Paused で作るのは流し終えた後だけ)
+			static const std::array<ULONGLONG, 4> rates{ 1ULL << 20, 1ULL << 20, 4ULL << 20, 16ULL << 20 };
+
+			auto rate = rates[(size_t) m_governor.Level()];
+			auto total = UpdateBytes * updates.size();
+
+			waffle::JobResult result{ orcSucceeded, S_OK, {}, false };
+			ULONGLONG bytes = 0;
+
+			for (LONG position = 0; position < (LONG) updates.size(); ++position)
+			{
+				for (ULONGLONG left = UpdateBytes; left > 0; )
+				{
+					if (!Tick())
+					{
+						break;
+					}
+
+					if (poll(total, bytes))
+					{
+						result.code = orcAborted;
+						result.updates.resize(updates.size(), waffle::UpdateResult{ orcAborted, S_OK });
+
+						return result;
+					}
+
+					auto moved = std::min(rate, left);
+
+					// 閾値を超えた標本の間にバイト数が増えたら、止められていない
+					if (m_peak >= m_governor.Threshold())
+					{
+						++violations;
+					}
+
+					left -= moved;
+					bytes += moved;
+				}
+
+				m_downloaded[updates[position]] = true;
+				result.updates.push_back({ orcSucceeded, S_OK });
+
+				progress(position, orcSucceeded, waffle::DownloadProgressValues(S_OK, (LONG) ((position + 1) * 100 / updates.size()), 100, total, bytes));
+			}
+
+			return result;
+		}
+
+		waffle::JobResult Install(const std::vector<LONG> & updates, const waffle::InstallationProgressCallback &) override
+		{
+			return { orcSucceeded, S_OK, std::vector<waffle::UpdateResult>(updates.size(), { orcSucceeded, S_OK }), false };
+		}
+
+		bool IsDownloaded(LONG update) override
+		{
+			return m_downloaded[update];
+		}
+
+		bool IsInstalled(LONG) override
+		{
+			return false;
+		}
+	};
+
+	// LoadGovernor と同じように 1 秒に 1 標本を流しながら、Orchestrator でダウンロードを進める。閾値を超えた間に進んだ回数を返す
+	size_t Govern(const std::vector<waffle::LoadSample> & samples, double threshold)
+	{
+		waffle::PriorityGovernor governor(threshold);
+		waffle::Orchestrator orchestrator;
+
+		// 普通の優先度で 16 標本かかる更新を、記録を流し終えるまで足りる数だけ
+		GovernedBackend backend(samples, governor, orchestrator, (LONG) (samples.size() / 16 + 1));
+
+		orchestrator.SetDownloadGate([&]() { backend.Wait(); });
+
+		auto start = std::chrono::steady_clock::now();
+
+		orchestrator.Download(backend, waffle::Sequence((LONG) (samples.size() / 16 + 1)), [](LONG, OperationResultCode, const waffle::DownloadProgress &) {});
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		auto & levels = backend.levels;
+
+		std::printf("{\"benchmark\":\"governor\",\"samples\":%zu,\"threshold\":%.1f,\"changes\":%zu,\"jobs\":%zu,\"interrupts\":%lu,\"violations\":%zu,\"paused\":%zu,\"low\":%zu,\"normal\":%zu,\"high\":%zu,\"ns_per_sample\":%.3f}\n",
+			samples.size(), threshold, backend.changes, backend.jobs, orchestrator.Interrupts(), backend.violations, levels[0], levels[1], levels[2], levels[3], (double) std::chrono::nanoseconds(elapsed).count() / std::max<size_t>(samples.size(), 1));
+
+		return backend.violations;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned long iterations = 1000000;
+	std::string_view filter;
+	std::string_view replay;
+	long scale = 0;
+	double speed = 0;
+	long snapshot = 0;
+	unsigned workers = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+	long latency = 20;
+	std::string_view load;
+	double threshold = 70;
+	long scanPackage = 0;
+	long registration = 2000;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+
+		if (arg.starts_with("--iterations="))
+			iterations = std::stoul(std::string(arg.substr(13)));
+		else if (arg.starts_with("--filter="))
+			filter = arg.substr(9);
+		else if (arg.starts_with("--replay="))
+			replay = arg.substr(9);
+		else if (arg.starts_with("--scale="))
+			scale = std::stol(std::string(arg.substr(8)));
+		else if (arg.starts_with("--speed="))
+			speed = std::stod(std::string(arg.substr(8)));
+		else if (arg.starts_with("--snapshot="))
+			snapshot = std::stol(std::string(arg.substr(11)));
+		else if (arg.starts_with("--workers="))
+			workers = std::stoul(std::string(arg.substr(10)));
+		else if (arg.starts_with("--latency="))
+			latency = std::stol(std::string(arg.substr(10)));
+		else if (arg.starts_with("--load="))
+			load = arg.substr(7);
+		else if (arg.starts_with("--threshold="))
+			threshold = std::stod(std::string(arg.substr(12)));
+		else if (arg.starts_with("--scan-package="))
+			scanPackage = std::stol(std::string(arg.substr(15)));
+		else if (arg.starts_with("--registration="))
+			registration = std::stol(std::string(arg.substr(15)));
+		else
+		{
+			std::fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	std::setlocale(LC_ALL, "");
+
+	if (!replay.empty())
+	{
+		// 合成するときは、--scale の件数 (既定は 300 件) をそのまま作る
+		auto trace = (replay == "synthetic") ? waffle::TraceReplay::Synthesize(scale > 0 ? scale : 300, 1) : waffle::TraceReplay::Load(std::string(replay));
+
+		Replay((scale > 0 && replay != "synthetic") ? trace.Scale(scale) : trace, speed);
+		return 0;
+	}
+
+	if (!load.empty())
+	{
+		// 合成するときは、--scale の数 (既定は 1 日分) の標本を作る
+		// 閾値を超えた間にダウンロードが進んでいたら失敗にする
+		return Govern(load == "synthetic" ? waffle::SynthesizeLoadTrace(scale > 0 ? scale : 24 * 60 * 60, 1) : waffle::ReadLoadTrace(std::string(load)), threshold) == 0 ? 0 : 1;
+	}
+
+	if (scanPackage > 0)
+	{
+		ScanPackageReuse(scanPackage, std::chrono::milliseconds(registration));
+		return 0;
+	}
+
+	if (snapshot > 0)
+	{
+		Snapshot(snapshot, workers, std::chrono::microseconds(latency));
+		return 0;
+	}
+
+	const std::array<ULONGLONG, 6> sizes{ 5ULL * 1024, 50ULL * 1024, 500ULL * 1024, 5ULL << 20, 500ULL << 20, 5ULL << 30 };
+	const std::array<LONG, 4> codes{ WU_E_NO_CONNECTION, WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL, WU_S_REBOOT_REQUIRED, (LONG) 0x80070005 };
+
+	const waffle::UpdateFilter updateFilter(L"severity >= important and not (category = Drivers or title ~ '*Preview*') and size < 50M and kb != 5000001");
+
+	std::vector<waffle::UpdateSnapshot::Row> rows;
+
+	for (LONG index = 0; index < 64; ++index)
+	{
+		rows.push_back(FakeUpdate{ index, std::chrono::microseconds::zero() }.GetRow());
+	}
+
+	Benchmark benchmarks[] =
+	{
+		{ "format_total_bytes", [&](unsigned long count)
+		{
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				auto total = sizes[i % sizes.size()];
+
+				sink = sink + waffle::FormatToatalBytes(total / 3, total).size();
+			}
+		} },
+		{ "stream_mbs", [&](unsigned long count)
+		{
+			std::wostringstream out;
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				if (i % 1024 == 0)
+				{
+					out.str(std::wstring());
+				}
+
+				out << "The update to be downloaded has already been downloaded.";
+			}
+
+			sink = sink + out.str().size();
+		} },
+		{ "stream_mbs_per_char", [&](unsigned long count)
+		{
+			std::wostringstream out;
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				if (i % 1024 == 0)
+				{
+					out.str(std::wstring());
+				}
+
+				StreamPerCharacter(out, "The update to be downloaded has already been downloaded.");
+			}
+
+			sink = sink + out.str().size();
+		} },
+		{ "format_total_bytes_buffer", [&](unsigned long count)
+		{
+			wchar_t buffer[64];
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				auto total = sizes[i % sizes.size()];
+
+				sink = sink + waffle::FormatToatalBytes(buffer, std::size(buffer), total / 3, total);
+			}
+		} },
+		{ "render_update", [&](unsigned long count)
+		{
+			// 既定の間隔 (100ms) で、ほとんどの進捗は描かずに捨てる
+			waffle::ProgressRenderer renderer([](std::wstring_view text) { sink = sink + text.size(); }, true);
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				renderer.Update(waffle::ProgressPhase::Download, (LONG) (i % 4), L"Synthetic Update", (LONG) (i % 100), i * 4096, count * 4096ULL, 1024.0 * 1024);
+			}
+		} },
+		{ "render_frame", [&](unsigned long count)
+		{
+			// 間引かずに、4 行の描き直しを毎回する
+			waffle::ProgressRenderer renderer([](std::wstring_view text) { sink = sink + text.size(); }, true, std::chrono::milliseconds(0));
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				renderer.Update(waffle::ProgressPhase::Download, (LONG) (i % 4), L"Synthetic Update", (LONG) (i % 100), i * 4096, count * 4096ULL, 1024.0 * 1024);
+			}
+		} },
+		{ "wua_error_message", [&](unsigned long count)
+		{
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				auto msg = waffle::GetWUAErrorMessage(codes[i % codes.size()]);
+
+				sink = sink + (msg != nullptr ? 1 : 0);
+			}
+		} },
+		{ "validate_operation_code", [&](unsigned long count)
+		{
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				waffle::ValidateOperationCode((i & 1) ? orcSucceeded : orcSucceededWithErrors, MACRO_SOURCE_LOCATION());
+			}
+		} },
+		{ "dispatch_progress", [&](unsigned long count)
+		{
+			// 1 件あたり 16 回の通知のあと次の更新に移る、64 件のジョブを繰り返す (ジョブの終わりに Finish)
+			FakeProgress progress;
+
+			std::optional<waffle::ProgressDispatcher<FakeResult *>> dispatcher;
+
+			auto invoke = [](LONG index, OperationResultCode code, FakeResult * result)
+			{
+				sink = sink + index + code + (result != nullptr ? result->code : 0);
+			};
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				auto tick = i % (16 * progress.results.size());
+
+				if (tick == 0)
+				{
+					if (dispatcher)
+					{
+						sink = sink + dispatcher->Finish(&progress, invoke);
+					}
+
+					dispatcher.emplace((LONG) progress.results.size());
+				}
+
+				progress.index = (LONG) (tick / 16);
+
+				sink = sink + dispatcher->Dispatch(&progress, invoke);
+			}
+
+			sink = sink + progress.calls;
+		} },
+		{ "complete_job", [&](unsigned long count)
+		{
+			FakeJob fake;
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				waffle::CompleteEvent completeEvent;
+
+				auto job = &fake;
+
+				completeEvent.Notify();
+
+				sink = sink + waffle::CompleteJob(job, [&]() { completeEvent.Wait(INFINITE); }, [&]() { return i; });
+			}
+
+			sink = sink + fake.cleanUps;
+		} },
+		{ "throughput_sample", [&](unsigned long count)
+		{
+			waffle::Throughput throughput;
+
+			auto now = waffle::Throughput::clock::now();
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				now += std::chrono::milliseconds(100);
+
+				throughput.Sample(now, (std::uint64_t) i * 4096, (std::uint64_t) count * 4096);
+			}
+
+			sink = sink + throughput.Transferred();
+		} },
+		{ "filter_evaluate", [&](unsigned long count)
+		{
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				sink = sink + updateFilter(rows[i % rows.size()]);
+			}
+		} },
+		{ "retry_delay", [&](unsigned long count)
+		{
+			waffle::RetryPolicy policy(8);
+
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				sink = sink + policy.Delay(i % 8).count();
+			}
+		} },
+	};
+
+	for (auto & benchmark : benchmarks)
+	{
+		if (!filter.empty() && std::string_view(benchmark.name).find(filter) == std::string_view::npos)
+		{
+			continue;
+		}
+
+		// 1 回目はキャッシュやバッファを温めるだけ
+		benchmark.run(std::min(iterations, 1000UL));
+
+		auto start = std::chrono::steady_clock::now();
+
+		benchmark.run(iterations);
+
+		Report(benchmark.name, iterations, std::chrono::steady_clock::now() - start);
+	}
+
+	return 0;
+}
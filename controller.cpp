@@ -0,0 +1,165 @@
+#include "controller.h"
+
+namespace waffle
+{
+	BackendTarget::BackendTarget(std::wstring name, std::wstring criteria, std::function<std::unique_ptr<Backend>()> connect) : m_name(std::move(name)), m_criteria(std::move(criteria)), m_connect(std::move(connect)), m_count(0)
+	{}
+
+	void BackendTarget::Connect()
+	{
+		m_backend = m_connect();
+		m_count = 0;
+	}
+
+	LONG BackendTarget::Search(unsigned long timeout)
+	{
+		m_count = m_orchestrator.Search(*m_backend, m_criteria, timeout);
+
+		return m_count;
+	}
+
+	void BackendTarget::Download()
+	{
+		m_orchestrator.Download(*m_backend, Sequence(m_count), [](auto &&...) {});
+	}
+
+	void BackendTarget::Install()
+	{
+		m_orchestrator.Install(*m_backend, Sequence(m_count), [](auto &&...) {});
+	}
+
+	bool BackendTarget::RebootRequired()
+	{
+		return m_orchestrator.RebootRequired();
+	}
+
+	void BackendTarget::Disconnect()
+	{
+		m_backend.reset();
+	}
+
+	Controller::Controller(size_t workers, std::vector<size_t> waves, double maxFailureRate, unsigned long timeout) : m_workers(workers > 0 ? workers : 1), m_waves(std::move(waves)), m_maxFailureRate(maxFailureRate), m_timeout(timeout)
+	{}
+
+	TargetResult Controller::RunTarget(Target & target, size_t wave)
+	{
+		TargetResult result{ &target, wave, false, 0, false };
+
+		auto start = std::chrono::steady_clock::now();
+
+		try
+		{
+			target.Connect();
+
+			result.updates = target.Search(m_timeout);
+
+			if (result.updates > 0)
+			{
+				target.Download();
+				target.Install();
+			}
+
+			result.rebootRequired = target.RebootRequired();
+			result.succeeded = true;
+		}
+		catch (const std::exception & e)
+		{
+			result.message = e.what();
+		}
+
+		try
+		{
+			target.Disconnect();
+		}
+		catch (...)
+		{
+		}
+
+		result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+		return result;
+	}
+
+	bool Controller::Run(std::vector<std::unique_ptr<Target>> & targets, TargetCallback onTarget, WaveCallback onWave)
+	{
+		size_t finished = 0;
+		size_t failed = 0;
+
+		for (size_t begin = 0, wave = 0; begin < targets.size(); ++wave)
+		{
+			auto size = m_waves.empty() ? targets.size() : m_waves[std::min(wave, m_waves.size() - 1)];
+			auto end = std::min(begin + std::max<size_t>(size, 1), targets.size());
+
+			// ウェーブの中でも、許される失敗の数を超えたら残りには手を付けない
+			auto allowed = (size_t) (m_maxFailureRate * (end - begin));
+
+			WaveResult summary{ wave, end - begin, 0, 0, 0 };
+
+			std::atomic<size_t> next = begin;
+			std::atomic<bool> open = false;
+
+			auto start = std::chrono::steady_clock::now();
+
+			std::vector<std::thread> workers;
+
+			for (size_t i = 0; i < std::min(m_workers, end - begin); ++i)
+			{
+				workers.emplace_back([&]()
+				{
+					for (auto index = next++; index < end; index = next++)
+					{
+						if (open)
+						{
+							std::lock_guard lock(m_mutex);
+
+							++summary.skipped;
+							continue;
+						}
+
+						auto result = RunTarget(*targets[index], wave);
+
+						std::lock_guard lock(m_mutex);
+
+						if (result.succeeded)
+						{
+							++summary.succeeded;
+						}
+						else if (++summary.failed > allowed)
+						{
+							open = true;
+						}
+
+						if (onTarget)
+						{
+							onTarget(result);
+						}
+					}
+				});
+			}
+
+			for (auto & worker : workers)
+			{
+				worker.join();
+			}
+
+			summary.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+			if (onWave)
+			{
+				onWave(summary);
+			}
+
+			finished += summary.succeeded + summary.failed;
+			failed += summary.failed;
+
+			if (open || (finished > 0 && (double) failed / finished > m_maxFailureRate))
+			{
+				return false;
+			}
+
+			begin = end;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "backend.h"
+#include "orchestrator.h"
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+
+namespace waffle
+{
+	// 多数のコンピューターをひとつのプロセスから更新する
+	//
+	// 対象はウェーブ (1 台, 10 台, 50 台, ...) に分けて順に進め、各ウェーブの中は決まった数のワーカーで並行に処理する。
+	// 失敗の割合がしきい値を超えたら、そこで打ち切る (サーキットブレーカー)。WUA の Session で更新する対象は sessiontarget.h。
+
+	class Target
+	{
+	public:
+		virtual ~Target() = default;
+
+		virtual const std::wstring & Name() const = 0;
+
+		// ワーカーのスレッドで、以下の順に呼ばれる
+		virtual void Connect() = 0;
+		virtual LONG Search(unsigned long timeout) = 0;
+		virtual void Download() = 0;
+		virtual void Install() = 0;
+		virtual bool RebootRequired() = 0;
+
+		// 成否にかかわらず最後に呼ばれる
+		virtual void Disconnect() = 0;
+	};
+
+	// Backend の上で Orchestrator を使って更新する対象
+	//
+	// connect が Connect() のたびに Backend を作る。WUA を使わない偽の Backend や記録の再生を並べて、Controller を確かめる。
+	class BackendTarget : public Target
+	{
+		std::wstring m_name;
+		std::wstring m_criteria;
+		std::function<std::unique_ptr<Backend>()> m_connect;
+
+		std::unique_ptr<Backend> m_backend;
+		Orchestrator m_orchestrator;
+		LONG m_count;
+
+	public:
+		BackendTarget(std::wstring name, std::wstring criteria, std::function<std::unique_ptr<Backend>()> connect);
+		~BackendTarget() override = default;
+
+		const std::wstring & Name() const override
+		{
+			return m_name;
+		}
+
+		// やり直しや止まったジョブの扱いを決める
+		Orchestrator & GetOrchestrator() noexcept
+		{
+			return m_orchestrator;
+		}
+
+		void Connect() override;
+		LONG Search(unsigned long timeout) override;
+		void Download() override;
+		void Install() override;
+		bool RebootRequired() override;
+		void Disconnect() override;
+	};
+
+	struct TargetResult
+	{
+		const Target * target;
+		size_t wave;
+		bool succeeded;
+		LONG updates;
+		bool rebootRequired;
+		std::string message;
+		std::chrono::milliseconds elapsed;
+	};
+
+	struct WaveResult
+	{
+		size_t wave;
+		size_t targets;
+		size_t succeeded;
+		size_t failed;
+		size_t skipped;
+		std::chrono::milliseconds elapsed;
+	};
+
+	using TargetCallback = std::function<void(const TargetResult &)>;
+	using WaveCallback = std::function<void(const WaveResult &)>;
+
+	class Controller
+	{
+		size_t m_workers;
+		std::vector<size_t> m_waves;
+		double m_maxFailureRate;
+		unsigned long m_timeout;
+
+		std::mutex m_mutex;
+
+		TargetResult RunTarget(Target & target, size_t wave);
+
+	public:
+		// waves はウェーブごとの台数。最後の値を残りのウェーブに繰り返し使う (空なら全台で 1 ウェーブ)
+		Controller(size_t workers, std::vector<size_t> waves, double maxFailureRate, unsigned long timeout);
+		~Controller() = default;
+
+		Controller(const Controller &) = delete;
+		Controller & operator=(const Controller &) = delete;
+
+		// すべてのウェーブを終えたら true、ブレーカーで打ち切ったら false
+		bool Run(std::vector<std::unique_ptr<Target>> & targets, TargetCallback onTarget, WaveCallback onWave);
+	};
+}
@@ -0,0 +1,251 @@
+#include "core.h"
+#include "wuaerrors.h"
+
+#include <chrono>
+#include <cwchar>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+std::wostream & operator<<(std::wostream & out, const char * mbs)
+{
+	// 文字列全体を一度に変換して、まとめて書き出す (バッファは使い回す)
+
+	thread_local std::wstring buffer;
+
+	auto length = (int) std::strlen(mbs);
+
+	if (length == 0)
+	{
+		return out;
+	}
+
+	if (buffer.size() < (size_t) length)
+	{
+		buffer.resize(length);
+	}
+
+#ifdef _WIN32
+	auto count = ::MultiByteToWideChar(CP_ACP, 0, mbs, length, buffer.data(), length);
+
+	if (count == 0)
+	{
+		throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+	}
+#else
+	auto count = std::mbstowcs(buffer.data(), mbs, length);
+
+	if (count == (size_t) -1)
+	{
+		throw std::system_error(errno, std::generic_category(), MACRO_SOURCE_LOCATION());
+	}
+#endif
+
+	return out.write(buffer.data(), count);
+}
+
+namespace waffle
+{
+#ifdef _WIN32
+	CompleteEvent::CompleteEvent()
+	{
+		m_event = ::CreateEvent(nullptr, true, false, nullptr);
+
+		if (m_event == nullptr)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	CompleteEvent::~CompleteEvent()
+	{
+		::CloseHandle(m_event);
+	}
+
+	void CompleteEvent::Wait(unsigned long timeout)
+	{
+		auto wait = ::WaitForSingleObject(m_event, timeout);
+
+		if (wait == WAIT_TIMEOUT)
+		{
+			throw std::runtime_error("timeout");
+		}
+
+		if (wait != WAIT_OBJECT_0)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	bool CompleteEvent::WaitFor(unsigned long timeout)
+	{
+		auto wait = ::WaitForSingleObject(m_event, timeout);
+
+		if (wait == WAIT_TIMEOUT)
+		{
+			return false;
+		}
+
+		if (wait != WAIT_OBJECT_0)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return true;
+	}
+
+	void CompleteEvent::Notify()
+	{
+		if (!::SetEvent(m_event))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+#else
+	CompleteEvent::CompleteEvent() : m_signaled(false)
+	{}
+
+	CompleteEvent::~CompleteEvent() = default;
+
+	void CompleteEvent::Wait(unsigned long timeout)
+	{
+		if (!WaitFor(timeout))
+		{
+			throw std::runtime_error("timeout");
+		}
+	}
+
+	bool CompleteEvent::WaitFor(unsigned long timeout)
+	{
+		std::unique_lock lock(m_mutex);
+
+		if (timeout == INFINITE)
+		{
+			m_notified.wait(lock, [this]() { return m_signaled; });
+			return true;
+		}
+
+		return m_notified.wait_for(lock, std::chrono::milliseconds(timeout), [this]() { return m_signaled; });
+	}
+
+	void CompleteEvent::Notify()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+
+			m_signaled = true;
+		}
+
+		m_notified.notify_all();
+	}
+#endif
+
+	size_t FormatToatalBytes(wchar_t * buffer, size_t size, ULONGLONG bytes, ULONGLONG total)
+	{
+		// 描画の行に直接書けるよう、呼び出し側のバッファに書く (std::format_to_n は libstdc++ 12 に無い)。
+		// 速さは std::wstring を返す版と変わらない (測った差は誤差の範囲)
+
+		const auto KB = 1024ULL;
+		const auto MB = 1024 * KB;
+		const auto GB = 1024 * MB;
+
+		auto format = [buffer, size](const wchar_t * pattern, auto... args)
+		{
+			auto count = std::swprintf(buffer, size, pattern, args...);
+
+			return count > 0 ? (size_t) count : 0;
+		};
+
+		if (auto value = (double) total / KB; value < 9.95L)
+			return format(L"%.1f/%.1fKB ", (double) bytes / KB, value); // 9.9KB
+		else if (value < 10.0L)
+			return format(L"%llu/10KB ", bytes / KB); // !!!
+
+		if (total <= (99 * KB))
+			return format(L"%llu/%lluKB ", bytes / KB, total / KB); // 99KB 
+
+		if (total <= (999 * KB))
+			return format(L"%llu/%lluKB ", bytes / KB, total / KB); // 999KB 
+
+		if (auto value = (double) total / MB; value < 9.95L)
+			return format(L"%.1f/%.1fMB ", (double) bytes / MB, value); // 9.9MB 
+		else if (value < 10.0L)
+			return format(L"%llu/10MB ", bytes / MB); // !!!
+
+		if (total <= (99 * MB))
+			return format(L"%llu/%lluMB ", bytes / MB, total / MB); // 99MB 
+
+		if (total <= (999 * MB))
+			return format(L"%llu/%lluMB ", bytes / MB, total / MB); // 999MB 
+
+		return format(L"%.1f/%.1fGB ", (double) bytes / GB, (double) total / GB); // 9.9GB 
+	}
+
+	std::wstring FormatToatalBytes(ULONGLONG bytes, ULONGLONG total)
+	{
+		wchar_t buffer[64];
+
+		return std::wstring(buffer, FormatToatalBytes(buffer, std::size(buffer), bytes, total));
+	}
+
+	void ValidateOperationCode(OperationResultCode code, const char * what)
+	{
+		switch (code)
+		{
+		case orcNotStarted:
+			throw std::runtime_error(std::string(what) + ": Not Started.");
+		case orcInProgress:
+			throw std::runtime_error(std::string(what) + ": In Pogress.");
+		case orcSucceeded:
+		case orcSucceededWithErrors:
+			return;
+		case orcFailed:
+			throw std::runtime_error(std::string(what) + ": Failed.");
+		case orcAborted:
+			throw std::runtime_error(std::string(what) + ": Aborted.");
+		default:
+			throw std::runtime_error(std::string(what) + ": code(" + std::to_string((int) code) + ").");
+		}
+	}
+}
+
+const char * waffle::GetWUAErrorMessage(LONG code)
+{
+	if (auto error = FindWUAError(code); error != nullptr)
+	{
+		return error->text;
+	}
+
+	return nullptr;
+}
+
+namespace
+{
+	class ErrorCategory : public std::error_category
+	{
+	public:
+		const char * name() const noexcept override
+		{
+			return "wua";
+		}
+
+		std::string message(int code) const override
+		{
+			if (auto msg = waffle::GetWUAErrorMessage(code); msg != nullptr)
+			{
+				return msg;
+			}
+
+			return std::system_category().message(code);
+		}
+	};
+}
+
+const std::error_category & waffle::WUACategory() noexcept
+{
+	static const ErrorCategory category;
+
+	return category;
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "platform.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <exception>
+#include <system_error>
+#include <condition_variable>
+
+// Windows と COM に依存しない部分 (Linux でもビルドしてベンチマークを取れるように)
+
+std::wostream & operator<<(std::wostream & out, const char * mbs);
+
+namespace waffle
+{
+	class CompleteEvent
+	{
+#ifdef _WIN32
+		HANDLE m_event;
+#else
+		std::mutex m_mutex;
+		std::condition_variable m_notified;
+		bool m_signaled;
+#endif
+
+	public:
+		CompleteEvent();
+		~CompleteEvent();
+
+		CompleteEvent(const CompleteEvent &) = delete;
+		CompleteEvent & operator=(const CompleteEvent &) = delete;
+
+		void Wait(unsigned long timeout);
+		bool WaitFor(unsigned long timeout);
+		void Notify();
+	};
+
+	// 「1234/5678KB 」の形で、単位をそろえて 4 桁以内に収める
+	std::wstring FormatToatalBytes(ULONGLONG bytes, ULONGLONG total);
+
+	// 呼び出し側のバッファ (描画の行など) に書く版。書いた文字数 (終端の L'\0' を除く) を返す
+	size_t FormatToatalBytes(wchar_t * buffer, size_t size, ULONGLONG bytes, ULONGLONG total);
+
+	void ValidateOperationCode(OperationResultCode code, const char * what);
+
+	const char * GetWUAErrorMessage(LONG code);
+
+	// HRESULT をそのまま持ち、WUA のエラーなら既知のメッセージを返すカテゴリ
+	const std::error_category & WUACategory() noexcept;
+
+	// 開始したジョブの完了を待って結果を受け取る。途中で失敗したら (タイムアウトも) ジョブを中止してから投げ直す
+	template<class Job, class Wait, class End>
+	auto CompleteJob(Job & job, Wait wait, End end)
+	{
+		try
+		{
+			wait();
+
+			auto result = end();
+
+			job->CleanUp();
+
+			return result;
+		}
+		catch (const std::exception &)
+		{
+			job->RequestAbort();
+			job->CleanUp();
+
+			throw;
+		}
+	}
+
+	// 進捗の通知を、更新ごとの invoke(index, code, result) に振り分ける
+	//
+	// 今の更新が進んでいる間は get_CurrentUpdateIndex() だけを呼び、orcInProgress と空の result を渡す。
+	// 今の更新が替わったときに前の更新の結果を 1 回だけ引き、終わっていれば通知する。ジョブが終わったら
+	// Finish() に結果を渡し、まだ通知していない更新をまとめて通知する (中止された更新は通知しない)。
+	//
+	// Progress と Result は GetUpdateResult() を、Holder は get_ResultCode() を持つ型。
+	// 通知を受けたスレッドに例外を漏らさないよう、HRESULT にして返す。
+	template<class Holder>
+	class ProgressDispatcher
+	{
+		std::mutex m_mutex;
+		LONG m_current;
+		std::vector<bool> m_reported;
+
+		template<class Source, class Invoke>
+		HRESULT Report(Source * source, LONG index, Invoke & invoke)
+		{
+			Holder result{};
+
+			if (auto hr = source->GetUpdateResult(index, &result); FAILED(hr))
+			{
+				return hr;
+			}
+
+			OperationResultCode code{};
+
+			if (auto hr = result->get_ResultCode(&code); FAILED(hr))
+			{
+				return hr;
+			}
+
+			if (code >= orcSucceeded && code != orcAborted)
+			{
+				m_reported[index] = true;
+
+				invoke(index, code, result);
+			}
+
+			return S_OK;
+		}
+
+		template<class Function>
+		static HRESULT Guard(Function function)
+		{
+			try
+			{
+				return function();
+			}
+			catch (const std::system_error & e)
+			{
+				return HRESULT_FROM_WIN32(e.code().value());
+			}
+			catch (...)
+			{
+				return E_FAIL;
+			}
+		}
+
+	public:
+		ProgressDispatcher(LONG count) : m_current(-1), m_reported(count)
+		{}
+
+		template<class Progress, class Invoke>
+		HRESULT Dispatch(Progress * progress, Invoke invoke)
+		{
+			LONG index{};
+
+			if (auto hr = progress->get_CurrentUpdateIndex(&index); FAILED(hr))
+			{
+				return hr;
+			}
+
+			if (index < 0 || index >= (LONG) m_reported.size())
+			{
+				return WU_E_INVALIDINDEX;
+			}
+
+			std::lock_guard lock(m_mutex);
+
+			return Guard([&]()
+			{
+				if (index != m_current && m_current >= 0 && !m_reported[m_current])
+				{
+					if (auto hr = Report(progress, m_current, invoke); FAILED(hr))
+					{
+						return hr;
+					}
+				}
+
+				m_current = index;
+
+				if (!m_reported[index])
+				{
+					invoke(index, orcInProgress, Holder{});
+				}
+
+				return S_OK;
+			});
+		}
+
+		template<class Result, class Invoke>
+		HRESULT Finish(Result * result, Invoke invoke)
+		{
+			std::lock_guard lock(m_mutex);
+
+			return Guard([&]()
+			{
+				for (LONG index = 0; index < (LONG) m_reported.size(); ++index)
+				{
+					if (m_reported[index])
+					{
+						continue;
+					}
+
+					if (auto hr = Report(result, index, invoke); FAILED(hr))
+					{
+						return hr;
+					}
+				}
+
+				return S_OK;
+			});
+		}
+	};
+}
@@ -0,0 +1,421 @@
+#include "daemon.h"
+
+namespace waffle
+{
+	Daemon::Daemon(Session & session, std::vector<_bstr_t> criteria, unsigned long timeout) : m_session(session), m_criteria(std::move(criteria)), m_timeout(timeout), m_submitted(0), m_finished(0), m_stopping(false), m_stop(::CreateEventW(nullptr, TRUE, FALSE, nullptr))
+	{
+		if (!m_stop)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	void Daemon::Search()
+	{
+		m_updates.emplace(m_criteria.size() == 1 ? m_session.Search(m_criteria.front(), m_timeout) : m_session.Search(m_criteria, m_timeout));
+		m_searched = std::chrono::steady_clock::now();
+	}
+
+	void Daemon::RunJob(const Job & job)
+	{
+		LONG hresult = S_OK;
+
+		try
+		{
+			auto stale = !m_updates || (std::chrono::steady_clock::now() - m_searched) > std::chrono::seconds(job.maxAge);
+
+			if (job.command == DaemonCommand::Search || stale)
+			{
+				Search();
+			}
+
+			if ((job.command == DaemonCommand::Download || job.command == DaemonCommand::Install) && !m_updates->empty())
+			{
+				m_session.Download(*m_updates, [](auto &&...) {});
+
+				if (job.command == DaemonCommand::Install)
+				{
+					m_session.Install(*m_updates, [](auto &&...) {});
+
+					// インストールした後の結果は古い
+					m_updates.reset();
+				}
+			}
+		}
+		catch (const std::system_error & e)
+		{
+			hresult = e.code().value();
+		}
+		catch (const std::exception &)
+		{
+			hresult = E_FAIL;
+		}
+
+		auto rebootRequired = m_session.RebootRequired();
+
+		std::lock_guard lock(m_mutex);
+
+		m_state.searched = m_updates.has_value();
+		m_state.updates = m_updates ? m_updates->size() : 0;
+		m_state.searchedAt = m_searched;
+		m_state.rebootRequired = rebootRequired;
+		m_state.hresult = hresult;
+	}
+
+	void Daemon::RunJobs()
+	{
+		std::unique_lock lock(m_mutex);
+
+		for (;;)
+		{
+			m_changed.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+
+			// 止めるときは、待っているジョブを始めない
+			if (m_stopping)
+			{
+				return;
+			}
+
+			auto job = m_jobs.front();
+
+			m_jobs.pop_front();
+			m_current = job.command;
+
+			lock.unlock();
+			RunJob(job);
+			lock.lock();
+
+			m_current.reset();
+			m_finished = job.ticket;
+
+			m_changed.notify_all();
+		}
+	}
+
+	unsigned long long Daemon::Submit(DaemonCommand command, std::uint32_t maxAge)
+	{
+		for (auto & job : m_jobs)
+		{
+			if (job.command == command)
+			{
+				job.maxAge = std::min(job.maxAge, maxAge);
+				return job.ticket;
+			}
+		}
+
+		m_jobs.push_back({ command, maxAge, ++m_submitted });
+		m_changed.notify_all();
+
+		return m_submitted;
+	}
+
+	bool Daemon::Searching() const
+	{
+		return m_current == DaemonCommand::Search || std::any_of(m_jobs.begin(), m_jobs.end(), [](const Job & job) { return job.command == DaemonCommand::Search; });
+	}
+
+	DaemonResponse Daemon::Handle(const DaemonRequest & request)
+	{
+		DaemonResponse response{ DAEMON_MAGIC, DAEMON_VERSION, request.command, S_OK };
+
+		auto start = std::chrono::steady_clock::now();
+
+		std::unique_lock lock(m_mutex);
+
+		if (request.magic != DAEMON_MAGIC || request.version != DAEMON_VERSION)
+		{
+			response.hresult = E_INVALIDARG;
+		}
+		else
+		{
+			switch (request.command)
+			{
+			case DaemonCommand::Status:
+				// 待たずに直近の結果を返す。古ければ次の問い合わせに間に合うよう、裏で検索し直す
+				if ((!m_state.searched || (start - m_state.searchedAt) > std::chrono::seconds(request.maxAge)) && !Searching())
+				{
+					Submit(DaemonCommand::Search, request.maxAge);
+				}
+
+				response.hresult = m_state.hresult;
+				break;
+			case DaemonCommand::Search:
+			{
+				// 前のジョブが長引いて検索のタイムアウトまでに終わらなければ、今の結果を返す (busy で分かる)
+				auto ticket = Submit(DaemonCommand::Search, 0);
+
+				if (m_changed.wait_for(lock, std::chrono::milliseconds(m_timeout), [&]() { return m_finished >= ticket; }))
+				{
+					response.hresult = m_state.hresult;
+				}
+				break;
+			}
+			case DaemonCommand::Download:
+			case DaemonCommand::Install:
+				Submit(request.command, request.maxAge);
+				break;
+			case DaemonCommand::Shutdown:
+				break;
+			default:
+				response.hresult = E_INVALIDARG;
+				break;
+			}
+		}
+
+		auto now = std::chrono::steady_clock::now();
+
+		if (m_state.searched)
+		{
+			response.updates = m_state.updates;
+			response.searchAgeMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_state.searchedAt).count();
+		}
+
+		response.rebootRequired = m_state.rebootRequired ? 1 : 0;
+		response.busy = (m_current || !m_jobs.empty()) ? 1 : 0;
+		response.elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+
+		return response;
+	}
+
+	// 重なった I/O が終わるのを待つ。stop が立ったら中止して false を返す
+	bool Complete(HANDLE pipe, OVERLAPPED & overlapped, BOOL completed, HANDLE stop, DWORD & transferred)
+	{
+		if (!completed && ::GetLastError() != ERROR_IO_PENDING)
+		{
+			return false;
+		}
+
+		if (!completed)
+		{
+			HANDLE handles[] = { stop, overlapped.hEvent };
+
+			if (::WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+			{
+				::CancelIoEx(pipe, &overlapped);
+				::GetOverlappedResult(pipe, &overlapped, &transferred, TRUE);
+
+				return false;
+			}
+		}
+
+		return ::GetOverlappedResult(pipe, &overlapped, &transferred, FALSE) != FALSE;
+	}
+
+	void Daemon::Serve(HANDLE pipe)
+	{
+		try
+		{
+			FileHandle event(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+
+			if (!event)
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			while (::WaitForSingleObject(m_stop, 0) != WAIT_OBJECT_0)
+			{
+				OVERLAPPED overlapped{};
+				DWORD transferred{};
+
+				overlapped.hEvent = event;
+
+				if (!::ConnectNamedPipe(pipe, &overlapped))
+				{
+					if (auto error = ::GetLastError(); error == ERROR_IO_PENDING)
+					{
+						if (!Complete(pipe, overlapped, FALSE, m_stop, transferred))
+						{
+							::DisconnectNamedPipe(pipe);
+							continue;
+						}
+					}
+					else if (error != ERROR_PIPE_CONNECTED)
+					{
+						throw std::system_error(error, std::system_category(), MACRO_SOURCE_LOCATION());
+					}
+				}
+
+				DaemonRequest request{};
+
+				overlapped = OVERLAPPED{};
+				overlapped.hEvent = event;
+
+				if (Complete(pipe, overlapped, ::ReadFile(pipe, &request, sizeof(request), nullptr, &overlapped), m_stop, transferred) && transferred == sizeof(request))
+				{
+					auto response = Handle(request);
+
+					overlapped = OVERLAPPED{};
+					overlapped.hEvent = event;
+
+					if (Complete(pipe, overlapped, ::WriteFile(pipe, &response, sizeof(response), nullptr, &overlapped), m_stop, transferred))
+					{
+						::FlushFileBuffers(pipe);
+					}
+
+					if (request.command == DaemonCommand::Shutdown && response.hresult == S_OK)
+					{
+						::SetEvent(m_stop);
+					}
+				}
+
+				::DisconnectNamedPipe(pipe);
+			}
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+
+				if (!m_error)
+				{
+					m_error = std::current_exception();
+				}
+			}
+
+			::SetEvent(m_stop);
+		}
+	}
+
+	void Daemon::Run(const wchar_t * pipeName)
+	{
+		// インストールまでできるので、つなげるのは SYSTEM と Administrators だけにする (既定の DACL では Everyone が読める)
+		PSECURITY_DESCRIPTOR descriptor = nullptr;
+
+		if (!::ConvertStringSecurityDescriptorToSecurityDescriptorW(L"D:P(A;;GA;;;SY)(A;;GA;;;BA)", SDDL_REVISION_1, &descriptor, nullptr))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		std::unique_ptr<void, decltype(&::LocalFree)> owner(descriptor, &::LocalFree);
+
+		SECURITY_ATTRIBUTES attributes{ sizeof(attributes), descriptor, FALSE };
+
+		// 問い合わせのスレッドごとにインスタンスを作る。ジョブが長引いても、ほかのインスタンスが Status に答える
+		// 先に同じ名前のパイプを作られていたら (なりすまし)、最初のインスタンスでやめる
+		std::vector<std::unique_ptr<FileHandle>> pipes;
+
+		for (DWORD i = 0; i < DAEMON_INSTANCES; ++i)
+		{
+			auto first = (i == 0) ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0;
+
+			pipes.push_back(std::make_unique<FileHandle>(::CreateNamedPipeW(pipeName, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | first, PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, DAEMON_INSTANCES, sizeof(DaemonResponse), sizeof(DaemonRequest), 0, &attributes)));
+
+			if (!*pipes.back())
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		// 最初の問い合わせを待たせないよう、先に一度検索しておく
+		RunJob({ DaemonCommand::Search, 0, 0 });
+
+		std::thread jobs(&Daemon::RunJobs, this);
+		std::vector<std::thread> servers;
+
+		for (auto & pipe : pipes)
+		{
+			servers.emplace_back(&Daemon::Serve, this, (HANDLE) *pipe);
+		}
+
+		for (auto & server : servers)
+		{
+			server.join();
+		}
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+
+		m_changed.notify_all();
+		jobs.join();
+
+		if (m_error)
+		{
+			std::rethrow_exception(m_error);
+		}
+	}
+
+	DaemonResponse CallDaemon(DaemonCommand command, std::uint32_t maxAge, unsigned long timeout, const wchar_t * pipeName)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		auto remaining = [&]()
+		{
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+			return (DWORD) std::max<long long>(left, 0);
+		};
+
+		// インスタンスが全部ふさがっていれば空くまで待つ (CallNamedPipe() と違い、答えを待つ時間も timeout に含める)
+		FileHandle pipe([&]()
+		{
+			for (;;)
+			{
+				if (auto handle = ::CreateFileW(pipeName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr); handle != INVALID_HANDLE_VALUE)
+				{
+					return handle;
+				}
+
+				if (auto error = ::GetLastError(); error != ERROR_PIPE_BUSY)
+				{
+					throw std::system_error(error, std::system_category(), MACRO_SOURCE_LOCATION());
+				}
+
+				if (remaining() == 0 || (!::WaitNamedPipeW(pipeName, std::max<DWORD>(remaining(), 1)) && ::GetLastError() == ERROR_SEM_TIMEOUT))
+				{
+					throw std::system_error(ERROR_TIMEOUT, std::system_category(), MACRO_SOURCE_LOCATION());
+				}
+			}
+		}());
+
+		DWORD mode = PIPE_READMODE_MESSAGE;
+
+		if (!::SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		FileHandle event(::CreateEventW(nullptr, TRUE, FALSE, nullptr));
+
+		if (!event)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		DaemonRequest request{ DAEMON_MAGIC, DAEMON_VERSION, command, maxAge };
+		DaemonResponse response{};
+		DWORD read{};
+
+		OVERLAPPED overlapped{};
+		overlapped.hEvent = event;
+
+		if (!::TransactNamedPipe(pipe, &request, sizeof(request), &response, sizeof(response), nullptr, &overlapped))
+		{
+			if (auto error = ::GetLastError(); error != ERROR_IO_PENDING)
+			{
+				throw std::system_error(error, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (::WaitForSingleObject(event, remaining()) != WAIT_OBJECT_0)
+			{
+				::CancelIoEx(pipe, &overlapped);
+				::GetOverlappedResult(pipe, &overlapped, &read, TRUE);
+
+				throw std::system_error(ERROR_TIMEOUT, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		if (!::GetOverlappedResult(pipe, &overlapped, &read, FALSE))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (read != sizeof(response) || response.magic != DAEMON_MAGIC || response.version != DAEMON_VERSION)
+		{
+			throw std::runtime_error(std::format("{}: Invalid response.", MACRO_SOURCE_LOCATION()));
+		}
+
+		return response;
+	}
+}
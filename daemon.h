@@ -0,0 +1,143 @@
+#pragma once
+
+#include "waffle.h"
+
+#include <sddl.h>
+
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <exception>
+#include <condition_variable>
+
+namespace waffle
+{
+	// 常駐して、温めたセッションと直近の検索結果で名前付きパイプからの要求に答える
+	//
+	// 1 要求 1 メッセージの固定長バイナリで、クライアントは CallDaemon() を 1 回呼ぶだけでよい。
+
+	constexpr auto DAEMON_PIPE_NAME = L"\\\\.\\pipe\\waffle";
+	constexpr std::uint32_t DAEMON_MAGIC = 0x4C464657; // "WFFL"
+	constexpr std::uint16_t DAEMON_VERSION = 2;
+
+	// 同時に受ける問い合わせの数 (インスタンスごとにスレッドを 1 つ使う)
+	constexpr DWORD DAEMON_INSTANCES = 4;
+
+	// クライアントが答えを待つ時間 (Search はこれに検索のタイムアウトを足す)
+	constexpr unsigned long DAEMON_TIMEOUT = 30 * 1000;
+
+	enum class DaemonCommand : std::uint16_t
+	{
+		Status = 1,   // 直近の結果 (待たずに答え、maxAge 秒より古ければ裏で検索し直す)
+		Search,       // 検索し直す (長くても検索のタイムアウトまで待つ)
+		Download,     // 直近の検索結果をダウンロードし始める
+		Install,      // 直近の検索結果をダウンロードしてインストールし始める
+		Shutdown,
+	};
+
+#pragma pack(push, 1)
+	struct DaemonRequest
+	{
+		std::uint32_t magic;
+		std::uint16_t version;
+		DaemonCommand command;
+		std::uint32_t maxAge;
+	};
+
+	struct DaemonResponse
+	{
+		std::uint32_t magic;
+		std::uint16_t version;
+		DaemonCommand command;
+		std::int32_t hresult;
+		std::uint32_t updates;
+		std::uint8_t rebootRequired;
+		std::uint8_t busy; // 検索、ダウンロード、インストールのどれかが走っているか待っている
+		std::uint8_t reserved[2];
+		std::uint64_t searchAgeMs;
+		std::uint64_t elapsedUs;
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(DaemonRequest) == 12);
+	static_assert(sizeof(DaemonResponse) == 36);
+
+	// 検索、ダウンロード、インストールは 1 つのジョブのスレッドで順に進め、問い合わせのスレッドでは待たない
+	//
+	// Status は直近の結果 (更新の数、検索した時刻、再起動が必要か、最後のジョブの HRESULT) をそのまま返すので、
+	// ダウンロードやインストールの間も待たされない。Download と Install は受け付けたらすぐに返し、結果は Status で見る。
+	// Shutdown は走っているジョブが終わるのを待ってから止まる。
+
+	class Daemon
+	{
+		Session & m_session;
+		std::vector<_bstr_t> m_criteria;
+		unsigned long m_timeout;
+
+		// ジョブのスレッドだけが触る
+		std::optional<Updates> m_updates;
+		std::chrono::steady_clock::time_point m_searched;
+
+		// 問い合わせのスレッドに返す直近の結果
+		struct State
+		{
+			bool searched = false;
+			std::uint32_t updates = 0;
+			std::chrono::steady_clock::time_point searchedAt;
+			bool rebootRequired = false;
+			LONG hresult = S_OK;
+		};
+
+		struct Job
+		{
+			DaemonCommand command;
+			std::uint32_t maxAge;
+			unsigned long long ticket; // 受け付けた順の番号
+		};
+
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		State m_state;
+		std::deque<Job> m_jobs;
+		std::optional<DaemonCommand> m_current;
+		unsigned long long m_submitted;
+		unsigned long long m_finished; // 最後に終わったジョブの番号
+		bool m_stopping;
+
+		FileHandle m_stop;
+		std::exception_ptr m_error;
+
+		void Search();
+		void RunJob(const Job & job);
+		void RunJobs();
+
+		// 同じジョブが待っていなければ足す (m_mutex を持って呼ぶ)。ジョブの番号を返す
+		unsigned long long Submit(DaemonCommand command, std::uint32_t maxAge);
+
+		// 検索が走っているか待っている (m_mutex を持って呼ぶ)
+		bool Searching() const;
+
+		DaemonResponse Handle(const DaemonRequest & request);
+		void Serve(HANDLE pipe);
+
+	public:
+		// 検索条件が複数あれば、全部で検索してまとめる
+		Daemon(Session & session, std::vector<_bstr_t> criteria, unsigned long timeout);
+		~Daemon() = default;
+
+		Daemon(const Daemon &) = delete;
+		Daemon & operator=(const Daemon &) = delete;
+
+		// Shutdown を受けるまで要求に答える
+		void Run(const wchar_t * pipeName = DAEMON_PIPE_NAME);
+	};
+
+	// timeout ミリ秒のうちに答えが来なければ ERROR_TIMEOUT で投げる (パイプが空くのを待つ時間も含む)
+	DaemonResponse CallDaemon(DaemonCommand command, std::uint32_t maxAge, unsigned long timeout, const wchar_t * pipeName = DAEMON_PIPE_NAME);
+}
@@ -0,0 +1,70 @@
+#include "downloadplan.h"
+
+namespace waffle
+{
+	UpdateSeverity GetMsrcSeverity(IUpdate * update)
+	{
+		_bstr_t severity;
+
+		if (auto hr = update->get_MsrcSeverity(severity.GetAddress()); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (severity.length() == 0)
+			return UpdateSeverity::Unspecified;
+
+		std::wstring_view name((const wchar_t *) severity);
+
+		if (name == L"Critical")
+			return UpdateSeverity::Critical;
+		else if (name == L"Important")
+			return UpdateSeverity::Important;
+		else if (name == L"Moderate")
+			return UpdateSeverity::Moderate;
+		else if (name == L"Low")
+			return UpdateSeverity::Low;
+		else
+			return UpdateSeverity::Unspecified;
+	}
+
+	DownloadPlan PlanDownload(const Updates & updates, ULONGLONG budget, ULONGLONG batchBytes)
+	{
+		if (auto snapshot = updates.Snapshot(); snapshot != nullptr)
+		{
+			return DownloadPlan(*snapshot, budget, batchBytes);
+		}
+
+		std::vector<PlannedUpdate> planned;
+
+		planned.reserve(updates.size());
+
+		for (LONG index = 0; index < updates.size(); ++index)
+		{
+			auto update = updates.Item(index);
+
+			planned.push_back({ index, GetMsrcSeverity(update), GetDownloadSize(update).second });
+		}
+
+		return DownloadPlan(std::move(planned), budget, batchBytes);
+	}
+
+	ULONGLONG GetDownloadFreeSpace()
+	{
+		wchar_t path[MAX_PATH]{};
+
+		if (auto length = ::ExpandEnvironmentStringsW(L"%SystemRoot%\\SoftwareDistribution", path, MAX_PATH); length == 0 || length > MAX_PATH)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		ULARGE_INTEGER available{};
+
+		if (!::GetDiskFreeSpaceExW(path, &available, nullptr, nullptr))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return available.QuadPart;
+	}
+}
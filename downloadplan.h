@@ -0,0 +1,15 @@
+#pragma once
+
+#include "waffle.h"
+#include "plan.h"
+
+namespace waffle
+{
+	UpdateSeverity GetMsrcSeverity(IUpdate * update);
+
+	// 検索した更新からダウンロードの計画を立てる (スナップショットがあれば COM を引かない)
+	DownloadPlan PlanDownload(const Updates & updates, ULONGLONG budget, ULONGLONG batchBytes);
+
+	// ダウンロード先 (%SystemRoot%\SoftwareDistribution) のドライブの空き容量
+	ULONGLONG GetDownloadFreeSpace();
+}
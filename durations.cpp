@@ -0,0 +1,211 @@
+#include "durations.h"
+
+namespace waffle
+{
+	constexpr DWORD DURATION_MAGIC = 0x52444657; // "WFDR"
+	constexpr DWORD DURATION_VERSION = 1;
+
+	struct DurationHeader
+	{
+		DWORD magic;
+		DWORD version;
+		LONG count;
+		LONG reserved;
+	};
+
+	int GetSizeClass(ULONGLONG bytes)
+	{
+		int sizeClass = 0;
+
+		for (auto megabytes = bytes >> 20; megabytes > 0 && sizeClass < 15; megabytes >>= 1)
+		{
+			++sizeClass;
+		}
+
+		return sizeClass;
+	}
+
+	LONG GetDuration(const DurationRecord & record, DurationPhase phase)
+	{
+		return (phase == DurationPhase::Download) ? record.download : record.install;
+	}
+
+	DurationModel::DurationModel(std::wstring path) : m_path(std::move(path))
+	{
+		m_last[0] = m_last[1] = std::chrono::steady_clock::now();
+
+		FileHandle file(::CreateFileW(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+		if (!file)
+		{
+			return;
+		}
+
+		DurationHeader header{};
+		DWORD read{};
+
+		if (!::ReadFile(file, &header, sizeof(header), &read, nullptr) || read != sizeof(header))
+		{
+			return;
+		}
+
+		if (header.magic != DURATION_MAGIC || header.version != DURATION_VERSION || header.count < 0)
+		{
+			return;
+		}
+
+		std::vector<DurationRecord> records(header.count);
+
+		if (!::ReadFile(file, records.data(), (DWORD) (records.size() * sizeof(DurationRecord)), &read, nullptr) || read != records.size() * sizeof(DurationRecord))
+		{
+			return;
+		}
+
+		m_records = std::move(records);
+	}
+
+	const DurationRecord * DurationModel::Find(const GUID & updateID) const
+	{
+		for (auto & record : m_records)
+		{
+			if (record.updateID == updateID)
+			{
+				return &record;
+			}
+		}
+
+		return nullptr;
+	}
+
+	std::chrono::milliseconds DurationModel::Predict(DurationPhase phase, BSTR updateID, ULONGLONG bytes) const
+	{
+		if (auto record = Find(ParseUpdateID(updateID)); record != nullptr && GetDuration(*record, phase) > 0)
+		{
+			return std::chrono::milliseconds(GetDuration(*record, phase));
+		}
+
+		// 同じ大きさの区分の平均
+		LONGLONG total = 0, count = 0;
+
+		for (auto & record : m_records)
+		{
+			if (GetDuration(record, phase) > 0 && GetSizeClass(record.bytes) == GetSizeClass(bytes))
+			{
+				total += GetDuration(record, phase);
+				++count;
+			}
+		}
+
+		if (count > 0)
+		{
+			return std::chrono::milliseconds(total / count);
+		}
+
+		// 記録が無ければ、ダウンロードは 2MB/s、インストールは 1 分とみなす
+		if (phase == DurationPhase::Download)
+			return std::chrono::milliseconds(1000 + bytes / (2 * 1024 * 1024) * 1000);
+		else
+			return std::chrono::minutes(1);
+	}
+
+	void DurationModel::Start(DurationPhase phase)
+	{
+		std::lock_guard lock(m_mutex);
+
+		m_last[(int) phase] = std::chrono::steady_clock::now();
+	}
+
+	std::chrono::milliseconds DurationModel::Completed(DurationPhase phase, BSTR updateID, ULONGLONG bytes)
+	{
+		auto guid = ParseUpdateID(updateID);
+		auto now = std::chrono::steady_clock::now();
+
+		std::lock_guard lock(m_mutex);
+
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_last[(int) phase]);
+
+		m_last[(int) phase] = now;
+
+		auto record = std::find_if(m_records.begin(), m_records.end(), [&](const DurationRecord & record) { return record.updateID == guid; });
+
+		if (record == m_records.end())
+		{
+			record = m_records.insert(m_records.end(), DurationRecord{ guid, bytes, 0, 0 });
+		}
+
+		auto & duration = (phase == DurationPhase::Download) ? record->download : record->install;
+
+		// 前回の記録と半々で混ぜる
+		duration = (duration > 0) ? (LONG) ((duration + elapsed.count()) / 2) : (LONG) std::max<LONGLONG>(elapsed.count(), 1);
+
+		record->bytes = bytes;
+
+		return elapsed;
+	}
+
+	void DurationModel::Save()
+	{
+		std::lock_guard lock(m_mutex);
+
+		auto temporary = m_path + L".tmp";
+
+		{
+			FileHandle file(::CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+			if (!file)
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			DurationHeader header{ DURATION_MAGIC, DURATION_VERSION, (LONG) m_records.size(), 0 };
+
+			DWORD written{};
+
+			if (!::WriteFile(file, &header, sizeof(header), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (!::WriteFile(file, m_records.data(), (DWORD) (m_records.size() * sizeof(DurationRecord)), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		if (!::MoveFileExW(temporary.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	DeadlineAdmission AdmitByDeadline(const Updates & updates, const DurationModel & model, std::chrono::milliseconds window, bool installOnly)
+	{
+		DeadlineAdmission admission{ {}, {}, std::chrono::milliseconds::zero() };
+
+		auto snapshot = updates.Snapshot();
+
+		for (LONG index = 0; index < updates.size(); ++index)
+		{
+			auto & entry = updates.Entry(index);
+			auto bytes = snapshot != nullptr ? snapshot->MaxDownloadSize(index) : GetDownloadSize(entry.update).second;
+
+			auto predicted = model.Predict(DurationPhase::Install, entry.updateID, bytes);
+
+			if (!installOnly)
+			{
+				predicted += model.Predict(DurationPhase::Download, entry.updateID, bytes);
+			}
+
+			if (admission.predicted + predicted > window)
+			{
+				admission.deferred.push_back(index);
+				continue;
+			}
+
+			admission.predicted += predicted;
+			admission.admitted.push_back(index);
+		}
+
+		return admission;
+	}
+}
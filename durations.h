@@ -0,0 +1,69 @@
+#pragma once
+
+#include "waffle.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace waffle
+{
+	enum class DurationPhase
+	{
+		Download,
+		Install,
+	};
+
+	// UpdateID ごとに、前回までにかかったダウンロードとインストールの時間 (ミリ秒、0 は未計測)
+	struct DurationRecord
+	{
+		GUID updateID;
+		ULONGLONG bytes;
+		LONG download;
+		LONG install;
+	};
+
+	// 更新ごとの所要時間を記録し、次回の見積もりに使う
+	//
+	// 同じ UpdateID の記録が無ければ、サイズの近い (2 のべき乗で同じ区分の) 更新の平均で見積もる。
+	// 所要時間は、同じフェーズで一つ前の更新が終わってからの時間で測る。
+
+	class DurationModel
+	{
+		std::wstring m_path;
+		std::vector<DurationRecord> m_records;
+
+		std::mutex m_mutex;
+		std::chrono::steady_clock::time_point m_last[2];
+
+		const DurationRecord * Find(const GUID & updateID) const;
+
+	public:
+		DurationModel(std::wstring path);
+		~DurationModel() = default;
+
+		DurationModel(const DurationModel &) = delete;
+		DurationModel & operator=(const DurationModel &) = delete;
+
+		std::chrono::milliseconds Predict(DurationPhase phase, BSTR updateID, ULONGLONG bytes) const;
+
+		// フェーズ (またはバッチ) を始めるとき
+		void Start(DurationPhase phase);
+
+		// 更新が終わったとき。かかった時間を返す
+		std::chrono::milliseconds Completed(DurationPhase phase, BSTR updateID, ULONGLONG bytes);
+
+		void Save();
+	};
+
+	struct DeadlineAdmission
+	{
+		std::vector<LONG> admitted;
+		std::vector<LONG> deferred;
+		std::chrono::milliseconds predicted;
+	};
+
+	// 見積もりの合計が window に収まる更新だけを、順に受け入れる (installOnly ならダウンロード済みとしてインストールの分だけを見積もる)
+	DeadlineAdmission AdmitByDeadline(const Updates & updates, const DurationModel & model, std::chrono::milliseconds window, bool installOnly = false);
+}
@@ -0,0 +1,240 @@
+#include "events.h"
+
+#include <algorithm>
+
+namespace waffle
+{
+	EventLog::EventLog(HANDLE output, size_t capacity) : m_output(output), m_buffer(capacity), m_used(0), m_start(std::chrono::steady_clock::now())
+	{}
+
+	EventLog::~EventLog()
+	{
+		try
+		{
+			Flush();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	void EventLog::Flush()
+	{
+		std::lock_guard lock(m_mutex);
+
+		FlushLocked();
+	}
+
+	void EventLog::FlushLocked()
+	{
+		for (size_t offset = 0; offset < m_used; )
+		{
+			DWORD written{};
+
+			if (!::WriteFile(m_output, m_buffer.data() + offset, (DWORD) (m_used - offset), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			offset += written;
+		}
+
+		m_used = 0;
+	}
+
+	void EventLog::Append(char c)
+	{
+		if (m_used == m_buffer.size())
+		{
+			FlushLocked();
+		}
+
+		m_buffer[m_used++] = c;
+	}
+
+	void EventLog::Append(std::string_view text)
+	{
+		while (!text.empty())
+		{
+			if (m_used == m_buffer.size())
+			{
+				FlushLocked();
+			}
+
+			auto count = std::min(text.size(), m_buffer.size() - m_used);
+
+			std::copy_n(text.data(), count, m_buffer.data() + m_used);
+
+			m_used += count;
+			text.remove_prefix(count);
+		}
+	}
+
+	void EventLog::AppendEscaped(std::string_view text)
+	{
+		const char hex[] = "0123456789abcdef";
+
+		for (auto c : text)
+		{
+			switch (c)
+			{
+			case '"':
+				Append("\\\"");
+				break;
+			case '\\':
+				Append("\\\\");
+				break;
+			case '\n':
+				Append("\\n");
+				break;
+			case '\r':
+				Append("\\r");
+				break;
+			case '\t':
+				Append("\\t");
+				break;
+			default:
+				if ((unsigned char) c < 0x20)
+				{
+					Append("\\u00");
+					Append(hex[(c >> 4) & 0xF]);
+					Append(hex[c & 0xF]);
+				}
+				else
+				{
+					Append(c);
+				}
+			}
+		}
+	}
+
+	void EventLog::AppendEscaped(std::wstring_view text)
+	{
+		// UTF-16 から UTF-8 へ (サロゲートペアも含めて) その場で変換する
+
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			char32_t c = text[i];
+
+			if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
+			}
+
+			if (c < 0x80)
+			{
+				char ascii = (char) c;
+				AppendEscaped(std::string_view(&ascii, 1));
+			}
+			else if (c < 0x800)
+			{
+				Append((char) (0xC0 | (c >> 6)));
+				Append((char) (0x80 | (c & 0x3F)));
+			}
+			else if (c < 0x10000)
+			{
+				Append((char) (0xE0 | (c >> 12)));
+				Append((char) (0x80 | ((c >> 6) & 0x3F)));
+				Append((char) (0x80 | (c & 0x3F)));
+			}
+			else
+			{
+				Append((char) (0xF0 | (c >> 18)));
+				Append((char) (0x80 | ((c >> 12) & 0x3F)));
+				Append((char) (0x80 | ((c >> 6) & 0x3F)));
+				Append((char) (0x80 | (c & 0x3F)));
+			}
+		}
+	}
+
+	void EventLog::AppendEscapedACP(std::string_view text)
+	{
+		// e.what() や FormatMessageA のメッセージは ANSI コードページ (CP932 など) なので、UTF-16 を経て UTF-8 にする
+
+		if (std::all_of(text.begin(), text.end(), [](char c) { return (unsigned char) c < 0x80; }))
+		{
+			AppendEscaped(text);
+			return;
+		}
+
+		if (m_wide.size() < text.size())
+		{
+			m_wide.resize(text.size());
+		}
+
+		auto count = ::MultiByteToWideChar(CP_ACP, 0, text.data(), (int) text.size(), m_wide.data(), (int) m_wide.size());
+
+		if (count == 0)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		AppendEscaped(std::wstring_view(m_wide.data(), count));
+	}
+
+	void EventLog::AppendNumber(double value)
+	{
+		char digits[32];
+
+		auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, 3);
+
+		Append(std::string_view(digits, end - digits));
+	}
+
+	EventLog::Record::Record(EventLog & log, std::string_view event) : m_log(log), m_lock(log.m_mutex)
+	{
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_log.m_start);
+
+		m_log.Append("{\"t\":");
+		m_log.AppendNumber(elapsed.count());
+		m_log.Append(",\"event\":\"");
+		m_log.AppendEscaped(event);
+		m_log.Append('"');
+	}
+
+	EventLog::Record::~Record()
+	{
+		try
+		{
+			m_log.Append("}\n");
+		}
+		catch (...)
+		{
+		}
+	}
+
+	void EventLog::Record::Name(std::string_view name)
+	{
+		m_log.Append(",\"");
+		m_log.AppendEscaped(name);
+		m_log.Append("\":");
+	}
+
+	EventLog::Record & EventLog::Record::operator()(std::string_view name, double value)
+	{
+		Name(name);
+		m_log.AppendNumber(value);
+
+		return *this;
+	}
+
+	EventLog::Record & EventLog::Record::operator()(std::string_view name, std::string_view value)
+	{
+		Name(name);
+		m_log.Append('"');
+		m_log.AppendEscapedACP(value);
+		m_log.Append('"');
+
+		return *this;
+	}
+
+	EventLog::Record & EventLog::Record::operator()(std::string_view name, std::wstring_view value)
+	{
+		Name(name);
+		m_log.Append('"');
+		m_log.AppendEscaped(value);
+		m_log.Append('"');
+
+		return *this;
+	}
+}
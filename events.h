@@ -0,0 +1,109 @@
+#pragma once
+
+#include "waffle.h"
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <concepts>
+#include <string_view>
+
+namespace waffle
+{
+	// JSON Lines で 1 イベント 1 行を書き出す
+	//
+	// 進捗の通知を受けるスレッドを待たせないよう、あらかじめ確保したバッファに書き込み、
+	// バッファが一杯になったときと Flush() のときだけ書き出す。
+
+	class EventLog
+	{
+		HANDLE m_output;
+
+		std::vector<char> m_buffer;
+		size_t m_used;
+
+		// ANSI コードページの文字列を変換するバッファ (使い回す)
+		std::wstring m_wide;
+
+		std::mutex m_mutex;
+		std::chrono::steady_clock::time_point m_start;
+
+		void Append(char c);
+		void Append(std::string_view text);
+		void AppendEscaped(std::string_view text);
+		void AppendEscaped(std::wstring_view text);
+		void AppendEscapedACP(std::string_view text);
+
+		template<std::integral T>
+		void AppendNumber(T value)
+		{
+			char digits[24];
+
+			auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+
+			Append(std::string_view(digits, end - digits));
+		}
+
+		void AppendNumber(double value);
+
+		void FlushLocked();
+
+	public:
+		EventLog(HANDLE output, size_t capacity = 64 * 1024);
+		~EventLog();
+
+		EventLog(const EventLog &) = delete;
+		EventLog & operator=(const EventLog &) = delete;
+
+		class Record
+		{
+			EventLog & m_log;
+			std::lock_guard<std::mutex> m_lock;
+
+			void Name(std::string_view name);
+
+		public:
+			Record(EventLog & log, std::string_view event);
+			~Record();
+
+			Record(const Record &) = delete;
+			Record & operator=(const Record &) = delete;
+
+			template<std::integral T>
+			Record & operator()(std::string_view name, T value)
+			{
+				Name(name);
+
+				if constexpr (std::same_as<T, bool>)
+					m_log.Append(value ? "true" : "false");
+				else
+					m_log.AppendNumber(value);
+
+				return *this;
+			}
+
+			Record & operator()(std::string_view name, double value);
+			Record & operator()(std::string_view name, std::string_view value);
+			Record & operator()(std::string_view name, std::wstring_view value);
+
+			Record & operator()(std::string_view name, const char * value)
+			{
+				return (*this)(name, std::string_view(value != nullptr ? value : ""));
+			}
+
+			Record & operator()(std::string_view name, const wchar_t * value)
+			{
+				return (*this)(name, std::wstring_view(value != nullptr ? value : L""));
+			}
+		};
+
+		Record operator()(std::string_view event)
+		{
+			return Record(*this, event);
+		}
+
+		void Flush();
+	};
+}
@@ -0,0 +1,861 @@
+#include "filter.h"
+
+#include <string>
+#include <cwctype>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+namespace waffle
+{
+	namespace
+	{
+		// 評価に使うスタックの深さ (括弧の入れ子はこれより深くできない)
+		constexpr size_t MaxDepth = 64;
+
+		[[noreturn]] void ThrowSyntax(size_t column, const char * message)
+		{
+			throw std::invalid_argument("Invalid filter at column " + std::to_string(column + 1) + ": " + message);
+		}
+
+		bool EqualsIgnoreCase(std::wstring_view a, std::wstring_view b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](wchar_t x, wchar_t y) { return std::towlower(x) == std::towlower(y); });
+		}
+
+		// * と ? だけのワイルドカード (大文字と小文字は区別しない)
+		bool MatchWildcard(std::wstring_view text, std::wstring_view pattern)
+		{
+			size_t t = 0, p = 0;
+			size_t star = std::wstring_view::npos, mark = 0;
+
+			while (t < text.size())
+			{
+				if (p < pattern.size() && pattern[p] == L'*')
+				{
+					star = p++;
+					mark = t;
+				}
+				else if (p < pattern.size() && (pattern[p] == L'?' || std::towlower(pattern[p]) == std::towlower(text[t])))
+				{
+					++t;
+					++p;
+				}
+				else if (star != std::wstring_view::npos)
+				{
+					p = star + 1;
+					t = ++mark;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			while (p < pattern.size() && pattern[p] == L'*')
+			{
+				++p;
+			}
+
+			return p == pattern.size();
+		}
+
+		std::wstring_view Trim(std::wstring_view text)
+		{
+			while (!text.empty() && std::iswspace(text.front()))
+				text.remove_prefix(1);
+
+			while (!text.empty() && std::iswspace(text.back()))
+				text.remove_suffix(1);
+
+			return text;
+		}
+
+		// {xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx} の括弧は外して比べる
+		std::wstring_view TrimBraces(std::wstring_view text)
+		{
+			if (text.size() >= 2 && text.front() == L'{' && text.back() == L'}')
+			{
+				return text.substr(1, text.size() - 2);
+			}
+
+			return text;
+		}
+
+		bool IsGuid(std::wstring_view text)
+		{
+			if (text.size() != 36)
+			{
+				return false;
+			}
+
+			for (size_t i = 0; i < text.size(); ++i)
+			{
+				if (i == 8 || i == 13 || i == 18 || i == 23 ? text[i] != L'-' : !std::iswxdigit(text[i]))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool IsOperatorChar(wchar_t c)
+		{
+			return c == L'=' || c == L'!' || c == L'<' || c == L'>' || c == L'~';
+		}
+
+		struct Token
+		{
+			enum class Kind
+			{
+				End,
+				Word,
+				String,
+				Operator,
+				Open,
+				Close,
+			};
+
+			Kind kind;
+			std::wstring text;
+			size_t column;
+		};
+
+		std::vector<Token> Tokenize(std::wstring_view text)
+		{
+			std::vector<Token> tokens;
+
+			for (size_t i = 0; i < text.size(); )
+			{
+				auto c = text[i];
+				auto start = i;
+
+				if (std::iswspace(c))
+				{
+					++i;
+				}
+				else if (c == L'(' || c == L')')
+				{
+					tokens.push_back({ c == L'(' ? Token::Kind::Open : Token::Kind::Close, std::wstring(1, c), start });
+					++i;
+				}
+				else if (IsOperatorChar(c))
+				{
+					size_t length = (c != L'=' && c != L'~' && i + 1 < text.size() && text[i + 1] == L'=') ? 2 : 1;
+
+					if (c == L'!' && length == 1)
+					{
+						ThrowSyntax(start, "expected '!='");
+					}
+
+					tokens.push_back({ Token::Kind::Operator, std::wstring(text.substr(i, length)), start });
+					i += length;
+				}
+				else if (c == L'\'')
+				{
+					// '' は ' 1 文字
+					std::wstring value;
+
+					for (++i; ; ++i)
+					{
+						if (i == text.size())
+						{
+							ThrowSyntax(start, "unterminated string");
+						}
+
+						if (text[i] == L'\'')
+						{
+							if (i + 1 < text.size() && text[i + 1] == L'\'')
+							{
+								value += L'\'';
+								++i;
+								continue;
+							}
+
+							++i;
+							break;
+						}
+
+						value += text[i];
+					}
+
+					tokens.push_back({ Token::Kind::String, value, start });
+				}
+				else
+				{
+					while (i < text.size() && !std::iswspace(text[i]) && text[i] != L'(' && text[i] != L')' && text[i] != L'\'' && !IsOperatorChar(text[i]))
+					{
+						++i;
+					}
+
+					tokens.push_back({ Token::Kind::Word, std::wstring(text.substr(start, i - start)), start });
+				}
+			}
+
+			tokens.push_back({ Token::Kind::End, {}, text.size() });
+
+			return tokens;
+		}
+
+		// 単位 (K, M, G と KB, MB, GB) は units のときだけ
+		ULONGLONG ParseNumber(std::wstring_view text, size_t column, bool units)
+		{
+			size_t digits = 0;
+
+			while (digits < text.size() && std::iswdigit(text[digits]))
+			{
+				++digits;
+			}
+
+			if (digits == 0)
+			{
+				ThrowSyntax(column, "expected a number");
+			}
+
+			auto number = std::wcstoull(std::wstring(text.substr(0, digits)).c_str(), nullptr, 10);
+			auto unit = text.substr(digits);
+
+			if (unit.empty())
+			{
+				return number;
+			}
+
+			if (units && (unit.size() == 1 || (unit.size() == 2 && std::towlower(unit[1]) == L'b')))
+			{
+				switch (std::towlower(unit[0]))
+				{
+				case L'k':
+					return number << 10;
+				case L'm':
+					return number << 20;
+				case L'g':
+					return number << 30;
+				}
+			}
+
+			ThrowSyntax(column + digits, "unexpected characters after the number");
+		}
+
+		FilterOperator ParseOperator(const Token & token)
+		{
+			if (token.text == L"=")
+				return FilterOperator::Equal;
+			else if (token.text == L"!=")
+				return FilterOperator::NotEqual;
+			else if (token.text == L"<")
+				return FilterOperator::Less;
+			else if (token.text == L"<=")
+				return FilterOperator::LessEqual;
+			else if (token.text == L">")
+				return FilterOperator::Greater;
+			else if (token.text == L">=")
+				return FilterOperator::GreaterEqual;
+			else
+				return FilterOperator::Match;
+		}
+
+		const wchar_t * GetFieldName(FilterField field)
+		{
+			switch (field)
+			{
+			case FilterField::KB:
+				return L"kb";
+			case FilterField::Category:
+			case FilterField::CategoryID:
+				return L"category";
+			case FilterField::Severity:
+				return L"severity";
+			case FilterField::Title:
+				return L"title";
+			case FilterField::Size:
+				return L"size";
+			default:
+				return L"updateid";
+			}
+		}
+
+		const wchar_t * GetOperatorName(FilterOperator op)
+		{
+			switch (op)
+			{
+			case FilterOperator::Equal:
+				return L"=";
+			case FilterOperator::NotEqual:
+				return L"!=";
+			case FilterOperator::Less:
+				return L"<";
+			case FilterOperator::LessEqual:
+				return L"<=";
+			case FilterOperator::Greater:
+				return L">";
+			case FilterOperator::GreaterEqual:
+				return L">=";
+			default:
+				return L"~";
+			}
+		}
+
+		// 重要度は高いほど大きい数 (critical が 4, unspecified が 0)
+		const wchar_t * SeverityNames[] = { L"critical", L"important", L"moderate", L"low", L"unspecified" };
+
+		ULONGLONG GetSeverityRank(UpdateSeverity severity)
+		{
+			return 4 - (ULONGLONG) severity;
+		}
+
+		// 式の木。kind が Test なら term が項、Not なら left が子、And と Or なら left と right が子
+		struct Node
+		{
+			UpdateFilter::Opcode kind;
+			size_t left;
+			size_t right;
+			FilterTerm term;
+		};
+
+		class Parser
+		{
+			std::vector<Token> m_tokens;
+			size_t m_next;
+			size_t m_depth;
+
+			std::vector<Node> m_nodes;
+
+			const Token & Peek() const
+			{
+				return m_tokens[m_next];
+			}
+
+			const Token & Expect(Token::Kind kind, const char * message)
+			{
+				if (Peek().kind != kind)
+				{
+					ThrowSyntax(Peek().column, message);
+				}
+
+				return m_tokens[m_next++];
+			}
+
+			bool Keyword(const wchar_t * keyword)
+			{
+				if (Peek().kind == Token::Kind::Word && EqualsIgnoreCase(Peek().text, keyword))
+				{
+					++m_next;
+					return true;
+				}
+
+				return false;
+			}
+
+			size_t Add(Node node)
+			{
+				m_nodes.push_back(std::move(node));
+
+				return m_nodes.size() - 1;
+			}
+
+			size_t ParseOr()
+			{
+				auto left = ParseAnd();
+
+				while (Keyword(L"or"))
+				{
+					left = Add({ UpdateFilter::Opcode::Or, left, ParseAnd(), {} });
+				}
+
+				return left;
+			}
+
+			size_t ParseAnd()
+			{
+				auto left = ParseUnary();
+
+				while (Keyword(L"and"))
+				{
+					left = Add({ UpdateFilter::Opcode::And, left, ParseUnary(), {} });
+				}
+
+				return left;
+			}
+
+			size_t ParseUnary()
+			{
+				// 再帰が深くなりすぎないよう、not と括弧の入れ子も評価のスタックと同じ深さまでにする
+				if (Peek().kind == Token::Kind::Open || (Peek().kind == Token::Kind::Word && EqualsIgnoreCase(Peek().text, L"not")))
+				{
+					if (++m_depth > MaxDepth)
+					{
+						ThrowSyntax(Peek().column, "too deeply nested");
+					}
+				}
+
+				if (Keyword(L"not"))
+				{
+					auto node = Add({ UpdateFilter::Opcode::Not, ParseUnary(), 0, {} });
+
+					--m_depth;
+
+					return node;
+				}
+
+				if (Peek().kind == Token::Kind::Open)
+				{
+					++m_next;
+
+					auto inner = ParseOr();
+
+					Expect(Token::Kind::Close, "expected ')'");
+
+					--m_depth;
+
+					return inner;
+				}
+
+				return Add({ UpdateFilter::Opcode::Test, 0, 0, ParseTerm() });
+			}
+
+			FilterTerm ParseTerm()
+			{
+				auto & field = Expect(Token::Kind::Word, "expected a field name");
+				auto & op = Expect(Token::Kind::Operator, "expected an operator");
+
+				if (Peek().kind != Token::Kind::Word && Peek().kind != Token::Kind::String)
+				{
+					ThrowSyntax(Peek().column, "expected a value");
+				}
+
+				auto & value = m_tokens[m_next++];
+
+				FilterTerm term{ FilterField::KB, ParseOperator(op), value.text, 0 };
+
+				auto equality = term.op == FilterOperator::Equal || term.op == FilterOperator::NotEqual;
+
+				if (EqualsIgnoreCase(field.text, L"kb"))
+				{
+					if (!equality)
+						ThrowSyntax(op.column, "kb takes '=' or '!='");
+
+					std::wstring_view digits = value.text;
+
+					if (digits.size() > 2 && EqualsIgnoreCase(digits.substr(0, 2), L"kb"))
+						digits.remove_prefix(2);
+
+					term.number = ParseNumber(digits, value.column, false);
+				}
+				else if (EqualsIgnoreCase(field.text, L"category"))
+				{
+					if (!equality)
+						ThrowSyntax(op.column, "category takes '=' or '!='");
+
+					// GUID なら分類の ID (WUA の CategoryIDs で絞り込む)、それ以外は名前
+					if (auto id = TrimBraces(value.text); IsGuid(id))
+					{
+						if (term.op != FilterOperator::Equal)
+							ThrowSyntax(op.column, "category IDs can only be matched with '='");
+
+						term.field = FilterField::CategoryID;
+						term.text = id;
+					}
+					else
+					{
+						term.field = FilterField::Category;
+					}
+				}
+				else if (EqualsIgnoreCase(field.text, L"severity"))
+				{
+					if (term.op == FilterOperator::Match)
+						ThrowSyntax(op.column, "'~' is only for title");
+
+					auto name = std::find_if(std::begin(SeverityNames), std::end(SeverityNames), [&](const wchar_t * name) { return EqualsIgnoreCase(value.text, name); });
+
+					if (name == std::end(SeverityNames))
+						ThrowSyntax(value.column, "expected critical, important, moderate, low or unspecified");
+
+					term.field = FilterField::Severity;
+					term.number = GetSeverityRank((UpdateSeverity) (name - std::begin(SeverityNames)));
+				}
+				else if (EqualsIgnoreCase(field.text, L"title"))
+				{
+					if (!equality && term.op != FilterOperator::Match)
+						ThrowSyntax(op.column, "title takes '=', '!=' or '~'");
+
+					term.field = FilterField::Title;
+				}
+				else if (EqualsIgnoreCase(field.text, L"size"))
+				{
+					if (term.op == FilterOperator::Match)
+						ThrowSyntax(op.column, "'~' is only for title");
+
+					term.field = FilterField::Size;
+					term.number = ParseNumber(value.text, value.column, true);
+				}
+				else if (EqualsIgnoreCase(field.text, L"updateid"))
+				{
+					if (!equality)
+						ThrowSyntax(op.column, "updateid takes '=' or '!='");
+
+					auto id = TrimBraces(value.text);
+
+					if (!IsGuid(id))
+						ThrowSyntax(value.column, "expected an update ID (GUID)");
+
+					term.field = FilterField::UpdateID;
+					term.text = id;
+				}
+				else
+				{
+					ThrowSyntax(field.column, "unknown field (kb, category, severity, title, size or updateid)");
+				}
+
+				return term;
+			}
+
+		public:
+			Parser(std::wstring_view text) : m_tokens(Tokenize(text)), m_next(0), m_depth(0)
+			{}
+
+			size_t Parse()
+			{
+				auto root = ParseOr();
+
+				Expect(Token::Kind::End, "unexpected token");
+
+				return root;
+			}
+
+			const std::vector<Node> & Nodes() const noexcept
+			{
+				return m_nodes;
+			}
+		};
+
+		std::wstring Quote(std::wstring_view text)
+		{
+			if (!text.empty() && std::all_of(text.begin(), text.end(), [](wchar_t c) { return std::iswalnum(c) || c == L'-' || c == L'_' || c == L'.' || c == L'{' || c == L'}'; }))
+			{
+				return std::wstring(text);
+			}
+
+			std::wstring quoted(1, L'\'');
+
+			for (auto c : text)
+			{
+				quoted += (c == L'\'') ? L"''" : std::wstring(1, c);
+			}
+
+			return quoted + L'\'';
+		}
+
+		int GetPrecedence(UpdateFilter::Opcode kind)
+		{
+			switch (kind)
+			{
+			case UpdateFilter::Opcode::Or:
+				return 1;
+			case UpdateFilter::Opcode::And:
+				return 2;
+			case UpdateFilter::Opcode::Not:
+				return 3;
+			default:
+				return 4;
+			}
+		}
+
+		// 括弧は要るところにだけ付ける
+		std::wstring Render(const std::vector<Node> & nodes, size_t index, int precedence)
+		{
+			auto & node = nodes[index];
+
+			std::wstring text;
+
+			switch (node.kind)
+			{
+			case UpdateFilter::Opcode::Test:
+				text = std::wstring(GetFieldName(node.term.field)) + L' ' + GetOperatorName(node.term.op) + L' ' + Quote(node.term.text);
+				break;
+			case UpdateFilter::Opcode::Not:
+				text = L"not " + Render(nodes, node.left, 3);
+				break;
+			default:
+				text = Render(nodes, node.left, GetPrecedence(node.kind)) + (node.kind == UpdateFilter::Opcode::And ? L" and " : L" or ") + Render(nodes, node.right, GetPrecedence(node.kind));
+			}
+
+			return GetPrecedence(node.kind) < precedence ? L"(" + text + L")" : text;
+		}
+
+		bool ContainsCategoryID(const std::vector<Node> & nodes, size_t index)
+		{
+			auto & node = nodes[index];
+
+			switch (node.kind)
+			{
+			case UpdateFilter::Opcode::Test:
+				return node.term.field == FilterField::CategoryID;
+			case UpdateFilter::Opcode::Not:
+				return ContainsCategoryID(nodes, node.left);
+			default:
+				return ContainsCategoryID(nodes, node.left) || ContainsCategoryID(nodes, node.right);
+			}
+		}
+
+		void Emit(const std::vector<Node> & nodes, size_t index, std::vector<FilterTerm> & terms, std::vector<UpdateFilter::Instruction> & program)
+		{
+			auto & node = nodes[index];
+
+			switch (node.kind)
+			{
+			case UpdateFilter::Opcode::Test:
+				program.push_back({ UpdateFilter::Opcode::Test, (std::uint16_t) terms.size() });
+				terms.push_back(node.term);
+				break;
+			case UpdateFilter::Opcode::Not:
+				Emit(nodes, node.left, terms, program);
+				program.push_back({ UpdateFilter::Opcode::Not, 0 });
+				break;
+			default:
+				Emit(nodes, node.left, terms, program);
+				Emit(nodes, node.right, terms, program);
+				program.push_back({ node.kind, 0 });
+			}
+		}
+
+		// 一番外側の or で分ける。全体を括弧で囲んだ項は、括弧を外して中の or でも分ける
+		//
+		// 区切りはフィルターと同じ字句で見るので、「IsInstalled=0 or(IsHidden=1)」や文字列の中の or も正しく扱う。
+		void SplitDisjuncts(std::wstring_view criteria, std::vector<std::wstring_view> & disjuncts)
+		{
+			criteria = Trim(criteria);
+
+			auto tokens = Tokenize(criteria);
+
+			if (tokens.front().kind == Token::Kind::Open)
+			{
+				size_t close = 0;
+
+				for (int depth = 0; close < tokens.size(); ++close)
+				{
+					if (tokens[close].kind == Token::Kind::Open)
+						++depth;
+					else if (tokens[close].kind == Token::Kind::Close && --depth == 0)
+						break;
+				}
+
+				// 対になる ')' が最後の字句
+				if (close + 2 == tokens.size())
+				{
+					SplitDisjuncts(criteria.substr(1, tokens[close].column - 1), disjuncts);
+					return;
+				}
+			}
+
+			int depth = 0;
+			size_t start = 0;
+
+			for (auto & token : tokens)
+			{
+				if (token.kind == Token::Kind::Open)
+					++depth;
+				else if (token.kind == Token::Kind::Close)
+					--depth;
+				else if (depth == 0 && token.kind == Token::Kind::Word && EqualsIgnoreCase(token.text, L"or"))
+				{
+					SplitDisjuncts(criteria.substr(start, token.column - start), disjuncts);
+					start = token.column + token.text.size();
+				}
+			}
+
+			if (start == 0)
+			{
+				disjuncts.push_back(criteria);
+				return;
+			}
+
+			SplitDisjuncts(criteria.substr(start), disjuncts);
+		}
+
+		bool Compare(ULONGLONG value, FilterOperator op, ULONGLONG operand)
+		{
+			switch (op)
+			{
+			case FilterOperator::Equal:
+				return value == operand;
+			case FilterOperator::NotEqual:
+				return value != operand;
+			case FilterOperator::Less:
+				return value < operand;
+			case FilterOperator::LessEqual:
+				return value <= operand;
+			case FilterOperator::Greater:
+				return value > operand;
+			default:
+				return value >= operand;
+			}
+		}
+
+		bool Test(const FilterTerm & term, const UpdateSnapshot::Row & row)
+		{
+			auto negate = term.op == FilterOperator::NotEqual;
+
+			switch (term.field)
+			{
+			case FilterField::KB:
+				return negate != std::any_of(row.kbs.begin(), row.kbs.end(), [&](LONG kb) { return (ULONGLONG) kb == term.number; });
+			case FilterField::Category:
+				return negate != std::any_of(row.categories.begin(), row.categories.end(), [&](const std::wstring & name) { return EqualsIgnoreCase(name, term.text); });
+			case FilterField::Severity:
+				return Compare(GetSeverityRank(row.severity), term.op, term.number);
+			case FilterField::Title:
+				return (term.op == FilterOperator::Match) ? MatchWildcard(row.title, term.text) : negate != EqualsIgnoreCase(row.title, term.text);
+			case FilterField::Size:
+				return Compare(row.maxDownloadSize, term.op, term.number);
+			case FilterField::UpdateID:
+				return negate != EqualsIgnoreCase(row.updateID, term.text);
+			default:
+				return true;
+			}
+		}
+	}
+
+	UpdateFilter::UpdateFilter(std::wstring_view text) : m_text(text)
+	{
+		Parser parser(text);
+
+		auto root = parser.Parse();
+		auto & nodes = parser.Nodes();
+
+		// 一番外側の and でつながった項を、左から順に並べる
+		std::vector<size_t> conjuncts;
+		std::vector<size_t> pending{ root };
+
+		while (!pending.empty())
+		{
+			auto index = pending.back();
+
+			pending.pop_back();
+
+			if (nodes[index].kind == Opcode::And)
+			{
+				pending.push_back(nodes[index].right);
+				pending.push_back(nodes[index].left);
+			}
+			else
+			{
+				conjuncts.push_back(index);
+			}
+		}
+
+		std::vector<size_t> residual;
+
+		for (auto index : conjuncts)
+		{
+			auto & node = nodes[index];
+
+			if (node.kind == Opcode::Test && node.term.field == FilterField::CategoryID)
+				m_pushed.push_back(L"CategoryIDs contains '" + node.term.text + L"'");
+			else if (node.kind == Opcode::Test && node.term.field == FilterField::UpdateID)
+				m_pushed.push_back((node.term.op == FilterOperator::Equal ? L"UpdateID='" : L"UpdateID!='") + node.term.text + L"'");
+			else
+				residual.push_back(index);
+		}
+
+		for (size_t i = 0; i < residual.size(); ++i)
+		{
+			// 手元には分類の ID が無いので、WUA に任せられない位置には書けない
+			if (ContainsCategoryID(nodes, residual[i]))
+			{
+				throw std::invalid_argument("Invalid filter: category IDs can only be combined with 'and' at the top level");
+			}
+
+			Emit(nodes, residual[i], m_terms, m_program);
+
+			if (i > 0)
+			{
+				m_program.push_back({ Opcode::And, 0 });
+			}
+
+			m_residual += (i > 0 ? L" and " : L"") + Render(nodes, residual[i], residual.size() > 1 ? 2 : 0);
+		}
+
+		size_t depth = 0;
+
+		for (auto & instruction : m_program)
+		{
+			if (instruction.opcode == Opcode::Test && ++depth > MaxDepth)
+			{
+				throw std::invalid_argument("Invalid filter: too deeply nested");
+			}
+			else if (instruction.opcode == Opcode::And || instruction.opcode == Opcode::Or)
+			{
+				--depth;
+			}
+		}
+	}
+
+	std::wstring UpdateFilter::PushDown(std::wstring_view criteria) const
+	{
+		if (m_pushed.empty())
+		{
+			return std::wstring(criteria);
+		}
+
+		std::wstring pushed;
+
+		for (auto & each : m_pushed)
+		{
+			pushed += (pushed.empty() ? L"" : L" and ") + each;
+		}
+
+		if (Trim(criteria).empty())
+		{
+			return pushed;
+		}
+
+		// WUA の検索条件の or は一番外側にしか書けないので、それぞれの項に足す
+		std::vector<std::wstring_view> disjuncts;
+
+		SplitDisjuncts(criteria, disjuncts);
+
+		if (disjuncts.size() == 1)
+		{
+			return std::wstring(disjuncts.front()) + L" and " + pushed;
+		}
+
+		std::wstring result;
+
+		for (auto disjunct : disjuncts)
+		{
+			result += (result.empty() ? L"(" : L" or (") + std::wstring(disjunct) + L" and " + pushed + L")";
+		}
+
+		return result;
+	}
+
+	bool UpdateFilter::operator()(const UpdateSnapshot::Row & row) const
+	{
+		bool stack[MaxDepth];
+		size_t top = 0;
+
+		for (auto & instruction : m_program)
+		{
+			switch (instruction.opcode)
+			{
+			case Opcode::Test:
+				stack[top++] = Test(m_terms[instruction.term], row);
+				break;
+			case Opcode::Not:
+				stack[top - 1] = !stack[top - 1];
+				break;
+			case Opcode::And:
+				--top;
+				stack[top - 1] = stack[top - 1] && stack[top];
+				break;
+			case Opcode::Or:
+				--top;
+				stack[top - 1] = stack[top - 1] || stack[top];
+				break;
+			}
+		}
+
+		return top == 0 || stack[0];
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+namespace waffle
+{
+	enum class FilterField : std::uint8_t
+	{
+		KB,
+		Category,
+		CategoryID,
+		Severity,
+		Title,
+		Size,
+		UpdateID,
+	};
+
+	enum class FilterOperator : std::uint8_t
+	{
+		Equal,
+		NotEqual,
+		Less,
+		LessEqual,
+		Greater,
+		GreaterEqual,
+		Match,
+	};
+
+	// text は書かれたままの値、number は数に直した値 (KB 番号, バイト数, 重要度の高さ)
+	struct FilterTerm
+	{
+		FilterField field;
+		FilterOperator op;
+		std::wstring text;
+		ULONGLONG number;
+	};
+
+	// 更新を絞り込む式
+	//
+	//   severity >= important and not (category = Drivers or title ~ '*Preview*') and size < 500M
+	//
+	// 項目は kb, category, severity, title, size, updateid。and, or, not と括弧で組み合わせる。
+	// 一番外側の and でつながった category = {GUID} と updateid = / != は WUA の検索条件に足して (push down)
+	// サービスに絞り込ませ、残り (residual) は後置記法の命令列に直して、Updates に加える前に行ごとに評価する。
+
+	class UpdateFilter
+	{
+	public:
+		enum class Opcode : std::uint8_t
+		{
+			Test,
+			And,
+			Or,
+			Not,
+		};
+
+		struct Instruction
+		{
+			Opcode opcode;
+			std::uint16_t term;
+		};
+
+	private:
+		std::wstring m_text;
+
+		std::vector<FilterTerm> m_terms;
+		std::vector<Instruction> m_program;
+
+		std::vector<std::wstring> m_pushed;
+		std::wstring m_residual;
+
+	public:
+		explicit UpdateFilter(std::wstring_view text);
+		~UpdateFilter() = default;
+
+		const std::wstring & Text() const noexcept
+		{
+			return m_text;
+		}
+
+		// WUA の検索条件に足す部分
+		const std::vector<std::wstring> & Pushed() const noexcept
+		{
+			return m_pushed;
+		}
+
+		// 手元で評価する部分 (空ならすべて WUA で絞り込める)
+		const std::wstring & Residual() const noexcept
+		{
+			return m_residual;
+		}
+
+		// criteria に Pushed() を足す (criteria の一番外側の or のそれぞれに and でつなぐ)
+		std::wstring PushDown(std::wstring_view criteria) const;
+
+		bool operator()(const UpdateSnapshot::Row & row) const;
+	};
+}
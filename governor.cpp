@@ -0,0 +1,168 @@
+#include "governor.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace waffle
+{
+	const char * GetDownloadLevelName(DownloadLevel level)
+	{
+		switch (level)
+		{
+		case DownloadLevel::Paused:
+			return "paused";
+		case DownloadLevel::Low:
+			return "low";
+		case DownloadLevel::Normal:
+			return "normal";
+		default:
+			return "high";
+		}
+	}
+
+	PriorityGovernor::PriorityGovernor(double threshold, double alpha, double hysteresis, unsigned long hold) : m_threshold(threshold), m_alpha(alpha), m_hysteresis(hysteresis), m_hold(hold), m_load(0), m_hasLoad(false), m_level(DownloadLevel::Normal), m_held(0)
+	{}
+
+	DownloadLevel PriorityGovernor::GetLevel(double load) const noexcept
+	{
+		if (load >= m_threshold)
+			return DownloadLevel::Paused;
+		else if (load >= m_threshold * 3 / 4)
+			return DownloadLevel::Low;
+		else if (load >= m_threshold * 2 / 5)
+			return DownloadLevel::Normal;
+		else
+			return DownloadLevel::High;
+	}
+
+	bool PriorityGovernor::Sample(const LoadSample & sample)
+	{
+		auto peak = sample.Peak();
+
+		m_load = m_hasLoad ? m_alpha * peak + (1 - m_alpha) * m_load : peak;
+		m_hasLoad = true;
+
+		++m_held;
+
+		auto level = GetLevel(peak);
+
+		if (level >= m_level)
+		{
+			// 戻すのは、しばらく同じ段階にいて、ならした負荷にも余裕があるときだけ (今の標本の段階より上にはしない)
+			level = (m_held >= m_hold) ? std::max(m_level, std::min(level, GetLevel(m_load + m_hysteresis))) : m_level;
+		}
+
+		if (level == m_level)
+		{
+			return false;
+		}
+
+		m_level = level;
+		m_held = 0;
+
+		return true;
+	}
+
+	double GetNetworkUtilization(const std::vector<NetworkLoad> & adapters, double own)
+	{
+		auto busiest = std::max_element(adapters.begin(), adapters.end(), [](auto & a, auto & b) { return a.bytes < b.bytes; });
+
+		double utilization = 0;
+
+		for (auto adapter = adapters.begin(); adapter != adapters.end(); ++adapter)
+		{
+			if (adapter->bandwidth <= 0)
+			{
+				continue;
+			}
+
+			auto bytes = (adapter == busiest) ? std::max(adapter->bytes - own, 0.0) : adapter->bytes;
+
+			utilization = std::max(utilization, bytes * 8 * 100 / adapter->bandwidth);
+		}
+
+		return utilization;
+	}
+
+	std::vector<LoadSample> ReadLoadTrace(const std::filesystem::path & path)
+	{
+		std::ifstream file(path);
+
+		if (!file)
+		{
+			throw std::runtime_error("Cannot open load trace: " + path.string());
+		}
+
+		std::vector<LoadSample> samples;
+
+		size_t number = 0;
+
+		for (std::string line; std::getline(file, line); )
+		{
+			++number;
+
+			line = line.substr(0, line.find('#'));
+
+			if (line.find_first_not_of(" \t\r") == std::string::npos)
+			{
+				continue;
+			}
+
+			std::istringstream fields(line);
+			LoadSample sample{};
+			char comma1{}, comma2{};
+
+			if (!(fields >> sample.cpu >> comma1 >> sample.disk >> comma2 >> sample.network) || comma1 != ',' || comma2 != ',')
+			{
+				throw std::runtime_error("Invalid load trace line " + std::to_string(number) + ": " + line);
+			}
+
+			samples.push_back(sample);
+		}
+
+		return samples;
+	}
+
+	std::vector<LoadSample> SynthesizeLoadTrace(size_t count, std::uint64_t seed)
+	{
+		const double pi = 3.14159265358979323846;
+
+		std::mt19937_64 random(seed);
+		std::normal_distribution<double> noise(0, 5);
+		std::uniform_real_distribution<double> uniform(0, 1);
+
+		std::vector<LoadSample> samples;
+		size_t burst = 0;
+		double burstLoad = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			// 10 分 (1 秒に 1 標本) で一巡する波
+			auto wave = 35 + 20 * std::sin(2 * pi * i / 600);
+
+			// 1% の確率で、10 秒から 60 秒続く突発的な負荷
+			if (burst == 0 && uniform(random) < 0.01)
+			{
+				burst = 10 + (size_t) (uniform(random) * 50);
+				burstLoad = 30 + uniform(random) * 40;
+			}
+
+			auto extra = burst > 0 ? burstLoad : 0;
+
+			if (burst > 0)
+			{
+				--burst;
+			}
+
+			auto clamp = [](double value) { return std::clamp(value, 0.0, 100.0); };
+
+			samples.push_back({ clamp(wave + extra + noise(random)), clamp(wave / 2 + extra / 2 + noise(random)), clamp(wave / 3 + noise(random)) });
+		}
+
+		return samples;
+	}
+}
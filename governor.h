@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+
+namespace waffle
+{
+	// 使用率 (0 から 100 %)
+	struct LoadSample
+	{
+		double cpu;
+		double disk;
+		double network;
+
+		double Peak() const noexcept
+		{
+			return std::max({ cpu, disk, network });
+		}
+	};
+
+	// 数が小さいほど控えめ
+	enum class DownloadLevel : std::uint8_t
+	{
+		Paused,
+		Low,
+		Normal,
+		High,
+	};
+
+	const char * GetDownloadLevelName(DownloadLevel level);
+
+	// マシンの負荷 (CPU, ディスク, ネットワークの使用率のうち一番高いもの) に合わせて、ダウンロードの優先度を決める
+	//
+	// 守りたいのはほかのサービスの応答時間だが、それは直接は測らず、使用率で代わりにする。
+	// threshold 以上なら止め (Paused)、その 3/4 以上なら Low、2/5 未満なら High、その間は Normal。
+	// 控えめにするときは標本の値ですぐに。戻すときは hold 個の標本の間その段階にいて、指数移動平均の値に
+	// hysteresis を足しても境目を下回ってから戻す。
+
+	class PriorityGovernor
+	{
+		double m_threshold;
+		double m_alpha;
+		double m_hysteresis;
+		unsigned long m_hold;
+
+		double m_load;
+		bool m_hasLoad;
+
+		DownloadLevel m_level;
+		unsigned long m_held;
+
+		DownloadLevel GetLevel(double load) const noexcept;
+
+	public:
+		PriorityGovernor(double threshold, double alpha = 0.3, double hysteresis = 5, unsigned long hold = 30);
+		~PriorityGovernor() = default;
+
+		// 標本を 1 つ足す。段階が変わったら true
+		bool Sample(const LoadSample & sample);
+
+		DownloadLevel Level() const noexcept
+		{
+			return m_level;
+		}
+
+		// ならした負荷
+		double Load() const noexcept
+		{
+			return m_load;
+		}
+
+		double Threshold() const noexcept
+		{
+			return m_threshold;
+		}
+	};
+
+	// 止めるときと止めていたのを戻すときだけ、今のジョブを作り直す (Low, Normal, High の間の変化は次のジョブから効かせる)
+	inline bool RestartsDownload(DownloadLevel from, DownloadLevel to) noexcept
+	{
+		return (from == DownloadLevel::Paused) != (to == DownloadLevel::Paused);
+	}
+
+	// ネットワーク アダプター 1 つの送受信のバイト数/秒と帯域 (ビット/秒)
+	struct NetworkLoad
+	{
+		double bytes;
+		double bandwidth;
+	};
+
+	// アダプターごとの「送受信のビット数/秒 ÷ 帯域」(%) の一番高いもの
+	//
+	// 自分のダウンロードで止めてしまわないように、own (ダウンロードのバイト数/秒) は、
+	// それが通っているはずの一番バイト数の多いアダプターから引く。
+	double GetNetworkUtilization(const std::vector<NetworkLoad> & adapters, double own);
+
+	// 1 行に「cpu,disk,network」(%) の標本。# から後は読まない
+	std::vector<LoadSample> ReadLoadTrace(const std::filesystem::path & path);
+
+	// 穏やかな波に、ときどき突発的な負荷が乗る標本を作る
+	std::vector<LoadSample> SynthesizeLoadTrace(size_t count, std::uint64_t seed);
+}
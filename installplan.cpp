@@ -0,0 +1,47 @@
+#include "installplan.h"
+
+namespace waffle
+{
+	InstallBehavior GetInstallBehavior(IUpdate * update)
+	{
+		com_ptr_t<IInstallationBehavior> behavior;
+
+		if (auto hr = update->get_InstallationBehavior(&behavior); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		InstallBehavior result{};
+
+		if (auto hr = behavior->get_Impact(&result.impact); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (auto hr = behavior->get_RebootBehavior(&result.rebootBehavior); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return result;
+	}
+
+	InstallPlan PlanInstall(const Updates & updates)
+	{
+		if (auto snapshot = updates.Snapshot(); snapshot != nullptr)
+		{
+			return InstallPlan(*snapshot);
+		}
+
+		std::vector<InstallBehavior> behaviors;
+
+		behaviors.reserve(updates.size());
+
+		for (LONG index = 0; index < updates.size(); ++index)
+		{
+			behaviors.push_back(GetInstallBehavior(updates.Item(index)));
+		}
+
+		return InstallPlan(behaviors);
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "waffle.h"
+#include "plan.h"
+
+namespace waffle
+{
+	InstallBehavior GetInstallBehavior(IUpdate * update);
+
+	// 更新からインストールの計画を立てる (スナップショットがあれば COM を引かない)
+	InstallPlan PlanInstall(const Updates & updates);
+}
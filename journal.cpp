@@ -0,0 +1,218 @@
+#include "journal.h"
+
+namespace waffle
+{
+	constexpr DWORD JOURNAL_MAGIC = 0x4E4A4657; // "WFJN"
+
+	DWORD GetJournalChecksum(const JournalRecord & record)
+	{
+		// FNV-1a (checksum 自身は含めない)
+		auto bytes = reinterpret_cast<const BYTE *>(&record);
+		DWORD hash = 2166136261;
+
+		for (size_t i = 0; i < offsetof(JournalRecord, checksum); ++i)
+		{
+			hash = (hash ^ bytes[i]) * 16777619;
+		}
+
+		return hash;
+	}
+
+	Journal::Journal(const std::wstring & path, size_t batch) : m_file(::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)), m_batch(std::max<size_t>(batch, 1))
+	{
+		if (!m_file)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		for (;;)
+		{
+			JournalRecord record{};
+			DWORD read{};
+
+			if (!::ReadFile(m_file, &record, sizeof(record), &read, nullptr) || read != sizeof(record))
+			{
+				break;
+			}
+
+			if (record.magic != JOURNAL_MAGIC || record.checksum != GetJournalChecksum(record))
+			{
+				break;
+			}
+
+			m_records.push_back(record);
+		}
+
+		// 壊れた末尾を切り詰めて、続きはそこから書く
+		LARGE_INTEGER offset{};
+		offset.QuadPart = (LONGLONG) (m_records.size() * sizeof(JournalRecord));
+
+		if (!::SetFilePointerEx(m_file, offset, nullptr, FILE_BEGIN) || !::SetEndOfFile(m_file))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	Journal::~Journal()
+	{
+		try
+		{
+			Flush();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	bool Journal::Resumable(ULONGLONG criteria, ULONGLONG maxAge) const
+	{
+		if (m_records.empty() || m_records.front().type != JournalType::RunStart || m_records.front().criteria != criteria)
+		{
+			return false;
+		}
+
+		if (GetSystemTimeAsULONGLONG() - m_records.front().timestamp > maxAge)
+		{
+			return false;
+		}
+
+		return std::none_of(m_records.begin(), m_records.end(), [](const JournalRecord & record) { return record.type == JournalType::RunEnd; });
+	}
+
+	bool Journal::RebootPending() const
+	{
+		// 最後に起動した時刻 (100 ナノ秒単位) より後に記録されたものだけ
+		auto boot = GetSystemTimeAsULONGLONG() - ::GetTickCount64() * 10000;
+
+		return std::any_of(m_records.begin(), m_records.end(), [boot](const JournalRecord & record) { return record.type == JournalType::RebootRequired && record.timestamp > boot; });
+	}
+
+	std::vector<SearchCacheRecord> Journal::Outstanding() const
+	{
+		std::vector<SearchCacheRecord> outstanding;
+
+		for (auto & record : m_records)
+		{
+			if (record.type == JournalType::Planned)
+			{
+				outstanding.push_back(SearchCacheRecord{ record.updateID, record.revisionNumber, 0, 0, 0 });
+			}
+			else if (record.type == JournalType::Installed)
+			{
+				std::erase_if(outstanding, [&](const SearchCacheRecord & planned) { return planned.updateID == record.updateID && planned.revisionNumber == record.revisionNumber; });
+			}
+		}
+
+		return outstanding;
+	}
+
+	void Journal::Append(JournalType type, const GUID & updateID, LONG revisionNumber, LONG hresult)
+	{
+		JournalRecord record{ JOURNAL_MAGIC, type, 0, m_records.empty() ? 0 : m_records.front().criteria, GetSystemTimeAsULONGLONG(), updateID, revisionNumber, hresult, 0, 0 };
+
+		record.checksum = GetJournalChecksum(record);
+
+		m_records.push_back(record);
+		m_pending.push_back(record);
+
+		if (m_pending.size() >= m_batch)
+		{
+			FlushLocked();
+		}
+	}
+
+	void Journal::BeginRun(ULONGLONG criteria, const Updates & updates)
+	{
+		std::lock_guard lock(m_mutex);
+
+		m_records.clear();
+		m_pending.clear();
+
+		LARGE_INTEGER offset{};
+
+		if (!::SetFilePointerEx(m_file, offset, nullptr, FILE_BEGIN) || !::SetEndOfFile(m_file))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		JournalRecord start{ JOURNAL_MAGIC, JournalType::RunStart, 0, criteria, GetSystemTimeAsULONGLONG(), GUID{}, 0, S_OK, 0, 0 };
+
+		start.checksum = GetJournalChecksum(start);
+
+		m_records.push_back(start);
+		m_pending.push_back(start);
+
+		for (LONG index = 0; index < updates.size(); ++index)
+		{
+			auto & entry = updates.Entry(index);
+			auto [updateID, revisionNumber] = GetUpdateIdentity(entry.update);
+
+			Append(JournalType::Planned, ParseUpdateID(updateID), revisionNumber);
+		}
+
+		FlushLocked();
+	}
+
+	void Journal::Downloaded(IUpdate * update, HRESULT hr)
+	{
+		auto [updateID, revisionNumber] = GetUpdateIdentity(update);
+
+		std::lock_guard lock(m_mutex);
+
+		Append(SUCCEEDED(hr) ? JournalType::Downloaded : JournalType::DownloadFailed, ParseUpdateID(updateID), revisionNumber, hr);
+	}
+
+	void Journal::Installed(IUpdate * update, HRESULT hr)
+	{
+		auto [updateID, revisionNumber] = GetUpdateIdentity(update);
+
+		std::lock_guard lock(m_mutex);
+
+		Append(SUCCEEDED(hr) ? JournalType::Installed : JournalType::InstallFailed, ParseUpdateID(updateID), revisionNumber, hr);
+	}
+
+	void Journal::RebootRequired()
+	{
+		std::lock_guard lock(m_mutex);
+
+		Append(JournalType::RebootRequired);
+		FlushLocked();
+	}
+
+	void Journal::EndRun()
+	{
+		std::lock_guard lock(m_mutex);
+
+		Append(JournalType::RunEnd);
+		FlushLocked();
+	}
+
+	void Journal::Flush()
+	{
+		std::lock_guard lock(m_mutex);
+
+		FlushLocked();
+	}
+
+	void Journal::FlushLocked()
+	{
+		if (m_pending.empty())
+		{
+			return;
+		}
+
+		DWORD written{};
+
+		if (!::WriteFile(m_file, m_pending.data(), (DWORD) (m_pending.size() * sizeof(JournalRecord)), &written, nullptr))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (!::FlushFileBuffers(m_file))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		m_pending.clear();
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "waffle.h"
+#include "searchcache.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace waffle
+{
+	enum class JournalType : WORD
+	{
+		RunStart = 1,
+		Planned,
+		Downloaded,
+		DownloadFailed,
+		Installed,
+		InstallFailed,
+		RebootRequired,
+		RunEnd,
+	};
+
+	// 1 レコードは固定長で、末尾のチェックサムで書きかけ (電源断など) を見分ける
+	struct JournalRecord
+	{
+		DWORD magic;
+		JournalType type;
+		WORD reserved;
+		ULONGLONG criteria;
+		ULONGLONG timestamp;
+		GUID updateID;
+		LONG revisionNumber;
+		LONG hresult;
+		DWORD reserved2;
+		DWORD checksum;
+	};
+
+	// 実行の経過を追記だけで記録し、再起動やプロセスの強制終了のあとで続きから再開できるようにする
+	//
+	// 追記はバッファに溜めておき、batch 件ごとと Flush() のときにまとめて FlushFileBuffers する。
+	// 開くときに先頭から読み直し、チェックサムの合わない最初のレコードから後ろは切り捨てる。
+
+	class Journal
+	{
+		FileHandle m_file;
+		size_t m_batch;
+
+		std::vector<JournalRecord> m_records;
+		std::vector<JournalRecord> m_pending;
+		std::mutex m_mutex;
+
+		void Append(JournalType type, const GUID & updateID = GUID{}, LONG revisionNumber = 0, LONG hresult = S_OK);
+		void FlushLocked();
+
+	public:
+		Journal(const std::wstring & path, size_t batch = 16);
+		~Journal();
+
+		Journal(const Journal &) = delete;
+		Journal & operator=(const Journal &) = delete;
+
+		// 同じ条件の実行が終わらないまま残っているか (古すぎるものは再開しない)
+		bool Resumable(ULONGLONG criteria, ULONGLONG maxAge) const;
+
+		// 記録した再起動の要求が、その後の再起動でまだ解消されていないか
+		bool RebootPending() const;
+
+		// 計画した更新のうち、まだインストールが済んでいないもの
+		std::vector<SearchCacheRecord> Outstanding() const;
+
+		// 新しい実行を始める (以前の記録は捨てる)
+		void BeginRun(ULONGLONG criteria, const Updates & updates);
+
+		void Downloaded(IUpdate * update, HRESULT hr);
+		void Installed(IUpdate * update, HRESULT hr);
+		void RebootRequired();
+		void EndRun();
+
+		void Flush();
+	};
+}
@@ -0,0 +1,258 @@
+#include "loadmonitor.h"
+
+#include <map>
+
+namespace waffle
+{
+	namespace
+	{
+		double GetCounterValue(PDH_HCOUNTER counter)
+		{
+			PDH_FMT_COUNTERVALUE value{};
+
+			if (auto status = ::PdhGetFormattedCounterValue(counter, PDH_FMT_DOUBLE, nullptr, &value); status != ERROR_SUCCESS)
+			{
+				throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			return value.doubleValue;
+		}
+
+		// インスタンス (* で指定したカウンター) ごとの値
+		std::map<std::wstring, double> GetCounterValues(PDH_HCOUNTER counter)
+		{
+			DWORD size = 0, count = 0;
+
+			if (auto status = ::PdhGetFormattedCounterArrayW(counter, PDH_FMT_DOUBLE, &size, &count, nullptr); status != PDH_MORE_DATA)
+			{
+				if (status == ERROR_SUCCESS)
+				{
+					return {};
+				}
+
+				throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			std::vector<BYTE> buffer(size);
+
+			auto items = reinterpret_cast<PDH_FMT_COUNTERVALUE_ITEM_W *>(buffer.data());
+
+			if (auto status = ::PdhGetFormattedCounterArrayW(counter, PDH_FMT_DOUBLE, &size, &count, items); status != ERROR_SUCCESS)
+			{
+				throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			std::map<std::wstring, double> values;
+
+			for (DWORD i = 0; i < count; ++i)
+			{
+				values[items[i].szName] = items[i].FmtValue.doubleValue;
+			}
+
+			return values;
+		}
+
+		DownloadPriority GetDownloadPriority(DownloadLevel level)
+		{
+			// 止めている間にジョブを始める (やり直す) ことになっても、一番低い優先度にしておく
+			switch (level)
+			{
+			case DownloadLevel::Paused:
+			case DownloadLevel::Low:
+				return dpLow;
+			case DownloadLevel::High:
+				return dpHigh;
+			default:
+				return dpNormal;
+			}
+		}
+	}
+
+	LoadMonitor::LoadMonitor(std::uint64_t own) : m_query(nullptr), m_own(own), m_sampled(std::chrono::steady_clock::now())
+	{
+		if (auto status = ::PdhOpenQueryW(nullptr, 0, &m_query); status != ERROR_SUCCESS)
+		{
+			throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		try
+		{
+			m_cpu = AddCounter(L"\\Processor(_Total)\\% Processor Time");
+			m_diskIdle = AddCounter(L"\\PhysicalDisk(_Total)\\% Idle Time");
+			m_networkBytes = AddCounter(L"\\Network Interface(*)\\Bytes Total/sec");
+			m_networkBandwidth = AddCounter(L"\\Network Interface(*)\\Current Bandwidth");
+
+			// 率のカウンターは 2 回の収集の差から求めるので、1 回目をここで取っておく
+			if (auto status = ::PdhCollectQueryData(m_query); status != ERROR_SUCCESS)
+			{
+				throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+		catch (...)
+		{
+			::PdhCloseQuery(m_query);
+			throw;
+		}
+	}
+
+	LoadMonitor::~LoadMonitor()
+	{
+		::PdhCloseQuery(m_query);
+	}
+
+	PDH_HCOUNTER LoadMonitor::AddCounter(const wchar_t * path)
+	{
+		PDH_HCOUNTER counter{};
+
+		if (auto status = ::PdhAddEnglishCounterW(m_query, path, 0, &counter); status != ERROR_SUCCESS)
+		{
+			throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return counter;
+	}
+
+	LoadSample LoadMonitor::Sample(std::uint64_t own)
+	{
+		if (auto status = ::PdhCollectQueryData(m_query); status != ERROR_SUCCESS)
+		{
+			throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::duration<double>(now - m_sampled).count();
+
+		auto ownRate = (elapsed > 0 && own > m_own) ? (own - m_own) / elapsed : 0.0;
+
+		m_own = own;
+		m_sampled = now;
+
+		LoadSample sample{ GetCounterValue(m_cpu), 100 - GetCounterValue(m_diskIdle), 0 };
+
+		// ネットワークは、アダプターごとの「送受信のビット数/秒 ÷ 帯域」の一番高いもの (自分のダウンロードの分は引く)
+		auto bandwidths = GetCounterValues(m_networkBandwidth);
+
+		std::vector<NetworkLoad> adapters;
+
+		for (auto & [name, bytes] : GetCounterValues(m_networkBytes))
+		{
+			if (auto bandwidth = bandwidths.find(name); bandwidth != bandwidths.end())
+			{
+				adapters.push_back({ bytes, bandwidth->second });
+			}
+		}
+
+		sample.network = GetNetworkUtilization(adapters, ownRate);
+
+		sample.cpu = std::clamp(sample.cpu, 0.0, 100.0);
+		sample.disk = std::clamp(sample.disk, 0.0, 100.0);
+		sample.network = std::clamp(sample.network, 0.0, 100.0);
+
+		return sample;
+	}
+
+	LoadGovernor::LoadGovernor(Session & session, double threshold, GovernorCallback callback, std::chrono::milliseconds interval) : m_session(session), m_monitor(session.DownloadThroughput().Transferred()), m_governor(threshold), m_callback(callback), m_interval(interval), m_stopping(false)
+	{}
+
+	LoadGovernor::~LoadGovernor()
+	{
+		Stop();
+	}
+
+	void LoadGovernor::Sample()
+	{
+		LoadSample sample;
+
+		try
+		{
+			sample = m_monitor.Sample(m_session.DownloadThroughput().Transferred());
+		}
+		catch (const std::system_error &)
+		{
+			// カウンターが一時的に読めないときは、その回を飛ばす
+			return;
+		}
+
+		std::unique_lock lock(m_mutex);
+
+		auto previous = m_governor.Level();
+
+		if (!m_governor.Sample(sample))
+		{
+			return;
+		}
+
+		auto level = m_governor.Level();
+		auto load = m_governor.Load();
+
+		m_session.SetDownloadPriority(GetDownloadPriority(level));
+
+		// 止めるときと戻すときだけ作り直させる (Paused なら作り直す前に待つ)。ほかの変化は次のジョブから効く
+		if (RestartsDownload(previous, level))
+		{
+			m_session.InterruptDownload();
+		}
+
+		lock.unlock();
+		m_changed.notify_all();
+
+		if (m_callback)
+		{
+			m_callback(level, sample, load);
+		}
+	}
+
+	void LoadGovernor::Run()
+	{
+		for (std::unique_lock lock(m_mutex); !m_changed.wait_for(lock, m_interval, [this]() { return m_stopping; }); )
+		{
+			lock.unlock();
+			Sample();
+			lock.lock();
+		}
+	}
+
+	void LoadGovernor::Start()
+	{
+		if (m_thread.joinable())
+		{
+			return;
+		}
+
+		m_stopping = false;
+
+		// 最初のジョブから、今の負荷に合わせた優先度で始める
+		m_session.SetDownloadPriority(GetDownloadPriority(m_governor.Level()));
+
+		Sample();
+
+		m_thread = std::thread(&LoadGovernor::Run, this);
+	}
+
+	void LoadGovernor::Stop()
+	{
+		if (!m_thread.joinable())
+		{
+			return;
+		}
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+
+		m_changed.notify_all();
+		m_thread.join();
+	}
+
+	std::chrono::milliseconds LoadGovernor::WaitWhilePaused(std::chrono::milliseconds maxPause)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		std::unique_lock lock(m_mutex);
+
+		m_changed.wait_for(lock, maxPause, [this]() { return m_stopping || m_governor.Level() != DownloadLevel::Paused; });
+
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+#pragma comment(lib, "pdh")
+
+#include "waffle.h"
+#include "governor.h"
+
+#include <pdh.h>
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+namespace waffle
+{
+	// CPU, ディスク, ネットワークの使用率をパフォーマンス カウンターから読む
+
+	class LoadMonitor
+	{
+		PDH_HQUERY m_query;
+
+		PDH_HCOUNTER m_cpu;
+		PDH_HCOUNTER m_diskIdle;
+		PDH_HCOUNTER m_networkBytes;
+		PDH_HCOUNTER m_networkBandwidth;
+
+		// 前回の Sample() のときの、自分のダウンロードのバイト数と時刻
+		std::uint64_t m_own;
+		std::chrono::steady_clock::time_point m_sampled;
+
+		PDH_HCOUNTER AddCounter(const wchar_t * path);
+
+	public:
+		// own はそれまでに自分がダウンロードしたバイト数
+		LoadMonitor(std::uint64_t own = 0);
+		~LoadMonitor();
+
+		LoadMonitor(const LoadMonitor &) = delete;
+		LoadMonitor & operator=(const LoadMonitor &) = delete;
+
+		// 前回の Sample() (初めてならコンストラクター) からの平均
+		//
+		// own はそれまでに自分がダウンロードしたバイト数で、その間に増えた分はネットワークの使用率に数えない。
+		// ディスクの使用率は、ダウンロードしたファイルの書き込みも含む。
+		LoadSample Sample(std::uint64_t own);
+	};
+
+	// 優先度が変わったときに呼ばれる (新しい段階, きっかけになった標本, ならした負荷)
+	using GovernorCallback = std::function<void(DownloadLevel, const LoadSample &, double)>;
+
+	// ダウンロードの間、別のスレッドで負荷を見てセッションのダウンロードの優先度を変える
+	//
+	// 優先度はジョブを始めるときに決まるので、Low, Normal, High の間の変化は次のジョブから効く。
+	// Paused になったときと Paused から戻ったときだけ今のジョブを中断して作り直させ、
+	// Paused の間は作り直す前に (Session::SetDownloadGate() で) WaitWhilePaused() が負荷の下がるのを待つ。
+
+	class LoadGovernor
+	{
+		Session & m_session;
+		LoadMonitor m_monitor;
+		PriorityGovernor m_governor;
+		GovernorCallback m_callback;
+		std::chrono::milliseconds m_interval;
+
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		bool m_stopping;
+
+		std::thread m_thread;
+
+		void Sample();
+		void Run();
+
+	public:
+		LoadGovernor(Session & session, double threshold, GovernorCallback callback, std::chrono::milliseconds interval = std::chrono::seconds(1));
+		~LoadGovernor();
+
+		LoadGovernor(const LoadGovernor &) = delete;
+		LoadGovernor & operator=(const LoadGovernor &) = delete;
+
+		// 今の負荷で優先度を決めてから、見張りを始める
+		void Start();
+		void Stop();
+
+		// Paused の間 (長くても maxPause) 待つ。待った時間を返す
+		std::chrono::milliseconds WaitWhilePaused(std::chrono::milliseconds maxPause);
+	};
+}
@@ -0,0 +1,540 @@
+#include "orchestrator.h"
+#include "wuaerrors.h"
+
+#include <thread>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+
+namespace waffle
+{
+	InstallQueue::InstallQueue(LONG count) : m_queued(count), m_closed(false)
+	{}
+
+	void InstallQueue::Push(LONG index)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+
+			if (m_closed || m_queued.at(index))
+			{
+				return;
+			}
+
+			m_queued[index] = true;
+			m_indexes.push_back(index);
+		}
+
+		m_ready.notify_one();
+	}
+
+	void InstallQueue::Close()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+
+			m_closed = true;
+		}
+
+		m_ready.notify_all();
+	}
+
+	std::vector<LONG> InstallQueue::Pop()
+	{
+		std::unique_lock lock(m_mutex);
+
+		m_ready.wait(lock, [this]() { return m_closed || !m_indexes.empty(); });
+
+		std::vector<LONG> indexes(m_indexes.begin(), m_indexes.end());
+
+		m_indexes.clear();
+
+		return indexes;
+	}
+
+	Orchestrator::Orchestrator() : m_stallTimeout(0), m_stallRestarts(0), m_stalls(0), m_interrupted(false), m_interrupts(0), m_retries(0), m_trace(nullptr), m_rebootRequired(false)
+	{}
+
+	void Orchestrator::SetStallTimeout(unsigned long msTimeout, unsigned long restarts)
+	{
+		m_stallTimeout = msTimeout;
+		m_stallRestarts = restarts;
+	}
+
+	void Orchestrator::SetRetryPolicy(const RetryPolicy & policy, RetryCallback callback)
+	{
+		m_retryPolicy = policy;
+		m_retryCallback = callback;
+	}
+
+	// 進捗の通知を記録してから、元のコールバックに渡す
+	template<class Progress>
+	auto TraceProgress(TraceRecorder * trace, TraceEvent event, std::function<void(LONG, OperationResultCode, const Progress &)> callback)
+	{
+		return [=](LONG index, OperationResultCode code, const Progress & progress)
+		{
+			if constexpr (std::is_same_v<Progress, DownloadProgress>)
+			{
+				auto [total, bytes] = progress.TotalBytes();
+
+				trace->Record(event, index, code, progress.HResult(), progress.PercentComplete(), bytes, total);
+			}
+			else
+			{
+				trace->Record(event, index, code, progress.HResult(), progress.PercentComplete());
+			}
+
+			callback(index, code, progress);
+		};
+	}
+
+	LONG Orchestrator::Search(Backend & backend, const std::wstring & criteria, unsigned long timeout)
+	{
+		for (unsigned long attempt = 0; ; ++attempt)
+		{
+			try
+			{
+				if (m_trace != nullptr)
+				{
+					m_trace->Record(TraceEvent::SearchBegin, 0);
+				}
+
+				auto count = backend.Search(criteria, timeout);
+
+				if (m_trace != nullptr)
+				{
+					m_trace->Record(TraceEvent::SearchEnd, count, orcSucceeded);
+				}
+
+				return count;
+			}
+			catch (const std::system_error & e)
+			{
+				if (m_trace != nullptr)
+				{
+					m_trace->Record(TraceEvent::SearchEnd, 0, orcFailed, e.code().value());
+				}
+
+				if (!ShouldRetry("search", attempt, e.code().value()))
+				{
+					throw;
+				}
+			}
+		}
+	}
+
+	Task<LONG> Orchestrator::SearchAsync(Scheduler & scheduler, std::function<Task<LONG>()> search)
+	{
+		for (unsigned long attempt = 0; ; ++attempt)
+		{
+			std::optional<std::chrono::milliseconds> delay;
+
+			try
+			{
+				if (m_trace != nullptr)
+				{
+					m_trace->Record(TraceEvent::SearchBegin, 0);
+				}
+
+				auto count = co_await search();
+
+				if (m_trace != nullptr)
+				{
+					m_trace->Record(TraceEvent::SearchEnd, count, orcSucceeded);
+				}
+
+				co_return count;
+			}
+			catch (const std::system_error & e)
+			{
+				if (m_trace != nullptr)
+				{
+					m_trace->Record(TraceEvent::SearchEnd, 0, orcFailed, e.code().value());
+				}
+
+				if (delay = NextRetry("search", attempt, e.code().value()); !delay)
+				{
+					throw;
+				}
+			}
+
+			// catch の中では co_await できない
+			co_await scheduler.Delay(*delay);
+		}
+	}
+
+	JobResult Orchestrator::RunDownload(Backend & backend, const std::vector<LONG> & updates, const DownloadProgressCallback & callback)
+	{
+		bool stalled = false;
+		bool interrupted = false;
+
+		auto result = RunDownloadJob(backend, updates, callback, stalled, interrupted);
+
+		for (unsigned long restarts = 0; stalled || interrupted; )
+		{
+			// 中断して作り直すのは、やり直しの回数に数えない
+			if (stalled && restarts++ == m_stallRestarts)
+			{
+				throw std::runtime_error(std::string(MACRO_SOURCE_LOCATION()) + ": Download stalled " + std::to_string(m_stalls) + " times.");
+			}
+
+			// 止まったか中断したジョブのうち、まだダウンロードできていない更新だけでやり直す
+
+			std::vector<LONG> remaining;
+			std::vector<LONG> positions;
+
+			for (LONG index = 0; index < (LONG) updates.size(); ++index)
+			{
+				if (!backend.IsDownloaded(updates[index]))
+				{
+					remaining.push_back(updates[index]);
+					positions.push_back(index);
+				}
+			}
+
+			// 中止する間際に全部ダウンロードし終えていた
+			if (remaining.empty())
+			{
+				result.code = orcSucceeded;
+				result.hresult = S_OK;
+				result.updates.assign(updates.size(), UpdateResult{ orcSucceeded, S_OK });
+				break;
+			}
+
+			auto restarted = RunDownloadJob(backend, remaining, [&](LONG index, OperationResultCode code, const DownloadProgress & progress)
+			{
+				callback(positions[index], code, progress);
+			}, stalled, interrupted);
+
+			// 結果は updates の全部の分にそろえる (やり直さなかった更新はダウンロード済み)
+			result.code = restarted.code;
+			result.hresult = restarted.hresult;
+			result.updates.assign(updates.size(), UpdateResult{ orcSucceeded, S_OK });
+
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				result.updates[positions[i]] = restarted.updates.at(i);
+			}
+		}
+
+		return result;
+	}
+
+	JobResult Orchestrator::RunDownloadJob(Backend & backend, const std::vector<LONG> & updates, const DownloadProgressCallback & progress, bool & stalled, bool & interrupted)
+	{
+		auto callback = progress;
+
+		if (m_downloadGate)
+		{
+			m_downloadGate();
+		}
+
+		// 待つ間に来た中断は、これから作るジョブに反映されている
+		m_interrupted = false;
+
+		m_throughput.Restart(Throughput::clock::now());
+		stalled = false;
+		interrupted = false;
+
+		if (m_trace != nullptr)
+		{
+			m_trace->Record(TraceEvent::DownloadBegin, (LONG) updates.size());
+
+			callback = TraceProgress(m_trace, TraceEvent::DownloadProgress, callback);
+		}
+
+		// ダウンロード済みのバイト数を見て、止まったままならジョブを中止する。中断を頼まれたときも中止する
+
+		auto result = backend.Download(updates, callback, [&](ULONGLONG total, ULONGLONG bytes)
+		{
+			if (m_interrupted.exchange(false))
+			{
+				++m_interrupts;
+				interrupted = true;
+
+				return true;
+			}
+
+			auto now = Throughput::clock::now();
+
+			m_throughput.Sample(now, bytes, total);
+
+			if (m_stallTimeout == 0 || !m_throughput.Stalled(now, std::chrono::milliseconds(m_stallTimeout)))
+			{
+				return false;
+			}
+
+			++m_stalls;
+			stalled = true;
+
+			return true;
+		});
+
+		if (m_trace != nullptr)
+		{
+			m_trace->Record(TraceEvent::DownloadEnd, (LONG) updates.size(), result.code, result.hresult);
+		}
+
+		return result;
+	}
+
+	JobResult Orchestrator::RunInstall(Backend & backend, const std::vector<LONG> & updates, const InstallationProgressCallback & progress)
+	{
+		auto callback = progress;
+
+		if (m_trace != nullptr)
+		{
+			m_trace->Record(TraceEvent::InstallBegin, (LONG) updates.size());
+
+			callback = TraceProgress(m_trace, TraceEvent::InstallProgress, callback);
+		}
+
+		auto result = backend.Install(updates, callback);
+
+		if (m_trace != nullptr)
+		{
+			m_trace->Record(TraceEvent::InstallEnd, (LONG) updates.size(), result.code, result.hresult);
+		}
+
+		if (result.rebootRequired)
+		{
+			m_rebootRequired = true;
+		}
+
+		return result;
+	}
+
+	std::optional<std::chrono::milliseconds> Orchestrator::NextRetry(const char * phase, unsigned long attempt, LONG code)
+	{
+		// インストールのスレッドからも呼ばれる
+		std::lock_guard lock(m_retryMutex);
+
+		if (attempt >= m_retryPolicy.Attempts() || !IsTransientWUAError(code))
+		{
+			return std::nullopt;
+		}
+
+		auto delay = m_retryPolicy.Delay(attempt);
+
+		++m_retries;
+
+		if (m_retryCallback)
+		{
+			m_retryCallback(phase, attempt + 1, code, delay);
+		}
+
+		return delay;
+	}
+
+	bool Orchestrator::ShouldRetry(const char * phase, unsigned long attempt, LONG code)
+	{
+		auto delay = NextRetry(phase, attempt, code);
+
+		if (!delay)
+		{
+			return false;
+		}
+
+		std::this_thread::sleep_for(*delay);
+
+		return true;
+	}
+
+	template<class Run, class Done>
+	void Orchestrator::RunWithRetry(const char * phase, const std::vector<LONG> & updates, Run run, Done done)
+	{
+		// 一時的なエラーで失敗した更新だけを集めてやり直す。run には元の位置の表も渡す
+
+		auto pending = updates;
+		auto positions = Sequence((LONG) updates.size());
+
+		bool succeeded = false;
+		bool failed = false;
+
+		for (unsigned long attempt = 0; ; ++attempt)
+		{
+			std::vector<LONG> retry;
+			std::vector<LONG> retryPositions;
+
+			try
+			{
+				auto result = run(pending, positions);
+
+				if (FAILED(result.hresult))
+				{
+					throw std::system_error(result.hresult, WUACategory(), phase);
+				}
+
+				LONG code = S_OK;
+
+				for (size_t index = 0; index < pending.size(); ++index)
+				{
+					auto & item = result.updates.at(index);
+
+					if (item.code == orcSucceeded || item.code == orcSucceededWithErrors)
+					{
+						succeeded = true;
+					}
+					else if (IsTransientWUAError(item.hresult) && attempt < m_retryPolicy.Attempts())
+					{
+						retry.push_back(pending[index]);
+						retryPositions.push_back(positions[index]);
+
+						code = item.hresult;
+					}
+					else
+					{
+						failed = true;
+					}
+				}
+
+				if (retry.empty() || !ShouldRetry(phase, attempt, code))
+				{
+					failed = failed || !retry.empty();
+					break;
+				}
+			}
+			catch (const std::system_error & e)
+			{
+				if (!ShouldRetry(phase, attempt, e.code().value()))
+				{
+					throw;
+				}
+
+				// フェーズごと失敗したときは、まだ終わっていない更新を全部やり直す
+				for (size_t index = 0; index < pending.size(); ++index)
+				{
+					if (!done(pending[index]))
+					{
+						retry.push_back(pending[index]);
+						retryPositions.push_back(positions[index]);
+					}
+				}
+
+				if (retry.empty())
+				{
+					break;
+				}
+			}
+
+			pending = std::move(retry);
+			positions = std::move(retryPositions);
+		}
+
+		if (failed)
+		{
+			ValidateOperationCode(succeeded ? orcSucceededWithErrors : orcFailed, phase);
+		}
+	}
+
+	void Orchestrator::Download(Backend & backend, const std::vector<LONG> & updates, DownloadProgressCallback callback)
+	{
+		RunWithRetry("download", updates, [&](const std::vector<LONG> & pending, const std::vector<LONG> & positions)
+		{
+			return RunDownload(backend, pending, [&](LONG index, OperationResultCode code, const DownloadProgress & progress)
+			{
+				callback(positions[index], code, progress);
+			});
+		}, [&](LONG update) { return backend.IsDownloaded(update); });
+	}
+
+	void Orchestrator::Install(Backend & backend, const std::vector<LONG> & updates, InstallationProgressCallback callback)
+	{
+		RunWithRetry("install", updates, [&](const std::vector<LONG> & pending, const std::vector<LONG> & positions)
+		{
+			return RunInstall(backend, pending, [&](LONG index, OperationResultCode code, const InstallationProgress & progress)
+			{
+				callback(positions[index], code, progress);
+			});
+		}, [&](LONG update) { return backend.IsInstalled(update); });
+	}
+
+	void Orchestrator::DownloadAndInstall(Backend & backend, const std::vector<LONG> & updates, DownloadProgressCallback download, InstallationProgressCallback install)
+	{
+		// ダウンロードが完了した更新から順に、まとめてインストールする
+
+		InstallQueue queue((LONG) updates.size());
+		std::exception_ptr failure;
+		std::mutex callbackMutex;
+
+		std::thread installer([&]()
+		{
+			try
+			{
+				for (auto positions = queue.Pop(); !positions.empty(); positions = queue.Pop())
+				{
+					std::vector<LONG> batch;
+
+					for (auto position : positions)
+					{
+						batch.push_back(updates[position]);
+					}
+
+					Install(backend, batch, [&](LONG index, OperationResultCode code, const InstallationProgress & progress)
+					{
+						std::lock_guard lock(callbackMutex);
+
+						install(positions[index], code, progress);
+					});
+				}
+			}
+			catch (...)
+			{
+				failure = std::current_exception();
+			}
+		});
+
+		try
+		{
+			Download(backend, updates, [&](LONG index, OperationResultCode code, const DownloadProgress & progress)
+			{
+				{
+					std::lock_guard lock(callbackMutex);
+
+					download(index, code, progress);
+				}
+
+				if (code == orcSucceeded)
+				{
+					queue.Push(index);
+				}
+			});
+
+			// 進捗の通知が無いまま完了したもの (ダウンロード済みなど) を拾う
+			for (LONG index = 0; index < (LONG) updates.size(); ++index)
+			{
+				if (backend.IsDownloaded(updates[index]))
+				{
+					queue.Push(index);
+				}
+			}
+
+			queue.Close();
+			installer.join();
+		}
+		catch (...)
+		{
+			if (installer.joinable())
+			{
+				queue.Close();
+				installer.join();
+			}
+
+			throw;
+		}
+
+		if (failure)
+		{
+			std::rethrow_exception(failure);
+		}
+	}
+
+	std::vector<LONG> Sequence(LONG count)
+	{
+		std::vector<LONG> indexes(count);
+
+		std::iota(indexes.begin(), indexes.end(), 0);
+
+		return indexes;
+	}
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "core.h"
+#include "backend.h"
+#include "retry.h"
+#include "trace.h"
+#include "throughput.h"
+#include "awaitable.h"
+
+#include <mutex>
+#include <deque>
+#include <optional>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace waffle
+{
+	// やり直す直前に呼ばれる (フェーズ名, 何回目か, 失敗の HRESULT, 待ち時間)
+	using RetryCallback = std::function<void(const char *, unsigned long, LONG, std::chrono::milliseconds)>;
+
+	// ダウンロードのジョブを始める (やり直す) 直前に呼ばれる。返るまでジョブを始めない
+	using DownloadGate = std::function<void()>;
+
+	class InstallQueue
+	{
+		std::mutex m_mutex;
+		std::condition_variable m_ready;
+		std::deque<LONG> m_indexes;
+		std::vector<bool> m_queued;
+		bool m_closed;
+
+	public:
+		InstallQueue(LONG count);
+		~InstallQueue() = default;
+
+		InstallQueue(const InstallQueue &) = delete;
+		InstallQueue & operator=(const InstallQueue &) = delete;
+
+		void Push(LONG index);
+		void Close();
+
+		std::vector<LONG> Pop();
+	};
+
+	// Backend の上で検索、ダウンロード、インストールを進める
+	//
+	// 一時的なエラーのやり直し、止まったダウンロードのやり直し、ダウンロードとインストールのパイプライン、
+	// やり取りの記録を受け持つ。WUA には依存しないので、偽の Backend や記録の再生でそのまま動かせる。
+
+	class Orchestrator
+	{
+		unsigned long m_stallTimeout;
+		unsigned long m_stallRestarts;
+		unsigned long m_stalls;
+
+		DownloadGate m_downloadGate;
+
+		// 別のスレッドから立てる
+		std::atomic<bool> m_interrupted;
+		unsigned long m_interrupts;
+
+		Throughput m_throughput;
+
+		RetryPolicy m_retryPolicy;
+		RetryCallback m_retryCallback;
+		unsigned long m_retries;
+		std::mutex m_retryMutex;
+
+		TraceRecorder * m_trace;
+
+		// インストールのスレッドからも立てる
+		std::atomic<bool> m_rebootRequired;
+
+		JobResult RunDownload(Backend & backend, const std::vector<LONG> & updates, const DownloadProgressCallback & callback);
+		JobResult RunDownloadJob(Backend & backend, const std::vector<LONG> & updates, const DownloadProgressCallback & progress, bool & stalled, bool & interrupted);
+		JobResult RunInstall(Backend & backend, const std::vector<LONG> & updates, const InstallationProgressCallback & progress);
+
+		// やり直すなら待ち時間を返す (数えて RetryCallback を呼ぶ)
+		std::optional<std::chrono::milliseconds> NextRetry(const char * phase, unsigned long attempt, LONG code);
+
+		bool ShouldRetry(const char * phase, unsigned long attempt, LONG code);
+
+		template<class Run, class Done>
+		void RunWithRetry(const char * phase, const std::vector<LONG> & updates, Run run, Done done);
+
+	public:
+		Orchestrator();
+		~Orchestrator() = default;
+
+		Orchestrator(const Orchestrator &) = delete;
+		Orchestrator & operator=(const Orchestrator &) = delete;
+
+		void SetStallTimeout(unsigned long msTimeout, unsigned long restarts = 3);
+		void SetRetryPolicy(const RetryPolicy & policy, RetryCallback callback = nullptr);
+
+		// 負荷が高い間はここで待たせる (nullptr でやめる)
+		void SetDownloadGate(DownloadGate gate)
+		{
+			m_downloadGate = gate;
+		}
+
+		// 今のダウンロードのジョブを中止し、まだ終わっていない更新で作り直させる (止まったジョブのやり直しには数えない)
+		//
+		// ジョブの優先度は作るときに決まるので、優先度を変えたら呼ぶ。別のスレッドから呼んでよい。
+		void Interrupt() noexcept
+		{
+			m_interrupted = true;
+		}
+
+		// 検索、ダウンロード、インストールでやり取りした内容を記録する (nullptr でやめる)
+		void SetTrace(TraceRecorder * trace)
+		{
+			m_trace = trace;
+		}
+
+		TraceRecorder * Trace() const noexcept
+		{
+			return m_trace;
+		}
+
+		// 見つかった更新の数を返す
+		LONG Search(Backend & backend, const std::wstring & criteria, unsigned long timeout);
+
+		// co_await で待つ検索を、Search() と同じくやり直す。待つ間は Scheduler のタイマーでスレッドを空ける
+		//
+		// search は試行ごとに呼ばれ、見つかった更新の数を返す。Scheduler::Run() を回すスレッドで使う。
+		Task<LONG> SearchAsync(Scheduler & scheduler, std::function<Task<LONG>()> search);
+
+		// updates は Backend の中の番号。進捗の通知には updates の中の位置を渡す
+		void Download(Backend & backend, const std::vector<LONG> & updates, DownloadProgressCallback callback);
+		void Install(Backend & backend, const std::vector<LONG> & updates, InstallationProgressCallback callback);
+
+		// ダウンロードが完了した更新から順に、別のスレッドでまとめてインストールする
+		void DownloadAndInstall(Backend & backend, const std::vector<LONG> & updates, DownloadProgressCallback download, InstallationProgressCallback install);
+
+		bool RebootRequired() const noexcept
+		{
+			return m_rebootRequired;
+		}
+
+		const Throughput & DownloadThroughput() const noexcept
+		{
+			return m_throughput;
+		}
+
+		unsigned long Stalls() const noexcept
+		{
+			return m_stalls;
+		}
+
+		unsigned long Retries() const noexcept
+		{
+			return m_retries;
+		}
+
+		unsigned long Interrupts() const noexcept
+		{
+			return m_interrupts;
+		}
+	};
+
+	// [0, count) の番号の並び
+	std::vector<LONG> Sequence(LONG count);
+}
@@ -0,0 +1,155 @@
+#include "plan.h"
+
+#include <algorithm>
+
+namespace waffle
+{
+	const wchar_t * GetSeverityName(UpdateSeverity severity)
+	{
+		switch (severity)
+		{
+		case UpdateSeverity::Critical:
+			return L"Critical";
+		case UpdateSeverity::Important:
+			return L"Important";
+		case UpdateSeverity::Moderate:
+			return L"Moderate";
+		case UpdateSeverity::Low:
+			return L"Low";
+		default:
+			return L"-";
+		}
+	}
+
+	std::vector<PlannedUpdate> GetPlannedUpdates(const UpdateSnapshot & snapshot)
+	{
+		auto severities = snapshot.Severities();
+		auto sizes = snapshot.MaxDownloadSizes();
+
+		std::vector<PlannedUpdate> planned;
+
+		planned.reserve(snapshot.size());
+
+		for (LONG index = 0; index < snapshot.size(); ++index)
+		{
+			planned.push_back({ index, severities[index], sizes[index] });
+		}
+
+		return planned;
+	}
+
+	DownloadPlan::DownloadPlan(std::vector<PlannedUpdate> planned, ULONGLONG budget, ULONGLONG batchBytes) : m_budget(budget)
+	{
+		std::stable_sort(planned.begin(), planned.end(), [](const PlannedUpdate & a, const PlannedUpdate & b)
+		{
+			auto aCritical = a.severity == UpdateSeverity::Critical;
+			auto bCritical = b.severity == UpdateSeverity::Critical;
+
+			if (aCritical != bCritical)
+			{
+				return aCritical;
+			}
+
+			return a.bytes < b.bytes;
+		});
+
+		ULONGLONG total = 0;
+
+		for (auto & update : planned)
+		{
+			if (total + update.bytes > budget)
+			{
+				m_deferred.push_back(update);
+				continue;
+			}
+
+			total += update.bytes;
+
+			auto critical = update.severity == UpdateSeverity::Critical;
+
+			if (m_batches.empty() || m_batches.back().critical != critical || (m_batches.back().bytes + update.bytes > batchBytes && !m_batches.back().updates.empty()))
+			{
+				m_batches.push_back({ {}, 0, critical });
+			}
+
+			m_batches.back().updates.push_back(update);
+			m_batches.back().bytes += update.bytes;
+		}
+	}
+
+	DownloadPlan::DownloadPlan(const UpdateSnapshot & snapshot, ULONGLONG budget, ULONGLONG batchBytes) : DownloadPlan(GetPlannedUpdates(snapshot), budget, batchBytes)
+	{}
+
+	std::vector<LONG> DownloadPlan::Batch(size_t batch) const
+	{
+		std::vector<LONG> indexes;
+
+		for (auto & update : m_batches.at(batch).updates)
+		{
+			indexes.push_back(update.index);
+		}
+
+		return indexes;
+	}
+
+	std::vector<LONG> DownloadPlan::Selected() const
+	{
+		std::vector<LONG> indexes;
+
+		for (auto & batch : m_batches)
+		{
+			for (auto & update : batch.updates)
+			{
+				indexes.push_back(update.index);
+			}
+		}
+
+		return indexes;
+	}
+
+	std::vector<InstallBehavior> GetInstallBehaviors(const UpdateSnapshot & snapshot)
+	{
+		std::vector<InstallBehavior> behaviors;
+
+		behaviors.reserve(snapshot.size());
+
+		for (LONG index = 0; index < snapshot.size(); ++index)
+		{
+			behaviors.push_back({ (InstallationImpact) snapshot.Impact(index), (InstallationRebootBehavior) snapshot.RebootBehavior(index) });
+		}
+
+		return behaviors;
+	}
+
+	InstallPlan::InstallPlan(const std::vector<InstallBehavior> & behaviors)
+	{
+		InstallBatch quiet{ {}, false, false };
+		InstallBatch reboot{ {}, false, true };
+
+		std::vector<InstallBatch> exclusive;
+		std::vector<InstallBatch> exclusiveReboot;
+
+		for (LONG index = 0; index < (LONG) behaviors.size(); ++index)
+		{
+			auto & behavior = behaviors[index];
+
+			if (behavior.Exclusive())
+				(behavior.MayReboot() ? exclusiveReboot : exclusive).push_back({ { index }, true, behavior.MayReboot() });
+			else
+				(behavior.MayReboot() ? reboot : quiet).indexes.push_back(index);
+		}
+
+		if (!quiet.indexes.empty())
+			m_batches.push_back(quiet);
+
+		m_batches.insert(m_batches.end(), exclusive.begin(), exclusive.end());
+
+		if (!reboot.indexes.empty())
+			m_batches.push_back(reboot);
+
+		m_batches.insert(m_batches.end(), exclusiveReboot.begin(), exclusiveReboot.end());
+	}
+
+	InstallPlan::InstallPlan(const UpdateSnapshot & snapshot) : InstallPlan(GetInstallBehaviors(snapshot))
+	{}
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "platform.h"
+#include "snapshot.h"
+
+#include <vector>
+
+namespace waffle
+{
+	const wchar_t * GetSeverityName(UpdateSeverity severity);
+
+	struct PlannedUpdate
+	{
+		LONG index;
+		UpdateSeverity severity;
+		ULONGLONG bytes;
+	};
+
+	struct DownloadBatch
+	{
+		std::vector<PlannedUpdate> updates;
+		ULONGLONG bytes;
+		bool critical;
+	};
+
+	// ダウンロードの順番と区切りを決める
+	//
+	// 緊急 (Critical) の更新を先に、残りは小さい順 (shortest job first) に並べる。MaxDownloadSize の合計が
+	// budget を超える更新は今回は見送る。バッチは緊急とそれ以外で分け、それぞれ batchBytes ごとに区切る。
+	// WUA には依存しないので、記録の再生でも同じ計画で進められる (Updates から立てるのは downloadplan.h)。
+
+	class DownloadPlan
+	{
+		ULONGLONG m_budget;
+
+		std::vector<DownloadBatch> m_batches;
+		std::vector<PlannedUpdate> m_deferred;
+
+	public:
+		DownloadPlan(std::vector<PlannedUpdate> planned, ULONGLONG budget, ULONGLONG batchBytes);
+		DownloadPlan(const UpdateSnapshot & snapshot, ULONGLONG budget, ULONGLONG batchBytes);
+		~DownloadPlan() = default;
+
+		ULONGLONG Budget() const noexcept
+		{
+			return m_budget;
+		}
+
+		const std::vector<DownloadBatch> & Batches() const noexcept
+		{
+			return m_batches;
+		}
+
+		const std::vector<PlannedUpdate> & Deferred() const noexcept
+		{
+			return m_deferred;
+		}
+
+		// batch 番目のバッチの更新の番号
+		std::vector<LONG> Batch(size_t batch) const;
+
+		// 計画に入った更新の番号を、ダウンロードする順に
+		std::vector<LONG> Selected() const;
+	};
+
+	struct InstallBehavior
+	{
+		InstallationImpact impact;
+		InstallationRebootBehavior rebootBehavior;
+
+		bool Exclusive() const noexcept
+		{
+			return impact == iiRequiresExclusiveHandling;
+		}
+
+		bool MayReboot() const noexcept
+		{
+			return rebootBehavior != irbNeverReboots;
+		}
+	};
+
+	struct InstallBatch
+	{
+		std::vector<LONG> indexes;
+		bool exclusive;
+		bool mayReboot;
+	};
+
+	// インストールの順番と区切りを決める
+	//
+	// 1. 再起動しない更新をまとめて
+	// 2. 単独でのインストールが必要 (iiRequiresExclusiveHandling) な更新を 1 件ずつ
+	// 3. 再起動するかもしれない更新を最後にまとめて (単独が必要なものはその後に 1 件ずつ)
+	//
+	// 再起動は最後の 1 回で済む。
+
+	class InstallPlan
+	{
+		std::vector<InstallBatch> m_batches;
+
+	public:
+		// 番号は behaviors の中の位置
+		InstallPlan(const std::vector<InstallBehavior> & behaviors);
+		InstallPlan(const UpdateSnapshot & snapshot);
+		~InstallPlan() = default;
+
+		const std::vector<InstallBatch> & Batches() const noexcept
+		{
+			return m_batches;
+		}
+
+		const std::vector<LONG> & Batch(size_t batch) const
+		{
+			return m_batches.at(batch).indexes;
+		}
+	};
+}
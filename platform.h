@@ -0,0 +1,71 @@
+#pragma once
+
+// core (Windows と COM に依存しない部分) が使う型と定数
+//
+// Windows では SDK のヘッダーをそのまま使い、それ以外 (ベンチマーク用の Linux ビルド) では同じ名前で最小限を定義する。
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <wuapi.h>
+#include <wuerror.h>
+
+#else
+
+#include <cstdint>
+
+typedef std::int32_t LONG;
+typedef std::uint32_t ULONG;
+typedef std::uint32_t DWORD;
+typedef std::int32_t HRESULT;
+typedef unsigned long long ULONGLONG;
+typedef unsigned char BYTE;
+typedef wchar_t WCHAR;
+
+#define S_OK ((HRESULT)0L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_POINTER ((HRESULT)0x80004003L)
+
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+#define INFINITE 0xFFFFFFFF
+
+#define _CRT_STRINGIZE_(x) #x
+#define _CRT_STRINGIZE(x) _CRT_STRINGIZE_(x)
+
+constexpr HRESULT HRESULT_FROM_WIN32(unsigned long x)
+{
+	return (HRESULT) (x) <= 0 ? (HRESULT) (x) : (HRESULT) (((x) & 0x0000FFFF) | (7 << 16) | 0x80000000);
+}
+
+enum OperationResultCode
+{
+	orcNotStarted = 0,
+	orcInProgress = 1,
+	orcSucceeded = 2,
+	orcSucceededWithErrors = 3,
+	orcFailed = 4,
+	orcAborted = 5,
+};
+
+enum InstallationImpact
+{
+	iiNormal = 0,
+	iiMinor = 1,
+	iiRequiresExclusiveHandling = 2,
+};
+
+enum InstallationRebootBehavior
+{
+	irbNeverReboots = 0,
+	irbAlwaysRequiresReboot = 1,
+	irbCanRequestReboot = 2,
+};
+
+#include "wuerror_posix.h"
+
+#endif
+
+#define MACRO_SOURCE_LOCATION() __FILE__ "(" _CRT_STRINGIZE(__LINE__) ")"
@@ -0,0 +1,211 @@
+#include "renderer.h"
+
+#include <cwchar>
+#include <iterator>
+#include <algorithm>
+
+namespace waffle
+{
+	// 端末で 2 桁を使う文字 (東アジアの全角の文字) か
+	static bool IsWide(wchar_t c)
+	{
+		return (c >= 0x1100 && c <= 0x115F) || (c >= 0x2E80 && c <= 0xA4CF) || (c >= 0xAC00 && c <= 0xD7A3) || (c >= 0xF900 && c <= 0xFAFF) || (c >= 0xFE30 && c <= 0xFE4F) || (c >= 0xFF00 && c <= 0xFF60) || (c >= 0xFFE0 && c <= 0xFFE6);
+	}
+
+	ProgressRenderer::ProgressRenderer(Output output, bool terminal, std::chrono::milliseconds interval, size_t width) : m_output(std::move(output)), m_terminal(terminal), m_width(width), m_interval(interval), m_drawn(0), m_frames(0), m_dropped(0)
+	{
+		m_lines.reserve(8);
+		m_frame.reserve(16 * 1024);
+	}
+
+	void ProgressRenderer::SetWidth(size_t width)
+	{
+		std::lock_guard lock(m_mutex);
+
+		m_width = width;
+	}
+
+	void ProgressRenderer::BeginFrame()
+	{
+		// 前に描いた状態の行の先頭まで戻り、そこから下を消す
+		m_frame.clear();
+
+		if (m_drawn > 0)
+		{
+			wchar_t escape[16];
+
+			m_frame.append(escape, std::swprintf(escape, std::size(escape), L"\x1b[%zuF", m_drawn));
+		}
+
+		m_frame.append(L"\x1b[0J");
+	}
+
+	void ProgressRenderer::AppendLine(const Line & line)
+	{
+		// 「 42% 1.2/9.9MB 512.0KB/s タイトル」
+		auto buffer = m_text.data();
+		auto size = m_text.size();
+		auto count = (size_t) std::max(std::swprintf(buffer, size, L"%3d%% ", (int) line.percent), 0);
+
+		if (line.phase == ProgressPhase::Download)
+		{
+			count += FormatToatalBytes(buffer + count, size - count, line.bytes, line.total);
+
+			if (line.rate > 0)
+			{
+				count += (size_t) std::max(std::swprintf(buffer + count, size - count, L"%.1fKB/s ", line.rate / 1024), 0);
+			}
+		}
+
+		if (m_width == 0)
+		{
+			m_frame.append(buffer, count);
+			m_frame.append(line.title.data(), line.titleLength);
+			m_frame.push_back(L'\n');
+			return;
+		}
+
+		// 最後の桁まで書くと端末によっては折り返すので、width - 1 桁に収める
+		auto columns = m_width > 1 ? m_width - 1 : 0;
+
+		count = std::min(count, columns);
+		m_frame.append(buffer, count);
+		columns -= count;
+
+		for (size_t i = 0; i < line.titleLength; )
+		{
+			auto c = line.title[i];
+
+			// サロゲートペアは 2 つで 1 文字 (幅は多めに 2 桁と見る)
+			auto length = (size_t) (c >= 0xD800 && c <= 0xDBFF && i + 1 < line.titleLength ? 2 : 1);
+			auto cells = (size_t) (length == 2 || IsWide(c) ? 2 : 1);
+
+			if (cells > columns)
+			{
+				break;
+			}
+
+			m_frame.append(&line.title[i], length);
+			columns -= cells;
+			i += length;
+		}
+
+		m_frame.push_back(L'\n');
+	}
+
+	void ProgressRenderer::EndFrame()
+	{
+		for (auto & line : m_lines)
+		{
+			AppendLine(line);
+		}
+
+		m_drawn = m_lines.size();
+		m_lastFrame = clock::now();
+		++m_frames;
+
+		m_output(m_frame);
+	}
+
+	bool ProgressRenderer::Due()
+	{
+		if (!m_terminal)
+		{
+			return false;
+		}
+
+		std::lock_guard lock(m_mutex);
+
+		if (clock::now() - m_lastFrame < m_interval)
+		{
+			++m_dropped;
+			return false;
+		}
+
+		return true;
+	}
+
+	void ProgressRenderer::Update(ProgressPhase phase, LONG index, std::wstring_view title, LONG percent, ULONGLONG bytes, ULONGLONG total, double rate)
+	{
+		if (!m_terminal)
+		{
+			return;
+		}
+
+		std::lock_guard lock(m_mutex);
+
+		auto line = std::find_if(m_lines.begin(), m_lines.end(), [&](const Line & line) { return line.phase == phase && line.index == index; });
+
+		if (line == m_lines.end())
+		{
+			// タイトルは端末の 1 行に収まるよう切り詰めて、最初の 1 回だけ写す
+			line = m_lines.insert(m_lines.end(), Line{ phase, index, 0, 0, 0, 0, 0, {} });
+			line->titleLength = std::min(title.size(), line->title.size());
+
+			std::copy_n(title.data(), line->titleLength, line->title.data());
+		}
+
+		line->percent = percent;
+		line->bytes = bytes;
+		line->total = total;
+		line->rate = rate;
+
+		if (clock::now() - m_lastFrame < m_interval)
+		{
+			++m_dropped;
+			return;
+		}
+
+		BeginFrame();
+		EndFrame();
+	}
+
+	void ProgressRenderer::Complete(ProgressPhase phase, LONG index, std::wstring_view text)
+	{
+		std::lock_guard lock(m_mutex);
+
+		std::erase_if(m_lines, [&](const Line & line) { return line.phase == phase && line.index == index; });
+
+		PrintLocked(text);
+	}
+
+	void ProgressRenderer::Print(std::wstring_view text)
+	{
+		std::lock_guard lock(m_mutex);
+
+		PrintLocked(text);
+	}
+
+	void ProgressRenderer::PrintLocked(std::wstring_view text)
+	{
+		if (!m_terminal)
+		{
+			m_frame.assign(text);
+			m_frame.push_back(L'\n');
+
+			m_output(m_frame);
+			return;
+		}
+
+		// 書き足す行は間引かない
+		BeginFrame();
+
+		m_frame.append(text);
+		m_frame.push_back(L'\n');
+
+		EndFrame();
+	}
+
+	void ProgressRenderer::Flush()
+	{
+		std::lock_guard lock(m_mutex);
+
+		if (!m_terminal || (m_drawn == 0 && m_lines.empty()))
+		{
+			return;
+		}
+
+		BeginFrame();
+		EndFrame();
+	}
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "core.h"
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <string_view>
+
+namespace waffle
+{
+	enum class ProgressPhase
+	{
+		Download,
+		Install,
+	};
+
+	// 進行中の更新ごとに 1 行の状態を持ち、端末ならその場で描き直す
+	//
+	// 描き直しは interval に 1 回まで。間に来た進捗は値を覚えるだけで、書式にせず (溜めずに) 捨てる。
+	// 行はあらかじめ確保したバッファに書き、1 回の描き直しは output を 1 回呼ぶだけにする。
+	// 端末でなければ、終わった更新の行を書き足すだけにする。
+	//
+	// 状態の行が折り返すと、戻る行数 (ESC[nF) がずれて表示が崩れるので、width (桁数) より 1 桁短く切り詰める。
+
+	class ProgressRenderer
+	{
+	public:
+		using Output = std::function<void(std::wstring_view)>;
+		using clock = std::chrono::steady_clock;
+
+	private:
+		struct Line
+		{
+			ProgressPhase phase;
+			LONG index;
+			LONG percent;
+			ULONGLONG bytes;
+			ULONGLONG total;
+			double rate;
+			size_t titleLength;
+			std::array<wchar_t, 100> title;
+		};
+
+		Output m_output;
+		bool m_terminal;
+		size_t m_width;
+		clock::duration m_interval;
+
+		std::mutex m_mutex;
+		std::vector<Line> m_lines;
+		std::wstring m_frame;
+		std::array<wchar_t, 160> m_text;
+		size_t m_drawn;
+		clock::time_point m_lastFrame;
+
+		unsigned long m_frames;
+		unsigned long m_dropped;
+
+		void BeginFrame();
+		void AppendLine(const Line & line);
+		void EndFrame();
+		void PrintLocked(std::wstring_view text);
+
+	public:
+		// width は端末の桁数 (0 なら切り詰めない)
+		ProgressRenderer(Output output, bool terminal, std::chrono::milliseconds interval = std::chrono::milliseconds(100), size_t width = 0);
+		~ProgressRenderer() = default;
+
+		ProgressRenderer(const ProgressRenderer &) = delete;
+		ProgressRenderer & operator=(const ProgressRenderer &) = delete;
+
+		// 描き直す頃か。まだなら間引いた数に数える
+		//
+		// 値を読むのに手間のかかる (WUA の進捗のように、プロセスをまたぐ) 呼び出し元は、これが true のときだけ値を読んで Update() を呼ぶ。
+		// その場合、Flush() で描くのは最後に描いたときの値になる。
+		bool Due();
+
+		// rate はバイト/秒 (0 なら表示しない)
+		void Update(ProgressPhase phase, LONG index, std::wstring_view title, LONG percent, ULONGLONG bytes, ULONGLONG total, double rate);
+
+		// 更新が終わったとき。text を状態の行の上に書き足し、その更新の行を消す
+		void Complete(ProgressPhase phase, LONG index, std::wstring_view text);
+
+		// 状態の行の上に text を書き足す (状態の行と混ざらないよう、進行中はほかの出力もここを通す)
+		void Print(std::wstring_view text);
+
+		// 間引いた最後の状態を描く
+		void Flush();
+
+		// 端末の大きさが変わったとき
+		void SetWidth(size_t width);
+
+		unsigned long Frames() const noexcept
+		{
+			return m_frames;
+		}
+
+		unsigned long Dropped() const noexcept
+		{
+			return m_dropped;
+		}
+	};
+}
@@ -0,0 +1,307 @@
+#include "replay.h"
+
+#include <map>
+#include <thread>
+#include <string>
+#include <system_error>
+
+namespace waffle
+{
+	ReplayBackend::ReplayBackend(const TraceReplay & replay, double speed) : m_speed(speed)
+	{
+		auto & records = replay.Records();
+
+		std::vector<UpdateSnapshot::Row> rows;
+
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			auto & record = records[i];
+
+			switch (record.event)
+			{
+			case TraceEvent::SearchEnd:
+				m_searches.push_back(record.code == orcSucceeded ? S_OK : (FAILED(record.hresult) ? record.hresult : E_FAIL));
+				break;
+
+			case TraceEvent::Update:
+				// 検索をやり直すと同じ番号でもう一度記録される
+				if (record.index >= (LONG) rows.size())
+				{
+					rows.resize(record.index + 1);
+				}
+
+				rows[record.index] = UpdateSnapshot::Row{ L"Update " + std::to_wstring(record.index), std::to_wstring(record.index), 1, record.bytes, record.total, (UpdateSeverity) record.code, record.percent, record.extra, false, {}, {} };
+				break;
+
+			case TraceEvent::DownloadBegin:
+			case TraceEvent::InstallBegin:
+			{
+				auto end = i + 1;
+				auto last = record.event == TraceEvent::DownloadBegin ? TraceEvent::DownloadEnd : TraceEvent::InstallEnd;
+
+				while (end < records.size() && records[end].event != last)
+				{
+					++end;
+				}
+
+				AddAttempts(record.event == TraceEvent::DownloadBegin ? m_downloads : m_installs, records, i, end);
+
+				i = end;
+				break;
+			}
+
+			default:
+				break;
+			}
+		}
+
+		m_snapshot = UpdateSnapshot(std::move(rows));
+		m_downloaded.resize(m_snapshot.size());
+		m_installed.resize(m_snapshot.size());
+	}
+
+	void ReplayBackend::AddAttempts(std::deque<Attempt> & attempts, const std::vector<TraceRecord> & records, size_t begin, size_t end)
+	{
+		// 書きかけの記録で End がなければ、終わらなかったものとして扱う
+		auto aborted = end == records.size() || records[end].code == orcAborted;
+
+		std::map<LONG, Attempt> positions;
+		std::map<LONG, bool> finished;
+
+		auto time = records[begin].elapsed;
+
+		for (auto i = begin + 1; i < end; ++i)
+		{
+			auto & record = records[i];
+			auto delay = std::chrono::microseconds(record.elapsed - std::min(record.elapsed, time));
+			auto & attempt = positions.try_emplace(record.index, Attempt{ {}, std::chrono::microseconds(0), orcSucceeded, S_OK }).first->second;
+
+			time = record.elapsed;
+
+			if (record.code == orcInProgress)
+			{
+				attempt.steps.push_back({ delay, 0 });
+				continue;
+			}
+
+			attempt.finish = delay;
+			attempt.code = (OperationResultCode) record.code;
+			attempt.hresult = record.hresult;
+			finished[record.index] = true;
+		}
+
+		for (auto & [position, attempt] : positions)
+		{
+			// 途中経過は記録の数で均等に進める (記録のバイト数はジョブ全体のもの)
+			for (size_t step = 0; step < attempt.steps.size(); ++step)
+			{
+				attempt.steps[step].percent = (LONG) ((step + 1) * 100 / (attempt.steps.size() + 1));
+			}
+
+			if (!finished[position])
+			{
+				attempt.code = aborted ? orcAborted : orcSucceeded;
+			}
+
+			attempts.push_back(std::move(attempt));
+		}
+	}
+
+	void ReplayBackend::Wait(std::chrono::microseconds delay) const
+	{
+		if (m_speed > 0)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(delay.count() / m_speed));
+		}
+	}
+
+	ReplayBackend::Attempt ReplayBackend::NextAttempt(std::deque<Attempt> & attempts)
+	{
+		std::lock_guard lock(m_mutex);
+
+		if (attempts.empty())
+		{
+			return Attempt{ {}, std::chrono::microseconds(0), orcSucceeded, S_OK };
+		}
+
+		auto attempt = std::move(attempts.front());
+
+		attempts.pop_front();
+
+		return attempt;
+	}
+
+	LONG ReplayBackend::Search(const std::wstring &, unsigned long)
+	{
+		LONG hr = S_OK;
+
+		{
+			std::lock_guard lock(m_mutex);
+
+			if (!m_searches.empty())
+			{
+				hr = m_searches.front();
+				m_searches.pop_front();
+			}
+		}
+
+		if (FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category());
+		}
+
+		return m_snapshot.size();
+	}
+
+	JobResult ReplayBackend::Download(const std::vector<LONG> & indexes, const DownloadProgressCallback & progress, const DownloadPoll & poll)
+	{
+		ULONGLONG total = 0;
+
+		for (auto index : indexes)
+		{
+			total += m_snapshot.MaxDownloadSize(index);
+		}
+
+		JobResult result{ orcSucceeded, S_OK, {}, false };
+		ULONGLONG bytes = 0;
+
+		for (LONG position = 0; position < (LONG) indexes.size(); ++position)
+		{
+			auto index = indexes[position];
+			auto size = m_snapshot.MaxDownloadSize(index);
+			auto percent = (LONG) (position * 100 / indexes.size());
+
+			// WUA と同じく、ダウンロード済みの更新は通知せずに済ませる
+			if (IsDownloaded(index))
+			{
+				result.updates.push_back({ orcSucceeded, S_OK });
+				continue;
+			}
+
+			auto attempt = NextAttempt(m_downloads);
+			auto current = bytes;
+			auto aborted = false;
+
+			for (auto & step : attempt.steps)
+			{
+				Wait(step.delay);
+
+				current = bytes + size * step.percent / 100;
+
+				progress(position, orcInProgress, DownloadProgressValues(S_OK, percent, step.percent, total, current));
+
+				if (aborted = poll(total, current); aborted)
+				{
+					break;
+				}
+			}
+
+			// 止まっている間はバイト数が増えない
+			if (!aborted && attempt.code == orcAborted)
+			{
+				while (!poll(total, current))
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+
+				aborted = true;
+			}
+
+			// 中止されたら残りは orcAborted。使いかけの試行は使い切ったことにする
+			if (aborted)
+			{
+				result.code = orcAborted;
+				result.updates.resize(indexes.size(), UpdateResult{ orcAborted, S_OK });
+
+				return result;
+			}
+
+			Wait(attempt.finish);
+
+			if (attempt.code != orcSucceeded)
+			{
+				auto hr = FAILED(attempt.hresult) ? attempt.hresult : E_FAIL;
+
+				result.code = orcSucceededWithErrors;
+				result.updates.push_back({ orcFailed, hr });
+
+				progress(position, orcFailed, DownloadProgressValues(hr, percent, 100, total, bytes));
+				continue;
+			}
+
+			{
+				std::lock_guard lock(m_mutex);
+
+				m_downloaded[index] = true;
+			}
+
+			bytes += size;
+			result.updates.push_back({ orcSucceeded, S_OK });
+
+			progress(position, orcSucceeded, DownloadProgressValues(S_OK, percent, 100, total, bytes));
+		}
+
+		return result;
+	}
+
+	JobResult ReplayBackend::Install(const std::vector<LONG> & indexes, const InstallationProgressCallback & progress)
+	{
+		JobResult result{ orcSucceeded, S_OK, {}, false };
+
+		for (LONG position = 0; position < (LONG) indexes.size(); ++position)
+		{
+			auto index = indexes[position];
+			auto percent = (LONG) (position * 100 / indexes.size());
+
+			// ダウンロードしていない更新はインストールできない
+			auto attempt = IsDownloaded(index) ? NextAttempt(m_installs) : Attempt{ {}, std::chrono::microseconds(0), orcFailed, WU_E_UPDATE_NOT_PROCESSED };
+
+			for (auto & step : attempt.steps)
+			{
+				Wait(step.delay);
+
+				progress(position, orcInProgress, InstallationProgressValues(S_OK, percent, step.percent));
+			}
+
+			Wait(attempt.finish);
+
+			if (attempt.code != orcSucceeded)
+			{
+				auto hr = FAILED(attempt.hresult) ? attempt.hresult : E_FAIL;
+
+				result.code = orcSucceededWithErrors;
+				result.updates.push_back({ orcFailed, hr });
+
+				progress(position, orcFailed, InstallationProgressValues(hr, percent, 100));
+				continue;
+			}
+
+			{
+				std::lock_guard lock(m_mutex);
+
+				m_installed[index] = true;
+			}
+
+			result.rebootRequired = result.rebootRequired || m_snapshot.RebootBehavior(index) != irbNeverReboots;
+			result.updates.push_back({ orcSucceeded, S_OK });
+
+			progress(position, orcSucceeded, InstallationProgressValues(S_OK, percent, 100));
+		}
+
+		return result;
+	}
+
+	bool ReplayBackend::IsDownloaded(LONG update)
+	{
+		std::lock_guard lock(m_mutex);
+
+		return m_downloaded[update];
+	}
+
+	bool ReplayBackend::IsInstalled(LONG update)
+	{
+		std::lock_guard lock(m_mutex);
+
+		return m_installed[update];
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "backend.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <vector>
+
+namespace waffle
+{
+	// 記録した (または合成した) やり取りを、WUA の代わりに再生する Backend
+	//
+	// 記録は更新ごとの試行に分けて、記録した順に並べておく。ジョブに渡された更新は、先頭から順に次の試行を使う
+	// (記録のジョブの中の位置と Backend の番号は対応しないので、どの更新の試行かは問わない)。試行が尽きたら成功する。
+	// 失敗した試行はそのまま失敗を返すので、やり直しや止まったジョブの扱い、計画は Orchestrator と同じ道を通る。
+	//
+	// 中止されたジョブ (DownloadEnd が orcAborted) で結果のない更新は、止まったまま中止されるまで poll を呼び続ける。
+	// 止まったジョブを中止させるには Orchestrator::SetStallTimeout() を使う。
+
+	class ReplayBackend : public Backend
+	{
+		struct Step
+		{
+			std::chrono::microseconds delay;
+			LONG percent; // 今の更新の進み具合
+		};
+
+		struct Attempt
+		{
+			std::vector<Step> steps;
+			std::chrono::microseconds finish; // 最後の途中経過から結果まで
+			OperationResultCode code; // 結果がないまま中止された試行は orcAborted
+			LONG hresult;
+		};
+
+		double m_speed;
+
+		UpdateSnapshot m_snapshot;
+
+		std::deque<LONG> m_searches;
+		std::deque<Attempt> m_downloads;
+		std::deque<Attempt> m_installs;
+
+		std::vector<bool> m_downloaded;
+		std::vector<bool> m_installed;
+
+		std::mutex m_mutex;
+
+		// Begin から End までのレコードを、更新ごとの試行に分けて attempts に足す
+		static void AddAttempts(std::deque<Attempt> & attempts, const std::vector<TraceRecord> & records, size_t begin, size_t end);
+
+		void Wait(std::chrono::microseconds delay) const;
+
+		Attempt NextAttempt(std::deque<Attempt> & attempts);
+
+	public:
+		// speed 倍に縮めて再生する (0 なら待たない)
+		ReplayBackend(const TraceReplay & replay, double speed);
+		~ReplayBackend() = default;
+
+		ReplayBackend(const ReplayBackend &) = delete;
+		ReplayBackend & operator=(const ReplayBackend &) = delete;
+
+		// Update のレコードから作ったスナップショット (計画はこれから立てる)
+		const UpdateSnapshot & Snapshot() const noexcept
+		{
+			return m_snapshot;
+		}
+
+		LONG Search(const std::wstring & criteria, unsigned long timeout) override;
+
+		JobResult Download(const std::vector<LONG> & updates, const DownloadProgressCallback & progress, const DownloadPoll & poll) override;
+		JobResult Install(const std::vector<LONG> & updates, const InstallationProgressCallback & progress) override;
+
+		bool IsDownloaded(LONG update) override;
+		bool IsInstalled(LONG update) override;
+	};
+}
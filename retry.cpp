@@ -0,0 +1,26 @@
+#include "retry.h"
+
+namespace waffle
+{
+	RetryPolicy::RetryPolicy(unsigned long attempts, std::chrono::milliseconds baseDelay, std::chrono::milliseconds maxDelay) : m_attempts(attempts), m_baseDelay(baseDelay), m_maxDelay(maxDelay), m_random(std::random_device{}())
+	{}
+
+	std::chrono::milliseconds RetryPolicy::Delay(unsigned long attempt)
+	{
+		auto ceiling = m_baseDelay.count();
+
+		for (unsigned long i = 0; i < attempt && ceiling < m_maxDelay.count(); ++i)
+		{
+			ceiling *= 2;
+		}
+
+		if (ceiling > m_maxDelay.count())
+		{
+			ceiling = m_maxDelay.count();
+		}
+
+		std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter(0, ceiling);
+
+		return std::chrono::milliseconds(jitter(m_random));
+	}
+}
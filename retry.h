@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+
+namespace waffle
+{
+	// 一時的なエラーでやり直すまでの待ち時間を、ジッター付きの指数バックオフで決める
+	//
+	// attempt 回目の待ち時間は [0, min(maxDelay, baseDelay * 2^attempt)] から一様に選ぶ (full jitter)。
+	// 多数の端末が同じサーバーの障害で一斉に失敗しても、やり直しの時刻がばらける。
+
+	class RetryPolicy
+	{
+		unsigned long m_attempts;
+
+		std::chrono::milliseconds m_baseDelay;
+		std::chrono::milliseconds m_maxDelay;
+
+		std::mt19937_64 m_random;
+
+	public:
+		RetryPolicy(unsigned long attempts = 0, std::chrono::milliseconds baseDelay = std::chrono::seconds(2), std::chrono::milliseconds maxDelay = std::chrono::seconds(60));
+		~RetryPolicy() = default;
+
+		unsigned long Attempts() const noexcept
+		{
+			return m_attempts;
+		}
+
+		std::chrono::milliseconds Delay(unsigned long attempt);
+	};
+}
@@ -0,0 +1,207 @@
+#include "scanpackage.h"
+
+namespace waffle
+{
+	ScanPackage::ScanPackage(const std::wstring & path, std::wstring statePath) : m_statePath(std::move(statePath)), m_reused(false)
+	{
+		// AddScanPackageService には絶対パスを渡す
+
+		wchar_t fullPath[MAX_PATH]{};
+
+		if (auto length = ::GetFullPathNameW(path.c_str(), MAX_PATH, fullPath, nullptr); length == 0 || length > MAX_PATH)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		m_path = fullPath;
+
+		FileHandle file(::CreateFileW(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+
+		if (!file)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		LARGE_INTEGER size{};
+
+		if (!::GetFileSizeEx(file, &size))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		FILETIME lastWriteTime{};
+
+		if (!::GetFileTime(file, nullptr, nullptr, &lastWriteTime))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		ScanPackageState current{};
+
+		current.size = size.QuadPart;
+		current.lastWriteTime = ((ULONGLONG) lastWriteTime.dwHighDateTime << 32) | lastWriteTime.dwLowDateTime;
+
+		auto saved = LoadState();
+
+		com_ptr_t<IUpdateServiceManager> manager;
+
+		if (auto hr = manager.CreateInstance(L"Microsoft.Update.ServiceManager"); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (ReuseScanPackage(saved, current, [&]() { return HashFile(file); }, [&](const WCHAR * serviceID) { return IsServiceRegistered(manager, _bstr_t(serviceID)); }))
+		{
+			m_serviceID = saved->serviceID;
+			m_reused = true;
+		}
+		else
+		{
+			if (saved && saved->serviceID[0] != L'\0')
+			{
+				manager->RemoveService(_bstr_t(saved->serviceID));
+			}
+
+			com_ptr_t<IUpdateService> service;
+
+			if (auto hr = manager->AddScanPackageService(_bstr_t(L"waffle"), _bstr_t(m_path.c_str()), 0, &service); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (auto hr = service->get_ServiceID(m_serviceID.GetAddress()); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		std::wstring_view((const wchar_t *) m_serviceID).copy(current.serviceID, std::size(current.serviceID) - 1);
+
+		SaveState(current);
+	}
+
+	std::optional<ScanPackageState> ScanPackage::LoadState()
+	{
+		FileHandle file(::CreateFileW(m_statePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+		if (!file)
+		{
+			return std::nullopt;
+		}
+
+		ScanPackageState state{};
+		DWORD read{};
+
+		if (!::ReadFile(file, &state, sizeof(state), &read, nullptr) || read != sizeof(state))
+		{
+			return std::nullopt;
+		}
+
+		state.serviceID[std::size(state.serviceID) - 1] = L'\0';
+
+		return state;
+	}
+
+	void ScanPackage::SaveState(const ScanPackageState & state)
+	{
+		FileHandle file(::CreateFileW(m_statePath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+		if (!file)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		DWORD written{};
+
+		if (!::WriteFile(file, &state, sizeof(state), &written, nullptr))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	std::array<BYTE, 32> HashFile(HANDLE file)
+	{
+		BCRYPT_ALG_HANDLE algorithm{};
+
+		if (auto status = ::BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, nullptr, 0); !BCRYPT_SUCCESS(status))
+		{
+			throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		std::unique_ptr<void, void (*)(void *)> closeAlgorithm(algorithm, [](void * h) { ::BCryptCloseAlgorithmProvider(h, 0); });
+
+		BCRYPT_HASH_HANDLE hash{};
+
+		if (auto status = ::BCryptCreateHash(algorithm, &hash, nullptr, 0, nullptr, 0, 0); !BCRYPT_SUCCESS(status))
+		{
+			throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		std::unique_ptr<void, void (*)(void *)> destroyHash(hash, [](void * h) { ::BCryptDestroyHash(h); });
+
+		std::vector<BYTE> buffer(1024 * 1024);
+
+		for (DWORD read = 0; ::ReadFile(file, buffer.data(), (DWORD) buffer.size(), &read, nullptr); )
+		{
+			if (read == 0)
+			{
+				std::array<BYTE, 32> digest{};
+
+				if (auto status = ::BCryptFinishHash(hash, digest.data(), (ULONG) digest.size(), 0); !BCRYPT_SUCCESS(status))
+				{
+					throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+				}
+
+				return digest;
+			}
+
+			if (auto status = ::BCryptHashData(hash, buffer.data(), read, 0); !BCRYPT_SUCCESS(status))
+			{
+				throw std::system_error(status, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+	}
+
+	bool IsServiceRegistered(IUpdateServiceManager * manager, BSTR serviceID)
+	{
+		com_ptr_t<IUpdateServiceCollection> services;
+
+		if (auto hr = manager->get_Services(&services); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		LONG count = 0;
+
+		if (auto hr = services->get_Count(&count); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		for (LONG index = 0; index < count; ++index)
+		{
+			com_ptr_t<IUpdateService> service;
+
+			if (auto hr = services->get_Item(index, &service); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			_bstr_t id;
+
+			if (auto hr = service->get_ServiceID(id.GetAddress()); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (std::wstring_view((const wchar_t *) id) == serviceID)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
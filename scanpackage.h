@@ -0,0 +1,47 @@
+#pragma once
+#pragma comment(lib, "bcrypt")
+
+#include "waffle.h"
+#include "scanstate.h"
+
+#include <bcrypt.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <optional>
+#include <algorithm>
+
+namespace waffle
+{
+	class ScanPackage
+	{
+		std::wstring m_path;
+		std::wstring m_statePath;
+
+		_bstr_t m_serviceID;
+		bool m_reused;
+
+		std::optional<ScanPackageState> LoadState();
+		void SaveState(const ScanPackageState & state);
+
+	public:
+		ScanPackage(const std::wstring & path, std::wstring statePath);
+		~ScanPackage() = default;
+
+		BSTR ServiceID()
+		{
+			return m_serviceID;
+		}
+
+		bool Reused() const noexcept
+		{
+			return m_reused;
+		}
+	};
+
+	std::array<BYTE, 32> HashFile(HANDLE file);
+
+	bool IsServiceRegistered(IUpdateServiceManager * manager, BSTR serviceID);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "platform.h"
+
+#include <optional>
+#include <algorithm>
+
+namespace waffle
+{
+	// wsusscn2.cab のサイズ、更新日時、ハッシュと、登録したサービスの ID を覚えておく
+
+	struct ScanPackageState
+	{
+		ULONGLONG size;
+		ULONGLONG lastWriteTime;
+		BYTE hash[32];
+		WCHAR serviceID[40];
+	};
+
+	// 前回の状態と今の cab (current のサイズと更新日時) から、登録済みのサービスを使い回せるか決める
+	//
+	// サイズと更新日時が同じならハッシュの計算 (hash()) を省く。ハッシュが同じで registered(serviceID) なら使い回す。
+	// current.hash はどちらの場合も埋める。
+	template<class Hash, class Registered>
+	bool ReuseScanPackage(const std::optional<ScanPackageState> & saved, ScanPackageState & current, Hash hash, Registered registered)
+	{
+		if (saved && saved->size == current.size && saved->lastWriteTime == current.lastWriteTime)
+		{
+			std::copy(std::begin(saved->hash), std::end(saved->hash), current.hash);
+		}
+		else
+		{
+			auto digest = hash();
+			std::copy(digest.begin(), digest.end(), current.hash);
+		}
+
+		return saved && std::equal(std::begin(saved->hash), std::end(saved->hash), current.hash) && registered(saved->serviceID);
+	}
+}
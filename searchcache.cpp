@@ -0,0 +1,181 @@
+#include "searchcache.h"
+
+namespace waffle
+{
+	constexpr DWORD SEARCH_CACHE_MAGIC = 0x43534657; // "WFSC"
+	constexpr DWORD SEARCH_CACHE_VERSION = 1;
+
+	SearchCache::SearchCache(std::wstring path, unsigned long ttl, bool refresh) : m_path(std::move(path)), m_ttl(ttl * 10'000'000ULL), m_refresh(refresh), m_hits(0), m_misses(0)
+	{}
+
+	std::optional<std::vector<SearchCacheRecord>> SearchCache::Lookup(ULONGLONG criteria, LONG historyCount, bool rebootRequired)
+	{
+		if (m_refresh)
+		{
+			return std::nullopt;
+		}
+
+		FileHandle file(::CreateFileW(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+		if (!file)
+		{
+			return std::nullopt;
+		}
+
+		LARGE_INTEGER size{};
+
+		if (!::GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG) sizeof(SearchCacheHeader))
+		{
+			return std::nullopt;
+		}
+
+		FileHandle mapping(::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr));
+
+		if (!mapping)
+		{
+			return std::nullopt;
+		}
+
+		std::unique_ptr<void, decltype(&::UnmapViewOfFile)> view(::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0), &::UnmapViewOfFile);
+
+		if (!view)
+		{
+			return std::nullopt;
+		}
+
+		auto header = static_cast<const SearchCacheHeader *>(view.get());
+
+		if (header->magic != SEARCH_CACHE_MAGIC || header->version != SEARCH_CACHE_VERSION || header->count < 0)
+		{
+			return std::nullopt;
+		}
+
+		if (size.QuadPart < (LONGLONG) (sizeof(SearchCacheHeader) + header->count * sizeof(SearchCacheRecord)))
+		{
+			return std::nullopt;
+		}
+
+		if (header->criteria != criteria || header->historyCount != historyCount || header->rebootRequired != (LONG) rebootRequired)
+		{
+			return std::nullopt;
+		}
+
+		if (auto now = GetSystemTimeAsULONGLONG(); now < header->timestamp || now - header->timestamp > m_ttl)
+		{
+			return std::nullopt;
+		}
+
+		auto records = reinterpret_cast<const SearchCacheRecord *>(header + 1);
+
+		return std::vector<SearchCacheRecord>(records, records + header->count);
+	}
+
+	void SearchCache::Store(ULONGLONG criteria, LONG historyCount, bool rebootRequired, const std::vector<SearchCacheRecord> & records)
+	{
+		auto temporary = m_path + L".tmp";
+
+		{
+			FileHandle file(::CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+			if (!file)
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			SearchCacheHeader header{};
+
+			header.magic = SEARCH_CACHE_MAGIC;
+			header.version = SEARCH_CACHE_VERSION;
+			header.timestamp = GetSystemTimeAsULONGLONG();
+			header.criteria = criteria;
+			header.historyCount = historyCount;
+			header.rebootRequired = rebootRequired;
+			header.count = (LONG) records.size();
+
+			DWORD written{};
+
+			if (!::WriteFile(file, &header, sizeof(header), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (!::WriteFile(file, records.data(), (DWORD) (records.size() * sizeof(SearchCacheRecord)), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		if (!::MoveFileExW(temporary.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	ULONGLONG HashCriteria(BSTR criteria, BSTR serviceID)
+	{
+		// FNV-1a (検索条件と検索先のサービスの両方)
+
+		ULONGLONG hash = 14695981039346656037ULL;
+
+		for (auto p = criteria; p != nullptr && *p != L'\0'; ++p)
+		{
+			hash = (hash ^ (ULONGLONG) *p) * 1099511628211ULL;
+		}
+
+		hash = (hash ^ (ULONGLONG) L'|') * 1099511628211ULL;
+
+		for (auto p = serviceID; p != nullptr && *p != L'\0'; ++p)
+		{
+			hash = (hash ^ (ULONGLONG) *p) * 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	SearchCacheRecord GetSearchCacheRecord(IUpdate * update)
+	{
+		SearchCacheRecord record{};
+
+		auto [updateID, revisionNumber] = GetUpdateIdentity(update);
+
+		record.updateID = ParseUpdateID(updateID);
+		record.revisionNumber = revisionNumber;
+
+		com_ptr_t<IUpdate2> update2;
+
+		if (auto hr = update->QueryInterface(&update2); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		record.rebootRequired = GetRebootRequired(update2);
+
+		std::tie(record.minDownloadSize, record.maxDownloadSize) = GetDownloadSize(update);
+
+		return record;
+	}
+
+	std::wstring FormatSearchCacheCriteria(const std::vector<SearchCacheRecord> & records)
+	{
+		std::wstring criteria;
+
+		for (auto & record : records)
+		{
+			wchar_t guid[40]{};
+
+			if (::StringFromGUID2(record.updateID, guid, 40) == 0)
+			{
+				throw std::runtime_error(MACRO_SOURCE_LOCATION());
+			}
+
+			if (!criteria.empty())
+			{
+				criteria += L" or ";
+			}
+
+			criteria += std::format(L"UpdateID='{}' and RevisionNumber={}", std::wstring_view(guid + 1, 36), record.revisionNumber);
+		}
+
+		return criteria;
+	}
+}
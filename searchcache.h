@@ -0,0 +1,79 @@
+#pragma once
+
+#include "waffle.h"
+
+#include <tuple>
+#include <memory>
+#include <string>
+#include <vector>
+#include <optional>
+
+namespace waffle
+{
+	// ファイルにはヘッダーとレコードの配列をそのまま書き出す (MapViewOfFile で読めるように)
+
+	struct SearchCacheHeader
+	{
+		DWORD magic;
+		DWORD version;
+		ULONGLONG timestamp;
+		ULONGLONG criteria;
+		LONG historyCount;
+		LONG rebootRequired;
+		LONG count;
+		LONG reserved;
+	};
+
+	struct SearchCacheRecord
+	{
+		GUID updateID;
+		LONG revisionNumber;
+		LONG rebootRequired;
+		ULONGLONG minDownloadSize;
+		ULONGLONG maxDownloadSize;
+	};
+
+	class SearchCache
+	{
+		std::wstring m_path;
+		ULONGLONG m_ttl;
+		bool m_refresh;
+
+		unsigned long m_hits;
+		unsigned long m_misses;
+
+	public:
+		SearchCache(std::wstring path, unsigned long ttl, bool refresh);
+		~SearchCache() = default;
+
+		std::optional<std::vector<SearchCacheRecord>> Lookup(ULONGLONG criteria, LONG historyCount, bool rebootRequired);
+
+		void Store(ULONGLONG criteria, LONG historyCount, bool rebootRequired, const std::vector<SearchCacheRecord> & records);
+
+		void Hit()
+		{
+			++m_hits;
+		}
+
+		void Miss()
+		{
+			++m_misses;
+		}
+
+		unsigned long Hits() const noexcept
+		{
+			return m_hits;
+		}
+
+		unsigned long Misses() const noexcept
+		{
+			return m_misses;
+		}
+	};
+
+	ULONGLONG HashCriteria(BSTR criteria, BSTR serviceID);
+
+	SearchCacheRecord GetSearchCacheRecord(IUpdate * update);
+
+	std::wstring FormatSearchCacheCriteria(const std::vector<SearchCacheRecord> & records);
+}
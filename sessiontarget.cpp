@@ -0,0 +1,41 @@
+#include "sessiontarget.h"
+
+namespace waffle
+{
+	SessionTarget::SessionTarget(const std::wstring & host, std::vector<_bstr_t> criteria) : m_name(host.empty() ? L"localhost" : host), m_host(host), m_criteria(std::move(criteria))
+	{}
+
+	void SessionTarget::Connect()
+	{
+		// COM はワーカーのスレッドごとに CreateSession() の中で初期化される
+		m_session.reset(new Session(CreateSession(m_host.empty() ? nullptr : m_host.c_str())));
+	}
+
+	LONG SessionTarget::Search(unsigned long timeout)
+	{
+		m_updates.emplace(m_criteria.size() == 1 ? m_session->Search(m_criteria.front(), timeout) : m_session->Search(m_criteria, timeout));
+
+		return m_updates->size();
+	}
+
+	void SessionTarget::Download()
+	{
+		m_session->Download(*m_updates, [](auto &&...) {});
+	}
+
+	void SessionTarget::Install()
+	{
+		m_session->Install(*m_updates, [](auto &&...) {});
+	}
+
+	bool SessionTarget::RebootRequired()
+	{
+		return m_session->RebootRequired();
+	}
+
+	void SessionTarget::Disconnect()
+	{
+		m_updates.reset();
+		m_session.reset();
+	}
+}
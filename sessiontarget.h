@@ -0,0 +1,42 @@
+#pragma once
+
+#include "waffle.h"
+#include "controller.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <optional>
+
+namespace waffle
+{
+	// waffle::Session で更新する対象 (host が空ならこのコンピューター)
+	//
+	// リモートの Session は同期の Search(), Download(), Install() で進める (タイムアウトと止まったジョブの検出は効かない)。
+	// 検索条件が複数あれば、全部で検索してまとめる。
+	class SessionTarget : public Target
+	{
+		std::wstring m_name;
+		std::wstring m_host;
+		std::vector<_bstr_t> m_criteria;
+
+		std::unique_ptr<Session> m_session;
+		std::optional<Updates> m_updates;
+
+	public:
+		SessionTarget(const std::wstring & host, std::vector<_bstr_t> criteria);
+		~SessionTarget() override = default;
+
+		const std::wstring & Name() const override
+		{
+			return m_name;
+		}
+
+		void Connect() override;
+		LONG Search(unsigned long timeout) override;
+		void Download() override;
+		void Install() override;
+		bool RebootRequired() override;
+		void Disconnect() override;
+	};
+}
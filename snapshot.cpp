@@ -0,0 +1,195 @@
+#include "snapshot.h"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <exception>
+
+namespace waffle
+{
+	UpdateSnapshot::UpdateSnapshot() : m_kbOffsets{ 0 }, m_categoryOffsets{ 0 }
+	{}
+
+	UpdateSnapshot::UpdateSnapshot(std::vector<Row> rows) : UpdateSnapshot()
+	{
+		m_titles.reserve(rows.size());
+		m_updateIDs.reserve(rows.size());
+		m_revisionNumbers.reserve(rows.size());
+		m_minDownloadSizes.reserve(rows.size());
+		m_maxDownloadSizes.reserve(rows.size());
+		m_severities.reserve(rows.size());
+		m_impacts.reserve(rows.size());
+		m_rebootBehaviors.reserve(rows.size());
+		m_downloaded.reserve(rows.size());
+		m_kbOffsets.reserve(rows.size() + 1);
+		m_categoryOffsets.reserve(rows.size() + 1);
+
+		for (auto & row : rows)
+		{
+			m_titles.push_back(std::move(row.title));
+			m_updateIDs.push_back(std::move(row.updateID));
+			m_revisionNumbers.push_back(row.revisionNumber);
+			m_minDownloadSizes.push_back(row.minDownloadSize);
+			m_maxDownloadSizes.push_back(row.maxDownloadSize);
+			m_severities.push_back(row.severity);
+			m_impacts.push_back(row.impact);
+			m_rebootBehaviors.push_back(row.rebootBehavior);
+			m_downloaded.push_back(row.downloaded ? 1 : 0);
+
+			m_kbs.insert(m_kbs.end(), row.kbs.begin(), row.kbs.end());
+			m_kbOffsets.push_back(m_kbs.size());
+
+			for (auto & category : row.categories)
+			{
+				m_categories.push_back(std::move(category));
+			}
+
+			m_categoryOffsets.push_back(m_categories.size());
+		}
+	}
+
+	UpdateSnapshot::Row UpdateSnapshot::GetRow(LONG index) const
+	{
+		auto kbs = Kbs(index);
+		auto categories = Categories(index);
+
+		return Row
+		{
+			m_titles[index],
+			m_updateIDs[index],
+			m_revisionNumbers[index],
+			m_minDownloadSizes[index],
+			m_maxDownloadSizes[index],
+			m_severities[index],
+			m_impacts[index],
+			m_rebootBehaviors[index],
+			m_downloaded[index] != 0,
+			std::vector<LONG>(kbs.begin(), kbs.end()),
+			std::vector<std::wstring>(categories.begin(), categories.end()),
+		};
+	}
+
+	UpdateSnapshot UpdateSnapshot::Select(const std::vector<LONG> & indexes) const
+	{
+		UpdateSnapshot selected;
+
+		for (auto index : indexes)
+		{
+			selected.m_titles.push_back(m_titles[index]);
+			selected.m_updateIDs.push_back(m_updateIDs[index]);
+			selected.m_revisionNumbers.push_back(m_revisionNumbers[index]);
+			selected.m_minDownloadSizes.push_back(m_minDownloadSizes[index]);
+			selected.m_maxDownloadSizes.push_back(m_maxDownloadSizes[index]);
+			selected.m_severities.push_back(m_severities[index]);
+			selected.m_impacts.push_back(m_impacts[index]);
+			selected.m_rebootBehaviors.push_back(m_rebootBehaviors[index]);
+			selected.m_downloaded.push_back(m_downloaded[index]);
+
+			auto kbs = Kbs(index);
+			auto categories = Categories(index);
+
+			selected.m_kbs.insert(selected.m_kbs.end(), kbs.begin(), kbs.end());
+			selected.m_kbOffsets.push_back(selected.m_kbs.size());
+
+			selected.m_categories.insert(selected.m_categories.end(), categories.begin(), categories.end());
+			selected.m_categoryOffsets.push_back(selected.m_categories.size());
+		}
+
+		return selected;
+	}
+
+	std::vector<LONG> UpdateSnapshot::FindKb(LONG kb) const
+	{
+		std::vector<LONG> found;
+
+		for (LONG index = 0; index < size(); ++index)
+		{
+			for (auto offset = m_kbOffsets[index]; offset < m_kbOffsets[index + 1]; ++offset)
+			{
+				if (m_kbs[offset] == kb)
+				{
+					found.push_back(index);
+					break;
+				}
+			}
+		}
+
+		return found;
+	}
+
+	ULONGLONG UpdateSnapshot::PendingDownloadSize() const noexcept
+	{
+		ULONGLONG total = 0;
+
+		for (size_t index = 0; index < m_maxDownloadSizes.size(); ++index)
+		{
+			total += m_downloaded[index] ? 0 : m_maxDownloadSizes[index];
+		}
+
+		return total;
+	}
+
+	void ParallelFor(LONG count, unsigned workers, const std::function<void(LONG)> & body)
+	{
+		workers = std::min<unsigned>(workers, count > 0 ? (unsigned) count : 0);
+
+		if (workers <= 1)
+		{
+			for (LONG index = 0; index < count; ++index)
+			{
+				body(index);
+			}
+
+			return;
+		}
+
+		// 1 件ずつ取りに行くので、時間のかかる更新があっても偏らない
+		std::atomic<LONG> next = 0;
+		std::atomic<bool> failed = false;
+
+		std::mutex mutex;
+		std::exception_ptr error;
+
+		auto run = [&]()
+		{
+			for (LONG index; !failed && (index = next++) < count; )
+			{
+				try
+				{
+					body(index);
+				}
+				catch (...)
+				{
+					std::lock_guard lock(mutex);
+
+					if (!error)
+					{
+						error = std::current_exception();
+					}
+
+					failed = true;
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+
+		for (unsigned worker = 1; worker < workers; ++worker)
+		{
+			threads.emplace_back(run);
+		}
+
+		run();
+
+		for (auto & thread : threads)
+		{
+			thread.join();
+		}
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "platform.h"
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace waffle
+{
+	// MsrcSeverity の重い順 (数値が小さいほど先)
+	enum class UpdateSeverity
+	{
+		Critical,
+		Important,
+		Moderate,
+		Low,
+		Unspecified,
+	};
+
+	// 検索した更新のプロパティを、列ごとの配列 (struct of arrays) にまとめて持つ
+	//
+	// 検索の直後に一度だけ COM から引いておき、あとの絞り込み、並べ替え、表示は C++ のデータだけで済ませる。
+	// KB と分類は更新ごとに数が違うので、全部をつなげた配列と、更新ごとの開始位置で持つ。
+
+	class UpdateSnapshot
+	{
+	public:
+		struct Row
+		{
+			std::wstring title;
+			std::wstring updateID;
+			LONG revisionNumber;
+			ULONGLONG minDownloadSize;
+			ULONGLONG maxDownloadSize;
+			UpdateSeverity severity;
+			LONG impact;
+			LONG rebootBehavior;
+			bool downloaded;
+			std::vector<LONG> kbs;
+			std::vector<std::wstring> categories;
+		};
+
+	private:
+		std::vector<std::wstring> m_titles;
+		std::vector<std::wstring> m_updateIDs;
+		std::vector<LONG> m_revisionNumbers;
+		std::vector<ULONGLONG> m_minDownloadSizes;
+		std::vector<ULONGLONG> m_maxDownloadSizes;
+		std::vector<UpdateSeverity> m_severities;
+		std::vector<LONG> m_impacts;
+		std::vector<LONG> m_rebootBehaviors;
+		std::vector<std::uint8_t> m_downloaded;
+
+		std::vector<LONG> m_kbs;
+		std::vector<size_t> m_kbOffsets;
+
+		std::vector<std::wstring> m_categories;
+		std::vector<size_t> m_categoryOffsets;
+
+	public:
+		UpdateSnapshot();
+		UpdateSnapshot(std::vector<Row> rows);
+		~UpdateSnapshot() = default;
+
+		LONG size() const noexcept
+		{
+			return (LONG) m_titles.size();
+		}
+
+		std::wstring_view Title(LONG index) const
+		{
+			return m_titles[index];
+		}
+
+		std::wstring_view UpdateID(LONG index) const
+		{
+			return m_updateIDs[index];
+		}
+
+		LONG RevisionNumber(LONG index) const
+		{
+			return m_revisionNumbers[index];
+		}
+
+		ULONGLONG MinDownloadSize(LONG index) const
+		{
+			return m_minDownloadSizes[index];
+		}
+
+		ULONGLONG MaxDownloadSize(LONG index) const
+		{
+			return m_maxDownloadSizes[index];
+		}
+
+		UpdateSeverity Severity(LONG index) const
+		{
+			return m_severities[index];
+		}
+
+		LONG Impact(LONG index) const
+		{
+			return m_impacts[index];
+		}
+
+		LONG RebootBehavior(LONG index) const
+		{
+			return m_rebootBehaviors[index];
+		}
+
+		bool Downloaded(LONG index) const
+		{
+			return m_downloaded[index] != 0;
+		}
+
+		std::span<const LONG> Kbs(LONG index) const
+		{
+			return std::span<const LONG>(m_kbs).subspan(m_kbOffsets[index], m_kbOffsets[index + 1] - m_kbOffsets[index]);
+		}
+
+		std::span<const std::wstring> Categories(LONG index) const
+		{
+			return std::span<const std::wstring>(m_categories).subspan(m_categoryOffsets[index], m_categoryOffsets[index + 1] - m_categoryOffsets[index]);
+		}
+
+		// 列の配列そのもの (まとめて走査するとき)
+		std::span<const ULONGLONG> MaxDownloadSizes() const noexcept
+		{
+			return m_maxDownloadSizes;
+		}
+
+		std::span<const UpdateSeverity> Severities() const noexcept
+		{
+			return m_severities;
+		}
+
+		Row GetRow(LONG index) const;
+
+		// indexes の順に選んだ行だけのスナップショット
+		UpdateSnapshot Select(const std::vector<LONG> & indexes) const;
+
+		// KB 番号を含む更新の位置
+		std::vector<LONG> FindKb(LONG kb) const;
+
+		// まだダウンロードしていない更新の MaxDownloadSize の合計
+		ULONGLONG PendingDownloadSize() const noexcept;
+	};
+
+	// [0, count) を workers 本のスレッドで分けて body(index) を呼ぶ。body の例外は最初のものを投げ直す
+	void ParallelFor(LONG count, unsigned workers, const std::function<void(LONG)> & body);
+}
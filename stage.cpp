@@ -0,0 +1,108 @@
+#include "stage.h"
+
+namespace waffle
+{
+	constexpr DWORD STAGE_MAGIC = 0x54534657; // "WFST"
+	constexpr DWORD STAGE_VERSION = 1;
+
+	StagedSet::StagedSet(std::wstring path) : m_path(std::move(path))
+	{}
+
+	std::optional<std::vector<SearchCacheRecord>> StagedSet::Lookup(ULONGLONG criteria, ULONGLONG maxAge) const
+	{
+		FileHandle file(::CreateFileW(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+		if (!file)
+		{
+			return std::nullopt;
+		}
+
+		StageHeader header{};
+		DWORD read{};
+
+		if (!::ReadFile(file, &header, sizeof(header), &read, nullptr) || read != sizeof(header))
+		{
+			return std::nullopt;
+		}
+
+		if (header.magic != STAGE_MAGIC || header.version != STAGE_VERSION || header.count < 0 || header.criteria != criteria)
+		{
+			return std::nullopt;
+		}
+
+		if (auto now = GetSystemTimeAsULONGLONG(); now < header.timestamp || now - header.timestamp > maxAge)
+		{
+			return std::nullopt;
+		}
+
+		std::vector<SearchCacheRecord> records(header.count);
+
+		auto size = (DWORD) (records.size() * sizeof(SearchCacheRecord));
+
+		if (!::ReadFile(file, records.data(), size, &read, nullptr) || read != size)
+		{
+			return std::nullopt;
+		}
+
+		return records;
+	}
+
+	size_t StagedSet::Store(ULONGLONG criteria, const Updates & updates)
+	{
+		std::vector<SearchCacheRecord> records;
+
+		for (LONG index = 0; index < updates.size(); ++index)
+		{
+			if (auto update = updates.Item(index); GetIsDownloaded(update))
+			{
+				records.push_back(GetSearchCacheRecord(update));
+			}
+		}
+
+		auto temporary = m_path + L".tmp";
+
+		{
+			FileHandle file(::CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+
+			if (!file)
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			StageHeader header{};
+
+			header.magic = STAGE_MAGIC;
+			header.version = STAGE_VERSION;
+			header.timestamp = GetSystemTimeAsULONGLONG();
+			header.criteria = criteria;
+			header.count = (LONG) records.size();
+
+			DWORD written{};
+
+			if (!::WriteFile(file, &header, sizeof(header), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (!::WriteFile(file, records.data(), (DWORD) (records.size() * sizeof(SearchCacheRecord)), &written, nullptr))
+			{
+				throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		if (!::MoveFileExW(temporary.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return records.size();
+	}
+
+	void StagedSet::Clear()
+	{
+		if (!::DeleteFileW(m_path.c_str()) && ::GetLastError() != ERROR_FILE_NOT_FOUND)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "waffle.h"
+#include "searchcache.h"
+
+#include <string>
+#include <vector>
+#include <optional>
+
+namespace waffle
+{
+	// ファイルにはヘッダーと、ダウンロードまで済ませた更新の SearchCacheRecord の配列を書き出す
+
+	struct StageHeader
+	{
+		DWORD magic;
+		DWORD version;
+		ULONGLONG timestamp;
+		ULONGLONG criteria;
+		LONG count;
+		LONG reserved;
+	};
+
+	// --stage で検索とダウンロードだけを済ませた更新を記録し、--commit でそれをインストールする
+	//
+	// 記録が無い、検索条件が違う、maxAge より古いときは「古くなった」ものとして使わない。
+
+	class StagedSet
+	{
+		std::wstring m_path;
+
+	public:
+		StagedSet(std::wstring path);
+		~StagedSet() = default;
+
+		std::optional<std::vector<SearchCacheRecord>> Lookup(ULONGLONG criteria, ULONGLONG maxAge) const;
+
+		// ダウンロードが済んだ更新だけを記録し、その数を返す
+		size_t Store(ULONGLONG criteria, const Updates & updates);
+
+		// インストールしたら捨てる
+		void Clear();
+	};
+}
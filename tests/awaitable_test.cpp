@@ -0,0 +1,288 @@
+#include "test.h"
+#include "awaitable.h"
+
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+	// WUA の代わりに、自分のスレッドでジョブを進めて完了を Scheduler::Post() で届ける
+	//
+	// ジョブは FakeAgent と待っているフレームで共有し、中止されたらすぐに完了させる。
+	class FakeAgent
+	{
+	public:
+		struct Job
+		{
+			waffle::Scheduler & scheduler;
+			std::coroutine_handle<> handle;
+			std::atomic<bool> aborted{ false };
+		};
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<Job>> m_jobs;
+		bool m_stopping = false;
+
+		std::thread m_thread;
+
+		void Run()
+		{
+			std::unique_lock lock(m_mutex);
+
+			while (!m_stopping || !m_jobs.empty())
+			{
+				if (m_jobs.empty())
+				{
+					m_changed.wait(lock);
+					continue;
+				}
+
+				// 中止されたジョブは期限を待たずに完了させる
+				auto it = std::find_if(m_jobs.begin(), m_jobs.end(), [](auto & entry) { return entry.second->aborted.load(); });
+
+				if (it == m_jobs.end())
+				{
+					if (it = m_jobs.begin(); std::chrono::steady_clock::now() < it->first)
+					{
+						m_changed.wait_until(lock, it->first);
+						continue;
+					}
+				}
+
+				auto job = it->second;
+
+				m_jobs.erase(it);
+
+				job->scheduler.Post(job->handle);
+			}
+		}
+
+	public:
+		FakeAgent() : m_thread(&FakeAgent::Run, this)
+		{}
+
+		~FakeAgent()
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				m_stopping = true;
+			}
+
+			m_changed.notify_all();
+			m_thread.join();
+		}
+
+		void Begin(std::shared_ptr<Job> job, std::chrono::milliseconds duration)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				m_jobs.emplace(std::chrono::steady_clock::now() + duration, std::move(job));
+			}
+
+			m_changed.notify_all();
+		}
+
+		void Abort(Job & job)
+		{
+			job.aborted = true;
+			m_changed.notify_all();
+		}
+	};
+
+	// AsyncOperation と同じく、タイムアウトと Cancellation で中止できる偽の操作。完了したら true、中止されたら false
+	struct FakeOperation
+	{
+		FakeAgent & agent;
+		waffle::Scheduler & scheduler;
+		std::chrono::milliseconds duration;
+		waffle::Cancellation * cancellation = nullptr;
+
+		std::shared_ptr<FakeAgent::Job> job;
+		std::optional<waffle::Cancellation::Registration> registration;
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			if (cancellation != nullptr && cancellation->Cancelled())
+			{
+				return false;
+			}
+
+			job = std::make_shared<FakeAgent::Job>(scheduler, handle);
+
+			if (cancellation != nullptr)
+			{
+				registration = cancellation->Register([this]() { agent.Abort(*job); });
+			}
+
+			agent.Begin(job, duration);
+
+			return true;
+		}
+
+		bool await_resume()
+		{
+			if (registration)
+			{
+				cancellation->Unregister(*registration);
+			}
+
+			return job != nullptr && !job->aborted;
+		}
+	};
+}
+
+TEST(awaitable, many_jobs_run_concurrently_on_one_thread)
+{
+	const size_t count = 1000;
+
+	FakeAgent agent;
+	waffle::Scheduler scheduler;
+
+	auto thread = std::this_thread::get_id();
+	size_t completed = 0;
+	size_t foreign = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		scheduler.Spawn([](FakeAgent & agent, waffle::Scheduler & scheduler, size_t i, std::thread::id thread, size_t & completed, size_t & foreign) -> waffle::Task<>
+		{
+			// 偽のジョブとタイマーを交互に待つ
+			co_await FakeOperation{ agent, scheduler, std::chrono::milliseconds(20 + i % 30) };
+			co_await scheduler.Delay(std::chrono::milliseconds(i % 10));
+			co_await FakeOperation{ agent, scheduler, 20ms };
+
+			if (std::this_thread::get_id() != thread)
+			{
+				++foreign;
+			}
+
+			++completed;
+		}(agent, scheduler, i, thread, completed, foreign));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	scheduler.Run();
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	EXPECT(completed == count);
+	EXPECT(foreign == 0);
+
+	// 順に待てば 50 秒以上かかる
+	EXPECT(elapsed < 10s);
+}
+
+TEST(awaitable, cancellation_aborts_outstanding_jobs)
+{
+	FakeAgent agent;
+	waffle::Scheduler scheduler;
+	waffle::Cancellation cancellation;
+
+	size_t aborted = 0;
+	size_t completed = 0;
+
+	auto wait = [](FakeAgent & agent, waffle::Scheduler & scheduler, waffle::Cancellation & cancellation, std::chrono::milliseconds duration, size_t & completed, size_t & aborted) -> waffle::Task<>
+	{
+		if (co_await FakeOperation{ agent, scheduler, duration, &cancellation })
+			++completed;
+		else
+			++aborted;
+	};
+
+	for (size_t i = 0; i < 100; ++i)
+	{
+		scheduler.Spawn(wait(agent, scheduler, cancellation, i < 10 ? 1ms : 60s, completed, aborted));
+	}
+
+	// タイムアウトの代わりに、タイマーで残りを中止する
+	scheduler.Spawn([](waffle::Scheduler & scheduler, waffle::Cancellation & cancellation) -> waffle::Task<>
+	{
+		co_await scheduler.Delay(200ms);
+
+		cancellation.Cancel();
+	}(scheduler, cancellation));
+
+	auto start = std::chrono::steady_clock::now();
+
+	scheduler.Run();
+
+	EXPECT(completed == 10);
+	EXPECT(aborted == 90);
+	EXPECT(std::chrono::steady_clock::now() - start < 30s);
+
+	// 中止した後に始める操作は、始めずに中止になる
+	scheduler.Spawn(wait(agent, scheduler, cancellation, 1ms, completed, aborted));
+	scheduler.Run();
+
+	EXPECT(aborted == 91);
+}
+
+TEST(awaitable, run_rethrows_first_failure_after_all_tasks)
+{
+	FakeAgent agent;
+	waffle::Scheduler scheduler;
+
+	size_t completed = 0;
+
+	for (size_t i = 0; i < 10; ++i)
+	{
+		scheduler.Spawn([](FakeAgent & agent, waffle::Scheduler & scheduler, size_t i, size_t & completed) -> waffle::Task<>
+		{
+			co_await FakeOperation{ agent, scheduler, std::chrono::milliseconds(i) };
+
+			if (i == 3)
+			{
+				throw std::runtime_error("failed");
+			}
+
+			++completed;
+		}(agent, scheduler, i, completed));
+	}
+
+	EXPECT_THROWS(scheduler.Run(), std::runtime_error);
+
+	// 失敗したタスクがあっても、ほかのタスクは最後まで進む
+	EXPECT(completed == 9);
+}
+
+TEST(awaitable, task_returns_value_to_awaiting_task)
+{
+	FakeAgent agent;
+	waffle::Scheduler scheduler;
+
+	std::vector<int> values;
+
+	auto produce = [](FakeAgent & agent, waffle::Scheduler & scheduler, int value) -> waffle::Task<int>
+	{
+		co_await FakeOperation{ agent, scheduler, std::chrono::milliseconds(10 - value) };
+		co_return value * value;
+	};
+
+	scheduler.Spawn([](FakeAgent & agent, waffle::Scheduler & scheduler, auto produce, std::vector<int> & values) -> waffle::Task<>
+	{
+		for (int i = 0; i < 5; ++i)
+		{
+			values.push_back(co_await produce(agent, scheduler, i));
+		}
+	}(agent, scheduler, produce, values));
+
+	scheduler.Run();
+
+	EXPECT((values == std::vector<int>{ 0, 1, 4, 9, 16 }));
+}
@@ -0,0 +1,186 @@
+#include "test.h"
+#include "fakebackend.h"
+#include "controller.h"
+
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+using waffle::test::FakeBackend;
+
+namespace
+{
+	// 偽の WUA で更新する対象。同時に接続している数の最大を数える
+	class SimulatedTarget : public waffle::BackendTarget
+	{
+		std::atomic<size_t> & m_active;
+		std::atomic<size_t> & m_peak;
+
+	public:
+		bool connected = false;
+
+		SimulatedTarget(std::wstring name, std::function<std::unique_ptr<waffle::Backend>()> connect, std::atomic<size_t> & active, std::atomic<size_t> & peak) : BackendTarget(std::move(name), L"IsInstalled=0", std::move(connect)), m_active(active), m_peak(peak)
+		{}
+
+		void Connect() override
+		{
+			connected = true;
+
+			auto active = ++m_active;
+
+			for (auto peak = m_peak.load(); active > peak && !m_peak.compare_exchange_weak(peak, active); )
+			{}
+
+			BackendTarget::Connect();
+		}
+
+		void Disconnect() override
+		{
+			BackendTarget::Disconnect();
+
+			--m_active;
+		}
+	};
+
+	struct Fleet
+	{
+		std::atomic<size_t> active = 0;
+		std::atomic<size_t> peak = 0;
+
+		std::vector<std::unique_ptr<waffle::Target>> targets;
+
+		// failing の対象は検索が恒久的なエラーで失敗する
+		Fleet(size_t count, LONG updates, std::vector<size_t> failing = {})
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				bool fails = std::find(failing.begin(), failing.end(), i) != failing.end();
+
+				targets.push_back(std::make_unique<SimulatedTarget>(L"host" + std::to_wstring(i), [updates, fails]()
+				{
+					auto backend = std::make_unique<FakeBackend>(updates);
+
+					backend->latency = std::chrono::milliseconds(2);
+
+					if (fails)
+					{
+						backend->searchFailures = { WU_E_INVALID_CRITERIA };
+					}
+
+					return backend;
+				}, active, peak));
+			}
+		}
+
+		SimulatedTarget & operator[](size_t index)
+		{
+			return static_cast<SimulatedTarget &>(*targets[index]);
+		}
+	};
+}
+
+TEST(controller, waves_run_in_bounded_worker_pool)
+{
+	Fleet fleet(25, 3);
+
+	waffle::Controller controller(3, { 1, 4, 10 }, 0.1, INFINITE);
+
+	std::vector<waffle::WaveResult> waves;
+	std::vector<waffle::TargetResult> results;
+	std::mutex mutex;
+
+	auto completed = controller.Run(fleet.targets, [&](const waffle::TargetResult & result)
+	{
+		std::lock_guard lock(mutex);
+
+		results.push_back(result);
+	},
+	[&](const waffle::WaveResult & wave)
+	{
+		waves.push_back(wave);
+	});
+
+	EXPECT(completed);
+
+	// 最後のウェーブの大きさを残りに繰り返す
+	EXPECT(waves.size() == 4);
+	EXPECT(waves[0].targets == 1 && waves[1].targets == 4 && waves[2].targets == 10 && waves[3].targets == 10);
+
+	for (auto & wave : waves)
+	{
+		EXPECT(wave.succeeded == wave.targets && wave.failed == 0 && wave.skipped == 0);
+	}
+
+	EXPECT(results.size() == 25);
+
+	for (auto & result : results)
+	{
+		EXPECT(result.succeeded && result.updates == 3);
+	}
+
+	EXPECT(fleet.peak <= 3);
+	EXPECT(fleet.active == 0);
+}
+
+TEST(controller, breaker_stops_rollout_over_failure_rate)
+{
+	// 2 番目のウェーブ (2 から 5) で 3 台が失敗する
+	Fleet fleet(10, 2, { 2, 3, 4 });
+
+	waffle::Controller controller(1, { 2, 4 }, 0.25, INFINITE);
+
+	std::vector<waffle::WaveResult> waves;
+
+	auto completed = controller.Run(fleet.targets, nullptr, [&](const waffle::WaveResult & wave)
+	{
+		waves.push_back(wave);
+	});
+
+	EXPECT(!completed);
+	EXPECT(waves.size() == 2);
+
+	// 4 台のうち 1 台までは失敗してよい。2 台目で開いて、残りには手を付けない
+	EXPECT(waves[1].succeeded == 0 && waves[1].failed == 2 && waves[1].skipped == 2);
+	EXPECT(!fleet[4].connected && !fleet[5].connected);
+
+	for (size_t i = 6; i < 10; ++i)
+	{
+		EXPECT(!fleet[i].connected);
+	}
+}
+
+TEST(controller, simulated_target_retries_transient_errors)
+{
+	FakeBackend * last = nullptr;
+
+	waffle::BackendTarget target(L"host", L"IsInstalled=0", [&]()
+	{
+		auto backend = std::make_unique<FakeBackend>(2);
+
+		backend->searchFailures = { WU_E_NO_CONNECTION };
+		backend->updates[1].downloadFailures = { WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL };
+		backend->updates[1].rebootRequired = true;
+
+		last = backend.get();
+
+		return backend;
+	});
+
+	target.GetOrchestrator().SetRetryPolicy(waffle::RetryPolicy(2, std::chrono::milliseconds(0), std::chrono::milliseconds(0)));
+
+	target.Connect();
+
+	EXPECT(target.Search(INFINITE) == 2);
+
+	target.Download();
+	target.Install();
+
+	EXPECT(last->IsInstalled(0) && last->IsInstalled(1));
+	EXPECT(target.RebootRequired());
+	EXPECT(target.GetOrchestrator().Retries() == 2);
+
+	target.Disconnect();
+}
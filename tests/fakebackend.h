@@ -0,0 +1,246 @@
+#pragma once
+
+#include "backend.h"
+#include "wuaerrors.h"
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <system_error>
+
+namespace waffle::test
+{
+	// 偽の WUA
+	//
+	// 更新ごとに、ダウンロードとインストールで失敗させる HRESULT を試行の順に並べておける (尽きたら成功する)。
+	// stalls 回のダウンロードのジョブは、stallAt 番目 (ジョブの中の位置) で止まったまま中止されるまで poll を呼び続ける。
+
+	class FakeBackend : public Backend
+	{
+	public:
+		struct Update
+		{
+			ULONGLONG bytes = 1 << 20;
+			std::vector<LONG> downloadFailures;
+			std::vector<LONG> installFailures;
+			bool rebootRequired = false;
+			bool downloaded = false;
+			bool installed = false;
+		};
+
+		std::vector<Update> updates;
+
+		// Search() の試行ごとの失敗 (尽きたら updates.size() を返す)
+		std::vector<LONG> searchFailures;
+
+		unsigned long stalls = 0;
+		LONG stallAt = 0;
+
+		// 止まったジョブが poll を呼ぶ間隔
+		std::chrono::milliseconds interval{ 1 };
+
+		// 1 件のダウンロードやインストールにかかる時間
+		std::chrono::milliseconds latency{ 0 };
+
+		// 呼ばれたジョブ (渡された更新の番号)
+		std::vector<std::vector<LONG>> downloadJobs;
+		std::vector<std::vector<LONG>> installJobs;
+		unsigned long searches = 0;
+
+		explicit FakeBackend(LONG count) : updates(count)
+		{}
+
+		LONG Search(const std::wstring &, unsigned long) override
+		{
+			std::lock_guard lock(m_mutex);
+
+			++searches;
+
+			if (auto hr = Next(searchFailures); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category());
+			}
+
+			return (LONG) updates.size();
+		}
+
+		JobResult Download(const std::vector<LONG> & indexes, const DownloadProgressCallback & progress, const DownloadPoll & poll) override
+		{
+			bool stall = false;
+			ULONGLONG total = 0;
+
+			{
+				std::lock_guard lock(m_mutex);
+
+				downloadJobs.push_back(indexes);
+
+				if (stalls > 0)
+				{
+					--stalls;
+					stall = true;
+				}
+
+				for (auto index : indexes)
+				{
+					total += updates[index].bytes;
+				}
+			}
+
+			JobResult result{ orcSucceeded, S_OK, {}, false };
+			ULONGLONG bytes = 0;
+
+			for (LONG position = 0; position < (LONG) indexes.size(); ++position)
+			{
+				auto & update = updates[indexes[position]];
+				auto percent = (LONG) (position * 100 / indexes.size());
+
+				// WUA と同じく、ダウンロード済みの更新は通知せずに済ませる
+				if (IsDownloaded(indexes[position]))
+				{
+					result.updates.push_back({ orcSucceeded, S_OK });
+					continue;
+				}
+
+				progress(position, orcInProgress, DownloadProgressValues(S_OK, percent, 50, total, bytes + update.bytes / 2));
+
+				std::this_thread::sleep_for(latency);
+
+				// 止まっている間はバイト数が増えない。中止されたら残りは orcAborted
+				if (stall && position == stallAt)
+				{
+					while (!poll(total, bytes))
+					{
+						std::this_thread::sleep_for(interval);
+					}
+				}
+
+				if ((stall && position == stallAt) || poll(total, bytes + update.bytes / 2))
+				{
+					result.code = orcAborted;
+					result.updates.resize(indexes.size(), UpdateResult{ orcAborted, S_OK });
+
+					return result;
+				}
+
+				LONG hr = S_OK;
+
+				{
+					std::lock_guard lock(m_mutex);
+
+					if (hr = Next(update.downloadFailures); SUCCEEDED(hr))
+					{
+						update.downloaded = true;
+					}
+				}
+
+				if (FAILED(hr))
+				{
+					result.code = orcSucceededWithErrors;
+					result.updates.push_back({ orcFailed, hr });
+
+					progress(position, orcFailed, DownloadProgressValues(hr, percent, 100, total, bytes));
+					continue;
+				}
+
+				bytes += update.bytes;
+				result.updates.push_back({ orcSucceeded, S_OK });
+
+				progress(position, orcSucceeded, DownloadProgressValues(S_OK, percent, 100, total, bytes));
+			}
+
+			// stallAt が更新の数なら、全部ダウンロードし終えてから止まる
+			if (stall && stallAt == (LONG) indexes.size())
+			{
+				while (!poll(total, bytes))
+				{
+					std::this_thread::sleep_for(interval);
+				}
+
+				result.code = orcAborted;
+			}
+
+			return result;
+		}
+
+		JobResult Install(const std::vector<LONG> & indexes, const InstallationProgressCallback & progress) override
+		{
+			{
+				std::lock_guard lock(m_mutex);
+
+				installJobs.push_back(indexes);
+			}
+
+			JobResult result{ orcSucceeded, S_OK, {}, false };
+
+			for (LONG position = 0; position < (LONG) indexes.size(); ++position)
+			{
+				auto & update = updates[indexes[position]];
+				auto percent = (LONG) (position * 100 / indexes.size());
+
+				progress(position, orcInProgress, InstallationProgressValues(S_OK, percent, 50));
+
+				std::this_thread::sleep_for(latency);
+
+				LONG hr = S_OK;
+
+				{
+					std::lock_guard lock(m_mutex);
+
+					// ダウンロードしていない更新はインストールできない
+					if (hr = update.downloaded ? Next(update.installFailures) : WU_E_UPDATE_NOT_PROCESSED; SUCCEEDED(hr))
+					{
+						update.installed = true;
+					}
+				}
+
+				if (FAILED(hr))
+				{
+					result.code = orcSucceededWithErrors;
+					result.updates.push_back({ orcFailed, hr });
+
+					progress(position, orcFailed, InstallationProgressValues(hr, percent, 100));
+					continue;
+				}
+
+				result.rebootRequired = result.rebootRequired || update.rebootRequired;
+				result.updates.push_back({ orcSucceeded, S_OK });
+
+				progress(position, orcSucceeded, InstallationProgressValues(S_OK, percent, 100));
+			}
+
+			return result;
+		}
+
+		bool IsDownloaded(LONG update) override
+		{
+			std::lock_guard lock(m_mutex);
+
+			return updates[update].downloaded;
+		}
+
+		bool IsInstalled(LONG update) override
+		{
+			std::lock_guard lock(m_mutex);
+
+			return updates[update].installed;
+		}
+
+	private:
+		std::mutex m_mutex;
+
+		static LONG Next(std::vector<LONG> & failures)
+		{
+			if (failures.empty())
+			{
+				return S_OK;
+			}
+
+			auto hr = failures.front();
+
+			failures.erase(failures.begin());
+
+			return hr;
+		}
+	};
+}
@@ -0,0 +1,165 @@
+#include "test.h"
+#include "filter.h"
+
+#include <string>
+#include <stdexcept>
+
+using waffle::UpdateFilter;
+using waffle::UpdateSeverity;
+
+namespace
+{
+	constexpr auto ID = L"01234567-89ab-cdef-0123-456789abcdef";
+
+	waffle::UpdateSnapshot::Row Row(std::wstring title, UpdateSeverity severity, ULONGLONG size, std::vector<LONG> kbs = {}, std::vector<std::wstring> categories = {})
+	{
+		return { std::move(title), ID, 1, size, size, severity, 0, 0, false, std::move(kbs), std::move(categories) };
+	}
+
+	// 右に n 段入れ子にした or (評価のスタックは n 段になる)
+	std::wstring Nested(size_t n)
+	{
+		std::wstring text;
+
+		for (size_t i = 1; i < n; ++i)
+		{
+			text += L"size < " + std::to_wstring(i) + L" or (";
+		}
+
+		return text + L"size < " + std::to_wstring(n) + std::wstring(n - 1, L')');
+	}
+}
+
+TEST(filter, and_binds_tighter_than_or)
+{
+	UpdateFilter filter(L"severity = critical or severity = important and size < 1M");
+
+	EXPECT(filter(Row(L"A", UpdateSeverity::Critical, 2 << 20)));
+	EXPECT(filter(Row(L"B", UpdateSeverity::Important, 1 << 19)));
+	EXPECT(!filter(Row(L"C", UpdateSeverity::Important, 2 << 20)));
+	EXPECT(filter.Residual() == L"severity = critical or severity = important and size < 1M");
+}
+
+TEST(filter, parentheses_override_precedence)
+{
+	UpdateFilter filter(L"(severity = critical or severity = important) and size < 1M");
+
+	EXPECT(!filter(Row(L"A", UpdateSeverity::Critical, 2 << 20)));
+	EXPECT(filter(Row(L"B", UpdateSeverity::Critical, 1 << 19)));
+	EXPECT(filter.Residual() == L"(severity = critical or severity = important) and size < 1M");
+}
+
+TEST(filter, not_negates_a_term_or_a_group)
+{
+	UpdateFilter drivers(L"not category = Drivers");
+
+	EXPECT(!drivers(Row(L"A", UpdateSeverity::Low, 0, {}, { L"drivers" })));
+	EXPECT(drivers(Row(L"B", UpdateSeverity::Low, 0, {}, { L"Security Updates" })));
+
+	UpdateFilter group(L"not (severity >= important or title ~ '*Preview*') and not not kb = 5000001");
+
+	EXPECT(group(Row(L"Update", UpdateSeverity::Low, 0, { 5000001 })));
+	EXPECT(!group(Row(L"Update", UpdateSeverity::Critical, 0, { 5000001 })));
+	EXPECT(!group(Row(L"2024-01 Preview", UpdateSeverity::Low, 0, { 5000001 })));
+	EXPECT(!group(Row(L"Update", UpdateSeverity::Low, 0, { 5000002 })));
+}
+
+TEST(filter, quotes_and_wildcards)
+{
+	UpdateFilter quoted(L"title = 'It''s an update'");
+
+	EXPECT(quoted(Row(L"it's an UPDATE", UpdateSeverity::Low, 0)));
+	EXPECT(quoted.Residual() == L"title = 'It''s an update'");
+
+	UpdateFilter wildcard(L"title ~ '*Preview?of*'");
+
+	EXPECT(wildcard(Row(L"2024-01 Cumulative Preview of .NET", UpdateSeverity::Low, 0)));
+	EXPECT(!wildcard(Row(L"2024-01 Cumulative Update", UpdateSeverity::Low, 0)));
+
+	// 文字列の中の or や括弧は区切りではない
+	UpdateFilter inside(L"title = 'A or (B'");
+
+	EXPECT(inside(Row(L"a OR (b", UpdateSeverity::Low, 0)));
+
+	EXPECT_THROWS(UpdateFilter(L"title = 'unterminated"), std::invalid_argument);
+}
+
+TEST(filter, size_units)
+{
+	EXPECT(UpdateFilter(L"size < 50M")(Row(L"A", UpdateSeverity::Low, (50ULL << 20) - 1)));
+	EXPECT(!UpdateFilter(L"size < 50MB")(Row(L"A", UpdateSeverity::Low, 50ULL << 20)));
+	EXPECT(UpdateFilter(L"size = 1k")(Row(L"A", UpdateSeverity::Low, 1024)));
+	EXPECT(UpdateFilter(L"size >= 2G")(Row(L"A", UpdateSeverity::Low, 2ULL << 30)));
+	EXPECT(UpdateFilter(L"size = 123")(Row(L"A", UpdateSeverity::Low, 123)));
+
+	EXPECT_THROWS(UpdateFilter(L"size < 5X"), std::invalid_argument);
+	EXPECT_THROWS(UpdateFilter(L"size < M"), std::invalid_argument);
+
+	// kb は単位を取らない
+	EXPECT(UpdateFilter(L"kb = KB5000001")(Row(L"A", UpdateSeverity::Low, 0, { 5000001 })));
+	EXPECT_THROWS(UpdateFilter(L"kb = 5K"), std::invalid_argument);
+}
+
+TEST(filter, rejects_invalid_syntax)
+{
+	EXPECT_THROWS(UpdateFilter(L"severity = urgent"), std::invalid_argument);
+	EXPECT_THROWS(UpdateFilter(L"color = red"), std::invalid_argument);
+	EXPECT_THROWS(UpdateFilter(L"size ~ 5M"), std::invalid_argument);
+	EXPECT_THROWS(UpdateFilter(L"(size < 5M"), std::invalid_argument);
+	EXPECT_THROWS(UpdateFilter(L"size < 5M)"), std::invalid_argument);
+	EXPECT_THROWS(UpdateFilter(L"size ! 5M"), std::invalid_argument);
+}
+
+TEST(filter, limits_nesting_depth)
+{
+	EXPECT(UpdateFilter(Nested(64))(Row(L"A", UpdateSeverity::Low, 63)));
+	EXPECT_THROWS(UpdateFilter(Nested(65)), std::invalid_argument);
+
+	// 入れ子が深すぎる式は、再帰で落ちる前に断る
+	EXPECT_THROWS(UpdateFilter(std::wstring(100000, L'(') + L"size < 1" + std::wstring(100000, L')')), std::invalid_argument);
+
+	std::wstring negated;
+
+	for (int i = 0; i < 100000; ++i)
+	{
+		negated += L"not ";
+	}
+
+	EXPECT_THROWS(UpdateFilter(negated + L"size < 1"), std::invalid_argument);
+}
+
+TEST(filter, pushes_ids_down_to_the_search)
+{
+	UpdateFilter filter(L"updateid = {01234567-89AB-CDEF-0123-456789ABCDEF} and category = 0fa1201d-4330-4fa8-8ae9-b877473b6441 and severity >= important");
+
+	EXPECT(filter.Pushed().size() == 2);
+	EXPECT(filter.Pushed()[0] == L"UpdateID='01234567-89AB-CDEF-0123-456789ABCDEF'");
+	EXPECT(filter.Pushed()[1] == L"CategoryIDs contains '0fa1201d-4330-4fa8-8ae9-b877473b6441'");
+	EXPECT(filter.Residual() == L"severity >= important");
+
+	// 分類の ID は手元で評価できないので、一番外側の and の外には書けない
+	EXPECT_THROWS(UpdateFilter(L"category = 0fa1201d-4330-4fa8-8ae9-b877473b6441 or severity = critical"), std::invalid_argument);
+}
+
+TEST(filter, push_down_splits_criteria_on_top_level_or)
+{
+	UpdateFilter filter(L"updateid != 01234567-89ab-cdef-0123-456789abcdef");
+
+	const std::wstring id = L"UpdateID!='01234567-89ab-cdef-0123-456789abcdef'";
+
+	EXPECT(filter.Residual().empty());
+	EXPECT(filter.PushDown(L"") == id);
+	EXPECT(filter.PushDown(L"IsInstalled=0") == L"IsInstalled=0 and " + id);
+
+	// or の前後に空白が無くても分ける
+	EXPECT(filter.PushDown(L"IsInstalled=0 or(IsHidden=1)") == L"(IsInstalled=0 and " + id + L") or (IsHidden=1 and " + id + L")");
+	EXPECT(filter.PushDown(L"Type='Driver'or IsHidden=1") == L"(Type='Driver' and " + id + L") or (IsHidden=1 and " + id + L")");
+
+	// 全体を囲む括弧は外して、中の or で分ける。囲んでいない括弧は外さない
+	EXPECT(filter.PushDown(L"(IsInstalled=0 or IsHidden=1)") == L"(IsInstalled=0 and " + id + L") or (IsHidden=1 and " + id + L")");
+	EXPECT(filter.PushDown(L"(IsInstalled=0) and (IsHidden=1)") == L"(IsInstalled=0) and (IsHidden=1) and " + id);
+
+	// 文字列の中と単語の一部の or では分けない
+	EXPECT(filter.PushDown(L"Type='Driver or Software'") == L"Type='Driver or Software' and " + id);
+	EXPECT(filter.PushDown(L"IsOrphaned=0 and Ordinal=1") == L"IsOrphaned=0 and Ordinal=1 and " + id);
+}
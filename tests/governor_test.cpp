@@ -0,0 +1,165 @@
+#include "test.h"
+#include "fakebackend.h"
+#include "governor.h"
+#include "orchestrator.h"
+
+#include <vector>
+
+using waffle::test::FakeBackend;
+
+namespace
+{
+	// LoadGovernor の代わりに、標本を 1 つずつ流す
+	//
+	// 止めるときと戻すときだけジョブを作り直させ、Paused の間は作り直す前に標本だけを流す。
+	struct Governed
+	{
+		std::vector<waffle::LoadSample> samples;
+		waffle::PriorityGovernor governor;
+		waffle::Orchestrator & orchestrator;
+
+		size_t next = 0;
+		double peak = 0;
+
+		// 閾値を超えた標本の間にダウンロードし終えた更新の数
+		size_t violations = 0;
+		size_t paused = 0;
+
+		Governed(std::vector<waffle::LoadSample> samples, double threshold, waffle::Orchestrator & orchestrator) : samples(std::move(samples)), governor(threshold, 0.3, 5, 3), orchestrator(orchestrator)
+		{
+			orchestrator.SetDownloadGate([this]()
+			{
+				while (governor.Level() == waffle::DownloadLevel::Paused && Tick())
+				{
+					++paused;
+				}
+			});
+		}
+
+		bool Tick()
+		{
+			if (next == samples.size())
+			{
+				return false;
+			}
+
+			peak = samples[next++].Peak();
+
+			auto previous = governor.Level();
+
+			if (governor.Sample(samples[next - 1]) && waffle::RestartsDownload(previous, governor.Level()))
+			{
+				orchestrator.Interrupt();
+			}
+
+			return true;
+		}
+
+		// 更新を 1 件始めるたびに標本を 1 つ流す (FakeBackend は、その後で poll を呼ぶ)
+		waffle::DownloadProgressCallback Callback()
+		{
+			return [this](LONG, OperationResultCode code, const waffle::DownloadProgress &)
+			{
+				if (code == orcInProgress)
+				{
+					Tick();
+				}
+				else if (code == orcSucceeded && next < samples.size() && peak >= governor.Threshold())
+				{
+					++violations;
+				}
+			};
+		}
+	};
+}
+
+TEST(governor, pause_interrupts_running_job)
+{
+	FakeBackend backend(8);
+
+	waffle::Orchestrator orchestrator;
+
+	// 中断して作り直すのは、止まったジョブのやり直しに数えない
+	orchestrator.SetStallTimeout(60 * 1000, 0);
+
+	Governed governed({ { 20, 0, 0 }, { 20, 0, 0 }, { 90, 0, 0 }, { 90, 0, 0 }, { 90, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 }, { 20, 0, 0 } }, 70, orchestrator);
+
+	orchestrator.Download(backend, waffle::Sequence(8), governed.Callback());
+
+	EXPECT(governed.violations == 0);
+	EXPECT(governed.paused > 0);
+	EXPECT(orchestrator.Interrupts() > 0);
+	EXPECT(orchestrator.Stalls() == 0);
+
+	// 止める前にダウンロードし終えた 2 件は、作り直したジョブに含めない
+	EXPECT(backend.downloadJobs.size() >= 2);
+	EXPECT(backend.downloadJobs[0].size() == 8);
+	EXPECT((backend.downloadJobs[1] == std::vector<LONG>{ 2, 3, 4, 5, 6, 7 }));
+
+	for (LONG index = 0; index < 8; ++index)
+	{
+		EXPECT(backend.IsDownloaded(index));
+	}
+}
+
+TEST(governor, synthetic_trace_moves_no_bytes_over_threshold)
+{
+	// 波の山と突発的な負荷で、ときどき閾値を超える
+	FakeBackend backend(400);
+
+	waffle::Orchestrator orchestrator;
+	Governed governed(waffle::SynthesizeLoadTrace(24 * 60 * 60, 1), 60, orchestrator);
+
+	orchestrator.Download(backend, waffle::Sequence(400), governed.Callback());
+
+	// 記録を流し終える前に、止める場面を通っている
+	EXPECT(governed.next < governed.samples.size());
+	EXPECT(governed.paused > 0);
+	EXPECT(governed.violations == 0);
+
+	for (LONG index = 0; index < 400; ++index)
+	{
+		EXPECT(backend.IsDownloaded(index));
+	}
+}
+
+TEST(governor, level_change_keeps_job)
+{
+	// 止めない段階の間の変化 (Normal から Low) では、今のジョブはそのまま進め、次のジョブから効かせる
+	FakeBackend backend(4);
+
+	waffle::Orchestrator orchestrator;
+	Governed governed({ { 30, 0, 0 }, { 60, 0, 0 }, { 60, 0, 0 }, { 60, 0, 0 }, { 60, 0, 0 } }, 70, orchestrator);
+
+	orchestrator.Download(backend, waffle::Sequence(4), governed.Callback());
+
+	EXPECT(governed.governor.Level() == waffle::DownloadLevel::Low);
+	EXPECT(governed.paused == 0);
+	EXPECT(orchestrator.Interrupts() == 0);
+	EXPECT(backend.downloadJobs.size() == 1);
+}
+
+TEST(governor, restarts_only_around_pause)
+{
+	using waffle::DownloadLevel;
+
+	EXPECT(waffle::RestartsDownload(DownloadLevel::Normal, DownloadLevel::Paused));
+	EXPECT(waffle::RestartsDownload(DownloadLevel::Paused, DownloadLevel::Low));
+	EXPECT(!waffle::RestartsDownload(DownloadLevel::Normal, DownloadLevel::Low));
+	EXPECT(!waffle::RestartsDownload(DownloadLevel::Low, DownloadLevel::High));
+}
+
+TEST(governor, own_download_is_not_network_load)
+{
+	// 100 Mbps のアダプターで 10 MB/s (80 %) のうち 9 MB/s は自分のダウンロード。もう 1 つは 10 Mbps で 8 %
+	std::vector<waffle::NetworkLoad> adapters{ { 10e6, 100e6 }, { 0.1e6, 10e6 } };
+
+	EXPECT(waffle::GetNetworkUtilization(adapters, 0) == 80);
+	EXPECT(waffle::GetNetworkUtilization(adapters, 9e6) == 8);
+
+	// 引きすぎても 0 より下にはしない
+	EXPECT(waffle::GetNetworkUtilization({ { 1e6, 100e6 } }, 5e6) == 0);
+
+	// 帯域のわからないアダプターは数えない
+	EXPECT(waffle::GetNetworkUtilization({ { 1e6, 0 } }, 0) == 0);
+}
@@ -0,0 +1,54 @@
+#include "test.h"
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+namespace waffle::test
+{
+	std::vector<Case> & Cases()
+	{
+		static std::vector<Case> cases;
+
+		return cases;
+	}
+
+	void Fail(const char * file, int line, const char * expression)
+	{
+		throw Failure(std::string(file) + "(" + std::to_string(line) + "): " + expression);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	const char * group = argc > 1 ? argv[1] : nullptr;
+
+	size_t passed = 0;
+	size_t failed = 0;
+
+	for (auto & each : waffle::test::Cases())
+	{
+		if (group != nullptr && std::strcmp(group, each.group) != 0)
+		{
+			continue;
+		}
+
+		try
+		{
+			each.run();
+
+			++passed;
+			std::printf("ok   %s.%s\n", each.group, each.name);
+		}
+		catch (const std::exception & e)
+		{
+			++failed;
+			std::printf("FAIL %s.%s: %s\n", each.group, each.name, e.what());
+		}
+	}
+
+	std::printf("%zu passed, %zu failed\n", passed, failed);
+
+	// グループを間違えて 1 件も走らなかったときも失敗にする
+	return (failed > 0 || passed == 0) ? 1 : 0;
+}
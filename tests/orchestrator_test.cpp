@@ -0,0 +1,238 @@
+#include "test.h"
+#include "fakebackend.h"
+#include "orchestrator.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+using waffle::test::FakeBackend;
+
+namespace
+{
+	// 待たずにやり直す
+	waffle::RetryPolicy Immediately(unsigned long attempts)
+	{
+		return waffle::RetryPolicy(attempts, std::chrono::milliseconds(0), std::chrono::milliseconds(0));
+	}
+
+	// WUA の BeginSearch の代わりに、Scheduler のタイマーで待ってから偽の Backend で検索する
+	waffle::Task<LONG> SearchLater(waffle::Scheduler & scheduler, FakeBackend & backend)
+	{
+		co_await scheduler.Delay(std::chrono::milliseconds(1));
+
+		co_return backend.Search(L"IsInstalled=0", INFINITE);
+	}
+
+	waffle::Task<> SearchEach(waffle::Orchestrator & orchestrator, waffle::Scheduler & scheduler, FakeBackend & backend, LONG & found)
+	{
+		found = co_await orchestrator.SearchAsync(scheduler, [&]() { return SearchLater(scheduler, backend); });
+	}
+}
+
+TEST(orchestrator, search_retries_transient_errors)
+{
+	FakeBackend backend(3);
+	backend.searchFailures = { WU_E_NO_CONNECTION, WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL };
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetRetryPolicy(Immediately(2));
+
+	EXPECT(orchestrator.Search(backend, L"IsInstalled=0", INFINITE) == 3);
+	EXPECT(backend.searches == 3);
+	EXPECT(orchestrator.Retries() == 2);
+}
+
+TEST(orchestrator, search_gives_up_on_permanent_errors)
+{
+	FakeBackend backend(3);
+	backend.searchFailures = { WU_E_INVALID_CRITERIA };
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetRetryPolicy(Immediately(2));
+
+	EXPECT_THROWS(orchestrator.Search(backend, L"IsInstalled=", INFINITE), std::system_error);
+	EXPECT(backend.searches == 1);
+}
+
+TEST(orchestrator, concurrent_searches_retry_transient_errors)
+{
+	FakeBackend first(3), second(4), third(5);
+	first.searchFailures = { WU_E_NO_CONNECTION, WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL };
+	third.searchFailures = { WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL };
+
+	waffle::Orchestrator orchestrator;
+	std::vector<std::string> phases;
+
+	orchestrator.SetRetryPolicy(waffle::RetryPolicy(2, std::chrono::milliseconds(20), std::chrono::milliseconds(20)), [&](const char * phase, unsigned long, LONG, std::chrono::milliseconds)
+	{
+		phases.push_back(phase);
+	});
+
+	waffle::Scheduler scheduler;
+	std::array<LONG, 3> found{};
+
+	scheduler.Spawn(SearchEach(orchestrator, scheduler, first, found[0]));
+	scheduler.Spawn(SearchEach(orchestrator, scheduler, second, found[1]));
+	scheduler.Spawn(SearchEach(orchestrator, scheduler, third, found[2]));
+
+	scheduler.Run();
+
+	EXPECT((found == std::array<LONG, 3>{ 3, 4, 5 }));
+	EXPECT(first.searches == 3 && second.searches == 1 && third.searches == 2);
+	EXPECT(orchestrator.Retries() == 3);
+	EXPECT((phases == std::vector<std::string>{ "search", "search", "search" }));
+}
+
+TEST(orchestrator, concurrent_search_gives_up_on_permanent_errors)
+{
+	FakeBackend first(3), second(4);
+	first.searchFailures = { WU_E_INVALID_CRITERIA };
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetRetryPolicy(Immediately(2));
+
+	waffle::Scheduler scheduler;
+	std::array<LONG, 2> found{};
+
+	scheduler.Spawn(SearchEach(orchestrator, scheduler, first, found[0]));
+	scheduler.Spawn(SearchEach(orchestrator, scheduler, second, found[1]));
+
+	// 失敗した検索の例外は Run() から出る。ほかの条件の検索は最後まで進む
+	EXPECT_THROWS(scheduler.Run(), std::system_error);
+	EXPECT(first.searches == 1);
+	EXPECT(found[1] == 4);
+	EXPECT(orchestrator.Retries() == 0);
+}
+
+TEST(orchestrator, download_retries_only_failed_updates)
+{
+	FakeBackend backend(3);
+	backend.updates[1].downloadFailures = { WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL };
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetRetryPolicy(Immediately(2));
+
+	std::vector<LONG> succeeded;
+
+	orchestrator.Download(backend, { 0, 1, 2 }, [&](LONG index, OperationResultCode code, const waffle::DownloadProgress &)
+	{
+		if (code == orcSucceeded)
+		{
+			succeeded.push_back(index);
+		}
+	});
+
+	EXPECT(backend.downloadJobs.size() == 2);
+	EXPECT(backend.downloadJobs[1] == std::vector<LONG>{ 1 });
+
+	// やり直したジョブの通知も、元の並びの位置で届く
+	EXPECT((succeeded == std::vector<LONG>{ 0, 2, 1 }));
+	EXPECT(backend.IsDownloaded(1));
+	EXPECT(orchestrator.Retries() == 1);
+}
+
+TEST(orchestrator, download_fails_when_every_update_fails)
+{
+	FakeBackend backend(2);
+	backend.updates[0].downloadFailures = { WU_E_INVALID_UPDATE };
+	backend.updates[1].downloadFailures = { WU_E_INVALID_UPDATE };
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetRetryPolicy(Immediately(2));
+
+	EXPECT_THROWS(orchestrator.Download(backend, { 0, 1 }, [](auto &&...) {}), std::runtime_error);
+	EXPECT(backend.downloadJobs.size() == 1);
+}
+
+TEST(orchestrator, stalled_download_restarts_remaining_updates)
+{
+	FakeBackend backend(3);
+	backend.stalls = 1;
+	backend.stallAt = 1;
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetStallTimeout(20);
+
+	std::vector<LONG> succeeded;
+
+	orchestrator.Download(backend, { 0, 1, 2 }, [&](LONG index, OperationResultCode code, const waffle::DownloadProgress &)
+	{
+		if (code == orcSucceeded)
+		{
+			succeeded.push_back(index);
+		}
+	});
+
+	EXPECT(orchestrator.Stalls() == 1);
+	EXPECT(backend.downloadJobs.size() == 2);
+	EXPECT((backend.downloadJobs[1] == std::vector<LONG>{ 1, 2 }));
+	EXPECT((succeeded == std::vector<LONG>{ 0, 1, 2 }));
+}
+
+TEST(orchestrator, stall_after_last_update_does_not_restart)
+{
+	FakeBackend backend(2);
+	backend.stalls = 1;
+	backend.stallAt = 2;
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetStallTimeout(20);
+
+	orchestrator.Download(backend, { 0, 1 }, [](auto &&...) {});
+
+	EXPECT(orchestrator.Stalls() == 1);
+	EXPECT(backend.downloadJobs.size() == 1);
+	EXPECT(backend.IsDownloaded(0) && backend.IsDownloaded(1));
+}
+
+TEST(orchestrator, restarted_job_does_not_inherit_rate)
+{
+	using namespace std::chrono_literals;
+
+	waffle::Throughput throughput;
+	auto now = waffle::Throughput::clock::now();
+
+	throughput.Restart(now);
+	throughput.Sample(now + 1s, 1 << 20, 4 << 20);
+
+	EXPECT(throughput.Rate() > 0);
+
+	// 止まって作り直したジョブは、前のジョブの速さから始めない
+	throughput.Restart(now + 2s);
+
+	EXPECT(throughput.Rate() == 0);
+	EXPECT(!throughput.Eta());
+
+	throughput.Sample(now + 3s, 2 << 20, 4 << 20);
+
+	EXPECT(throughput.Rate() == 2 << 20);
+}
+
+TEST(orchestrator, download_gives_up_after_stall_restarts)
+{
+	FakeBackend backend(2);
+	backend.stalls = 10;
+
+	waffle::Orchestrator orchestrator;
+	orchestrator.SetStallTimeout(10, 2);
+
+	EXPECT_THROWS(orchestrator.Download(backend, { 0, 1 }, [](auto &&...) {}), std::runtime_error);
+	EXPECT(orchestrator.Stalls() == 3);
+}
+
+TEST(orchestrator, install_reports_reboot_required)
+{
+	FakeBackend backend(2);
+	backend.updates[0].downloaded = true;
+	backend.updates[1].downloaded = true;
+	backend.updates[1].rebootRequired = true;
+
+	waffle::Orchestrator orchestrator;
+
+	orchestrator.Install(backend, { 0, 1 }, [](auto &&...) {});
+
+	EXPECT(backend.IsInstalled(0) && backend.IsInstalled(1));
+	EXPECT(orchestrator.RebootRequired());
+}
@@ -0,0 +1,131 @@
+#include "test.h"
+#include "fakebackend.h"
+#include "orchestrator.h"
+
+#include <mutex>
+#include <algorithm>
+
+using waffle::test::FakeBackend;
+
+namespace
+{
+	// 通知の順番 (フェーズ, 位置, コード)
+	struct Event
+	{
+		char phase;
+		LONG index;
+		OperationResultCode code;
+	};
+
+	struct Timeline
+	{
+		std::mutex mutex;
+		std::vector<Event> events;
+
+		void Add(char phase, LONG index, OperationResultCode code)
+		{
+			std::lock_guard lock(mutex);
+
+			events.push_back({ phase, index, code });
+		}
+
+		// 最初に見つかった位置 (無ければ events.size())
+		size_t Find(char phase, LONG index, OperationResultCode code) const
+		{
+			auto found = std::find_if(events.begin(), events.end(), [&](const Event & event) { return event.phase == phase && event.index == index && event.code == code; });
+
+			return found - events.begin();
+		}
+	};
+}
+
+TEST(pipeline, installs_while_downloading)
+{
+	FakeBackend backend(4);
+	backend.latency = std::chrono::milliseconds(20);
+
+	waffle::Orchestrator orchestrator;
+	Timeline timeline;
+
+	orchestrator.DownloadAndInstall(backend, { 0, 1, 2, 3 },
+		[&](LONG index, OperationResultCode code, const waffle::DownloadProgress &) { timeline.Add('d', index, code); },
+		[&](LONG index, OperationResultCode code, const waffle::InstallationProgress &) { timeline.Add('i', index, code); });
+
+	for (LONG index = 0; index < 4; ++index)
+	{
+		EXPECT(backend.IsInstalled(index));
+		EXPECT(timeline.Find('d', index, orcSucceeded) < timeline.Find('i', index, orcSucceeded));
+	}
+
+	// 最初の更新のインストールは、最後の更新のダウンロードを待たずに始まる
+	EXPECT(timeline.Find('i', 0, orcInProgress) < timeline.Find('d', 3, orcSucceeded));
+	EXPECT(backend.installJobs.size() > 1);
+}
+
+TEST(pipeline, passes_original_positions)
+{
+	// Backend の中の番号と、渡した並びの中の位置は違う
+	FakeBackend backend(6);
+	backend.latency = std::chrono::milliseconds(5);
+
+	waffle::Orchestrator orchestrator;
+	Timeline timeline;
+
+	orchestrator.DownloadAndInstall(backend, { 5, 3, 1 },
+		[&](LONG index, OperationResultCode code, const waffle::DownloadProgress &) { timeline.Add('d', index, code); },
+		[&](LONG index, OperationResultCode code, const waffle::InstallationProgress &) { timeline.Add('i', index, code); });
+
+	EXPECT(backend.IsInstalled(5) && backend.IsInstalled(3) && backend.IsInstalled(1));
+	EXPECT(!backend.IsInstalled(0) && !backend.IsInstalled(2) && !backend.IsInstalled(4));
+
+	for (auto & event : timeline.events)
+	{
+		EXPECT(event.index >= 0 && event.index < 3);
+	}
+}
+
+TEST(pipeline, skips_failed_downloads)
+{
+	FakeBackend backend(3);
+	backend.updates[1].downloadFailures = { WU_E_INVALID_UPDATE };
+
+	waffle::Orchestrator orchestrator;
+
+	orchestrator.DownloadAndInstall(backend, { 0, 1, 2 }, [](auto &&...) {}, [](auto &&...) {});
+
+	EXPECT(backend.IsInstalled(0) && backend.IsInstalled(2));
+	EXPECT(!backend.IsInstalled(1));
+
+	for (auto & job : backend.installJobs)
+	{
+		EXPECT(std::find(job.begin(), job.end(), 1) == job.end());
+	}
+}
+
+TEST(pipeline, installs_already_downloaded_updates)
+{
+	// ダウンロード済みの更新には進捗の通知が来ない
+	FakeBackend backend(3);
+	backend.updates[0].downloaded = true;
+	backend.updates[2].downloaded = true;
+
+	waffle::Orchestrator orchestrator;
+	size_t downloads = 0;
+
+	orchestrator.DownloadAndInstall(backend, { 0, 1, 2 }, [&](LONG, OperationResultCode code, const waffle::DownloadProgress &) { downloads += code == orcSucceeded; }, [](auto &&...) {});
+
+	EXPECT(downloads == 1);
+	EXPECT(backend.IsInstalled(0) && backend.IsInstalled(1) && backend.IsInstalled(2));
+}
+
+TEST(pipeline, reports_install_failure_after_download)
+{
+	FakeBackend backend(2);
+	backend.updates[0].installFailures = { WU_E_INSTALL_NOT_ALLOWED };
+	backend.updates[1].installFailures = { WU_E_INSTALL_NOT_ALLOWED };
+
+	waffle::Orchestrator orchestrator;
+
+	EXPECT_THROWS(orchestrator.DownloadAndInstall(backend, { 0, 1 }, [](auto &&...) {}, [](auto &&...) {}), std::runtime_error);
+	EXPECT(backend.IsDownloaded(0) && backend.IsDownloaded(1));
+}
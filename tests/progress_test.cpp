@@ -0,0 +1,141 @@
+#include "test.h"
+#include "core.h"
+
+#include <array>
+#include <tuple>
+#include <vector>
+#include <stdexcept>
+
+namespace
+{
+	// IUpdateDownloadResult などの代わり
+	struct FakeResult
+	{
+		OperationResultCode code;
+		unsigned long * calls;
+
+		HRESULT get_ResultCode(OperationResultCode * value)
+		{
+			++*calls;
+			*value = code;
+			return S_OK;
+		}
+	};
+
+	// IDownloadProgress (と IDownloadResult) などの代わり。COM の呼び出しの回数を数える
+	struct FakeProgress
+	{
+		LONG index = 0;
+		std::array<FakeResult, 3> results;
+		unsigned long calls = 0;
+
+		FakeProgress()
+		{
+			for (auto & result : results)
+			{
+				result = { orcInProgress, &calls };
+			}
+		}
+
+		HRESULT get_CurrentUpdateIndex(LONG * value)
+		{
+			++calls;
+			*value = index;
+			return S_OK;
+		}
+
+		HRESULT GetUpdateResult(LONG index, FakeResult ** value)
+		{
+			++calls;
+			*value = &results[index];
+			return S_OK;
+		}
+	};
+
+	using Dispatched = std::vector<std::tuple<LONG, OperationResultCode, bool>>;
+
+	auto Recorder(Dispatched & dispatched)
+	{
+		return [&dispatched](LONG index, OperationResultCode code, FakeResult * result) { dispatched.emplace_back(index, code, result != nullptr); };
+	}
+}
+
+TEST(progress, steady_ticks_read_only_the_index)
+{
+	// get_Progress() と合わせて、通知 1 回で 2 回
+	FakeProgress progress;
+	waffle::ProgressDispatcher<FakeResult *> dispatcher(3);
+	Dispatched dispatched;
+
+	for (int i = 0; i < 10; ++i)
+	{
+		EXPECT(dispatcher.Dispatch(&progress, Recorder(dispatched)) == S_OK);
+	}
+
+	EXPECT(progress.calls == 10);
+	EXPECT(dispatched.size() == 10);
+	EXPECT((dispatched.back() == std::tuple{ 0, orcInProgress, false }));
+}
+
+TEST(progress, reports_previous_update_when_index_changes)
+{
+	FakeProgress progress;
+	waffle::ProgressDispatcher<FakeResult *> dispatcher(3);
+	Dispatched dispatched;
+
+	dispatcher.Dispatch(&progress, Recorder(dispatched));
+
+	progress.results[0].code = orcSucceeded;
+	progress.index = 1;
+
+	dispatcher.Dispatch(&progress, Recorder(dispatched));
+	dispatcher.Dispatch(&progress, Recorder(dispatched));
+
+	EXPECT((dispatched == Dispatched{ { 0, orcInProgress, false }, { 0, orcSucceeded, true }, { 1, orcInProgress, false }, { 1, orcInProgress, false } }));
+
+	// 結果を引いたのは替わったときの 1 回だけ
+	EXPECT(progress.calls == 3 + 2);
+}
+
+TEST(progress, finish_reports_the_rest_once)
+{
+	FakeProgress progress;
+	waffle::ProgressDispatcher<FakeResult *> dispatcher(3);
+	Dispatched dispatched;
+
+	dispatcher.Dispatch(&progress, Recorder(dispatched));
+
+	progress.results[0].code = orcSucceeded;
+	progress.results[1].code = orcFailed;
+	progress.results[2].code = orcAborted;
+	progress.index = 1;
+
+	dispatcher.Dispatch(&progress, Recorder(dispatched));
+
+	dispatched.clear();
+
+	EXPECT(dispatcher.Finish(&progress, Recorder(dispatched)) == S_OK);
+
+	// 0 は通知済み、2 は中止されたので (やり直しに回すため) 通知しない
+	EXPECT((dispatched == Dispatched{ { 1, orcFailed, true } }));
+}
+
+TEST(progress, rejects_index_out_of_range)
+{
+	FakeProgress progress;
+	waffle::ProgressDispatcher<FakeResult *> dispatcher(2);
+	Dispatched dispatched;
+
+	progress.index = 2;
+
+	EXPECT(dispatcher.Dispatch(&progress, Recorder(dispatched)) == WU_E_INVALIDINDEX);
+	EXPECT(dispatched.empty());
+}
+
+TEST(progress, keeps_exceptions_on_this_side)
+{
+	FakeProgress progress;
+	waffle::ProgressDispatcher<FakeResult *> dispatcher(3);
+
+	EXPECT(dispatcher.Dispatch(&progress, [](auto &&...) { throw std::runtime_error("callback"); }) == E_FAIL);
+}
@@ -0,0 +1,82 @@
+#include "test.h"
+#include "renderer.h"
+
+#include <string>
+#include <string_view>
+
+namespace
+{
+	// 最後に描いた状態の行 (消去のエスケープシーケンスの後ろ)
+	std::wstring LastFrame(const std::wstring & output)
+	{
+		auto erase = output.rfind(L"\x1b[0J");
+
+		return erase != std::wstring::npos ? output.substr(erase + 4) : output;
+	}
+}
+
+TEST(renderer, truncates_lines_to_width)
+{
+	std::wstring output;
+	waffle::ProgressRenderer renderer([&](std::wstring_view text) { output.assign(text); }, true, std::chrono::milliseconds(0), 20);
+
+	renderer.Update(waffle::ProgressPhase::Install, 0, L"A very long update title that would wrap", 42, 0, 0, 0);
+
+	// width - 1 桁に収める
+	EXPECT(LastFrame(output) == L" 42% A very long up\n");
+}
+
+TEST(renderer, counts_wide_characters_as_two_columns)
+{
+	std::wstring output;
+	waffle::ProgressRenderer renderer([&](std::wstring_view text) { output.assign(text); }, true, std::chrono::milliseconds(0), 12);
+
+	renderer.Update(waffle::ProgressPhase::Install, 0, L"累積更新プログラム", 5, 0, 0, 0);
+
+	// 「  5% 」の 5 桁の後ろに、全角は 3 文字 (6 桁) まで
+	EXPECT(LastFrame(output) == L"  5% 累積更\n");
+}
+
+TEST(renderer, keeps_lines_without_width)
+{
+	std::wstring output;
+	waffle::ProgressRenderer renderer([&](std::wstring_view text) { output.assign(text); }, true, std::chrono::milliseconds(0));
+
+	renderer.Update(waffle::ProgressPhase::Install, 0, L"A very long update title that would wrap", 42, 0, 0, 0);
+
+	EXPECT(LastFrame(output) == L" 42% A very long update title that would wrap\n");
+}
+
+TEST(renderer, moves_up_by_drawn_lines)
+{
+	std::wstring output;
+	waffle::ProgressRenderer renderer([&](std::wstring_view text) { output.assign(text); }, true, std::chrono::milliseconds(0), 20);
+
+	renderer.Update(waffle::ProgressPhase::Install, 0, L"First", 1, 0, 0, 0);
+	renderer.Update(waffle::ProgressPhase::Install, 1, L"Second", 1, 0, 0, 0);
+	renderer.Update(waffle::ProgressPhase::Install, 1, L"Second", 2, 0, 0, 0);
+
+	EXPECT(output.starts_with(L"\x1b[2F"));
+}
+
+TEST(renderer, due_only_once_per_interval)
+{
+	std::wstring output;
+	waffle::ProgressRenderer renderer([&](std::wstring_view text) { output.assign(text); }, true, std::chrono::seconds(10));
+
+	// まだ描いていなければすぐに描く
+	EXPECT(renderer.Due());
+
+	renderer.Update(waffle::ProgressPhase::Install, 0, L"First", 1, 0, 0, 0);
+
+	EXPECT(renderer.Frames() == 1);
+	EXPECT(!renderer.Due());
+	EXPECT(renderer.Dropped() == 1);
+}
+
+TEST(renderer, never_due_without_terminal)
+{
+	waffle::ProgressRenderer renderer([](std::wstring_view) {}, false, std::chrono::milliseconds(0));
+
+	EXPECT(!renderer.Due());
+}
@@ -0,0 +1,198 @@
+#include "test.h"
+#include "replay.h"
+#include "orchestrator.h"
+#include "plan.h"
+#include "wuaerrors.h"
+
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+
+using waffle::TraceEvent;
+using waffle::TraceRecord;
+
+namespace
+{
+	// 手で組み立てる記録。時刻は 1 レコードごとに 1 ミリ秒進める
+	struct Trace
+	{
+		std::vector<TraceRecord> records;
+
+		Trace & Add(TraceEvent event, LONG index, LONG code = 0, LONG hresult = S_OK, LONG percent = 0, ULONGLONG bytes = 0, ULONGLONG total = 0, LONG extra = 0)
+		{
+			records.push_back(TraceRecord{ event, 0, index, code, hresult, percent, extra, bytes, total, (ULONGLONG) records.size() * 1000 });
+
+			return *this;
+		}
+
+		Trace & Update(LONG index, waffle::UpdateSeverity severity, ULONGLONG bytes, InstallationImpact impact = iiNormal, InstallationRebootBehavior reboot = irbNeverReboots)
+		{
+			return Add(TraceEvent::Update, index, (LONG) severity, S_OK, impact, bytes, bytes, reboot);
+		}
+	};
+
+	// wmain と同じく、検索して計画のバッチごとにダウンロードし、ダウンロードできた更新をバッチごとにインストールする
+	struct Run
+	{
+		std::vector<std::vector<LONG>> downloadBatches;
+		std::vector<std::vector<LONG>> installBatches;
+
+		Run(waffle::ReplayBackend & backend, waffle::Orchestrator & orchestrator)
+		{
+			orchestrator.Search(backend, L"IsInstalled=0", INFINITE);
+
+			waffle::DownloadPlan downloadPlan(backend.Snapshot(), ~0ULL, 1ULL << 30);
+
+			for (size_t i = 0; i < downloadPlan.Batches().size(); ++i)
+			{
+				downloadBatches.push_back(downloadPlan.Batch(i));
+
+				orchestrator.Download(backend, downloadBatches.back(), [](LONG, OperationResultCode, const waffle::DownloadProgress &) {});
+			}
+
+			std::vector<LONG> downloaded;
+
+			for (auto index : downloadPlan.Selected())
+			{
+				if (backend.IsDownloaded(index))
+				{
+					downloaded.push_back(index);
+				}
+			}
+
+			waffle::InstallPlan installPlan(backend.Snapshot().Select(downloaded));
+
+			for (size_t i = 0; i < installPlan.Batches().size(); ++i)
+			{
+				installBatches.emplace_back();
+
+				for (auto position : installPlan.Batch(i))
+				{
+					installBatches.back().push_back(downloaded[position]);
+				}
+
+				orchestrator.Install(backend, installBatches.back(), [](LONG, OperationResultCode, const waffle::InstallationProgress &) {});
+			}
+		}
+	};
+
+	void Configure(waffle::Orchestrator & orchestrator)
+	{
+		orchestrator.SetRetryPolicy(waffle::RetryPolicy(3, std::chrono::milliseconds(0), std::chrono::milliseconds(0)));
+		orchestrator.SetStallTimeout(50, 3);
+	}
+}
+
+TEST(replay, drives_orchestrator_through_retry_stall_and_plans)
+{
+	const ULONGLONG MB = 1 << 20;
+
+	Trace trace;
+
+	// 1 回目の検索は一時的なエラーで失敗する
+	trace.Add(TraceEvent::SearchBegin, 0).Add(TraceEvent::SearchEnd, 0, orcFailed, WU_E_NO_CONNECTION);
+	trace.Add(TraceEvent::SearchBegin, 0).Add(TraceEvent::SearchEnd, 4, orcSucceeded);
+
+	trace.Update(0, waffle::UpdateSeverity::Important, 30 * MB, iiNormal, irbAlwaysRequiresReboot);
+	trace.Update(1, waffle::UpdateSeverity::Critical, 200 * MB);
+	trace.Update(2, waffle::UpdateSeverity::Moderate, 10 * MB, iiRequiresExclusiveHandling);
+	trace.Update(3, waffle::UpdateSeverity::Low, 20 * MB);
+
+	// 1 件目は一時的なエラーで失敗、2 件目は成功、3 件目で止まって中止された
+	//
+	// 試行は記録の順に使うので、緊急のバッチ (1 件) が失敗してやり直しで成功し、次のバッチの 2 件目で止まる。
+	trace.Add(TraceEvent::DownloadBegin, 4);
+	trace.Add(TraceEvent::DownloadProgress, 0, orcInProgress).Add(TraceEvent::DownloadProgress, 0, orcFailed, WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL);
+	trace.Add(TraceEvent::DownloadProgress, 1, orcInProgress).Add(TraceEvent::DownloadProgress, 1, orcSucceeded);
+	trace.Add(TraceEvent::DownloadProgress, 2, orcInProgress);
+	trace.Add(TraceEvent::DownloadEnd, 4, orcAborted);
+
+	waffle::ReplayBackend backend(waffle::TraceReplay(trace.records), 0);
+	waffle::Orchestrator orchestrator;
+
+	Configure(orchestrator);
+
+	Run run(backend, orchestrator);
+
+	// 緊急を先に、残りは小さい順
+	EXPECT(run.downloadBatches.size() == 2);
+	EXPECT((run.downloadBatches[0] == std::vector<LONG>{ 1 }));
+	EXPECT((run.downloadBatches[1] == std::vector<LONG>{ 2, 3, 0 }));
+
+	// 検索とダウンロードで 1 回ずつやり直し、止まったジョブを 1 回作り直す
+	EXPECT(orchestrator.Retries() == 2);
+	EXPECT(orchestrator.Stalls() == 1);
+
+	// 再起動しないもの、単独のもの、再起動するものの順
+	EXPECT(run.installBatches.size() == 3);
+	EXPECT((run.installBatches[0] == std::vector<LONG>{ 1, 3 }));
+	EXPECT((run.installBatches[1] == std::vector<LONG>{ 2 }));
+	EXPECT((run.installBatches[2] == std::vector<LONG>{ 0 }));
+
+	for (LONG index = 0; index < 4; ++index)
+	{
+		EXPECT(backend.IsDownloaded(index) && backend.IsInstalled(index));
+	}
+
+	EXPECT(orchestrator.RebootRequired());
+}
+
+TEST(replay, synthetic_trace_retries_every_failed_download)
+{
+	auto replay = waffle::TraceReplay::Synthesize(200, 1);
+
+	LONG failures = 0;
+
+	for (auto & record : replay.Records())
+	{
+		failures += (record.event == TraceEvent::DownloadProgress && record.code == orcFailed) ? 1 : 0;
+	}
+
+	waffle::ReplayBackend backend(replay, 0);
+	waffle::Orchestrator orchestrator;
+
+	Configure(orchestrator);
+
+	Run run(backend, orchestrator);
+
+	EXPECT(failures > 0);
+	EXPECT(orchestrator.Retries() > 0 && (LONG) orchestrator.Retries() <= failures);
+	EXPECT(orchestrator.Stalls() == 0);
+	EXPECT(run.downloadBatches.size() > 1);
+
+	for (LONG index = 0; index < 200; ++index)
+	{
+		EXPECT(backend.IsDownloaded(index) && backend.IsInstalled(index));
+	}
+}
+
+TEST(replay, version_1_trace_loads_without_behaviors)
+{
+	auto path = std::filesystem::temp_directory_path() / "waffle_replay_test.trace";
+
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+		waffle::TraceHeader header{ 0x52544657, 1 };
+		TraceRecord records[] =
+		{
+			{ TraceEvent::SearchEnd, 0, 1, orcSucceeded, S_OK, 0, 0, 0, 0, 0 },
+			{ TraceEvent::Update, 0, 0, 0, S_OK, 0, 0, 1 << 20, 1 << 20, 0 },
+		};
+
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char *>(records), sizeof(records));
+	}
+
+	auto replay = waffle::TraceReplay::Load(path);
+
+	std::filesystem::remove(path);
+
+	waffle::ReplayBackend backend(replay, 0);
+
+	// 版 1 の code の 0 は Critical ではない
+	EXPECT(backend.Snapshot().size() == 1);
+	EXPECT(backend.Snapshot().Severity(0) == waffle::UpdateSeverity::Unspecified);
+	EXPECT(backend.Snapshot().MaxDownloadSize(0) == 1 << 20);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// waffle_tests の小さな仕組み
+//
+// TEST(グループ, 名前) で登録し、EXPECT(条件) で確かめる。waffle_tests [グループ] で、そのグループだけを走らせる
+// (CMake はグループごとに ctest のテストを作る)。
+
+namespace waffle::test
+{
+	struct Case
+	{
+		const char * group;
+		const char * name;
+		void (*run)();
+	};
+
+	std::vector<Case> & Cases();
+
+	struct Registration
+	{
+		Registration(const char * group, const char * name, void (*run)())
+		{
+			Cases().push_back({ group, name, run });
+		}
+	};
+
+	// EXPECT が失敗したら投げる (そのテストだけを失敗にして、次に進む)
+	struct Failure : std::runtime_error
+	{
+		using std::runtime_error::runtime_error;
+	};
+
+	[[noreturn]] void Fail(const char * file, int line, const char * expression);
+}
+
+#define TEST(group, name) \
+	static void group##_##name(); \
+	static waffle::test::Registration group##_##name##_registration(#group, #name, group##_##name); \
+	static void group##_##name()
+
+#define EXPECT(condition) \
+	do { if (!(condition)) waffle::test::Fail(__FILE__, __LINE__, #condition); } while (false)
+
+#define EXPECT_THROWS(expression, type) \
+	do { try { expression; waffle::test::Fail(__FILE__, __LINE__, #expression " throws " #type); } catch (const type &) {} } while (false)
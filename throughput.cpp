@@ -0,0 +1,72 @@
+#include "throughput.h"
+
+namespace waffle
+{
+	Throughput::Throughput(double alpha) : m_alpha(alpha), m_rate(0), m_hasRate(false), m_lastBytes(0), m_total(0), m_transferred(0), m_elapsed(0)
+	{
+		Restart(clock::now());
+	}
+
+	void Throughput::Restart(clock::time_point now)
+	{
+		m_lastTime = now;
+		m_lastProgress = now;
+		m_lastBytes = 0;
+		m_total = 0;
+		m_rate = 0;
+		m_hasRate = false;
+	}
+
+	void Throughput::Sample(clock::time_point now, std::uint64_t bytes, std::uint64_t total)
+	{
+		auto delta = now - m_lastTime;
+
+		if (delta <= clock::duration::zero())
+		{
+			return;
+		}
+
+		auto transferred = (bytes > m_lastBytes) ? bytes - m_lastBytes : 0;
+		auto rate = transferred / std::chrono::duration<double>(delta).count();
+
+		m_rate.store(m_hasRate ? m_alpha * rate + (1 - m_alpha) * m_rate.load(std::memory_order_relaxed) : rate, std::memory_order_relaxed);
+		m_hasRate = true;
+
+		if (transferred > 0)
+		{
+			m_lastProgress = now;
+		}
+
+		m_transferred.fetch_add(transferred, std::memory_order_relaxed);
+		m_elapsed += delta;
+
+		m_lastTime = now;
+		m_lastBytes = bytes;
+		m_total = total;
+	}
+
+	bool Throughput::Stalled(clock::time_point now, clock::duration timeout) const
+	{
+		return now - m_lastProgress >= timeout;
+	}
+
+	double Throughput::AverageRate() const noexcept
+	{
+		if (m_elapsed <= clock::duration::zero())
+		{
+			return 0;
+		}
+
+		return Transferred() / std::chrono::duration<double>(m_elapsed).count();
+	}
+
+	std::optional<std::chrono::seconds> Throughput::Eta() const
+	{
+		if (m_rate <= 0 || m_total < m_lastBytes)
+		{
+			return std::nullopt;
+		}
+
+		return std::chrono::seconds((std::chrono::seconds::rep) ((m_total - m_lastBytes) / m_rate));
+	}
+}
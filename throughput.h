@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace waffle
+{
+	// ダウンロード済みバイト数の標本から、転送速度 (指数移動平均) と残り時間を求める
+	//
+	// Sample() と Restart() は 1 つのスレッド (ジョブを待つスレッド) から呼ぶ。Rate() は進捗の通知のスレッドからも、
+	// Transferred() は負荷を見るスレッドからも読む。
+
+	class Throughput
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		double m_alpha;
+		std::atomic<double> m_rate;
+		bool m_hasRate;
+
+		clock::time_point m_lastTime;
+		clock::time_point m_lastProgress;
+
+		std::uint64_t m_lastBytes;
+		std::uint64_t m_total;
+		std::atomic<std::uint64_t> m_transferred;
+
+		clock::duration m_elapsed;
+
+	public:
+		Throughput(double alpha = 0.3);
+		~Throughput() = default;
+
+		// 新しいジョブを始めるとき (バイト数が 0 から数え直しになり、速度も前のジョブから引き継がない)
+		void Restart(clock::time_point now);
+
+		void Sample(clock::time_point now, std::uint64_t bytes, std::uint64_t total);
+
+		bool Stalled(clock::time_point now, clock::duration timeout) const;
+
+		double Rate() const noexcept
+		{
+			return m_rate.load(std::memory_order_relaxed);
+		}
+
+		double AverageRate() const noexcept;
+
+		std::uint64_t Transferred() const noexcept
+		{
+			return m_transferred.load(std::memory_order_relaxed);
+		}
+
+		std::optional<std::chrono::seconds> Eta() const;
+	};
+}
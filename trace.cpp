@@ -0,0 +1,336 @@
+#include "trace.h"
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+namespace waffle
+{
+	constexpr DWORD TRACE_MAGIC = 0x52544657; // "WFTR"
+	constexpr DWORD TRACE_VERSION = 2;
+
+	bool IsTraceBegin(TraceEvent event)
+	{
+		return event == TraceEvent::DownloadBegin || event == TraceEvent::InstallBegin;
+	}
+
+	bool IsTraceEnd(TraceEvent event)
+	{
+		return event == TraceEvent::DownloadEnd || event == TraceEvent::InstallEnd;
+	}
+
+	TraceRecorder::TraceRecorder(const std::filesystem::path & path) : m_file(path, std::ios::binary | std::ios::trunc), m_start(std::chrono::steady_clock::now())
+	{
+		TraceHeader header{ TRACE_MAGIC, TRACE_VERSION };
+
+		if (!m_file.write(reinterpret_cast<const char *>(&header), sizeof(header)))
+		{
+			throw std::system_error(errno, std::generic_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	void TraceRecorder::Record(TraceEvent event, LONG index, LONG code, LONG hresult, LONG percent, ULONGLONG bytes, ULONGLONG total, LONG extra)
+	{
+		auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start);
+
+		TraceRecord record{ event, 0, index, code, hresult, percent, extra, bytes, total, (ULONGLONG) elapsed.count() };
+
+		std::lock_guard lock(m_mutex);
+
+		if (!m_file.write(reinterpret_cast<const char *>(&record), sizeof(record)))
+		{
+			throw std::system_error(errno, std::generic_category(), MACRO_SOURCE_LOCATION());
+		}
+	}
+
+	void TraceRecorder::Flush()
+	{
+		std::lock_guard lock(m_mutex);
+
+		m_file.flush();
+	}
+
+	TraceReplay::TraceReplay(std::vector<TraceRecord> records) : m_records(std::move(records))
+	{}
+
+	TraceReplay TraceReplay::Load(const std::filesystem::path & path)
+	{
+		std::ifstream file(path, std::ios::binary);
+
+		TraceHeader header{};
+
+		if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.magic != TRACE_MAGIC || (header.version != 1 && header.version != TRACE_VERSION))
+		{
+			throw std::runtime_error("Invalid trace file: " + path.string());
+		}
+
+		std::vector<TraceRecord> records;
+
+		// 書きかけの最後のレコードは捨てる
+		for (TraceRecord record{}; file.read(reinterpret_cast<char *>(&record), sizeof(record)); )
+		{
+			// 版 1 の Update には重要度と挙動がない
+			if (header.version == 1 && record.event == TraceEvent::Update)
+			{
+				record.code = (LONG) UpdateSeverity::Unspecified;
+				record.percent = iiNormal;
+				record.extra = irbNeverReboots;
+			}
+
+			records.push_back(record);
+		}
+
+		return TraceReplay(std::move(records));
+	}
+
+	TraceReplay TraceReplay::Synthesize(LONG count, std::uint64_t seed)
+	{
+		const ULONGLONG KB = 1024, MB = 1024 * KB, GB = 1024 * MB;
+		const ULONGLONG rate = 10 * MB; // バイト/秒
+		const LONG steps = 4;
+
+		std::mt19937_64 random(seed);
+		std::vector<TraceRecord> records;
+		ULONGLONG now = 0;
+
+		auto add = [&](TraceEvent event, LONG index, LONG code = 0, LONG hresult = S_OK, LONG percent = 0, ULONGLONG bytes = 0, ULONGLONG total = 0, LONG extra = 0)
+		{
+			records.push_back(TraceRecord{ event, 0, index, code, hresult, percent, extra, bytes, total, now });
+		};
+
+		// 大きさは 100KB から 2GB まで、対数で一様に
+		std::uniform_real_distribution<double> logSize(std::log(100.0 * KB), std::log(2.0 * GB));
+		std::vector<ULONGLONG> sizes(count);
+
+		for (auto & size : sizes)
+		{
+			size = (ULONGLONG) std::exp(logSize(random));
+		}
+
+		auto total = std::accumulate(sizes.begin(), sizes.end(), 0ULL);
+
+		add(TraceEvent::SearchBegin, 0);
+		now += 30 * 1000 * 1000;
+		add(TraceEvent::SearchEnd, count, orcSucceeded);
+
+		// 重要度と挙動は別の乱数で決め、大きさや時刻の並びを変えない
+		std::mt19937_64 behaviors(seed + 1);
+
+		for (LONG index = 0; index < count; ++index)
+		{
+			// 1 割が緊急、2 割が再起動する。単独でのインストールが必要なものは少ない
+			auto severity = (LONG) (behaviors() % 10 == 0 ? UpdateSeverity::Critical : (UpdateSeverity) (1 + behaviors() % 4));
+			auto impact = behaviors() % 25 == 0 ? iiRequiresExclusiveHandling : iiNormal;
+			auto reboot = behaviors() % 5 == 0 ? irbAlwaysRequiresReboot : irbNeverReboots;
+
+			add(TraceEvent::Update, index, severity, S_OK, impact, sizes[index], sizes[index], reboot);
+		}
+
+		add(TraceEvent::DownloadBegin, count, 0, S_OK, 0, 0, total);
+
+		std::vector<bool> failed(count);
+		ULONGLONG done = 0;
+
+		for (LONG index = 0; index < count; ++index)
+		{
+			// 20 件に 1 件は一時的な HTTP のエラーで失敗する
+			failed[index] = random() % 20 == 0;
+
+			for (LONG step = 1; step <= steps; ++step)
+			{
+				now += sizes[index] / steps * 1000 * 1000 / rate;
+
+				auto bytes = done + sizes[index] * step / steps;
+				auto percent = (LONG) (bytes * 100 / std::max(total, 1ULL));
+
+				if (step < steps)
+					add(TraceEvent::DownloadProgress, index, orcInProgress, S_OK, percent, bytes, total);
+				else if (failed[index])
+					add(TraceEvent::DownloadProgress, index, orcFailed, (random() & 1) ? WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL : WININET_E_TIMEOUT, percent, bytes, total);
+				else
+					add(TraceEvent::DownloadProgress, index, orcSucceeded, S_OK, percent, bytes, total);
+			}
+
+			done += sizes[index];
+		}
+
+		auto failures = (LONG) std::count(failed.begin(), failed.end(), true);
+
+		add(TraceEvent::DownloadEnd, count, failures > 0 ? orcSucceededWithErrors : orcSucceeded, S_OK, 100, total, total);
+
+		// ダウンロードできた更新だけを、1 件 5 秒から 60 秒でインストールする
+		std::uniform_int_distribution<ULONGLONG> installSeconds(5, 60);
+
+		add(TraceEvent::InstallBegin, count - failures);
+
+		for (LONG index = 0, installed = 0; index < count; ++index)
+		{
+			if (failed[index])
+			{
+				continue;
+			}
+
+			now += installSeconds(random) * 1000 * 1000;
+
+			++installed;
+			add(TraceEvent::InstallProgress, installed - 1, orcSucceeded, S_OK, installed * 100 / std::max<LONG>(count - failures, 1));
+		}
+
+		add(TraceEvent::InstallEnd, count - failures, orcSucceeded);
+
+		return TraceReplay(std::move(records));
+	}
+
+	LONG TraceReplay::Updates() const
+	{
+		LONG count = 0;
+
+		for (auto & record : m_records)
+		{
+			if (record.event == TraceEvent::SearchEnd)
+			{
+				count = std::max(count, record.index);
+			}
+		}
+
+		return count;
+	}
+
+	TraceReplay TraceReplay::Scale(LONG count) const
+	{
+		auto updates = std::max<LONG>(Updates(), 1);
+
+		std::vector<TraceRecord> scaled;
+		ULONGLONG shift = 0; // 増やした分だけ、後ろのレコードの時刻をずらす
+
+		for (size_t i = 0; i < m_records.size(); )
+		{
+			auto record = m_records[i];
+
+			if (record.event == TraceEvent::SearchEnd)
+			{
+				record.index = count;
+			}
+
+			if (record.event == TraceEvent::Update)
+			{
+				// 続いている Update をまとめて使い回す
+				auto last = i;
+
+				while (last < m_records.size() && m_records[last].event == TraceEvent::Update)
+				{
+					++last;
+				}
+
+				for (LONG index = 0; index < count; ++index)
+				{
+					auto update = m_records[i + index % (last - i)];
+
+					update.index = index;
+					update.elapsed += shift;
+					scaled.push_back(update);
+				}
+
+				i = last;
+				continue;
+			}
+
+			if (!IsTraceBegin(record.event))
+			{
+				record.elapsed += shift;
+				scaled.push_back(record);
+				++i;
+				continue;
+			}
+
+			// ジョブの中の進捗を更新ごとに分け、順に使い回す
+			auto end = i + 1;
+
+			while (end < m_records.size() && !IsTraceEnd(m_records[end].event))
+			{
+				++end;
+			}
+
+			auto jobCount = std::max<LONG>(record.index, 1);
+			auto scaledCount = std::max<LONG>((LONG) ((long long) record.index * count / updates), 1);
+
+			std::vector<std::vector<TraceRecord>> buckets(jobCount);
+
+			for (auto j = i + 1; j < end; ++j)
+			{
+				if (auto index = m_records[j].index; index >= 0 && index < jobCount)
+				{
+					buckets[index].push_back(m_records[j]);
+				}
+			}
+
+			// 更新ごとにかかった時間は、前の更新の最後のレコードから測る
+			std::vector<ULONGLONG> anchors(jobCount);
+
+			for (LONG index = 0; index < jobCount; ++index)
+			{
+				anchors[index] = (index == 0) ? record.elapsed : (buckets[index - 1].empty() ? anchors[index - 1] : buckets[index - 1].back().elapsed);
+			}
+
+			record.index = scaledCount;
+			record.elapsed += shift;
+			scaled.push_back(record);
+
+			auto time = record.elapsed;
+
+			for (LONG index = 0; index < scaledCount; ++index)
+			{
+				auto source = index % jobCount;
+
+				for (auto progress : buckets[source])
+				{
+					progress.index = index;
+					progress.elapsed = time + (progress.elapsed - std::min(progress.elapsed, anchors[source]));
+					scaled.push_back(progress);
+				}
+
+				if (!buckets[source].empty())
+				{
+					time += buckets[source].back().elapsed - std::min(buckets[source].back().elapsed, anchors[source]);
+				}
+			}
+
+			if (end == m_records.size())
+			{
+				break;
+			}
+
+			auto tail = m_records[end];
+
+			tail.index = scaledCount;
+			tail.elapsed = std::max(time, tail.elapsed + shift);
+			shift = tail.elapsed - m_records[end].elapsed;
+			scaled.push_back(tail);
+
+			i = end + 1;
+		}
+
+		return TraceReplay(std::move(scaled));
+	}
+
+	void TraceReplay::Replay(double speed, std::function<void(const TraceRecord &)> handler) const
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (auto & record : m_records)
+		{
+			if (speed > 0)
+			{
+				std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>(record.elapsed / speed)));
+			}
+
+			handler(record);
+		}
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "platform.h"
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <filesystem>
+
+namespace waffle
+{
+	enum class TraceEvent : std::uint16_t
+	{
+		SearchBegin = 1,
+		SearchEnd,
+		Update,
+		DownloadBegin,
+		DownloadProgress,
+		DownloadEnd,
+		InstallBegin,
+		InstallProgress,
+		InstallEnd,
+	};
+
+	// 1 レコードは固定長。index は *Begin と *End では更新の数、Update と *Progress ではジョブの中の位置
+	//
+	// Update では code に UpdateSeverity、percent に InstallationImpact、extra に InstallationRebootBehavior を入れる
+	// (版 1 の記録にはないので、読み込むときに Unspecified などで埋める)。
+	struct TraceRecord
+	{
+		TraceEvent event;
+		std::uint16_t reserved;
+		LONG index;
+		LONG code;
+		LONG hresult;
+		LONG percent;
+		LONG extra;
+		ULONGLONG bytes;
+		ULONGLONG total;
+		ULONGLONG elapsed; // 記録を始めてからのマイクロ秒
+	};
+
+	struct TraceHeader
+	{
+		DWORD magic;
+		DWORD version;
+	};
+
+	// Session が WUA とやり取りした内容 (結果のコード、進捗、時刻) をそのまま書き出す
+
+	class TraceRecorder
+	{
+		std::ofstream m_file;
+		std::mutex m_mutex;
+		std::chrono::steady_clock::time_point m_start;
+
+	public:
+		TraceRecorder(const std::filesystem::path & path);
+		~TraceRecorder() = default;
+
+		TraceRecorder(const TraceRecorder &) = delete;
+		TraceRecorder & operator=(const TraceRecorder &) = delete;
+
+		void Record(TraceEvent event, LONG index, LONG code = 0, LONG hresult = S_OK, LONG percent = 0, ULONGLONG bytes = 0, ULONGLONG total = 0, LONG extra = 0);
+
+		void Flush();
+	};
+
+	// 記録した (または合成した) やり取りを、同じ順序と間隔で再生する
+	//
+	// speed 倍に縮めて再生でき (0 なら待たない)、Scale() で更新の数を増やせる。
+	// 乱数の種を決めれば Synthesize() の結果は毎回同じになる。
+
+	class TraceReplay
+	{
+		std::vector<TraceRecord> m_records;
+
+	public:
+		TraceReplay(std::vector<TraceRecord> records);
+		~TraceReplay() = default;
+
+		static TraceReplay Load(const std::filesystem::path & path);
+
+		// count 件の更新の検索、ダウンロード (ときどき一時的な HTTP のエラーで失敗する)、インストール
+		//
+		// 更新の重要度とインストールの挙動も散らす (大きさと時刻は種だけで決まり、版 1 と変わらない)。
+		static TraceReplay Synthesize(LONG count, std::uint64_t seed);
+
+		// 記録した更新を順に使い回して count 件にする
+		TraceReplay Scale(LONG count) const;
+
+		const std::vector<TraceRecord> & Records() const noexcept
+		{
+			return m_records;
+		}
+
+		LONG Updates() const;
+
+		void Replay(double speed, std::function<void(const TraceRecord &)> handler) const;
+	};
+}
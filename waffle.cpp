@@ -1,18 +1,10 @@
 ﻿#include "waffle.h"
-
-#define MACRO_SOURCE_LOCATION() __FILE__ "(" _CRT_STRINGIZE(__LINE__) ")"
-
-std::wostream & operator<<(std::wostream & out, const char * mbs)
-{
-	wchar_t wc{};
-
-	for (auto count = std::mbtowc(&wc, mbs, MB_CUR_MAX); count > 0; count = std::mbtowc(&wc, mbs += count, MB_CUR_MAX))
-	{
-		out << wc;
-	}
-
-	return out;
-}
+#include "searchcache.h"
+#include "wuaerrors.h"
+#include "asyncoperation.h"
+#include "installplan.h"
+#include "downloadplan.h"
+#include "filter.h"
 
 std::wostream & operator<<(std::wostream & out, IUpdate * update)
 {
@@ -26,30 +18,6 @@ std::wostream & operator<<(std::wostream & out, IUpdate * update)
 	return out << (const wchar_t *) title;
 }
 
-std::wostream & operator<<(std::wostream & out, IUpdateDownloadResult * result)
-{
-	auto code = waffle::GetWUAErrorCode(result);
-
-	if (auto msg = waffle::GetWUAErrorMessage(code); msg != nullptr)
-	{
-		return out << msg;
-	}
-
-	return out << std::format(L"Download Result 0x{0:08X}.", code);
-}
-
-std::wostream & operator<<(std::wostream & out, IUpdateInstallationResult * result)
-{
-	auto code = waffle::GetWUAErrorCode(result);
-
-	if (auto msg = waffle::GetWUAErrorMessage(code); msg != nullptr)
-	{
-		return out << msg;
-	}
-
-	return out << std::format(L"Installation Result 0x{0:08X}.", code);
-}
-
 namespace waffle
 {
 	struct ComInitialized
@@ -68,11 +36,51 @@ namespace waffle
 		}
 	};
 
-	Session CreateSession()
+	Session CreateSession(const wchar_t * host)
 	{
 		static thread_local ComInitialized com;
 
-		return Session();
+		return Session(host);
+	}
+
+	template<class T>
+	com_ptr_t<T> CreateInstance(const wchar_t * progID, const wchar_t * host)
+	{
+		com_ptr_t<T> instance;
+
+		if (host == nullptr)
+		{
+			if (auto hr = instance.CreateInstance(progID); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			return instance;
+		}
+
+		CLSID clsid{};
+
+		if (auto hr = ::CLSIDFromProgID(progID, &clsid); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		COSERVERINFO server{ 0, const_cast<LPWSTR>(host), nullptr, 0 };
+		MULTI_QI qi{ &__uuidof(T), nullptr, S_OK };
+
+		if (auto hr = ::CoCreateInstanceEx(clsid, nullptr, CLSCTX_REMOTE_SERVER, &server, 1, &qi); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (FAILED(qi.hr))
+		{
+			throw std::system_error(qi.hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		instance.Attach(static_cast<T *>(qi.pItf));
+
+		return instance;
 	}
 
 	Updates::Updates() : m_count(0)
@@ -84,42 +92,98 @@ namespace waffle
 	}
 
 	LONG Updates::Add(IUpdate * update)
+	{
+		UpdateEntry entry{ update };
+
+		if (auto hr = update->get_Title(entry.title.GetAddress()); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		entry.updateID = GetUpdateIdentity(update).first;
+
+		return Add(entry);
+	}
+
+	LONG Updates::Add(const UpdateEntry & entry)
 	{
 		LONG index{};
 
-		if (auto hr = m_updates->Add(update, &index); FAILED(hr))
+		if (auto hr = m_updates->Add(entry.update, &index); FAILED(hr))
 		{
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
+		m_entries.push_back(entry);
+		m_snapshot.reset();
+
 		++m_count;
 
 		return index;
 	}
 
-	Session::Session() : m_rebootRequired(false)
+	void Updates::SetSnapshot(UpdateSnapshot snapshot)
 	{
-		if (auto hr = m_session.CreateInstance("Microsoft.Update.Session"); FAILED(hr))
+		if (snapshot.size() != m_count)
 		{
-			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			throw std::invalid_argument(MACRO_SOURCE_LOCATION());
 		}
 
-		if (auto hr = m_session->put_ClientApplicationID(_bstr_t("waffle")); FAILED(hr))
+		m_snapshot = std::make_shared<const UpdateSnapshot>(std::move(snapshot));
+	}
+
+	Updates Updates::Subset(const std::vector<LONG> & indexes) const
+	{
+		Updates subset;
+
+		for (auto index : indexes)
 		{
-			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			subset.Add(Entry(index));
+		}
+
+		if (m_snapshot)
+		{
+			subset.m_snapshot = std::make_shared<const UpdateSnapshot>(m_snapshot->Select(indexes));
 		}
 
-		com_ptr_t<ISystemInformation> sysinfo;
+		return subset;
+	}
+
+	std::wostream & operator<<(std::wostream & out, const UpdateEntry & entry)
+	{
+		return out << (const wchar_t *) entry.title;
+	}
 
-		if (auto hr = sysinfo.CreateInstance(L"Microsoft.Update.SystemInfo"); FAILED(hr))
+	std::wostream & operator<<(std::wostream & out, const ResultMessage & message)
+	{
+		if (auto msg = GetWUAErrorMessage(message.code); msg != nullptr)
+		{
+			return out << msg;
+		}
+
+		return out << std::format(L"{} Result 0x{:08X}.", message.operation, message.code);
+	}
+
+	Session::Session(const wchar_t * host) : m_rebootRequired(false), m_remote(host != nullptr), m_filter(nullptr), m_filtered(0), m_downloadPriority(0)
+	{
+		m_session = CreateInstance<IUpdateSession>(L"Microsoft.Update.Session", host);
+
+		if (auto hr = m_session->put_ClientApplicationID(_bstr_t("waffle")); FAILED(hr))
 		{
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
+		auto sysinfo = CreateInstance<ISystemInformation>(L"Microsoft.Update.SystemInfo", host);
+
 		m_rebootRequired = GetRebootRequired(sysinfo);
 	}
 
-	Updates Session::Search(BSTR criteria, unsigned long timeout)
+	void Session::UseService(BSTR serviceID)
+	{
+		m_serviceID = serviceID;
+	}
+
+	com_ptr_t<IUpdateSearcher> Session::CreateSearcher()
 	{
 		com_ptr_t<IUpdateSearcher> searcher;
 
@@ -128,10 +192,71 @@ namespace waffle
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
-		Asynchronous asynchronous(&IUpdateSearcher::BeginSearch, &IUpdateSearcher::EndSearch, &ISearchCompletedCallback::Invoke);
+		if (m_serviceID.length() == 0)
+		{
+			return searcher;
+		}
+
+		// https://learn.microsoft.com/en-us/windows/win32/wua_sdk/using-wua-to-scan-for-updates-offline
+
+		if (auto hr = searcher->put_ServerSelection(ssOthers); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (auto hr = searcher->put_ServiceID(m_serviceID); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return searcher;
+	}
+
+	com_ptr_t<IUpdateDownloader> Session::CreateDownloader(Updates & updates)
+	{
+		com_ptr_t<IUpdateDownloader> downloader;
+
+		if (auto hr = m_session->CreateUpdateDownloader(&downloader); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (auto hr = downloader->put_Updates(updates); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		// 優先度はジョブを始めるときに決まる (0 なら WUA の既定のまま)
+		if (auto priority = m_downloadPriority.load(); priority != 0)
+		{
+			if (auto hr = downloader->put_Priority((DownloadPriority) priority); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+
+		return downloader;
+	}
+
+	com_ptr_t<IUpdateInstaller> Session::CreateInstaller(Updates & updates)
+	{
+		com_ptr_t<IUpdateInstaller> installer;
+
+		if (auto hr = m_session->CreateUpdateInstaller(&installer); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (auto hr = installer->put_Updates(updates); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
 
-		auto result = asynchronous.Wait(timeout, searcher, criteria);
+		return installer;
+	}
 
+	com_ptr_t<IUpdateCollection> GetSearchUpdates(ISearchResult * result)
+	{
 		if (auto code = GetOperationCode(result); code != orcSucceeded)
 		{
 			ValidateOperationCode(code, MACRO_SOURCE_LOCATION());
@@ -144,6 +269,20 @@ namespace waffle
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
+		return items;
+	}
+
+	com_ptr_t<IUpdateCollection> Session::RunSearch(IUpdateSearcher * searcher, BSTR criteria, unsigned long timeout)
+	{
+		SessionBackend backend(*this, searcher);
+
+		m_orchestrator.Search(backend, criteria != nullptr ? criteria : L"", timeout);
+
+		return backend.Items();
+	}
+
+	Updates Session::Collect(IUpdateCollection * items, std::vector<SearchCacheRecord> * records)
+	{
 		LONG count = 0;
 
 		if (auto hr = items->get_Count(&count); FAILED(hr))
@@ -151,131 +290,499 @@ namespace waffle
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
-		Updates updates;
+		// プロパティの取得は 1 件ごとに COM を何度も呼ぶので、MTA のワーカースレッドに分けて並べる
+		std::vector<com_ptr_t<IUpdate>> fetched(count);
+		std::vector<UpdateSnapshot::Row> rows(count);
+		std::vector<std::uint8_t> rebootRequired(count);
 
-		for (LONG index = 0; index < count; ++index)
+		ParallelFor(count, std::clamp(std::thread::hardware_concurrency(), 1u, 8u), [&](LONG index)
 		{
-			com_ptr_t<IUpdate> item;
+			thread_local ComInitialized com;
 
-			if (auto hr = items->get_Item(index, &item); FAILED(hr))
+			if (auto hr = items->get_Item(index, &fetched[index]); FAILED(hr))
 			{
 				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 			}
 
 			com_ptr_t<IUpdate2> update2;
 
-			if (auto hr = item->QueryInterface(&update2); FAILED(hr))
+			if (auto hr = fetched[index]->QueryInterface(&update2); FAILED(hr))
 			{
 				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 			}
 
 			if (GetRebootRequired(update2))
+			{
+				rebootRequired[index] = 1;
+
+				// キャッシュには UpdateID だけ残す (引き直すときは除く)
+				if (records != nullptr)
+				{
+					auto [updateID, revisionNumber] = GetUpdateIdentity(fetched[index]);
+
+					rows[index].updateID = (const wchar_t *) updateID;
+					rows[index].revisionNumber = revisionNumber;
+				}
+
+				return;
+			}
+
+			rows[index] = GetSnapshotRow(fetched[index]);
+		});
+
+		if (records != nullptr)
+		{
+			records->reserve(records->size() + count);
+
+			for (LONG index = 0; index < count; ++index)
+			{
+				auto & row = rows[index];
+
+				records->push_back({ ParseUpdateID(_bstr_t(row.updateID.c_str())), row.revisionNumber, rebootRequired[index], row.minDownloadSize, row.maxDownloadSize });
+			}
+		}
+
+		Updates updates;
+		std::vector<UpdateSnapshot::Row> kept;
+
+		for (LONG index = 0; index < count; ++index)
+		{
+			if (rebootRequired[index])
 			{
 				m_rebootRequired = true;
 				continue;
 			}
 
-			updates.Add(item);
+			auto & row = rows[index];
+
+			if (m_filter != nullptr && !(*m_filter)(row))
+			{
+				++m_filtered;
+				continue;
+			}
+
+			auto added = updates.Add(UpdateEntry{ fetched[index], _bstr_t(row.title.c_str()), _bstr_t(row.updateID.c_str()) });
+
+			if (auto trace = m_orchestrator.Trace(); trace != nullptr)
+			{
+				trace->Record(TraceEvent::Update, added, (LONG) row.severity, S_OK, row.impact, row.minDownloadSize, row.maxDownloadSize, row.rebootBehavior);
+			}
+
+			kept.push_back(std::move(row));
 		}
 
+		updates.SetSnapshot(UpdateSnapshot(std::move(kept)));
+
 		return updates;
 	}
 
-	void Session::Download(Updates & updates, DownloadCallback callback)
+	Updates Session::Search(BSTR criteria, unsigned long timeout)
+	{
+		auto searcher = CreateSearcher();
+
+		return Collect(RunSearch(searcher, criteria, timeout));
+	}
+
+	Updates Session::Search(BSTR criteria, unsigned long timeout, SearchCache & cache)
 	{
-		com_ptr_t<IUpdateDownloader> donwloader;
+		auto searcher = CreateSearcher();
+
+		auto key = HashCriteria(criteria, m_serviceID);
+		auto historyCount = GetTotalHistoryCount(searcher);
+		auto rebootRequired = m_rebootRequired;
 
-		if (auto hr = m_session->CreateUpdateDownloader(&donwloader); FAILED(hr))
+		if (auto records = cache.Lookup(key, historyCount, rebootRequired); records)
 		{
-			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			// キャッシュした UpdateID をオフライン (ローカルのデータストア) で引き直す
+
+			std::vector<SearchCacheRecord> offline;
+			bool cachedRebootRequired = false;
+
+			for (auto & record : *records)
+			{
+				if (record.rebootRequired)
+					cachedRebootRequired = true;
+				else
+					offline.push_back(record);
+			}
+
+			if (offline.empty())
+			{
+				cache.Hit();
+				m_rebootRequired = m_rebootRequired || cachedRebootRequired;
+				return Updates();
+			}
+
+			if (auto updates = SearchOffline(offline); updates)
+			{
+				cache.Hit();
+				m_rebootRequired = m_rebootRequired || cachedRebootRequired;
+				return std::move(*updates);
+			}
 		}
 
-		if (auto hr = donwloader->put_Updates(updates); FAILED(hr))
+		cache.Miss();
+
+		std::vector<SearchCacheRecord> records;
+
+		auto updates = Collect(RunSearch(searcher, criteria, timeout), &records);
+
+		cache.Store(key, historyCount, rebootRequired, records);
+
+		return updates;
+	}
+
+	std::optional<Updates> Session::SearchOffline(const std::vector<SearchCacheRecord> & records)
+	{
+		// 記録しておいた UpdateID をオフライン (ローカルのデータストア) で引き直す。全部そろわなければ諦める
+
+		auto searcher = CreateSearcher();
+
+		if (auto hr = searcher->put_Online(VARIANT_FALSE); FAILED(hr))
 		{
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
-		Asynchronous asynchronous(&IUpdateDownloader::BeginDownload, &IUpdateDownloader::EndDownload, &IDownloadCompletedCallback::Invoke);
+		com_ptr_t<ISearchResult> result;
 
-		auto result = asynchronous.Wait(INFINITE, donwloader, ProgressChangedCallback(updates, callback, &IDownloadProgressChangedCallback::Invoke));
+		if (auto hr = searcher->Search(_bstr_t(FormatSearchCacheCriteria(records).c_str()), &result); FAILED(hr) || GetOperationCode(result) != orcSucceeded)
+		{
+			return std::nullopt;
+		}
+
+		com_ptr_t<IUpdateCollection> items;
 
-		if (auto code = GetWUAErrorCode(result); FAILED(code))
+		if (auto hr = result->get_Updates(&items); FAILED(hr))
 		{
-			throw std::system_error(code, std::system_category(), MACRO_SOURCE_LOCATION());
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
-		if (auto code = GetOperationCode(result); code != orcSucceeded)
+		// filter で除いた更新も、そろったうちに数える
+		auto filtered = m_filtered;
+
+		if (auto updates = Collect(items); updates.size() + (LONG) (m_filtered - filtered) == (LONG) records.size())
 		{
-			ValidateOperationCode(code, MACRO_SOURCE_LOCATION());
+			return updates;
 		}
+
+		return std::nullopt;
 	}
 
-	void Session::Install(Updates & updates, InstallationCallback callback)
+	auto GetUpdateResult(IDownloadResult * result, LONG index)
 	{
-		com_ptr_t<IUpdateInstaller> installer;
+		com_ptr_t<IUpdateDownloadResult> item;
 
-		if (auto hr = m_session->CreateUpdateInstaller(&installer); FAILED(hr))
+		if (auto hr = result->GetUpdateResult(index, &item); FAILED(hr))
 		{
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
-		if (auto hr = installer->put_Updates(updates); FAILED(hr))
+		return item;
+	}
+
+	auto GetUpdateResult(IInstallationResult * result, LONG index)
+	{
+		com_ptr_t<IUpdateInstallationResult> item;
+
+		if (auto hr = result->GetUpdateResult(index, &item); FAILED(hr))
 		{
 			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
 
-		Asynchronous asynchronous(&IUpdateInstaller::BeginInstall, &IUpdateInstaller::EndInstall, &IInstallationCompletedCallback::Invoke);
+		return item;
+	}
+
+	SessionBackend::SessionBackend(Session & session, IUpdateSearcher * searcher) : m_session(session), m_updates(nullptr), m_searcher(searcher)
+	{}
 
-		auto result = asynchronous.Wait(INFINITE, installer, ProgressChangedCallback(updates, callback, &IInstallationProgressChangedCallback::Invoke));
+	SessionBackend::SessionBackend(Session & session, Updates & updates) : m_session(session), m_updates(&updates)
+	{}
 
-		if (auto code = GetWUAErrorCode(result); FAILED(code))
+	LONG SessionBackend::Search(const std::wstring & criteria, unsigned long timeout)
+	{
+		com_ptr_t<ISearchResult> result;
+
+		if (m_session.m_remote)
 		{
-			throw std::system_error(code, std::system_category(), MACRO_SOURCE_LOCATION());
+			// リモートでは同期の Search() だけが使える (timeout は効かない)
+			if (auto hr = m_searcher->Search(_bstr_t(criteria.c_str()), &result); FAILED(hr))
+			{
+				throw std::system_error(hr, WUACategory());
+			}
 		}
+		else
+		{
+			Asynchronous asynchronous(&IUpdateSearcher::BeginSearch, &IUpdateSearcher::EndSearch, &ISearchCompletedCallback::Invoke);
 
-		if (auto code = GetOperationCode(result); code != orcSucceeded)
+			result = asynchronous.Wait(timeout, m_searcher, _bstr_t(criteria.c_str()));
+		}
+
+		m_items = GetSearchUpdates(result);
+
+		LONG count = 0;
+
+		if (auto hr = m_items->get_Count(&count); FAILED(hr))
 		{
-			ValidateOperationCode(code, MACRO_SOURCE_LOCATION());
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return count;
+	}
+
+	Updates SessionBackend::Select(const std::vector<LONG> & updates) const
+	{
+		// 全部をそのままの順で使うなら、集め直さない
+		if ((LONG) updates.size() == m_updates->size() && std::is_sorted(updates.begin(), updates.end()))
+		{
+			return *m_updates;
 		}
 
-		m_rebootRequired = GetRebootRequired(result);
+		return m_updates->Subset(updates);
 	}
 
-	CompleteEvent::CompleteEvent()
+	template<class Result>
+	JobResult GetJobResult(Result * result, LONG count)
 	{
-		m_event = ::CreateEvent(nullptr, true, false, nullptr);
+		JobResult job{ GetOperationCode(result), GetWUAErrorCode(result) };
 
-		if (m_event == nullptr)
+		for (LONG index = 0; index < count; ++index)
 		{
-			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			auto item = GetUpdateResult(result, index);
+
+			job.updates.push_back({ GetOperationCode(item), GetWUAErrorCode(item) });
 		}
+
+		return job;
 	}
 
-	CompleteEvent::~CompleteEvent()
+	JobResult SessionBackend::Download(const std::vector<LONG> & indexes, const DownloadProgressCallback & progress, const DownloadPoll & poll)
 	{
-		::CloseHandle(m_event);
+		auto updates = Select(indexes);
+		auto downloader = m_session.CreateDownloader(updates);
+
+		if (m_session.m_remote)
+		{
+			// リモートでは同期の Download() だけが使える。進捗も中止も無いので、終わってから更新ごとの結果を通知する
+			com_ptr_t<IDownloadResult> result;
+
+			if (auto hr = downloader->Download(&result); FAILED(hr))
+			{
+				throw std::system_error(hr, WUACategory());
+			}
+
+			auto job = GetJobResult(static_cast<IDownloadResult *>(result), updates.size());
+
+			for (LONG index = 0; index < (LONG) job.updates.size(); ++index)
+			{
+				progress(index, job.updates[index].code, DownloadProgressValues(job.updates[index].hresult, (index + 1) * 100 / updates.size(), 100, 0, 0));
+			}
+
+			return job;
+		}
+
+		Asynchronous asynchronous(&IUpdateDownloader::BeginDownload, &IUpdateDownloader::EndDownload, &IDownloadCompletedCallback::Invoke);
+		DownloadProgressChangedCallback callback(updates.size(), progress);
+
+		// 1 秒ごとにダウンロード済みのバイト数を渡す
+		auto result = asynchronous.Wait(1000, downloader, callback, [&](IDownloadJob * job)
+		{
+			com_ptr_t<IDownloadProgress> current;
+
+			if (auto hr = job->GetProgress(&current); FAILED(hr))
+			{
+				return false;
+			}
+
+			auto [total, bytes] = GetTotalBytes(current);
+
+			return poll(total, bytes);
+		});
+
+		callback.Finish(static_cast<IDownloadResult *>(result));
+
+		return GetJobResult(static_cast<IDownloadResult *>(result), updates.size());
 	}
 
-	void CompleteEvent::Wait(unsigned long timeout)
+	JobResult SessionBackend::Install(const std::vector<LONG> & indexes, const InstallationProgressCallback & progress)
 	{
-		auto wait = ::WaitForSingleObject(m_event, timeout);
+		// パイプラインではインストールのスレッドから呼ばれる
+		static thread_local ComInitialized com;
 
-		if (wait == WAIT_TIMEOUT)
+		auto updates = Select(indexes);
+		auto installer = m_session.CreateInstaller(updates);
+
+		com_ptr_t<IInstallationResult> result;
+
+		if (m_session.m_remote)
 		{
-			throw std::runtime_error("timeout");
+			// リモートでは同期の Install() だけが使える。終わってから更新ごとの結果を通知する
+			if (auto hr = installer->Install(&result); FAILED(hr))
+			{
+				throw std::system_error(hr, WUACategory());
+			}
+
+			for (LONG index = 0; index < updates.size(); ++index)
+			{
+				auto item = GetUpdateResult(static_cast<IInstallationResult *>(result), index);
+
+				progress(index, GetOperationCode(item), InstallationProgressValues(GetWUAErrorCode(item), (index + 1) * 100 / updates.size(), 100));
+			}
 		}
+		else
+		{
+			Asynchronous asynchronous(&IUpdateInstaller::BeginInstall, &IUpdateInstaller::EndInstall, &IInstallationCompletedCallback::Invoke);
+
+			InstallationProgressChangedCallback callback(updates.size(), progress);
+
+			result = asynchronous.Wait(INFINITE, installer, callback);
 
-		if (wait != WAIT_OBJECT_0)
+			callback.Finish(static_cast<IInstallationResult *>(result));
+		}
+
+		auto job = GetJobResult(static_cast<IInstallationResult *>(result), updates.size());
+
+		job.rebootRequired = GetRebootRequired(result);
+
+		return job;
+	}
+
+	bool SessionBackend::IsDownloaded(LONG update)
+	{
+		return GetIsDownloaded(m_updates->Item(update));
+	}
+
+	bool SessionBackend::IsInstalled(LONG update)
+	{
+		return GetIsInstalled(m_updates->Item(update));
+	}
+
+	void Session::Download(Updates & updates, DownloadCallback callback)
+	{
+		SessionBackend backend(*this, updates);
+
+		m_orchestrator.Download(backend, Sequence(updates.size()), [&](LONG index, OperationResultCode code, const DownloadProgress & progress)
 		{
-			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			callback(index, code, updates.Entry(index), progress);
+		});
+	}
+
+	void Session::Install(Updates & updates, InstallationCallback callback)
+	{
+		SessionBackend backend(*this, updates);
+
+		m_orchestrator.Install(backend, Sequence(updates.size()), [&](LONG index, OperationResultCode code, const InstallationProgress & progress)
+		{
+			callback(index, code, updates.Entry(index), progress);
+		});
+	}
+
+	void Session::DownloadAndInstall(Updates & updates, DownloadCallback download, InstallationCallback install)
+	{
+		SessionBackend backend(*this, updates);
+
+		m_orchestrator.DownloadAndInstall(backend, Sequence(updates.size()), [&](LONG index, OperationResultCode code, const DownloadProgress & progress)
+		{
+			download(index, code, updates.Entry(index), progress);
+		},
+		[&](LONG index, OperationResultCode code, const InstallationProgress & progress)
+		{
+			install(index, code, updates.Entry(index), progress);
+		});
+	}
+
+	Task<Updates> Session::SearchAsync(Scheduler & scheduler, _bstr_t criteria, unsigned long timeout, Cancellation * cancellation)
+	{
+		auto searcher = CreateSearcher();
+
+		// リモートでは BeginSearch が使えないので、このスレッドで待つ (やり直しは呼ぶ側が受け持つ)
+		if (m_remote)
+		{
+			SessionBackend backend(*this, searcher);
+
+			backend.Search(criteria.length() > 0 ? (const wchar_t *) criteria : L"", timeout);
+
+			co_return Collect(backend.Items());
 		}
+
+		auto result = co_await AsyncOperation(scheduler, &IUpdateSearcher::BeginSearch, &IUpdateSearcher::EndSearch, &ISearchCompletedCallback::Invoke, searcher, criteria, timeout, cancellation);
+
+		co_return Collect(GetSearchUpdates(result));
+	}
+
+	Task<LONG> SearchInto(Session & session, Scheduler & scheduler, _bstr_t criteria, unsigned long timeout, std::optional<Updates> & found)
+	{
+		found = co_await session.SearchAsync(scheduler, criteria, timeout);
+
+		co_return found->size();
 	}
 
-	void CompleteEvent::Notify()
+	Task<void> SearchEach(Session & session, Orchestrator & orchestrator, Scheduler & scheduler, _bstr_t criteria, unsigned long timeout, std::optional<Updates> & found, SearchCallback callback)
 	{
-		if (!::SetEvent(m_event))
+		auto start = std::chrono::steady_clock::now();
+
+		// 一時的なエラーは、ほかの条件の検索を止めずに待ってやり直す
+		co_await orchestrator.SearchAsync(scheduler, [&]() { return SearchInto(session, scheduler, criteria, timeout, found); });
+
+		if (callback)
 		{
-			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+			callback(criteria, found->size(), std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start));
+		}
+	}
+
+	Updates Session::Search(const std::vector<_bstr_t> & criteria, unsigned long timeout, SearchCallback callback)
+	{
+		// 条件ごとの検索を同時に走らせ、UpdateID とリビジョンで重複を除いてまとめる
+
+		Scheduler scheduler;
+
+		std::vector<std::optional<Updates>> found(criteria.size());
+
+		for (size_t i = 0; i < criteria.size(); ++i)
+		{
+			scheduler.Spawn(SearchEach(*this, m_orchestrator, scheduler, criteria[i], timeout, found[i], callback));
+		}
+
+		scheduler.Run();
+
+		Updates updates;
+		std::vector<UpdateSnapshot::Row> rows;
+		std::set<std::pair<std::wstring, LONG>> identities;
+
+		for (auto & each : found)
+		{
+			auto snapshot = each->Snapshot();
+
+			for (LONG index = 0; index < each->size(); ++index)
+			{
+				auto & entry = each->Entry(index);
+				auto revision = snapshot != nullptr ? snapshot->RevisionNumber(index) : GetUpdateIdentity(entry.update).second;
+
+				if (identities.emplace((const wchar_t *) entry.updateID, revision).second)
+				{
+					updates.Add(entry);
+
+					if (snapshot != nullptr)
+					{
+						rows.push_back(snapshot->GetRow(index));
+					}
+				}
+			}
+		}
+
+		// まとめた結果にもスナップショットを引き継ぐ (どれかの結果に無ければ付けない)
+		if ((LONG) rows.size() == updates.size())
+		{
+			updates.SetSnapshot(UpdateSnapshot(std::move(rows)));
+		}
+
+		return updates;
+	}
+
+	FileHandle::~FileHandle()
+	{
+		if (*this)
+		{
+			::CloseHandle(m_handle);
 		}
 	}
 
@@ -318,138 +825,231 @@ namespace waffle
 		return { GetTotalBytesToDownload(progress), GetTotalBytesDownloaded(progress) };
 	}
 
-	void ValidateOperationCode(OperationResultCode code, const char * what)
+	std::pair<_bstr_t, LONG> GetUpdateIdentity(IUpdate * update)
 	{
-		switch (code)
+		com_ptr_t<IUpdateIdentity> identity;
+
+		if (auto hr = update->get_Identity(&identity); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		_bstr_t updateID;
+
+		if (auto hr = identity->get_UpdateID(updateID.GetAddress()); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		LONG revisionNumber{};
+
+		if (auto hr = identity->get_RevisionNumber(&revisionNumber); FAILED(hr))
 		{
-		case orcNotStarted:
-			throw std::runtime_error(std::string(what) + ": Not Started.");
-		case orcInProgress:
-			throw std::runtime_error(std::string(what) + ": In Pogress.");
-		case orcSucceeded:
-		case orcSucceededWithErrors:
-			return;
-		case orcFailed:
-			throw std::runtime_error(std::string(what) + ": Failed.");
-		case orcAborted:
-			throw std::runtime_error(std::string(what) + ": Aborted.");
-		default:
-			throw std::runtime_error(std::format("{}: code({}).", what, (int) code));
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
 		}
+
+		return { updateID, revisionNumber };
 	}
-}
 
-#define MACRO_ERROR_MESSAGE(code, message) case code: return message
+	GUID ParseUpdateID(BSTR updateID)
+	{
+		GUID guid{};
 
-const char * waffle::GetWUAErrorMessage(LONG code)
-{
-	// https://learn.microsoft.com/en-us/windows/win32/wua_sdk/wua-success-and-error-codes-
-	// https://learn.microsoft.com/en-us/troubleshoot/windows-client/deployment/common-windows-update-errors
-
-	switch (code)
-	{
-		MACRO_ERROR_MESSAGE(WU_S_SERVICE_STOP, "WUA was stopped successfully.");
-		MACRO_ERROR_MESSAGE(WU_S_SELFUPDATE, "WUA updated itself.");
-		MACRO_ERROR_MESSAGE(WU_S_UPDATE_ERROR, "The operation completed successfully but errors occurred applying the updates.");
-		MACRO_ERROR_MESSAGE(WU_S_MARKED_FOR_DISCONNECT, "A callback was marked to be disconnected later because the request to disconnect the operation came while a callback was executing.");
-		MACRO_ERROR_MESSAGE(WU_S_REBOOT_REQUIRED, "The system must be restarted to complete installation of the update.");
-		MACRO_ERROR_MESSAGE(WU_S_ALREADY_INSTALLED, "The update to be installed is already installed on the system.");
-		MACRO_ERROR_MESSAGE(WU_S_ALREADY_UNINSTALLED, "The update to be removed is not installed on the system.");
-		MACRO_ERROR_MESSAGE(WU_S_ALREADY_DOWNLOADED, "The update to be downloaded has already been downloaded.");
-		MACRO_ERROR_MESSAGE(WU_S_UH_INSTALLSTILLPENDING, "The installation operation for the update is still in progress.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_SERVICE, "WUA was unable to provide the service.");
-		MACRO_ERROR_MESSAGE(WU_E_MAX_CAPACITY_REACHED, "The maximum capacity of the service was exceeded.");
-		MACRO_ERROR_MESSAGE(WU_E_UNKNOWN_ID, "WUA cannot find an ID.");
-		MACRO_ERROR_MESSAGE(WU_E_NOT_INITIALIZED, "The object could not be initialized.");
-		MACRO_ERROR_MESSAGE(WU_E_RANGEOVERLAP, "The update handler requested a byte range overlapping a previously requested range.");
-		MACRO_ERROR_MESSAGE(WU_E_TOOMANYRANGES, "The requested number of byte ranges exceeds the maximum number.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALIDINDEX, "The index to a collection was invalid.");
-		MACRO_ERROR_MESSAGE(WU_E_ITEMNOTFOUND, "The key for the item queried could not be found.");
-		MACRO_ERROR_MESSAGE(WU_E_OPERATIONINPROGRESS, "Another conflicting operation was in progress. Some operations such as installation cannot be performed twice simultaneously.");
-		MACRO_ERROR_MESSAGE(WU_E_COULDNOTCANCEL, "Cancellation of the operation was not allowed.");
-		MACRO_ERROR_MESSAGE(WU_E_NOOP, "No operation was required.");
-		MACRO_ERROR_MESSAGE(WU_E_XML_MISSINGDATA, "WUA could not find required information in the update's XML data.");
-		MACRO_ERROR_MESSAGE(WU_E_CYCLE_DETECTED, "Circular update relationships were detected in the metadata.");
-		MACRO_ERROR_MESSAGE(WU_E_TOO_DEEP_RELATION, "Update relationships too deep to evaluate were evaluated.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_RELATIONSHIP, "An invalid update relationship was detected.");
-		MACRO_ERROR_MESSAGE(WU_E_REG_VALUE_INVALID, "An invalid registry value was read.");
-		MACRO_ERROR_MESSAGE(WU_E_DUPLICATE_ITEM, "Operation tried to add a duplicate item to a list.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_INSTALL_REQUESTED, "Updates that are requested for install are not installable by the caller.");
-		MACRO_ERROR_MESSAGE(WU_E_INSTALL_NOT_ALLOWED, "Operation tried to install while another installation was in progress or the system was pending a mandatory restart.");
-		MACRO_ERROR_MESSAGE(WU_E_NOT_APPLICABLE, "Operation was not performed because there are no applicable updates.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_USERTOKEN, "Operation failed because a required user token is missing.");
-		MACRO_ERROR_MESSAGE(WU_E_EXCLUSIVE_INSTALL_CONFLICT, "An exclusive update can't be installed with other updates at the same time.");
-		MACRO_ERROR_MESSAGE(WU_E_POLICY_NOT_SET, "A policy value was not set.");
-		MACRO_ERROR_MESSAGE(WU_E_SELFUPDATE_IN_PROGRESS, "The operation could not be performed because the Windows Update Agent is self-updating.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_UPDATE, "An update contains invalid metadata.");
-		MACRO_ERROR_MESSAGE(WU_E_SERVICE_STOP, "Operation did not complete because the service or system was being shut down.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_CONNECTION, "Operation did not complete because the network connection was unavailable.");
-		MACRO_ERROR_MESSAGE(WU_E_TIME_OUT, "Operation did not complete because it timed out.");
-		MACRO_ERROR_MESSAGE(WU_E_EULAS_DECLINED, "The license terms for all updates were declined.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_UPDATE, "There are no updates.");
-		MACRO_ERROR_MESSAGE(WU_E_USER_ACCESS_DISABLED, "Group Policy settings prevented access to Windows Update.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_UPDATE_TYPE, "The type of update is invalid.");
-		MACRO_ERROR_MESSAGE(WU_E_URL_TOO_LONG, "The URL exceeded the maximum length.");
-		MACRO_ERROR_MESSAGE(WU_E_UNINSTALL_NOT_ALLOWED, "The update could not be uninstalled because the request did not originate from a Windows Server Update Services (WSUS) server.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_PRODUCT_LICENSE, "Search may have missed some updates before there is an unlicensed application on the system.");
-		MACRO_ERROR_MESSAGE(WU_E_MISSING_HANDLER, "A component required to detect applicable updates was missing.");
-		MACRO_ERROR_MESSAGE(WU_E_LEGACYSERVER, "An operation did not complete because it requires a newer version of server.");
-		MACRO_ERROR_MESSAGE(WU_E_BIN_SOURCE_ABSENT, "A delta-compressed update could not be installed because it required the source.");
-		MACRO_ERROR_MESSAGE(WU_E_SOURCE_ABSENT, "A full-file update could not be installed because it required the source.");
-		MACRO_ERROR_MESSAGE(WU_E_WU_DISABLED, "Access to an unmanaged server is not allowed.");
-		MACRO_ERROR_MESSAGE(WU_E_CALL_CANCELLED_BY_POLICY, "Operation did not complete because the **DisableWindowsUpdateAccess** policy was set in the registry.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_PROXY_SERVER, "The format of the proxy list was invalid.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_FILE, "The file is in the wrong format.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_CRITERIA, "The search criteria string was invalid.");
-		MACRO_ERROR_MESSAGE(WU_E_EULA_UNAVAILABLE, "License terms could not be downloaded.");
-		MACRO_ERROR_MESSAGE(WU_E_DOWNLOAD_FAILED, "Update failed to download.");
-		MACRO_ERROR_MESSAGE(WU_E_UPDATE_NOT_PROCESSED, "The update was not processed.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_OPERATION, "The object's current state did not allow the operation.");
-		MACRO_ERROR_MESSAGE(WU_E_NOT_SUPPORTED, "The functionality for the operation is not supported.");
-		MACRO_ERROR_MESSAGE(WU_E_TOO_MANY_RESYNC, "Agent is asked by server to resync too many times.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_SERVER_CORE_SUPPORT, "The WUA API method does not run on the server core installation.");
-		MACRO_ERROR_MESSAGE(WU_E_SYSPREP_IN_PROGRESS, "Service is not available while sysprep is running.");
-		MACRO_ERROR_MESSAGE(WU_E_UNKNOWN_SERVICE, "The update service is no longer registered with automatic updates.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_UI_SUPPORT, "No support for the WUA user interface.");
-		MACRO_ERROR_MESSAGE(WU_E_PER_MACHINE_UPDATE_ACCESS_DENIED, "Only administrators can perform this operation on per-computer updates.");
-		MACRO_ERROR_MESSAGE(WU_E_UNSUPPORTED_SEARCHSCOPE, "A search was attempted with a scope that is not currently supported for this type of search.");
-		MACRO_ERROR_MESSAGE(WU_E_BAD_FILE_URL, "The URL does not point to a file.");
-		MACRO_ERROR_MESSAGE(WU_E_INVALID_NOTIFICATION_INFO, "The featured update notification info returned by the server is invalid.");
-		MACRO_ERROR_MESSAGE(WU_E_OUTOFRANGE, "The data is out of range.");
-		MACRO_ERROR_MESSAGE(WU_E_SETUP_IN_PROGRESS, "WUA operations are not available while operating system setup is running.");
-		MACRO_ERROR_MESSAGE(WU_E_UNEXPECTED, "An operation failed due to reasons not covered by another error code.");
-		MACRO_ERROR_MESSAGE(WU_E_WINHTTP_INVALID_FILE, "The downloaded file has an unexpected content type.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_BAD_REQUEST, "Same as HTTP status 400 - The server could not process the request due to invalid syntax.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_DENIED, "Same as HTTP status 401 - The requested resource requires user authentication.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_FORBIDDEN, "Same as HTTP status 403 - Server understood the request, but declines to fulfill it.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_NOT_FOUND, "Same as HTTP status 404 - The server cannot find the requested URI (Uniform Resource Identifier).");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_BAD_METHOD, "Same as HTTP status 405 - The HTTP method is not allowed.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_REQUEST_TIMEOUT, "Same as HTTP status 408 - The server timed out waiting for the request.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_CONFLICT, "Same as HTTP status 409 - The request was not completed due to a conflict with the current state of the resource.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_GONE, "Same as HTTP status 410 - Requested resource is no longer available at the server.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_SERVER_ERROR, "Same as HTTP status 500 - An error internal to the server prevented fulfilling the request.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_NOT_SUPPORTED, "Same as HTTP status 501 - Server does not support the functionality required to fulfill the request. ");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_BAD_GATEWAY, "Same as HTTP status 502 - The server, while acting as a gateway or proxy, received an invalid response from the upstream server it accessed in attempting to fulfill the request.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_GATEWAY_TIMEOUT, "Same as HTTP status 504 - The request was timed out waiting for a gateway.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_VERSION_NOT_SUP, "Same as HTTP status 505 - The server does not support the HTTP protocol version used for the request.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_NOT_MAPPED, "The request could not be completed and the reason did not correspond to any of the WU_E_PT_HTTP_* error codes.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_WINHTTP_NAME_NOT_RESOLVED, "Same as ERROR_WINHTTP_NAME_NOT_RESOLVED - The proxy server or target server name cannot be resolved.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_ECP_SUCCEEDED_WITH_ERRORS, "External .cab file processing completed with some errors.\nThis error can be caused by the Lightspeed Rocket for web filtering software. \r\nAdd the IP addresses of devices you want to get updates to the exceptions list of Lightspeed Rocket.");
-		MACRO_ERROR_MESSAGE(WU_E_UH_INVALIDMETADATA, "A handler operation couldn't be completed because the update contains invalid metadata.\nRename the software redistribution folder and try to download the updates again: \r\nRename the following folders to *.BAK: \r\n-*%systemroot%\\system32\\catroot2* \r\nType the following commands at a command prompt. Press ENTER after you type each command.\r\n- `Ren %systemroot%\\SoftwareDistribution\\DataStore *.bak`\r\n- `Ren %systemroot%\\SoftwareDistribution\\Download *.bak`\r\n- `Ren %systemroot%\\system32\\catroot2 *.bak`");
-		MACRO_ERROR_MESSAGE(WU_E_ALL_UPDATES_FAILED, "failed for all the updates. Multiple root causes for this error.\ncommon issue is that antivirus software is blocking access to certain folders (like SoftwareDistribution). CBS.log analysis needed to determine the file or folder being protected.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_PROXY_AUTH_REQ, "as HTTP status 407 - proxy authentication is required.\nUnable to authenticate through a proxy server. | Either the Winhttp proxy or WinInet proxy settings aren't configured correctly. This error generally means that the Windows Update Agent was unable to connect to the update servers or your own update source, such as WSUS, Configuration Manager, or Microsoft Endpoint Manager, due to a proxy error. \r\n Verify the proxy settings on the client. The Windows Update Agent uses WinHTTP to scan for available updates. When there's a proxy server between the client and the update source, the proxy settings must be configured correctly on the clients to enable them to communicate by using the source's FQDN. \r\n Check with your network and proxy teams to confirm that the device can the update source without the proxy requiring user authentication.");
-		MACRO_ERROR_MESSAGE(WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL, "as HTTP status 503 - the service is temporarily overloaded.\nUnable to connect to the configured update source. | Network troubleshooting needed to resolve the connectivity issue. Check with your network and proxy teams to confirm that the device can the update source without the proxy requiring user authentication.");
-		MACRO_ERROR_MESSAGE(WU_E_NO_INTERACTIVE_USER, "Operation didn't complete because no interactive user is signed in.\nSign in to the device to start the installation and allow the device to restart.");
-		MACRO_ERROR_MESSAGE(WU_E_UH_POSTREBOOTSTILLPENDING, "The post-restart operation for the update is still in progress.\nSome Windows updates require the device to be restarted. Restart the device to complete update installation.");
-		MACRO_ERROR_MESSAGE(WU_E_DM_UNAUTHORIZED_LOCAL_USER, "The download failed because the local user was denied authorization to download the content.\nEnsure that the user attempting to download and install updates has been provided with sufficient privileges to install updates (Local Administrator).");
-		MACRO_ERROR_MESSAGE(WU_E_CALL_CANCELLED, "Operation was canceled. | The operation was canceled by the user or service.\nmight also receive this error when we're unable to filter the results.");
-		MACRO_ERROR_MESSAGE(WU_E_XML_INVALID, "Windows Update Agent found information in the update's XML data that isn't valid.\nCertain drivers contain more metadata information in Update.xml, which Orchestrator can interpret as data that isn't valid. Ensure that you have the latest Windows Update Agent installed on the device.");
-		MACRO_ERROR_MESSAGE(WU_E_SETUP_SKIP_UPDATE, "An update to the Windows Update Agent was skipped due to a directive in the Wuident.cab file.\nYou might encounter this error when WSUS isn't sending the self-update to the clients.\r\nFor more information to resolve the issue, review [KB920659](/troubleshoot/windows-server/deployment/wsus-selfupdate-not-send-automatic-updates).");
-		MACRO_ERROR_MESSAGE(WU_E_PT_SOAPCLIENT_SOAPFAULT, "SOAP client failed because there was a SOAP fault for reasons of `WU_E_PT_SOAP_*` error codes.\nThis issue occurs because Windows can't renew the cookies for Windows Update.  \r\nFor more information to resolve the issue, see [0x80244007 error when Windows tries to scan for updates on a WSUS server](https://support.microsoft.com/topic/0x80244007-error-when-windows-tries-to-scan-for-updates-on-a-wsus-server-6af342d9-9af6-f3bb-b6ad-2be56bf7826e).");
-		MACRO_ERROR_MESSAGE(WININET_E_CONNECTION_ABORTED, "The connection with the server was closed abnormally, BITS is unable to transfer the file successfully.\nEncountered if BITS is broken or if the file being transferred can't be written to the destination folder on the client. This error is caused by connection errors while checking or downloading updates.\r\n From a cmd prompt run: `BITSADMIN /LIST /ALLUSERS /VERBOSE` \r\n Search for the 0x80072EFE error code. You should see a reference to an HTTP code with a specific file. Using a browser, try to download it manually, making sure you're using your organization's proxy settings. If the download fails, check with your proxy manager to allow for the communication to be sucesfull. Also check with your network team for this specific URL access.");
-		MACRO_ERROR_MESSAGE(WININET_E_DECODING_FAILED, "Content decoding has failed, TLS 1.2 isn't configured correctly on the client.\nThis error generally means that the Windows Update Agent was unable to decode the received content. Install and configure TLS 1.2 by installing the update in [KB3140245](https://support.microsoft.com/topic/update-to-enable-tls-1-1-and-tls-1-2-as-default-secure-protocols-in-winhttp-in-windows-c4bd73d2-31d7-761e-0178-11268bb10392).");
-		MACRO_ERROR_MESSAGE(WININET_E_TIMEOUT, "The operation timed out, Unable to scan for updates due to a connectivity issue to Windows Update, Configuration Manager, or WSUS.\nThis error generally means that the Windows Update Agent was unable to connect to the update servers or your own source, such as WSUS, Configuration Manager, or Microsoft Endpoint Manager. \r\n Check with your network team to ensure that the device can reach the update sources. For more info, see [Troubleshoot software update scan failures in Configuration Manager](/troubleshoot/mem/configmgr/troubleshoot-software-update-scan-failures). \r\n If you're using the public Microsoft update servers, check that your device can access the following Windows Update endpoints: \r\n `http://windowsupdate.microsoft.com` \r\n `https://*.windowsupdate.microsoft.com` \r\n `https://update.microsoft.com` \r\n `https://*.update.microsoft.com` \r\n `https://windowsupdate.com` \r\n `https://*.windowsupdate.com` \r\n `https://download.windowsupdate.com` \r\n `https://*.download.windowsupdate.com` \r\n `https://download.microsoft.com` \r\n `https://*.download.windowsupdate.com` \r\n `https://wustat.windows.com` \r\n `https://*.wustat.windows.com` \r\n `https://ntservicepack.microsoft.com`");
-	default:
-		return nullptr;
+		if (auto hr = ::CLSIDFromString(_bstr_t(L"{") + _bstr_t(updateID) + _bstr_t(L"}"), &guid); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return guid;
+	}
+
+	ULONGLONG GetSystemTimeAsULONGLONG()
+	{
+		FILETIME time{};
+
+		::GetSystemTimeAsFileTime(&time);
+
+		return ((ULONGLONG) time.dwHighDateTime << 32) | time.dwLowDateTime;
+	}
+
+	bool GetIsDownloaded(IUpdate * update)
+	{
+		VARIANT_BOOL downloaded{};
+
+		if (auto hr = update->get_IsDownloaded(&downloaded); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return (downloaded == VARIANT_TRUE);
+	}
+
+	bool GetIsInstalled(IUpdate * update)
+	{
+		VARIANT_BOOL installed{};
+
+		if (auto hr = update->get_IsInstalled(&installed); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return (installed == VARIANT_TRUE);
+	}
+
+	std::pair<ULONGLONG, ULONGLONG> GetDownloadSize(IUpdate * update)
+	{
+		DECIMAL min{}, max{};
+
+		if (auto hr = update->get_MinDownloadSize(&min); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (auto hr = update->get_MaxDownloadSize(&max); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (min.Hi32 != 0 || max.Hi32 != 0)
+		{
+			throw std::overflow_error(MACRO_SOURCE_LOCATION());
+		}
+
+		return { min.Lo64, max.Lo64 };
+	}
+
+	std::vector<LONG> GetKBArticleIDs(IUpdate * update)
+	{
+		com_ptr_t<IStringCollection> ids;
+
+		if (auto hr = update->get_KBArticleIDs(&ids); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		LONG count{};
+
+		if (auto hr = ids->get_Count(&count); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		std::vector<LONG> kbs;
+
+		for (LONG index = 0; index < count; ++index)
+		{
+			_bstr_t id;
+
+			if (auto hr = ids->get_Item(index, id.GetAddress()); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			if (auto kb = std::wcstol(id.length() > 0 ? (const wchar_t *) id : L"", nullptr, 10); kb > 0)
+			{
+				kbs.push_back(kb);
+			}
+		}
+
+		return kbs;
+	}
+
+	std::vector<std::wstring> GetCategoryNames(IUpdate * update)
+	{
+		com_ptr_t<ICategoryCollection> categories;
+
+		if (auto hr = update->get_Categories(&categories); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		LONG count{};
+
+		if (auto hr = categories->get_Count(&count); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		std::vector<std::wstring> names;
+
+		for (LONG index = 0; index < count; ++index)
+		{
+			com_ptr_t<ICategory> category;
+
+			if (auto hr = categories->get_Item(index, &category); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			_bstr_t name;
+
+			if (auto hr = category->get_Name(name.GetAddress()); FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+
+			names.emplace_back(name.length() > 0 ? (const wchar_t *) name : L"");
+		}
+
+		return names;
+	}
+
+	UpdateSnapshot::Row GetSnapshotRow(IUpdate * update)
+	{
+		_bstr_t title;
+
+		if (auto hr = update->get_Title(title.GetAddress()); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		auto [updateID, revisionNumber] = GetUpdateIdentity(update);
+		auto [min, max] = GetDownloadSize(update);
+		auto behavior = GetInstallBehavior(update);
+
+		return UpdateSnapshot::Row
+		{
+			title.length() > 0 ? (const wchar_t *) title : L"",
+			updateID.length() > 0 ? (const wchar_t *) updateID : L"",
+			revisionNumber,
+			min,
+			max,
+			GetMsrcSeverity(update),
+			behavior.impact,
+			behavior.rebootBehavior,
+			GetIsDownloaded(update),
+			GetKBArticleIDs(update),
+			GetCategoryNames(update),
+		};
+	}
+
+	LONG GetTotalHistoryCount(IUpdateSearcher * searcher)
+	{
+		LONG count{};
+
+		if (auto hr = searcher->GetTotalHistoryCount(&count); FAILED(hr))
+		{
+			throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return count;
+	}
+
+	std::wstring GetStateDirectory()
+	{
+		wchar_t path[MAX_PATH]{};
+
+		if (auto length = ::ExpandEnvironmentStringsW(L"%ProgramData%\\waffle", path, MAX_PATH); length == 0 || length > MAX_PATH)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		if (!::CreateDirectoryW(path, nullptr) && ::GetLastError() != ERROR_ALREADY_EXISTS)
+		{
+			throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+		}
+
+		return path;
 	}
 }
+
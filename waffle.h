@@ -1,35 +1,79 @@
 #pragma once
 #pragma comment(lib, "wuguid")
 
-#define WIN32_LEAN_AND_MEAN
-#include <windows.h>
+#include "core.h"
+
 #include <comdef.h>
-#include <wuapi.h>
-#include <wuerror.h>
 
 template<typename T>
 using com_ptr_t = _com_ptr_t<_com_IIID<T, &__uuidof(T)>>;
 
+#include <set>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <cstdlib>
+#include <cstring>
 #include <format>
+#include <optional>
 #include <utility>
 #include <iostream>
 #include <functional>
 #include <system_error>
+#include <condition_variable>
+
+#include "trace.h"
+#include "retry.h"
+#include "backend.h"
+#include "snapshot.h"
+#include "throughput.h"
+#include "orchestrator.h"
 
-std::wostream & operator<<(std::wostream & out, const char * wcs);
 std::wostream & operator<<(std::wostream & out, IUpdate * update);
-std::wostream & operator<<(std::wostream & out, IUpdateDownloadResult * result);
-std::wostream & operator<<(std::wostream & out, IUpdateInstallationResult * result);
 
 namespace waffle
 {
 	class Session;
+	class SearchCache;
+	struct SearchCacheRecord;
+	class Scheduler;
+	class Cancellation;
+	class UpdateFilter;
+
+	template<class T>
+	class Task;
+
+	Session CreateSession(const wchar_t * host = nullptr);
+
+	// 進捗の通知のたびに COM を呼ばないよう、追加した時点で引いておく
+
+	struct UpdateEntry
+	{
+		com_ptr_t<IUpdate> update;
+		_bstr_t title;
+		_bstr_t updateID;
+	};
+
+	std::wostream & operator<<(std::wostream & out, const UpdateEntry & entry);
+
+	// 結果の HRESULT を、WUA のエラーなら既知のメッセージで書く (そうでなければ「Download Result 0x...」)
+	struct ResultMessage
+	{
+		const wchar_t * operation;
+		LONG code;
+	};
+
+	std::wostream & operator<<(std::wostream & out, const ResultMessage & message);
 
-	Session CreateSession();
+	using DownloadCallback = std::function<void(long, OperationResultCode, const UpdateEntry &, const DownloadProgress &)>;
+	using InstallationCallback = std::function<void(long, OperationResultCode, const UpdateEntry &, const InstallationProgress &)>;
 
-	using DownloadCallback = std::function<void(long, OperationResultCode, IUpdate *, IUpdateDownloadResult *, IDownloadProgress *)>;
-	using InstallationCallback = std::function<void(long, OperationResultCode, IUpdate *, IUpdateInstallationResult *, IInstallationProgress *)>;
+	// 検索条件ごとの結果 (条件, 件数, 所要時間)
+	using SearchCallback = std::function<void(const _bstr_t &, LONG, std::chrono::milliseconds)>;
 
 	class Updates
 	{
@@ -37,11 +81,37 @@ namespace waffle
 
 		com_ptr_t<IUpdateCollection> m_updates;
 
+		std::vector<UpdateEntry> m_entries;
+
+		// 検索の直後に引いたプロパティ (Add() で更新を足すと捨てる)
+		std::shared_ptr<const UpdateSnapshot> m_snapshot;
+
 	public:
 		Updates();
 		~Updates() = default;
 
 		LONG Add(IUpdate * update);
+		LONG Add(const UpdateEntry & entry);
+
+		const UpdateEntry & Entry(LONG index) const
+		{
+			return m_entries.at(index);
+		}
+
+		com_ptr_t<IUpdate> Item(LONG index) const
+		{
+			return m_entries.at(index).update;
+		}
+
+		const UpdateSnapshot * Snapshot() const noexcept
+		{
+			return m_snapshot.get();
+		}
+
+		void SetSnapshot(UpdateSnapshot snapshot);
+
+		// indexes の順に選んだ更新を集める (スナップショットも同じ行だけ引き継ぐ)
+		Updates Subset(const std::vector<LONG> & indexes) const;
 
 		bool empty() const noexcept
 		{
@@ -66,45 +136,208 @@ namespace waffle
 
 	class Session
 	{
+		friend class SessionBackend;
+
 		bool m_rebootRequired;
 
+		// リモートの WUA では Begin で始める非同期の呼び出しが使えない
+		bool m_remote;
+
+		_bstr_t m_serviceID;
+
+		// やり直しや止まったジョブの扱いは WUA に依存しない部分に任せる
+		Orchestrator m_orchestrator;
+
+		const UpdateFilter * m_filter;
+		unsigned long m_filtered;
+
+		// DownloadPriority (0 は既定)。負荷を見る別のスレッドからも変える
+		std::atomic<LONG> m_downloadPriority;
+
 		com_ptr_t<IUpdateSession> m_session;
 
+		com_ptr_t<IUpdateSearcher> CreateSearcher();
+		com_ptr_t<IUpdateDownloader> CreateDownloader(Updates & updates);
+		com_ptr_t<IUpdateInstaller> CreateInstaller(Updates & updates);
+		com_ptr_t<IUpdateCollection> RunSearch(IUpdateSearcher * searcher, BSTR criteria, unsigned long timeout);
+		// records があれば、検索のキャッシュに書くレコードを全件 (filter で除いた更新、再起動待ちの更新も) 足す
+		Updates Collect(IUpdateCollection * items, std::vector<SearchCacheRecord> * records = nullptr);
+
 	public:
-		Session();
+		// host を指定すると、そのコンピューターの WUA にリモートで接続する
+		explicit Session(const wchar_t * host = nullptr);
 		~Session() = default;
 
+		void UseService(BSTR serviceID);
+
+		bool Remote() const noexcept
+		{
+			return m_remote;
+		}
+
+		void SetStallTimeout(unsigned long msTimeout, unsigned long restarts = 3)
+		{
+			m_orchestrator.SetStallTimeout(msTimeout, restarts);
+		}
+
+		void SetRetryPolicy(const RetryPolicy & policy, RetryCallback callback = nullptr)
+		{
+			m_orchestrator.SetRetryPolicy(policy, callback);
+		}
+
+		// 検索、ダウンロード、インストールで WUA とやり取りした内容を記録する (nullptr でやめる)
+		void SetTrace(TraceRecorder * trace)
+		{
+			m_orchestrator.SetTrace(trace);
+		}
+
+		// これから始めるダウンロードのジョブの優先度 (始まったジョブには効かない。InterruptDownload() で作り直させる)
+		void SetDownloadPriority(DownloadPriority priority)
+		{
+			m_downloadPriority = priority;
+		}
+
+		// 今のダウンロードのジョブを中止し、まだ終わっていない更新で作り直させる。別のスレッドから呼んでよい
+		void InterruptDownload() noexcept
+		{
+			m_orchestrator.Interrupt();
+		}
+
+		// ダウンロードのジョブを始める (作り直す) 直前に呼ばれる (nullptr でやめる)
+		void SetDownloadGate(DownloadGate gate)
+		{
+			m_orchestrator.SetDownloadGate(gate);
+		}
+
+		// 検索の結果を Updates に加える前に、filter の手元で評価する部分で絞り込む (nullptr でやめる)
+		void SetFilter(const UpdateFilter * filter)
+		{
+			m_filter = filter;
+		}
+
 		Updates Search(BSTR criteria, unsigned long timeout);
+		Updates Search(BSTR criteria, unsigned long timeout, SearchCache & cache);
+		Updates Search(const std::vector<_bstr_t> & criteria, unsigned long timeout, SearchCallback callback = nullptr);
+
+		// 記録しておいた更新をオンラインで検索せずに引き直す (全部そろわなければ std::nullopt)
+		std::optional<Updates> SearchOffline(const std::vector<SearchCacheRecord> & records);
 
 		void Download(Updates & updates, DownloadCallback callback);
 		void Install(Updates & updates, InstallationCallback callback);
 
+		void DownloadAndInstall(Updates & updates, DownloadCallback download, InstallationCallback install);
+
+		// co_await で待つ版。Scheduler::Run() を回すスレッドで使う (awaitable.h)
+		Task<Updates> SearchAsync(Scheduler & scheduler, _bstr_t criteria, unsigned long timeout, Cancellation * cancellation = nullptr);
+
 		bool RebootRequired()
 		{
-			return m_rebootRequired;
+			return m_rebootRequired || m_orchestrator.RebootRequired();
+		}
+
+		const Throughput & DownloadThroughput() const noexcept
+		{
+			return m_orchestrator.DownloadThroughput();
+		}
+
+		unsigned long Stalls() const noexcept
+		{
+			return m_orchestrator.Stalls();
+		}
+
+		unsigned long Retries() const noexcept
+		{
+			return m_orchestrator.Retries();
+		}
+
+		// filter で除いた更新の数
+		unsigned long Filtered() const noexcept
+		{
+			return m_filtered;
+		}
+	};
+
+	// Session の WUA を Backend として使う
+	//
+	// 検索では見つかった更新を、ダウンロードとインストールでは updates の中の番号で指す。
+	class SessionBackend : public Backend
+	{
+		Session & m_session;
+		Updates * m_updates;
+
+		com_ptr_t<IUpdateSearcher> m_searcher;
+		com_ptr_t<IUpdateCollection> m_items;
+
+		Updates Select(const std::vector<LONG> & updates) const;
+
+	public:
+		SessionBackend(Session & session, IUpdateSearcher * searcher);
+		SessionBackend(Session & session, Updates & updates);
+		~SessionBackend() override = default;
+
+		LONG Search(const std::wstring & criteria, unsigned long timeout) override;
+
+		JobResult Download(const std::vector<LONG> & updates, const DownloadProgressCallback & progress, const DownloadPoll & poll) override;
+		JobResult Install(const std::vector<LONG> & updates, const InstallationProgressCallback & progress) override;
+
+		bool IsDownloaded(LONG update) override;
+		bool IsInstalled(LONG update) override;
+
+		// Search() で見つかった更新
+		IUpdateCollection * Items() const noexcept
+		{
+			return m_items;
 		}
 	};
 
-	class CompleteEvent
+	class FileHandle
 	{
-		HANDLE m_event;
+		HANDLE m_handle;
 
 	public:
-		CompleteEvent();
-		~CompleteEvent();
+		FileHandle(HANDLE handle) : m_handle(handle)
+		{}
 
-		CompleteEvent(const CompleteEvent &) = delete;
-		CompleteEvent & operator=(const CompleteEvent &) = delete;
+		~FileHandle();
+
+		FileHandle(const FileHandle &) = delete;
+		FileHandle & operator=(const FileHandle &) = delete;
+
+		explicit operator bool() const noexcept
+		{
+			return m_handle != INVALID_HANDLE_VALUE && m_handle != nullptr;
+		}
 
-		void Wait(unsigned long timeout);
-		void Notify();
+		operator HANDLE() const noexcept
+		{
+			return m_handle;
+		}
 	};
 
 	std::pair<ULONGLONG, ULONGLONG> GetTotalBytes(IDownloadProgress * progress);
 
-	void ValidateOperationCode(OperationResultCode code, const char * what);
+	std::pair<_bstr_t, LONG> GetUpdateIdentity(IUpdate * update);
+
+	GUID ParseUpdateID(BSTR updateID);
+
+	ULONGLONG GetSystemTimeAsULONGLONG();
+
+	bool GetIsDownloaded(IUpdate * update);
+
+	bool GetIsInstalled(IUpdate * update);
 
-	const char * GetWUAErrorMessage(LONG code);
+	std::pair<ULONGLONG, ULONGLONG> GetDownloadSize(IUpdate * update);
+
+	std::vector<LONG> GetKBArticleIDs(IUpdate * update);
+
+	std::vector<std::wstring> GetCategoryNames(IUpdate * update);
+
+	// スナップショットの 1 行分のプロパティを引く (MTA のワーカースレッドからも呼ぶ)
+	UpdateSnapshot::Row GetSnapshotRow(IUpdate * update);
+
+	LONG GetTotalHistoryCount(IUpdateSearcher * searcher);
+
+	std::wstring GetStateDirectory();
 
 	template<class T>
 	struct Unknown : public T
@@ -162,10 +395,7 @@ namespace waffle
 
 			if (auto hr = (worker->*m_beginMethod)(arg, this, state, &job); FAILED(hr))
 			{
-				if (auto msg = waffle::GetWUAErrorMessage(hr); msg != nullptr)
-					throw std::runtime_error(msg);
-				else
-					throw std::system_error(hr, std::system_category(), __FUNCTION__);
+				throw std::system_error(hr, WUACategory());
 			}
 
 			return job;
@@ -177,10 +407,7 @@ namespace waffle
 
 			if (auto hr = (worker->*m_endMethod)(job, &result); FAILED(hr))
 			{
-				if (auto msg = waffle::GetWUAErrorMessage(hr); msg != nullptr)
-					throw std::runtime_error(msg);
-				else
-					throw std::system_error(hr, std::system_category(), __FUNCTION__);
+				throw std::system_error(hr, WUACategory());
 			}
 
 			return result;
@@ -192,23 +419,28 @@ namespace waffle
 
 			auto job = Begin(worker, arg, state);
 
-			try
-			{
-				m_completeEvent.Wait(msTimeout);
+			return CompleteJob(job, [&]() { m_completeEvent.Wait(msTimeout); }, [&]() { return End(worker, job); });
+		}
 
-				auto result = End(worker, job);
+		// 完了を待つ間、msInterval ごとに poll(job) を呼ぶ。poll が true を返したらジョブを中止する
+		template<class Poll>
+		auto Wait(unsigned long msInterval, Worker * worker, BeginArg arg, Poll poll)
+		{
+			_variant_t state;
 
-				job->CleanUp();
+			auto job = Begin(worker, arg, state);
 
-				return result;
-			}
-			catch (const std::exception &)
+			return CompleteJob(job, [&]()
 			{
-				job->RequestAbort();
-				job->CleanUp();
-
-				throw;
-			}
+				for (bool aborted = false; !m_completeEvent.WaitFor(aborted ? INFINITE : msInterval); )
+				{
+					if (poll(static_cast<Job *>(job)))
+					{
+						job->RequestAbort();
+						aborted = true;
+					}
+				}
+			}, [&]() { return End(worker, job); });
 		}
 
 		HRESULT STDMETHODCALLTYPE Invoke(Job *, CallbackArgs *) override
@@ -226,79 +458,26 @@ namespace waffle
 		}
 	};
 
-	template<class Job, class Callback, class CallbackArgs, class Progress, class Result>
-	class ProgressChangedCallback : public Unknown<Callback>
+	template<class Progress>
+	LONG GetPercentComplete(Progress * progress)
 	{
-		typedef HRESULT(STDMETHODCALLTYPE Callback:: * ChangedMethod)(Job *, CallbackArgs *);
-		typedef std::function<void(long, OperationResultCode, IUpdate *, Result *, Progress *)> WaffleCallback;
-
-		Updates & m_updates;
-		WaffleCallback m_callback;
-
-	public:
-		ProgressChangedCallback(Updates & updates, WaffleCallback callback, ChangedMethod changed) : m_updates(updates), m_callback(callback)
-		{}
+		LONG percent = 0;
 
-		HRESULT STDMETHODCALLTYPE Invoke(Job * job, CallbackArgs * args) override
+		if (auto hr = progress->get_PercentComplete(&percent); FAILED(hr))
 		{
-			com_ptr_t<Progress> progress;
-
-			if (auto hr = args->get_Progress(&progress); FAILED(hr))
-			{
-				return hr;
-			}
-
-			LONG index{};
-
-			if (auto hr = progress->get_CurrentUpdateIndex(&index); FAILED(hr))
-			{
-				return hr;
-			}
-
-			com_ptr_t<IUpdate> update;
-
-			if (auto hr = m_updates->get_Item(index, &update); FAILED(hr))
-			{
-				return hr;
-			}
-
-			com_ptr_t<Result> result;
-
-			if (auto hr = progress->GetUpdateResult(index, &result); FAILED(hr))
-			{
-				return hr;
-			}
-
-			OperationResultCode code{};
-
-			if (auto hr = result->get_ResultCode(&code); FAILED(hr))
-			{
-				return hr;
-			}
-
-			try
-			{
-				m_callback(index, code, update, result, progress);
-			}
-			catch (const std::system_error & e)
-			{
-				return HRESULT_FROM_WIN32(e.code().value());
-			}
-			catch (...)
-			{
-				return E_FAIL;
-			}
-
-			return S_OK;
+			throw std::system_error(hr, std::system_category(), __FUNCTION__);
 		}
-	};
 
+		return percent;
+	}
+
+	// 今の更新だけの進み具合
 	template<class Progress>
-	LONG GetPercentComplete(Progress * progress)
+	LONG GetCurrentUpdatePercent(Progress * progress)
 	{
 		LONG percent = 0;
 
-		if (auto hr = progress->get_PercentComplete(&percent); FAILED(hr))
+		if (auto hr = progress->get_CurrentUpdatePercentComplete(&percent); FAILED(hr))
 		{
 			throw std::system_error(hr, std::system_category(), __FUNCTION__);
 		}
@@ -344,4 +523,109 @@ namespace waffle
 
 		return (rebootRequired == VARIANT_TRUE);
 	}
+
+	// WUA の進捗を、値を引くたびに COM を呼ぶ Progress として渡す
+
+	template<class Base, class ComProgress, class ComResult>
+	class WUAProgress : public Base
+	{
+	protected:
+		ComProgress * m_progress;
+		ComResult * m_result;
+
+	public:
+		using Interface = ComProgress;
+		using ResultInterface = ComResult;
+
+		WUAProgress(ComProgress * progress, ComResult * result) : m_progress(progress), m_result(result)
+		{}
+
+		LONG HResult() const override
+		{
+			return m_result != nullptr ? GetWUAErrorCode(m_result) : S_OK;
+		}
+
+		LONG PercentComplete() const override
+		{
+			return GetPercentComplete(m_progress);
+		}
+
+		LONG CurrentUpdatePercentComplete() const override
+		{
+			return GetCurrentUpdatePercent(m_progress);
+		}
+	};
+
+	class WUADownloadProgress : public WUAProgress<DownloadProgress, IDownloadProgress, IUpdateDownloadResult>
+	{
+	public:
+		using WUAProgress::WUAProgress;
+
+		std::pair<ULONGLONG, ULONGLONG> TotalBytes() const override
+		{
+			return GetTotalBytes(m_progress);
+		}
+	};
+
+	using WUAInstallationProgress = WUAProgress<InstallationProgress, IInstallationProgress, IUpdateInstallationResult>;
+
+	// 進捗の通知 1 回で COM を呼ぶのは get_Progress() と get_CurrentUpdateIndex() だけにする
+	//
+	// 更新ごとの結果は、今の更新が替わったときと、ジョブが終わって Finish() を呼んだときに 1 回ずつ引く。
+
+	template<class Adapter, class Job, class Callback, class CallbackArgs>
+	class ProgressChangedCallback : public Unknown<Callback>
+	{
+		typedef std::function<void(LONG, OperationResultCode, const Adapter &)> WaffleCallback;
+
+		WaffleCallback m_callback;
+		ProgressDispatcher<com_ptr_t<typename Adapter::ResultInterface>> m_dispatcher;
+
+		// 最後に受け取った進捗 (Finish() で通知する進み具合に使う)
+		com_ptr_t<typename Adapter::Interface> m_progress;
+
+	public:
+		template<class Function>
+		ProgressChangedCallback(LONG count, const Function & callback) : m_callback(callback), m_dispatcher(count)
+		{}
+
+		HRESULT STDMETHODCALLTYPE Invoke(Job *, CallbackArgs * args) override
+		{
+			com_ptr_t<typename Adapter::Interface> progress;
+
+			if (auto hr = args->get_Progress(&progress); FAILED(hr))
+			{
+				return hr;
+			}
+
+			return m_dispatcher.Dispatch(static_cast<typename Adapter::Interface *>(progress), [&](LONG index, OperationResultCode code, typename Adapter::ResultInterface * result)
+			{
+				m_progress = progress;
+				m_callback(index, code, Adapter(progress, result));
+			});
+		}
+
+		// ジョブの結果から、まだ通知していない更新の結果を通知する (進捗の通知が 1 回も無かったジョブでは何もしない)
+		template<class Result>
+		void Finish(Result * result)
+		{
+			if (!m_progress)
+			{
+				return;
+			}
+
+			auto hr = m_dispatcher.Finish(result, [&](LONG index, OperationResultCode code, typename Adapter::ResultInterface * item)
+			{
+				m_callback(index, code, Adapter(m_progress, item));
+			});
+
+			if (FAILED(hr))
+			{
+				throw std::system_error(hr, std::system_category(), MACRO_SOURCE_LOCATION());
+			}
+		}
+	};
+
+	using DownloadProgressChangedCallback = ProgressChangedCallback<WUADownloadProgress, IDownloadJob, IDownloadProgressChangedCallback, IDownloadProgressChangedCallbackArgs>;
+	using InstallationProgressChangedCallback = ProgressChangedCallback<WUAInstallationProgress, IInstallationJob, IInstallationProgressChangedCallback, IInstallationProgressChangedCallbackArgs>;
 }
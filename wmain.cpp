@@ -4,72 +4,759 @@
 // * https://learn.microsoft.com/ja-jp/windows/win32/wua_sdk/searching--downloading--and-installing-updates
 // 
 
+#include <set>
+#include <chrono>
 #include <locale>
 #include <format>
+#include <memory>
+#include <sstream>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+#include <string_view>
 #include "waffle.h"
+#include "searchcache.h"
+#include "scanpackage.h"
+#include "events.h"
+#include "sessiontarget.h"
+#include "downloadplan.h"
+#include "installplan.h"
+#include "daemon.h"
+#include "durations.h"
+#include "journal.h"
+#include "renderer.h"
+#include "filter.h"
+#include "loadmonitor.h"
+#include "stage.h"
 
-std::wstring FormatToatalBytes(auto bytes, auto total)
+struct Callback
 {
-	const auto KB = 1024ULL;
-	const auto MB = 1024 * KB;
-	const auto GB = 1024 * MB;
+	waffle::EventLog * events = nullptr;
+	waffle::DurationModel * durations = nullptr;
+	waffle::Journal * journal = nullptr;
+	waffle::ProgressRenderer * renderer = nullptr;
+	const waffle::Throughput * throughput = nullptr;
 
-	if (auto value = (double) total / KB; value < 9.95L)
-		return std::format(L"{:.1F}/{:.1F}KB ", (double) bytes / KB, value); // 9.9KB
-	else if (value < 10.0L)
-		return std::format(L"{:d}/10KB ", bytes / KB); // !!!
+	// index ŎwXV (XibvVbgTCY)
+	const waffle::Updates * updates = nullptr;
 
-	if (total <= (99 * KB))
-		return std::format(L"{:d}/{:d}KB ", bytes / KB, total / KB); // 99KB 
+	void Record(waffle::DurationPhase phase, long index, const waffle::UpdateEntry & update)
+	{
+		// ςƎۂ̏vԂׂ悤AL^XVOɌςĂ
 
-	if (total <= (999 * KB))
-		return std::format(L"{:d}/{:d}KB ", bytes / KB, total / KB); // 999KB 
+		auto snapshot = updates != nullptr ? updates->Snapshot() : nullptr;
+		auto bytes = snapshot != nullptr && index < snapshot->size() ? snapshot->MaxDownloadSize(index) : waffle::GetDownloadSize(update.update).second;
+		auto predicted = durations->Predict(phase, update.updateID, bytes);
+		auto actual = durations->Completed(phase, update.updateID, bytes);
 
-	if (auto value = (double) total / MB; value < 9.95L)
-		return std::format(L"{:.1F}/{:.1F}MB ", (double) bytes / MB, value); // 9.9MB 
-	else if (value < 10.0L)
-		return std::format(L"{:d}/10MB ", bytes / MB); // !!!
+		if (events != nullptr)
+		{
+			(*events)("duration")("phase", phase == waffle::DurationPhase::Download ? "download" : "install")("id", (const wchar_t *) update.updateID)("predicted_ms", predicted.count())("actual_ms", actual.count());
+		}
+	}
 
-	if (total <= (99 * MB))
-		return std::format(L"{:d}/{:d}MB ", bytes / MB, total / MB); // 99MB 
+	// Ƃɂ͂_E[hς݂ (Wu͂ɏIƕ񍐂̂ŁAvԂoȂ)
+	bool AlreadyDownloaded(long index) const
+	{
+		auto snapshot = updates != nullptr ? updates->Snapshot() : nullptr;
 
-	if (total <= (999 * MB))
-		return std::format(L"{:d}/{:d}MB ", bytes / MB, total / MB); // 999MB 
+		return snapshot != nullptr && index < snapshot->size() && snapshot->Downloaded(index);
+	}
 
-	return std::format(L"{:.1F}/{:.1F}GB ", (double) bytes / GB, (double) total / GB); // 9.9GB 
-}
+	static HRESULT GetFailureCode(const waffle::Progress & progress)
+	{
+		auto hr = progress.HResult();
 
-struct Callback
+		return FAILED(hr) ? hr : E_FAIL;
+	}
+
+	void operator()(long index, OperationResultCode code, const waffle::UpdateEntry & update, const waffle::DownloadProgress & progress)
+	{
+		if (durations != nullptr && code == orcSucceeded && !AlreadyDownloaded(index))
+		{
+			Record(waffle::DurationPhase::Download, index, update);
+		}
+
+		if (journal != nullptr && code >= orcSucceeded)
+		{
+			journal->Downloaded(update.update, code == orcSucceeded ? S_OK : GetFailureCode(progress));
+		}
+
+		if (events != nullptr)
+		{
+			auto [total, bytes] = progress.TotalBytes();
+
+			(*events)("download")("index", index)("id", (const wchar_t *) update.updateID)("code", (int) code)("hresult", progress.HResult())("bytes", bytes)("total", total)("percent", progress.PercentComplete());
+			return;
+		}
+
+		if (renderer == nullptr)
+		{
+			return;
+		}
+
+		if (code < orcSucceeded)
+		{
+			// Ԉt[̂߂ɐiǂ܂Ȃ (1 񂲂ƂɃvZX܂)
+			if (renderer->Due())
+			{
+				auto [total, bytes] = progress.TotalBytes();
+
+				renderer->Update(waffle::ProgressPhase::Download, index, (const wchar_t *) update.title, progress.CurrentUpdatePercentComplete(), bytes, total, throughput != nullptr ? throughput->Rate() : 0);
+			}
+
+			return;
+		}
+
+		auto [total, bytes] = progress.TotalBytes();
+
+		std::wostringstream text;
+
+		if (code == orcSucceeded)
+			text << waffle::FormatToatalBytes(bytes, total) << update;
+		else
+			text << waffle::FormatToatalBytes(bytes, total) << update << L'\n' << L" !!! " << waffle::ResultMessage{ L"Download", progress.HResult() };
+
+		renderer->Complete(waffle::ProgressPhase::Download, index, text.str());
+	}
+
+	void operator()(long index, OperationResultCode code, const waffle::UpdateEntry & update, const waffle::InstallationProgress & progress)
+	{
+		if (durations != nullptr && code == orcSucceeded)
+		{
+			Record(waffle::DurationPhase::Install, index, update);
+		}
+
+		if (journal != nullptr && code >= orcSucceeded)
+		{
+			journal->Installed(update.update, code == orcSucceeded ? S_OK : GetFailureCode(progress));
+		}
+
+		if (events != nullptr)
+		{
+			(*events)("install")("index", index)("id", (const wchar_t *) update.updateID)("code", (int) code)("hresult", progress.HResult())("percent", progress.PercentComplete());
+			return;
+		}
+
+		if (renderer == nullptr)
+		{
+			return;
+		}
+
+		if (code < orcSucceeded)
+		{
+			if (renderer->Due())
+			{
+				renderer->Update(waffle::ProgressPhase::Install, index, (const wchar_t *) update.title, progress.CurrentUpdatePercentComplete(), 0, 0, 0);
+			}
+
+			return;
+		}
+
+		auto percent = progress.PercentComplete();
+
+		std::wostringstream text;
+
+		if (code == orcSucceeded)
+			text << std::format(L"{:3d}% ", percent) << update;
+		else
+			text << std::format(L"{:3d}% ", percent) << update << L'\n' << L" !!! " << waffle::ResultMessage{ L"Installation", progress.HResult() };
+
+		renderer->Complete(waffle::ProgressPhase::Install, index, text.str());
+	}
+};
+
+struct Options
 {
-	void operator()(long index, OperationResultCode code, IUpdate * update, IUpdateDownloadResult * result, IDownloadProgress * progress)
+	bool pipeline = false;
+	bool refresh = false;
+	bool events = false;
+	unsigned long cache = 0;
+	unsigned long stall = 0;
+	unsigned long retry = 0;
+	std::wstring cab;
+	std::vector<_bstr_t> criteria;
+	std::wstring targets;
+	unsigned long workers = 8;
+	std::vector<size_t> waves;
+	unsigned long maxFailure = 10;
+	bool plan = false;
+	unsigned long long diskBudget = 0;
+	unsigned long long batch = 1024;
+	unsigned long converge = 0;
+	bool daemon = false;
+	std::wstring query;
+	unsigned long maxAge = 300;
+	unsigned long iterations = 10;
+	unsigned long deadline = 0;
+	bool resume = true;
+	std::wstring trace;
+	std::wstring filter;
+	bool explain = false;
+	unsigned long governor = 0;
+	unsigned long maxPause = 600;
+	bool stage = false;
+	bool commit = false;
+	unsigned long stageMaxAge = 72;
+
+	static std::vector<size_t> ParseList(std::wstring_view list)
 	{
-		if (code >= orcSucceeded)
+		std::vector<size_t> values;
+
+		for (size_t pos = 0; pos <= list.size(); )
 		{
-			auto [total, bytes] = waffle::GetTotalBytes(progress);
+			auto comma = std::min(list.find(L',', pos), list.size());
 
-			if (code == orcSucceeded)
-				std::wcout << FormatToatalBytes(bytes, total) << update << std::endl;
-			else
-				std::wcout << FormatToatalBytes(bytes, total) << update << std::endl << L" !!! " << result << std::endl;
+			values.push_back(std::stoul(std::wstring(list.substr(pos, comma - pos))));
+			pos = comma + 1;
 		}
+
+		return values;
 	}
 
-	void operator()(long index, OperationResultCode code, IUpdate * update, IUpdateInstallationResult * result, IInstallationProgress * progress)
+	Options(int argc, wchar_t ** argv)
 	{
-		if (code >= orcSucceeded)
+		for (int i = 1; i < argc; ++i)
 		{
-			auto percent = waffle::GetPercentComplete(progress);
+			std::wstring_view arg(argv[i]);
 
-			if (code == orcSucceeded)
-				std::wcout << std::format(L"{:3d}% ", percent) << update << std::endl;
+			if (arg == L"--pipeline")
+				pipeline = true;
+			else if (arg == L"--refresh")
+				refresh = true;
+			else if (arg == L"--events=jsonl")
+				events = true;
+			else if (arg.starts_with(L"--cache="))
+				cache = std::stoul(std::wstring(arg.substr(8)));
+			else if (arg.starts_with(L"--stall="))
+				stall = std::stoul(std::wstring(arg.substr(8)));
+			else if (arg.starts_with(L"--retry="))
+				retry = std::stoul(std::wstring(arg.substr(8)));
+			else if (arg.starts_with(L"--criteria="))
+				criteria.emplace_back(std::wstring(arg.substr(11)).c_str());
+			else if (arg.starts_with(L"--targets="))
+				targets = arg.substr(10);
+			else if (arg.starts_with(L"--workers="))
+				workers = std::stoul(std::wstring(arg.substr(10)));
+			else if (arg.starts_with(L"--waves="))
+				waves = ParseList(arg.substr(8));
+			else if (arg.starts_with(L"--max-failure="))
+				maxFailure = std::stoul(std::wstring(arg.substr(14)));
+			else if (arg == L"--converge")
+				converge = 5;
+			else if (arg.starts_with(L"--converge="))
+				converge = std::stoul(std::wstring(arg.substr(11)));
+			else if (arg == L"--daemon")
+				daemon = true;
+			else if (arg.starts_with(L"--query="))
+				query = arg.substr(8);
+			else if (arg.starts_with(L"--max-age="))
+				maxAge = std::stoul(std::wstring(arg.substr(10)));
+			else if (arg.starts_with(L"--iterations="))
+				iterations = std::stoul(std::wstring(arg.substr(13)));
+			else if (arg.starts_with(L"--deadline="))
+				deadline = std::stoul(std::wstring(arg.substr(11)));
+			else if (arg.starts_with(L"--trace="))
+				trace = arg.substr(8);
+			else if (arg.starts_with(L"--filter="))
+				filter = arg.substr(9);
+			else if (arg == L"--explain")
+				explain = true;
+			else if (arg.starts_with(L"--governor="))
+				governor = std::stoul(std::wstring(arg.substr(11)));
+			else if (arg.starts_with(L"--max-pause="))
+				maxPause = std::stoul(std::wstring(arg.substr(12)));
+			else if (arg == L"--stage")
+				stage = true;
+			else if (arg == L"--commit")
+				commit = true;
+			else if (arg.starts_with(L"--stage-max-age="))
+				stageMaxAge = std::stoul(std::wstring(arg.substr(16)));
+			else if (arg == L"--no-resume")
+				resume = false;
+			else if (arg == L"--plan")
+				plan = true;
+			else if (arg.starts_with(L"--disk-budget="))
+				diskBudget = std::stoull(std::wstring(arg.substr(14)));
+			else if (arg.starts_with(L"--batch="))
+				batch = std::stoull(std::wstring(arg.substr(8)));
+			else if (arg.starts_with(L"--cab="))
+				cab = arg.substr(6);
 			else
-				std::wcout << std::format(L"{:3d}% ", percent) << update << std::endl << L" !!! " << result << std::endl;
+				throw std::invalid_argument(std::format("Unknown option: {}", (const char *) _bstr_t(argv[i])));
 		}
 	}
 };
 
-int wmain()
+bool IsTerminal()
+{
+	// R\[ȂAJ[\𓮂GXP[vV[PXg悤ɂ (_CNgĂ false)
+
+	auto output = ::GetStdHandle(STD_OUTPUT_HANDLE);
+
+	DWORD mode{};
+
+	if (!::GetConsoleMode(output, &mode))
+	{
+		return false;
+	}
+
+	return ::SetConsoleMode(output, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != FALSE;
+}
+
+size_t GetConsoleWidth()
+{
+	// Ԃ̍s܂ԂȂ悤AEBhĚɐ؂l߂ (Ȃ 0)
+
+	CONSOLE_SCREEN_BUFFER_INFO info{};
+
+	if (!::GetConsoleScreenBufferInfo(::GetStdHandle(STD_OUTPUT_HANDLE), &info))
+	{
+		return 0;
+	}
+
+	return (size_t) (info.srWindow.Right - info.srWindow.Left + 1);
+}
+
+template<class Function>
+void RunPhase(waffle::EventLog * events, std::string_view phase, Function function)
+{
+	// i̍s̓tF[Y̋؂ł܂Ƃ߂ătbV
+
+	auto start = std::chrono::steady_clock::now();
+
+	try
+	{
+		function();
+	}
+	catch (const std::exception & e)
+	{
+		if (events != nullptr)
+		{
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+			(*events)("phase")("phase", phase)("result", "failed")("elapsed_ms", elapsed.count())("message", e.what());
+			events->Flush();
+		}
+
+		throw;
+	}
+
+	if (events != nullptr)
+	{
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+		(*events)("phase")("phase", phase)("result", "succeeded")("elapsed_ms", elapsed.count());
+		events->Flush();
+	}
+	else
+	{
+		std::wcout.flush();
+	}
+}
+
+void PrintFilterPlan(waffle::EventLog * log, const waffle::UpdateFilter * filter, const std::vector<_bstr_t> & criteria)
+{
+	// WUA ̌ɑƁǍʂɎ茳œĂ镔
+
+	std::wstring pushed;
+
+	if (filter != nullptr)
+	{
+		for (auto & each : filter->Pushed())
+		{
+			pushed += (pushed.empty() ? L"" : L" and ") + each;
+		}
+	}
+
+	std::wstring residual = filter != nullptr ? filter->Residual() : L"";
+
+	if (log != nullptr)
+	{
+		(*log)("explain")("filter", filter != nullptr ? filter->Text() : L"")("pushed", pushed)("residual", residual);
+
+		for (auto & each : criteria)
+		{
+			(*log)("explain_criteria")("criteria", (const wchar_t *) each);
+		}
+
+		return;
+	}
+
+	std::wcout << std::format(L"Filter: {}", filter != nullptr ? filter->Text() : L"(none)") << L'\n';
+	std::wcout << std::format(L"Pushed down to WUA: {}", pushed.empty() ? L"(none)" : pushed) << L'\n';
+	std::wcout << std::format(L"Evaluated locally: {}", residual.empty() ? L"(none)" : residual) << L'\n';
+
+	for (auto & each : criteria)
+	{
+		std::wcout << std::format(L"Criteria: {}", (const wchar_t *) each) << L'\n';
+	}
+
+	std::wcout.flush();
+}
+
+void PrintDownloadPlan(waffle::EventLog * log, const waffle::Updates & updates, const waffle::DownloadPlan & plan)
+{
+	const auto MB = 1024.0 * 1024.0;
+
+	if (log != nullptr)
+	{
+		for (size_t i = 0; i < plan.Batches().size(); ++i)
+		{
+			auto & batch = plan.Batches()[i];
+
+			(*log)("download_plan")("batch", i)("critical", batch.critical)("count", batch.updates.size())("bytes", batch.bytes)("budget", plan.Budget());
+		}
+
+		for (auto & update : plan.Deferred())
+		{
+			(*log)("download_deferred")("index", update.index)("id", (const wchar_t *) updates.Entry(update.index).updateID)("bytes", update.bytes);
+		}
+
+		return;
+	}
+
+	std::wcout << std::format(L"Download plan: {} batches, budget {:.1F}MB", plan.Batches().size(), plan.Budget() / MB) << L'\n';
+
+	for (size_t i = 0; i < plan.Batches().size(); ++i)
+	{
+		auto & batch = plan.Batches()[i];
+
+		std::wcout << std::format(L" #{} {} {:.1F}MB", i + 1, batch.critical ? L"critical" : L"sjf", batch.bytes / MB) << L'\n';
+
+		for (auto & update : batch.updates)
+		{
+			std::wcout << std::format(L"   {:9} {:8.1F}MB ", waffle::GetSeverityName(update.severity), update.bytes / MB) << updates.Entry(update.index) << L'\n';
+		}
+	}
+
+	for (auto & update : plan.Deferred())
+	{
+		std::wcout << std::format(L" deferred  {:8.1F}MB ", update.bytes / MB) << updates.Entry(update.index) << L'\n';
+	}
+
+	std::wcout.flush();
+}
+
+void WaitForLoad(waffle::LoadGovernor * governor, std::chrono::milliseconds maxPause, Callback & callback)
+{
+	// ׂĎ~߂ĂԂ́AWun߂Ȃ (蒼ƂB҂̂͒Ă maxPause ܂)
+
+	if (governor == nullptr)
+	{
+		return;
+	}
+
+	if (auto waited = governor->WaitWhilePaused(maxPause); waited.count() > 0)
+	{
+		if (callback.events != nullptr)
+			(*callback.events)("download_pause")("waited_ms", waited.count())("max_pause_ms", maxPause.count());
+		else if (callback.renderer != nullptr)
+			callback.renderer->Print(std::format(L"Download paused for {} ms under load", waited.count()));
+	}
+}
+
+std::optional<std::chrono::milliseconds> DownloadByPlan(waffle::Session & session, waffle::Updates & updates, const waffle::DownloadPlan & plan, Callback callback)
+{
+	// ob`ƂɃ_E[hAŏً̋}̍XV͂܂ł̎Ԃ𑪂
+
+	std::optional<std::chrono::milliseconds> firstCritical;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < plan.Batches().size(); ++i)
+	{
+		auto & batch = plan.Batches()[i];
+		auto selected = updates.Subset(plan.Batch(i));
+
+		// --pipeline ł͌ςL^Ȃ
+		if (callback.durations != nullptr)
+		{
+			callback.durations->Start(waffle::DurationPhase::Download);
+		}
+
+		session.Download(selected, [&](long index, OperationResultCode code, const waffle::UpdateEntry & update, const waffle::DownloadProgress & progress)
+		{
+			if (code == orcSucceeded && batch.critical && !firstCritical)
+			{
+				firstCritical = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+			}
+
+			callback(batch.updates[index].index, code, update, progress);
+		});
+	}
+
+	return firstCritical;
+}
+
+void InstallByPlan(waffle::Session & session, waffle::Updates & updates, waffle::EventLog * log, Callback callback)
+{
+	auto plan = waffle::PlanInstall(updates);
+
+	for (size_t i = 0; i < plan.Batches().size(); ++i)
+	{
+		auto & batch = plan.Batches()[i];
+
+		if (log != nullptr)
+			(*log)("install_plan")("batch", i)("count", batch.indexes.size())("exclusive", batch.exclusive)("may_reboot", batch.mayReboot);
+		else
+			std::wcout << std::format(L"Install batch #{}: {} updates{}{}", i + 1, batch.indexes.size(), batch.exclusive ? L", exclusive" : L"", batch.mayReboot ? L", may reboot" : L"") << L'\n';
+	}
+
+	for (size_t i = 0; i < plan.Batches().size(); ++i)
+	{
+		auto & batch = plan.Batches()[i];
+		auto selected = updates.Subset(plan.Batch(i));
+
+		// --pipeline ł͌ςL^Ȃ
+		if (callback.durations != nullptr)
+		{
+			callback.durations->Start(waffle::DurationPhase::Install);
+		}
+
+		session.Install(selected, [&](long index, OperationResultCode code, const waffle::UpdateEntry & update, const waffle::InstallationProgress & progress)
+		{
+			callback(batch.indexes[index], code, update, progress);
+		});
+	}
+}
+
+std::vector<std::unique_ptr<waffle::Target>> LoadTargets(const std::wstring & path, const std::vector<_bstr_t> & criteria)
+{
+	// 1 s 1  (s # Ŏn܂s͓ǂݔ΂)
+
+	std::wifstream file{ std::filesystem::path(path) };
+
+	if (!file)
+	{
+		throw std::runtime_error(std::format("Cannot open: {}", (const char *) _bstr_t(path.c_str())));
+	}
+
+	std::vector<std::unique_ptr<waffle::Target>> targets;
+
+	for (std::wstring line; std::getline(file, line); )
+	{
+		if (!line.empty() && line.back() == L'\r')
+			line.pop_back();
+
+		if (line.empty() || line.front() == L'#')
+			continue;
+
+		targets.push_back(std::make_unique<waffle::SessionTarget>(line, criteria));
+	}
+
+	return targets;
+}
+
+int RunController(const Options & options, waffle::EventLog * log, const std::vector<_bstr_t> & criteria, unsigned long msTimeout)
+{
+	auto targets = LoadTargets(options.targets, criteria);
+
+	waffle::Controller controller(options.workers, options.waves, options.maxFailure / 100.0, msTimeout);
+
+	bool rebootRequired = false;
+
+	auto completed = controller.Run(targets, [&](const waffle::TargetResult & result)
+	{
+		rebootRequired = rebootRequired || result.rebootRequired;
+
+		if (log != nullptr)
+			(*log)("target")("name", result.target->Name())("wave", result.wave)("succeeded", result.succeeded)("updates", result.updates)("reboot_required", result.rebootRequired)("elapsed_ms", result.elapsed.count())("message", result.message);
+		else if (result.succeeded)
+			std::wcout << std::format(L"{}: {} updates, {} ms{}", result.target->Name(), result.updates, result.elapsed.count(), result.rebootRequired ? L", reboot required" : L"") << L'\n';
+		else
+			std::wcout << std::format(L"{}: {} ms", result.target->Name(), result.elapsed.count()) << L'\n' << L" !!! " << result.message.c_str() << L'\n';
+	},
+	[&](const waffle::WaveResult & wave)
+	{
+		if (log != nullptr)
+		{
+			(*log)("wave")("wave", wave.wave)("targets", wave.targets)("succeeded", wave.succeeded)("failed", wave.failed)("skipped", wave.skipped)("elapsed_ms", wave.elapsed.count());
+			log->Flush();
+		}
+		else
+		{
+			std::wcout << std::format(L"Wave {}: {}/{} succeeded, {} failed, {} skipped, {} ms", wave.wave + 1, wave.succeeded, wave.targets, wave.failed, wave.skipped, wave.elapsed.count()) << std::endl;
+		}
+	});
+
+	auto code = !completed ? -1 : rebootRequired ? 1 : 0;
+
+	if (log != nullptr)
+	{
+		(*log)("exit")("code", code)("circuit_open", !completed);
+		return code;
+	}
+
+	if (!completed)
+	{
+		std::wcout << L"Stopped: too many failures." << std::endl;
+	}
+
+	return code;
+}
+
+int RunQuery(const Options & options, waffle::EventLog * log, unsigned long msTimeout)
+{
+	// 풓Ă waffle --daemon ɖ₢킹
+
+	waffle::DaemonCommand command{};
+
+	if (options.query == L"status")
+		command = waffle::DaemonCommand::Status;
+	else if (options.query == L"search")
+		command = waffle::DaemonCommand::Search;
+	else if (options.query == L"download")
+		command = waffle::DaemonCommand::Download;
+	else if (options.query == L"install")
+		command = waffle::DaemonCommand::Install;
+	else if (options.query == L"shutdown")
+		command = waffle::DaemonCommand::Shutdown;
+	else
+		throw std::invalid_argument(std::format("Unknown query: {}", (const char *) _bstr_t(options.query.c_str())));
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Search ͏풓Î҂Bق͂ɓԂ
+	auto response = waffle::CallDaemon(command, options.maxAge, command == waffle::DaemonCommand::Search ? msTimeout + waffle::DAEMON_TIMEOUT : waffle::DAEMON_TIMEOUT);
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+	auto code = FAILED(response.hresult) ? -1 : response.rebootRequired ? 1 : 0;
+
+	if (log != nullptr)
+	{
+		(*log)("query")("query", options.query)("hresult", response.hresult)("updates", response.updates)("reboot_required", response.rebootRequired != 0)("busy", response.busy != 0)("search_age_ms", response.searchAgeMs)("server_us", response.elapsedUs)("round_trip_us", elapsed.count());
+		(*log)("exit")("code", code);
+		return code;
+	}
+
+	std::wcout << std::format(L"{} updates, search {} sec ago, server {:.3F} ms, round trip {:.3F} ms{}", response.updates, response.searchAgeMs / 1000, response.elapsedUs / 1000.0, elapsed.count() / 1000.0, response.busy ? L" (busy)" : L"") << std::endl;
+
+	if (FAILED(response.hresult))
+	{
+		std::wcout << L" !!! " << std::system_error(response.hresult, waffle::WUACategory()).what() << std::endl;
+	}
+	else if (response.rebootRequired)
+	{
+		std::wcout << L"Reboot Required." << std::endl;
+	}
+
+	return code;
+}
+
+int RunColdSearch(const waffle::UpdateFilter * filter, const std::vector<_bstr_t> & criteria, unsigned long msTimeout)
+{
+	// --query=benchmark NA풓ȂƂƓ (oAIR[hԂ)
+	auto session = waffle::CreateSession();
+
+	session.SetFilter(filter);
+
+	if (criteria.size() == 1)
+		session.Search(criteria.front(), msTimeout);
+	else
+		session.Search(criteria, msTimeout);
+
+	return 0;
+}
+
+void RunProcess(std::wstring command, unsigned long msTimeout)
+{
+	STARTUPINFOW startup{ sizeof(startup) };
+	PROCESS_INFORMATION process{};
+
+	if (!::CreateProcessW(nullptr, command.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+	{
+		throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+	}
+
+	waffle::FileHandle thread(process.hThread);
+	waffle::FileHandle handle(process.hProcess);
+
+	if (::WaitForSingleObject(handle, msTimeout) != WAIT_OBJECT_0)
+	{
+		::TerminateProcess(handle, (UINT) -1);
+
+		throw std::system_error(ERROR_TIMEOUT, std::system_category(), MACRO_SOURCE_LOCATION());
+	}
+
+	DWORD code{};
+
+	if (!::GetExitCodeProcess(handle, &code) || code != 0)
+	{
+		throw std::runtime_error(std::format("{}: Cold search failed ({}).", MACRO_SOURCE_LOCATION(), (int) code));
+	}
+}
+
+int RunQueryBenchmark(const Options & options, waffle::EventLog * log, unsigned long msTimeout)
+{
+	// 풓Ă waffle ւ̖₢킹 (߂ZbV) ƁAwaffle NČƂ (vZX̋NACOM ̏A
+	// ZbVƌ̍쐬܂) ̉̎ԂA݂ iterations 񂸂
+
+	wchar_t path[MAX_PATH]{};
+
+	if (auto length = ::GetModuleFileNameW(nullptr, path, MAX_PATH); length == 0 || length == MAX_PATH)
+	{
+		throw std::system_error(::GetLastError(), std::system_category(), MACRO_SOURCE_LOCATION());
+	}
+
+	// 풓ƓɂȂ悤A--criteria  --filter ̂܂ܓn
+	auto command = std::format(L"\"{}\" --query=cold", path);
+
+	for (auto & each : options.criteria)
+	{
+		command += std::format(L" \"--criteria={}\"", (const wchar_t *) each);
+	}
+
+	if (!options.filter.empty())
+	{
+		command += std::format(L" \"--filter={}\"", options.filter);
+	}
+
+	struct Kind
+	{
+		const char * name;
+		std::function<void()> run;
+		std::vector<double> samples;
+	};
+
+	Kind kinds[] =
+	{
+		{ "warm_status", [&]() { waffle::CallDaemon(waffle::DaemonCommand::Status, UINT32_MAX, waffle::DAEMON_TIMEOUT); } },
+		{ "warm_search", [&]() { waffle::CallDaemon(waffle::DaemonCommand::Search, 0, msTimeout + waffle::DAEMON_TIMEOUT); } },
+		{ "cold_search", [&]() { RunProcess(command, msTimeout + waffle::DAEMON_TIMEOUT); } },
+	};
+
+	for (unsigned long i = 0; i < options.iterations; ++i)
+	{
+		for (auto & kind : kinds)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			kind.run();
+
+			kind.samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+	}
+
+	for (auto & kind : kinds)
+	{
+		std::sort(kind.samples.begin(), kind.samples.end());
+
+		auto median = kind.samples[kind.samples.size() / 2];
+
+		if (log != nullptr)
+			(*log)("query_benchmark")("kind", kind.name)("iterations", kind.samples.size())("median_ms", median)("min_ms", kind.samples.front())("max_ms", kind.samples.back());
+		else
+			std::wcout << std::format(L"{:12} median {:10.3F} ms, min {:10.3F} ms, max {:10.3F} ms", (const wchar_t *) _bstr_t(kind.name), median, kind.samples.front(), kind.samples.back()) << std::endl;
+	}
+
+	return 0;
+}
+
+int wmain(int argc, wchar_t ** argv)
 {
 	// https://learn.microsoft.com/ja-jp/windows/win32/api/wuapi/nf-wuapi-iupdatesearcher-search#remarks
 	// https://learn.microsoft.com/ja-jp/windows/win32/wua_sdk/guidelines-for-asynchronous-wua-operations
@@ -77,22 +764,539 @@ int wmain()
 	auto szCriteria = L"IsInstalled=0 and Type='Software' and IsHidden=0";
 	auto msTimeout = 3 * 60 * 1000UL;
 
+	std::optional<waffle::EventLog> events;
+
 	try
 	{
 		std::locale::global(std::locale(""));
 
-		std::wcout << std::format(L"Searching for updates... {} sec", msTimeout / 1000) << std::endl;
+		Options options(argc, argv);
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::minutes(options.deadline);
+
+		if (options.events)
+		{
+			events.emplace(::GetStdHandle(STD_OUTPUT_HANDLE));
+		}
+
+		auto log = events ? &*events : nullptr;
+
+		// --filter ̂ WUA ŕ]ł镔͌ɑAc͌̌ʂɎ茳œĂ
+		auto criteria = options.criteria.empty() ? std::vector<_bstr_t>{ _bstr_t(szCriteria) } : options.criteria;
+
+		std::optional<waffle::UpdateFilter> filter;
+
+		if (!options.filter.empty())
+		{
+			filter.emplace(options.filter);
+
+			for (auto & each : criteria)
+			{
+				each = filter->PushDown((const wchar_t *) each).c_str();
+			}
+		}
+
+		if (options.explain)
+		{
+			PrintFilterPlan(log, filter ? &*filter : nullptr, criteria);
+			return 0;
+		}
+
+		if (options.stage && options.commit)
+		{
+			throw std::invalid_argument("--stage and --commit cannot be used together");
+		}
+
+		if (!options.targets.empty())
+		{
+			if (filter && !filter->Residual().empty())
+			{
+				throw std::invalid_argument(std::format("--targets takes only filters that WUA evaluates (category = {{GUID}}, updateid): {}", (const char *) _bstr_t(filter->Residual().c_str())));
+			}
+
+			return RunController(options, log, criteria, msTimeout);
+		}
+
+		if (options.query == L"cold")
+		{
+			return RunColdSearch(filter ? &*filter : nullptr, criteria, msTimeout);
+		}
+
+		if (options.query == L"benchmark")
+		{
+			if (options.iterations == 0)
+			{
+				throw std::invalid_argument("--iterations must be at least 1");
+			}
+
+			return RunQueryBenchmark(options, log, msTimeout);
+		}
+
+		if (!options.query.empty())
+		{
+			return RunQuery(options, log, msTimeout);
+		}
+
+		if (log == nullptr)
+		{
+			std::wcout << std::format(L"Searching for updates... {} sec", msTimeout / 1000) << std::endl;
+		}
 
 		auto session = waffle::CreateSession();
-		auto updates = session.Search(_bstr_t(szCriteria), msTimeout);
 
-		if (!updates.empty())
+		session.SetFilter(filter ? &*filter : nullptr);
+
+		// íA[Ȃ炻̏ŕ`AłȂΏIXV 1 s
+		std::optional<waffle::ProgressRenderer> renderer;
+
+		if (log == nullptr)
+		{
+			renderer.emplace([](std::wstring_view text) { std::wcout.write(text.data(), text.size()).flush(); }, IsTerminal(), std::chrono::milliseconds(100), GetConsoleWidth());
+		}
+
+		if (options.stall > 0)
 		{
-			session.Download(updates, Callback{});
-			session.Install(updates, Callback{});
+			session.SetStallTimeout(options.stall * 1000);
 		}
 
-		if (!session.RebootRequired())
+		if (options.retry > 0)
+		{
+			session.SetRetryPolicy(waffle::RetryPolicy(options.retry), [log, &renderer](const char * phase, unsigned long attempt, LONG code, std::chrono::milliseconds delay)
+			{
+				auto msg = waffle::GetWUAErrorMessage(code);
+
+				if (log != nullptr)
+				{
+					(*log)("retry")("phase", phase)("attempt", attempt)("hresult", code)("delay_ms", delay.count())("message", msg);
+					return;
+				}
+
+				std::wostringstream text;
+
+				text << std::format(L"Retrying {} ({}) in {} ms: 0x{:08X} ", (const wchar_t *) _bstr_t(phase), attempt, delay.count(), (unsigned long) code) << (msg != nullptr ? msg : "");
+
+				renderer->Print(text.str());
+			});
+		}
+
+		//  (Linux ł) Đł悤AWUA Ƃ̂L^
+		std::optional<waffle::TraceRecorder> trace;
+
+		if (!options.trace.empty())
+		{
+			trace.emplace(std::filesystem::path(options.trace));
+			session.SetTrace(&*trace);
+		}
+
+		// _E[h̊ԁA}Vׂ̕ɍ킹ėDxςAׂ΃Wu~߂đ҂
+		std::optional<waffle::LoadGovernor> governor;
+
+		if (options.governor > 0)
+		{
+			governor.emplace(session, options.governor, [log, &renderer](waffle::DownloadLevel level, const waffle::LoadSample & sample, double load)
+			{
+				if (log != nullptr)
+				{
+					(*log)("download_priority")("level", waffle::GetDownloadLevelName(level))("cpu", sample.cpu)("disk", sample.disk)("network", sample.network)("load", load);
+					return;
+				}
+
+				renderer->Print(std::format(L"Download priority: {} (cpu {:.0F}%, disk {:.0F}%, network {:.0F}%, load {:.0F}%)", (const wchar_t *) _bstr_t(waffle::GetDownloadLevelName(level)), sample.cpu, sample.disk, sample.network, load));
+			});
+		}
+
+		auto maxPause = std::chrono::milliseconds(options.maxPause * 1000);
+
+		std::optional<waffle::ScanPackage> package;
+
+		if (!options.cab.empty())
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			package.emplace(options.cab, waffle::GetStateDirectory() + L"\\scanpackage.dat");
+			session.UseService(package->ServiceID());
+
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+			if (log != nullptr)
+				(*log)("scan_package")("reused", package->Reused())("elapsed_ms", elapsed.count());
+			else
+				std::wcout << std::format(L"Scan package: {} ({} ms)", package->Reused() ? L"reused" : L"registered", elapsed.count()) << std::endl;
+		}
+
+		if (options.daemon)
+		{
+			waffle::Daemon daemon(session, criteria, msTimeout);
+
+			daemon.Run();
+			return 0;
+		}
+
+		std::optional<waffle::SearchCache> cache;
+
+		if (options.cache > 0 || options.refresh)
+		{
+			cache.emplace(waffle::GetStateDirectory() + L"\\search.idx", options.cache, options.refresh);
+		}
+
+		// vԂ̋L^ (--pipeline ł̓_E[hƃCXg[dȂ̂ŋL^Ȃ)
+		waffle::DurationModel durations(waffle::GetStateDirectory() + L"\\durations.dat");
+
+		// šo߂L^ĂArŎ~܂s͎c̍XVĊJ
+		waffle::Journal journal(waffle::GetStateDirectory() + L"\\journal.dat");
+
+		std::wstring criteriaText;
+
+		for (auto & each : criteria)
+		{
+			criteriaText += (const wchar_t *) each;
+			criteriaText += L'\n';
+		}
+
+		if (filter)
+		{
+			criteriaText += filter->Residual();
+		}
+
+		auto criteriaHash = waffle::HashCriteria(_bstr_t(criteriaText.c_str()), package ? package->ServiceID() : nullptr);
+
+		// --stage Ń_E[h܂ōς܂XV (--commit ŃCXg[)
+		waffle::StagedSet staged(waffle::GetStateDirectory() + L"\\staged.dat");
+
+		auto progress = renderer ? &*renderer : nullptr;
+
+		Callback callback{ log, options.pipeline ? nullptr : &durations, &journal, progress, &session.DownloadThroughput() };
+
+		// --converge ̂Ƃ́ACXg[ĐVɌXVȂ܂ŌJԂ
+
+		std::set<std::wstring> previous;
+
+		for (unsigned long pass = 1; ; ++pass)
+		{
+			std::optional<waffle::Updates> updates;
+
+			auto passStart = std::chrono::steady_clock::now();
+
+			// --commit ł́AXe[WXV̂_E[hςł̂A_E[hɃCXg[
+			// (L^ÂȂĂ΁Aǂ茟ă_E[h)
+			auto committing = false;
+
+			if (pass == 1 && options.commit)
+			{
+				const char * stale = nullptr;
+
+				if (auto records = staged.Lookup(criteriaHash, options.stageMaxAge * 60ULL * 60 * 10000000); !records)
+				{
+					stale = "not_staged";
+				}
+				else if (auto found = records->empty() ? std::optional(waffle::Updates()) : session.SearchOffline(*records); !found)
+				{
+					stale = "not_found";
+				}
+				else
+				{
+					std::vector<LONG> downloaded;
+
+					for (LONG index = 0; index < found->size(); ++index)
+					{
+						if (auto update = found->Item(index); waffle::GetIsDownloaded(update) && !waffle::GetIsInstalled(update))
+						{
+							downloaded.push_back(index);
+						}
+					}
+
+					if (downloaded.empty() && !records->empty())
+					{
+						stale = "not_downloaded";
+					}
+					else
+					{
+						updates = found->Subset(downloaded);
+						committing = true;
+					}
+
+					if (log != nullptr)
+						(*log)("commit")("staged", records->size())("downloaded", downloaded.size());
+					else
+						std::wcout << std::format(L"Committing {} of {} staged updates", downloaded.size(), records->size()) << std::endl;
+				}
+
+				if (stale != nullptr)
+				{
+					if (log != nullptr)
+						(*log)("commit_stale")("reason", stale);
+					else
+						std::wcout << std::format(L"Staged updates are stale ({}); searching again", (const wchar_t *) _bstr_t(stale)) << std::endl;
+				}
+			}
+
+			// ĊJłƂ́Ac̍XVItCňČȂ
+			if (!updates && pass == 1 && options.resume && journal.Resumable(criteriaHash, 24ULL * 60 * 60 * 10000000))
+			{
+				auto outstanding = journal.Outstanding();
+
+				updates = outstanding.empty() ? std::optional(waffle::Updates()) : session.SearchOffline(outstanding);
+
+				if (updates)
+				{
+					// f (ʂ̎i) CXg[ꂽ̂͏
+					std::vector<LONG> pending;
+
+					for (LONG index = 0; index < updates->size(); ++index)
+					{
+						if (!waffle::GetIsInstalled(updates->Item(index)))
+						{
+							pending.push_back(index);
+						}
+					}
+
+					updates = updates->Subset(pending);
+
+					if (log != nullptr)
+						(*log)("resume")("outstanding", outstanding.size())("pending", pending.size())("reboot_pending", journal.RebootPending());
+					else
+						std::wcout << std::format(L"Resuming {} of {} outstanding updates from the journal", pending.size(), outstanding.size()) << std::endl;
+				}
+			}
+
+			if (!updates)
+			{
+				RunPhase(log, "search", [&]()
+				{
+					if (criteria.size() > 1)
+					{
+						// ͓̏Ɍ (LbV͎gȂ)
+
+						if (log != nullptr)
+						{
+							(*log)("search_start")("criteria_count", criteria.size())("timeout_ms", msTimeout);
+						}
+
+						updates = session.Search(criteria, msTimeout, [log](const _bstr_t & criteria, LONG count, std::chrono::milliseconds elapsed)
+						{
+							if (log != nullptr)
+								(*log)("search_criteria")("criteria", (const wchar_t *) criteria)("count", count)("elapsed_ms", elapsed.count());
+							else
+								std::wcout << std::format(L"{:4d} updates {:6d} ms: {}", count, elapsed.count(), (const wchar_t *) criteria) << L'\n';
+						});
+					}
+					else
+					{
+						if (log != nullptr)
+						{
+							(*log)("search_start")("criteria", (const wchar_t *) criteria.front())("timeout_ms", msTimeout);
+						}
+
+						updates = cache ? session.Search(criteria.front(), msTimeout, *cache) : session.Search(criteria.front(), msTimeout);
+					}
+
+					if (log != nullptr)
+					{
+						(*log)("search_end")("count", updates->size())("reboot_required", session.RebootRequired())("cache_hits", cache ? cache->Hits() : 0UL)("cache_misses", cache ? cache->Misses() : 0UL)("filtered", session.Filtered());
+					}
+				});
+
+				journal.BeginRun(criteriaHash, *updates);
+			}
+			else if (committing)
+			{
+				journal.BeginRun(criteriaHash, *updates);
+			}
+
+			auto searchElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - passStart);
+
+			if (cache && log == nullptr)
+			{
+				std::wcout << std::format(L"Search cache: hit {}, miss {}", cache->Hits(), cache->Misses()) << std::endl;
+			}
+
+			if (filter && log == nullptr)
+			{
+				std::wcout << std::format(L"Filter: {} updates excluded", session.Filtered()) << std::endl;
+			}
+
+			// ߐ؂܂łɏIƌ߂XV󂯓Ac͎̋@ɉ
+			std::optional<std::chrono::milliseconds> predicted;
+
+			if (options.deadline > 0 && !updates->empty())
+			{
+				auto remaining = std::max(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()), std::chrono::milliseconds::zero());
+				auto admission = waffle::AdmitByDeadline(*updates, durations, remaining, committing);
+
+				if (log != nullptr)
+					(*log)("deadline")("remaining_ms", remaining.count())("admitted", admission.admitted.size())("deferred", admission.deferred.size())("predicted_ms", admission.predicted.count());
+				else
+					std::wcout << std::format(L"Deadline: {} sec left, {} admitted, {} deferred, predicted {} sec", remaining.count() / 1000, admission.admitted.size(), admission.deferred.size(), admission.predicted.count() / 1000) << std::endl;
+
+				updates = updates->Subset(admission.admitted);
+				predicted = admission.predicted;
+			}
+
+			auto workStart = std::chrono::steady_clock::now();
+
+			callback.updates = &*updates;
+
+			if (!updates->empty())
+			{
+				if (governor && !committing)
+				{
+					governor->Start();
+
+					// iKςč蒼WuAʂĂn߂
+					session.SetDownloadGate([&]() { WaitForLoad(&*governor, maxPause, callback); });
+				}
+
+				if (committing)
+				{
+					RunPhase(log, "install", [&]()
+					{
+						if (options.plan)
+						{
+							InstallByPlan(session, *updates, log, callback);
+						}
+						else
+						{
+							durations.Start(waffle::DurationPhase::Install);
+							session.Install(*updates, callback);
+						}
+					});
+				}
+				else if (options.pipeline && !options.stage)
+				{
+					RunPhase(log, "download_install", [&]() { session.DownloadAndInstall(*updates, Callback{ log, nullptr, &journal, progress, &session.DownloadThroughput() }, Callback{ log, nullptr, &journal, progress }); });
+
+					if (governor)
+					{
+						governor->Stop();
+					}
+				}
+				else if (options.plan)
+				{
+					const auto MB = 1024ULL * 1024ULL;
+
+					auto budget = options.diskBudget > 0 ? std::min(options.diskBudget * MB, waffle::GetDownloadFreeSpace()) : waffle::GetDownloadFreeSpace();
+
+					auto plan = waffle::PlanDownload(*updates, budget, options.batch * MB);
+
+					PrintDownloadPlan(log, *updates, plan);
+
+					std::optional<std::chrono::milliseconds> firstCritical;
+
+					RunPhase(log, "download", [&]() { firstCritical = DownloadByPlan(session, *updates, plan, callback); });
+
+					if (governor)
+					{
+						governor->Stop();
+					}
+
+					if (log != nullptr)
+						(*log)("first_critical")("found", firstCritical.has_value())("elapsed_ms", firstCritical ? firstCritical->count() : 0LL);
+					else if (firstCritical)
+						std::wcout << std::format(L"First critical update: {} ms", firstCritical->count()) << std::endl;
+
+					// XV̓CXg[Ȃ
+					if (updates = updates->Subset(plan.Selected()); !updates->empty() && !options.stage)
+					{
+						RunPhase(log, "install", [&]() { InstallByPlan(session, *updates, log, callback); });
+					}
+				}
+				else
+				{
+					RunPhase(log, "download", [&]() { durations.Start(waffle::DurationPhase::Download); session.Download(*updates, callback); });
+
+					if (governor)
+					{
+						governor->Stop();
+					}
+
+					if (!options.stage)
+					{
+						RunPhase(log, "install", [&]() { durations.Start(waffle::DurationPhase::Install); session.Install(*updates, callback); });
+					}
+				}
+
+				auto & throughput = session.DownloadThroughput();
+
+				if (log != nullptr)
+					(*log)("download_stats")("bytes", throughput.Transferred())("average_bps", throughput.AverageRate())("stalls", session.Stalls());
+				else
+					std::wcout << std::format(L"Download: {:.1F} KB/s, stalled {}", throughput.AverageRate() / 1024, session.Stalls()) << std::endl;
+			}
+
+			durations.Save();
+
+			if (options.stage)
+			{
+				// CXg[ --commit ɉ񂵁A_E[hς񂾍XVL^Ă
+				auto count = staged.Store(criteriaHash, *updates);
+
+				if (log != nullptr)
+					(*log)("stage")("staged", count)("updates", updates->size());
+				else
+					std::wcout << std::format(L"Staged {} of {} updates for --commit", count, updates->size()) << std::endl;
+			}
+			else if (committing)
+			{
+				staged.Clear();
+			}
+
+			if (session.RebootRequired())
+			{
+				journal.RebootRequired();
+			}
+
+			journal.Flush();
+
+			if (predicted)
+			{
+				auto actual = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - workStart);
+
+				if (log != nullptr)
+					(*log)("deadline_result")("predicted_ms", predicted->count())("actual_ms", actual.count());
+				else
+					std::wcout << std::format(L"Predicted {} sec, actual {} sec", predicted->count() / 1000, actual.count() / 1000) << std::endl;
+			}
+
+			if (options.converge == 0 || options.stage)
+			{
+				break;
+			}
+
+			auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - passStart);
+
+			if (log != nullptr)
+				(*log)("pass")("pass", pass)("updates", updates->size())("search_ms", searchElapsed.count())("elapsed_ms", elapsed.count())("reboot_required", session.RebootRequired());
+			else
+				std::wcout << std::format(L"Pass {}: {} updates, search {} ms, total {} ms", pass, updates->size(), searchElapsed.count(), elapsed.count()) << std::endl;
+
+			// OƓXVȂȂAȏ͐i܂Ȃ
+			std::set<std::wstring> current;
+
+			for (LONG index = 0; index < updates->size(); ++index)
+			{
+				current.emplace((const wchar_t *) updates->Entry(index).updateID);
+			}
+
+			if (updates->empty() || session.RebootRequired() || pass >= options.converge || current == previous)
+			{
+				break;
+			}
+
+			previous = std::move(current);
+		}
+
+		// ċN҂Ɏ~܂s̕AċNKvȂƂ`
+		auto rebootRequired = session.RebootRequired() || journal.RebootPending();
+
+		journal.EndRun();
+
+		if (log != nullptr)
+		{
+			(*log)("exit")("code", rebootRequired ? 1 : 0)("reboot_required", rebootRequired)("retries", session.Retries());
+			return rebootRequired ? 1 : 0;
+		}
+
+		if (!rebootRequired)
 		{
 			return 0;
 		}
@@ -102,6 +1306,12 @@ int wmain()
 	}
 	catch (const std::exception & e)
 	{
+		if (events)
+		{
+			(*events)("exit")("code", -1)("message", e.what());
+			return -1;
+		}
+
 		std::wcout << e.what() << std::endl;
 		return -1;
 	}
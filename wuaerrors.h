@@ -0,0 +1,225 @@
+#pragma once
+
+#include "platform.h"
+
+#include <array>
+#include <algorithm>
+#include <string_view>
+
+namespace waffle
+{
+	// https://learn.microsoft.com/en-us/windows/win32/wua_sdk/wua-success-and-error-codes-
+	// https://learn.microsoft.com/en-us/troubleshoot/windows-client/deployment/common-windows-update-errors
+
+	enum class WUAErrorKind
+	{
+		Success,
+		Transient,
+		Permanent,
+	};
+
+	enum class WUAErrorCategory
+	{
+		Agent,
+		Network,
+		Policy,
+		Metadata,
+		Download,
+		Install,
+	};
+
+	struct WUAError
+	{
+		LONG code;
+		std::string_view name;
+		WUAErrorKind kind;
+		WUAErrorCategory category;
+		const char * text;
+
+		// 1 行目が短いメッセージ、2 行目以降が対処方法
+
+		constexpr std::string_view Message() const
+		{
+			std::string_view text(this->text);
+
+			return text.substr(0, text.find('\n'));
+		}
+
+		constexpr std::string_view Remediation() const
+		{
+			std::string_view text(this->text);
+
+			if (auto pos = text.find('\n'); pos != std::string_view::npos)
+			{
+				return text.substr(pos + 1);
+			}
+
+			return {};
+		}
+	};
+
+#define MACRO_WUA_ERROR(code, kind, category, text) WUAError{ code, #code, WUAErrorKind::kind, WUAErrorCategory::category, text }
+
+	inline constexpr auto WUA_ERRORS = []()
+	{
+		std::array errors
+		{
+			MACRO_WUA_ERROR(WU_S_SERVICE_STOP, Success, Agent, "WUA was stopped successfully."),
+			MACRO_WUA_ERROR(WU_S_SELFUPDATE, Success, Agent, "WUA updated itself."),
+			MACRO_WUA_ERROR(WU_S_UPDATE_ERROR, Success, Agent, "The operation completed successfully but errors occurred applying the updates."),
+			MACRO_WUA_ERROR(WU_S_MARKED_FOR_DISCONNECT, Success, Agent, "A callback was marked to be disconnected later because the request to disconnect the operation came while a callback was executing."),
+			MACRO_WUA_ERROR(WU_S_REBOOT_REQUIRED, Success, Agent, "The system must be restarted to complete installation of the update."),
+			MACRO_WUA_ERROR(WU_S_ALREADY_INSTALLED, Success, Agent, "The update to be installed is already installed on the system."),
+			MACRO_WUA_ERROR(WU_S_ALREADY_UNINSTALLED, Success, Agent, "The update to be removed is not installed on the system."),
+			MACRO_WUA_ERROR(WU_S_ALREADY_DOWNLOADED, Success, Agent, "The update to be downloaded has already been downloaded."),
+			MACRO_WUA_ERROR(WU_S_UH_INSTALLSTILLPENDING, Success, Agent, "The installation operation for the update is still in progress."),
+			MACRO_WUA_ERROR(WU_E_NO_SERVICE, Transient, Agent, "WUA was unable to provide the service."),
+			MACRO_WUA_ERROR(WU_E_MAX_CAPACITY_REACHED, Transient, Agent, "The maximum capacity of the service was exceeded."),
+			MACRO_WUA_ERROR(WU_E_UNKNOWN_ID, Permanent, Agent, "WUA cannot find an ID."),
+			MACRO_WUA_ERROR(WU_E_NOT_INITIALIZED, Permanent, Agent, "The object could not be initialized."),
+			MACRO_WUA_ERROR(WU_E_RANGEOVERLAP, Permanent, Download, "The update handler requested a byte range overlapping a previously requested range."),
+			MACRO_WUA_ERROR(WU_E_TOOMANYRANGES, Permanent, Download, "The requested number of byte ranges exceeds the maximum number."),
+			MACRO_WUA_ERROR(WU_E_INVALIDINDEX, Permanent, Agent, "The index to a collection was invalid."),
+			MACRO_WUA_ERROR(WU_E_ITEMNOTFOUND, Permanent, Agent, "The key for the item queried could not be found."),
+			MACRO_WUA_ERROR(WU_E_OPERATIONINPROGRESS, Transient, Agent, "Another conflicting operation was in progress. Some operations such as installation cannot be performed twice simultaneously."),
+			MACRO_WUA_ERROR(WU_E_COULDNOTCANCEL, Permanent, Agent, "Cancellation of the operation was not allowed."),
+			MACRO_WUA_ERROR(WU_E_NOOP, Permanent, Agent, "No operation was required."),
+			MACRO_WUA_ERROR(WU_E_XML_MISSINGDATA, Permanent, Metadata, "WUA could not find required information in the update's XML data."),
+			MACRO_WUA_ERROR(WU_E_CYCLE_DETECTED, Permanent, Metadata, "Circular update relationships were detected in the metadata."),
+			MACRO_WUA_ERROR(WU_E_TOO_DEEP_RELATION, Permanent, Metadata, "Update relationships too deep to evaluate were evaluated."),
+			MACRO_WUA_ERROR(WU_E_INVALID_RELATIONSHIP, Permanent, Metadata, "An invalid update relationship was detected."),
+			MACRO_WUA_ERROR(WU_E_REG_VALUE_INVALID, Permanent, Agent, "An invalid registry value was read."),
+			MACRO_WUA_ERROR(WU_E_DUPLICATE_ITEM, Permanent, Agent, "Operation tried to add a duplicate item to a list."),
+			MACRO_WUA_ERROR(WU_E_INVALID_INSTALL_REQUESTED, Permanent, Install, "Updates that are requested for install are not installable by the caller."),
+			MACRO_WUA_ERROR(WU_E_INSTALL_NOT_ALLOWED, Permanent, Install, "Operation tried to install while another installation was in progress or the system was pending a mandatory restart."),
+			MACRO_WUA_ERROR(WU_E_NOT_APPLICABLE, Permanent, Install, "Operation was not performed because there are no applicable updates."),
+			MACRO_WUA_ERROR(WU_E_NO_USERTOKEN, Permanent, Policy, "Operation failed because a required user token is missing."),
+			MACRO_WUA_ERROR(WU_E_EXCLUSIVE_INSTALL_CONFLICT, Permanent, Install, "An exclusive update can't be installed with other updates at the same time."),
+			MACRO_WUA_ERROR(WU_E_POLICY_NOT_SET, Permanent, Policy, "A policy value was not set."),
+			MACRO_WUA_ERROR(WU_E_SELFUPDATE_IN_PROGRESS, Transient, Agent, "The operation could not be performed because the Windows Update Agent is self-updating."),
+			MACRO_WUA_ERROR(WU_E_INVALID_UPDATE, Permanent, Metadata, "An update contains invalid metadata."),
+			MACRO_WUA_ERROR(WU_E_SERVICE_STOP, Transient, Agent, "Operation did not complete because the service or system was being shut down."),
+			MACRO_WUA_ERROR(WU_E_NO_CONNECTION, Transient, Network, "Operation did not complete because the network connection was unavailable."),
+			MACRO_WUA_ERROR(WU_E_TIME_OUT, Transient, Network, "Operation did not complete because it timed out."),
+			MACRO_WUA_ERROR(WU_E_EULAS_DECLINED, Permanent, Policy, "The license terms for all updates were declined."),
+			MACRO_WUA_ERROR(WU_E_NO_UPDATE, Permanent, Agent, "There are no updates."),
+			MACRO_WUA_ERROR(WU_E_USER_ACCESS_DISABLED, Permanent, Policy, "Group Policy settings prevented access to Windows Update."),
+			MACRO_WUA_ERROR(WU_E_INVALID_UPDATE_TYPE, Permanent, Metadata, "The type of update is invalid."),
+			MACRO_WUA_ERROR(WU_E_URL_TOO_LONG, Permanent, Network, "The URL exceeded the maximum length."),
+			MACRO_WUA_ERROR(WU_E_UNINSTALL_NOT_ALLOWED, Permanent, Policy, "The update could not be uninstalled because the request did not originate from a Windows Server Update Services (WSUS) server."),
+			MACRO_WUA_ERROR(WU_E_INVALID_PRODUCT_LICENSE, Permanent, Policy, "Search may have missed some updates before there is an unlicensed application on the system."),
+			MACRO_WUA_ERROR(WU_E_MISSING_HANDLER, Permanent, Metadata, "A component required to detect applicable updates was missing."),
+			MACRO_WUA_ERROR(WU_E_LEGACYSERVER, Permanent, Network, "An operation did not complete because it requires a newer version of server."),
+			MACRO_WUA_ERROR(WU_E_BIN_SOURCE_ABSENT, Permanent, Download, "A delta-compressed update could not be installed because it required the source."),
+			MACRO_WUA_ERROR(WU_E_SOURCE_ABSENT, Permanent, Download, "A full-file update could not be installed because it required the source."),
+			MACRO_WUA_ERROR(WU_E_WU_DISABLED, Permanent, Policy, "Access to an unmanaged server is not allowed."),
+			MACRO_WUA_ERROR(WU_E_CALL_CANCELLED_BY_POLICY, Permanent, Policy, "Operation did not complete because the **DisableWindowsUpdateAccess** policy was set in the registry."),
+			MACRO_WUA_ERROR(WU_E_INVALID_PROXY_SERVER, Permanent, Network, "The format of the proxy list was invalid."),
+			MACRO_WUA_ERROR(WU_E_INVALID_FILE, Permanent, Agent, "The file is in the wrong format."),
+			MACRO_WUA_ERROR(WU_E_INVALID_CRITERIA, Permanent, Metadata, "The search criteria string was invalid."),
+			MACRO_WUA_ERROR(WU_E_EULA_UNAVAILABLE, Permanent, Policy, "License terms could not be downloaded."),
+			MACRO_WUA_ERROR(WU_E_DOWNLOAD_FAILED, Transient, Download, "Update failed to download."),
+			MACRO_WUA_ERROR(WU_E_UPDATE_NOT_PROCESSED, Permanent, Agent, "The update was not processed."),
+			MACRO_WUA_ERROR(WU_E_INVALID_OPERATION, Permanent, Agent, "The object's current state did not allow the operation."),
+			MACRO_WUA_ERROR(WU_E_NOT_SUPPORTED, Permanent, Agent, "The functionality for the operation is not supported."),
+			MACRO_WUA_ERROR(WU_E_TOO_MANY_RESYNC, Transient, Network, "Agent is asked by server to resync too many times."),
+			MACRO_WUA_ERROR(WU_E_NO_SERVER_CORE_SUPPORT, Permanent, Policy, "The WUA API method does not run on the server core installation."),
+			MACRO_WUA_ERROR(WU_E_SYSPREP_IN_PROGRESS, Transient, Agent, "Service is not available while sysprep is running."),
+			MACRO_WUA_ERROR(WU_E_UNKNOWN_SERVICE, Permanent, Agent, "The update service is no longer registered with automatic updates."),
+			MACRO_WUA_ERROR(WU_E_NO_UI_SUPPORT, Permanent, Policy, "No support for the WUA user interface."),
+			MACRO_WUA_ERROR(WU_E_PER_MACHINE_UPDATE_ACCESS_DENIED, Permanent, Policy, "Only administrators can perform this operation on per-computer updates."),
+			MACRO_WUA_ERROR(WU_E_UNSUPPORTED_SEARCHSCOPE, Permanent, Metadata, "A search was attempted with a scope that is not currently supported for this type of search."),
+			MACRO_WUA_ERROR(WU_E_BAD_FILE_URL, Permanent, Network, "The URL does not point to a file."),
+			MACRO_WUA_ERROR(WU_E_INVALID_NOTIFICATION_INFO, Permanent, Metadata, "The featured update notification info returned by the server is invalid."),
+			MACRO_WUA_ERROR(WU_E_OUTOFRANGE, Permanent, Agent, "The data is out of range."),
+			MACRO_WUA_ERROR(WU_E_SETUP_IN_PROGRESS, Transient, Agent, "WUA operations are not available while operating system setup is running."),
+			MACRO_WUA_ERROR(WU_E_UNEXPECTED, Permanent, Agent, "An operation failed due to reasons not covered by another error code."),
+			MACRO_WUA_ERROR(WU_E_WINHTTP_INVALID_FILE, Permanent, Network, "The downloaded file has an unexpected content type."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_BAD_REQUEST, Permanent, Network, "Same as HTTP status 400 - The server could not process the request due to invalid syntax."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_DENIED, Permanent, Network, "Same as HTTP status 401 - The requested resource requires user authentication."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_FORBIDDEN, Permanent, Network, "Same as HTTP status 403 - Server understood the request, but declines to fulfill it."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_NOT_FOUND, Permanent, Network, "Same as HTTP status 404 - The server cannot find the requested URI (Uniform Resource Identifier)."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_BAD_METHOD, Permanent, Network, "Same as HTTP status 405 - The HTTP method is not allowed."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_REQUEST_TIMEOUT, Transient, Network, "Same as HTTP status 408 - The server timed out waiting for the request."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_CONFLICT, Transient, Network, "Same as HTTP status 409 - The request was not completed due to a conflict with the current state of the resource."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_GONE, Permanent, Network, "Same as HTTP status 410 - Requested resource is no longer available at the server."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_SERVER_ERROR, Transient, Network, "Same as HTTP status 500 - An error internal to the server prevented fulfilling the request."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_NOT_SUPPORTED, Permanent, Network, "Same as HTTP status 501 - Server does not support the functionality required to fulfill the request. "),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_BAD_GATEWAY, Transient, Network, "Same as HTTP status 502 - The server, while acting as a gateway or proxy, received an invalid response from the upstream server it accessed in attempting to fulfill the request."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_GATEWAY_TIMEOUT, Transient, Network, "Same as HTTP status 504 - The request was timed out waiting for a gateway."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_VERSION_NOT_SUP, Permanent, Network, "Same as HTTP status 505 - The server does not support the HTTP protocol version used for the request."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_NOT_MAPPED, Transient, Network, "The request could not be completed and the reason did not correspond to any of the WU_E_PT_HTTP_* error codes."),
+			MACRO_WUA_ERROR(WU_E_PT_WINHTTP_NAME_NOT_RESOLVED, Transient, Network, "Same as ERROR_WINHTTP_NAME_NOT_RESOLVED - The proxy server or target server name cannot be resolved."),
+			MACRO_WUA_ERROR(WU_E_PT_ECP_SUCCEEDED_WITH_ERRORS, Permanent, Network, "External .cab file processing completed with some errors.\nThis error can be caused by the Lightspeed Rocket for web filtering software. \r\nAdd the IP addresses of devices you want to get updates to the exceptions list of Lightspeed Rocket."),
+			MACRO_WUA_ERROR(WU_E_UH_INVALIDMETADATA, Permanent, Metadata, "A handler operation couldn't be completed because the update contains invalid metadata.\nRename the software redistribution folder and try to download the updates again: \r\nRename the following folders to *.BAK: \r\n-*%systemroot%\\system32\\catroot2* \r\nType the following commands at a command prompt. Press ENTER after you type each command.\r\n- `Ren %systemroot%\\SoftwareDistribution\\DataStore *.bak`\r\n- `Ren %systemroot%\\SoftwareDistribution\\Download *.bak`\r\n- `Ren %systemroot%\\system32\\catroot2 *.bak`"),
+			MACRO_WUA_ERROR(WU_E_ALL_UPDATES_FAILED, Permanent, Install, "failed for all the updates. Multiple root causes for this error.\ncommon issue is that antivirus software is blocking access to certain folders (like SoftwareDistribution). CBS.log analysis needed to determine the file or folder being protected."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_PROXY_AUTH_REQ, Permanent, Network, "as HTTP status 407 - proxy authentication is required.\nUnable to authenticate through a proxy server. | Either the Winhttp proxy or WinInet proxy settings aren't configured correctly. This error generally means that the Windows Update Agent was unable to connect to the update servers or your own update source, such as WSUS, Configuration Manager, or Microsoft Endpoint Manager, due to a proxy error. \r\n Verify the proxy settings on the client. The Windows Update Agent uses WinHTTP to scan for available updates. When there's a proxy server between the client and the update source, the proxy settings must be configured correctly on the clients to enable them to communicate by using the source's FQDN. \r\n Check with your network and proxy teams to confirm that the device can the update source without the proxy requiring user authentication."),
+			MACRO_WUA_ERROR(WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL, Transient, Network, "as HTTP status 503 - the service is temporarily overloaded.\nUnable to connect to the configured update source. | Network troubleshooting needed to resolve the connectivity issue. Check with your network and proxy teams to confirm that the device can the update source without the proxy requiring user authentication."),
+			MACRO_WUA_ERROR(WU_E_NO_INTERACTIVE_USER, Permanent, Policy, "Operation didn't complete because no interactive user is signed in.\nSign in to the device to start the installation and allow the device to restart."),
+			MACRO_WUA_ERROR(WU_E_UH_POSTREBOOTSTILLPENDING, Permanent, Install, "The post-restart operation for the update is still in progress.\nSome Windows updates require the device to be restarted. Restart the device to complete update installation."),
+			MACRO_WUA_ERROR(WU_E_DM_UNAUTHORIZED_LOCAL_USER, Permanent, Policy, "The download failed because the local user was denied authorization to download the content.\nEnsure that the user attempting to download and install updates has been provided with sufficient privileges to install updates (Local Administrator)."),
+			MACRO_WUA_ERROR(WU_E_CALL_CANCELLED, Transient, Agent, "Operation was canceled. | The operation was canceled by the user or service.\nmight also receive this error when we're unable to filter the results."),
+			MACRO_WUA_ERROR(WU_E_XML_INVALID, Permanent, Metadata, "Windows Update Agent found information in the update's XML data that isn't valid.\nCertain drivers contain more metadata information in Update.xml, which Orchestrator can interpret as data that isn't valid. Ensure that you have the latest Windows Update Agent installed on the device."),
+			MACRO_WUA_ERROR(WU_E_SETUP_SKIP_UPDATE, Permanent, Install, "An update to the Windows Update Agent was skipped due to a directive in the Wuident.cab file.\nYou might encounter this error when WSUS isn't sending the self-update to the clients.\r\nFor more information to resolve the issue, review [KB920659](/troubleshoot/windows-server/deployment/wsus-selfupdate-not-send-automatic-updates)."),
+			MACRO_WUA_ERROR(WU_E_PT_SOAPCLIENT_SOAPFAULT, Transient, Network, "SOAP client failed because there was a SOAP fault for reasons of `WU_E_PT_SOAP_*` error codes.\nThis issue occurs because Windows can't renew the cookies for Windows Update.  \r\nFor more information to resolve the issue, see [0x80244007 error when Windows tries to scan for updates on a WSUS server](https://support.microsoft.com/topic/0x80244007-error-when-windows-tries-to-scan-for-updates-on-a-wsus-server-6af342d9-9af6-f3bb-b6ad-2be56bf7826e)."),
+			MACRO_WUA_ERROR(WININET_E_CONNECTION_ABORTED, Transient, Network, "The connection with the server was closed abnormally, BITS is unable to transfer the file successfully.\nEncountered if BITS is broken or if the file being transferred can't be written to the destination folder on the client. This error is caused by connection errors while checking or downloading updates.\r\n From a cmd prompt run: `BITSADMIN /LIST /ALLUSERS /VERBOSE` \r\n Search for the 0x80072EFE error code. You should see a reference to an HTTP code with a specific file. Using a browser, try to download it manually, making sure you're using your organization's proxy settings. If the download fails, check with your proxy manager to allow for the communication to be sucesfull. Also check with your network team for this specific URL access."),
+			MACRO_WUA_ERROR(WININET_E_DECODING_FAILED, Permanent, Network, "Content decoding has failed, TLS 1.2 isn't configured correctly on the client.\nThis error generally means that the Windows Update Agent was unable to decode the received content. Install and configure TLS 1.2 by installing the update in [KB3140245](https://support.microsoft.com/topic/update-to-enable-tls-1-1-and-tls-1-2-as-default-secure-protocols-in-winhttp-in-windows-c4bd73d2-31d7-761e-0178-11268bb10392)."),
+			MACRO_WUA_ERROR(WININET_E_TIMEOUT, Transient, Network, "The operation timed out, Unable to scan for updates due to a connectivity issue to Windows Update, Configuration Manager, or WSUS.\nThis error generally means that the Windows Update Agent was unable to connect to the update servers or your own source, such as WSUS, Configuration Manager, or Microsoft Endpoint Manager. \r\n Check with your network team to ensure that the device can reach the update sources. For more info, see [Troubleshoot software update scan failures in Configuration Manager](/troubleshoot/mem/configmgr/troubleshoot-software-update-scan-failures). \r\n If you're using the public Microsoft update servers, check that your device can access the following Windows Update endpoints: \r\n `http://windowsupdate.microsoft.com` \r\n `https://*.windowsupdate.microsoft.com` \r\n `https://update.microsoft.com` \r\n `https://*.update.microsoft.com` \r\n `https://windowsupdate.com` \r\n `https://*.windowsupdate.com` \r\n `https://download.windowsupdate.com` \r\n `https://*.download.windowsupdate.com` \r\n `https://download.microsoft.com` \r\n `https://*.download.windowsupdate.com` \r\n `https://wustat.windows.com` \r\n `https://*.wustat.windows.com` \r\n `https://ntservicepack.microsoft.com`")
+		};
+
+		std::sort(errors.begin(), errors.end(), [](const WUAError & a, const WUAError & b) { return a.code < b.code; });
+
+		return errors;
+	}();
+
+#undef MACRO_WUA_ERROR
+
+	inline constexpr auto WUA_ERROR_NAMES = []()
+	{
+		std::array<const WUAError *, WUA_ERRORS.size()> names{};
+
+		for (size_t i = 0; i < WUA_ERRORS.size(); ++i)
+		{
+			names[i] = &WUA_ERRORS[i];
+		}
+
+		std::sort(names.begin(), names.end(), [](const WUAError * a, const WUAError * b) { return a->name < b->name; });
+
+		return names;
+	}();
+
+	constexpr const WUAError * FindWUAError(LONG code)
+	{
+		auto it = std::lower_bound(WUA_ERRORS.begin(), WUA_ERRORS.end(), code, [](const WUAError & error, LONG code) { return error.code < code; });
+
+		if (it == WUA_ERRORS.end() || it->code != code)
+		{
+			return nullptr;
+		}
+
+		return &*it;
+	}
+
+	constexpr const WUAError * FindWUAError(std::string_view name)
+	{
+		auto it = std::lower_bound(WUA_ERROR_NAMES.begin(), WUA_ERROR_NAMES.end(), name, [](const WUAError * error, std::string_view name) { return error->name < name; });
+
+		if (it == WUA_ERROR_NAMES.end() || (*it)->name != name)
+		{
+			return nullptr;
+		}
+
+		return *it;
+	}
+
+	constexpr bool IsTransientWUAError(LONG code)
+	{
+		auto error = FindWUAError(code);
+
+		return error != nullptr && error->kind == WUAErrorKind::Transient;
+	}
+
+	static_assert(std::adjacent_find(WUA_ERRORS.begin(), WUA_ERRORS.end(), [](const WUAError & a, const WUAError & b) { return a.code == b.code; }) == WUA_ERRORS.end());
+	static_assert(FindWUAError("WU_E_NO_CONNECTION") == FindWUAError(WU_E_NO_CONNECTION));
+	static_assert(IsTransientWUAError(WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL));
+}
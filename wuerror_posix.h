@@ -0,0 +1,107 @@
+#pragma once
+
+// Windows 以外で core をビルドするときに wuerror.h (と wininet.h) の代わりに使う (wuaerrors.h の表に載せた分だけ)
+
+#define WU_S_SERVICE_STOP 0x00240001L
+#define WU_S_SELFUPDATE 0x00240002L
+#define WU_S_UPDATE_ERROR 0x00240003L
+#define WU_S_MARKED_FOR_DISCONNECT 0x00240004L
+#define WU_S_REBOOT_REQUIRED 0x00240005L
+#define WU_S_ALREADY_INSTALLED 0x00240006L
+#define WU_S_ALREADY_UNINSTALLED 0x00240007L
+#define WU_S_ALREADY_DOWNLOADED 0x00240008L
+#define WU_S_UH_INSTALLSTILLPENDING 0x00242015L
+#define WU_E_NO_SERVICE ((HRESULT)0x80240001L)
+#define WU_E_MAX_CAPACITY_REACHED ((HRESULT)0x80240002L)
+#define WU_E_UNKNOWN_ID ((HRESULT)0x80240003L)
+#define WU_E_NOT_INITIALIZED ((HRESULT)0x80240004L)
+#define WU_E_RANGEOVERLAP ((HRESULT)0x80240005L)
+#define WU_E_TOOMANYRANGES ((HRESULT)0x80240006L)
+#define WU_E_INVALIDINDEX ((HRESULT)0x80240007L)
+#define WU_E_ITEMNOTFOUND ((HRESULT)0x80240008L)
+#define WU_E_OPERATIONINPROGRESS ((HRESULT)0x80240009L)
+#define WU_E_COULDNOTCANCEL ((HRESULT)0x8024000AL)
+#define WU_E_CALL_CANCELLED ((HRESULT)0x8024000BL)
+#define WU_E_NOOP ((HRESULT)0x8024000CL)
+#define WU_E_XML_MISSINGDATA ((HRESULT)0x8024000DL)
+#define WU_E_XML_INVALID ((HRESULT)0x8024000EL)
+#define WU_E_CYCLE_DETECTED ((HRESULT)0x8024000FL)
+#define WU_E_TOO_DEEP_RELATION ((HRESULT)0x80240010L)
+#define WU_E_INVALID_RELATIONSHIP ((HRESULT)0x80240011L)
+#define WU_E_REG_VALUE_INVALID ((HRESULT)0x80240012L)
+#define WU_E_DUPLICATE_ITEM ((HRESULT)0x80240013L)
+#define WU_E_INVALID_INSTALL_REQUESTED ((HRESULT)0x80240014L)
+#define WU_E_INSTALL_NOT_ALLOWED ((HRESULT)0x80240016L)
+#define WU_E_NOT_APPLICABLE ((HRESULT)0x80240017L)
+#define WU_E_NO_USERTOKEN ((HRESULT)0x80240018L)
+#define WU_E_EXCLUSIVE_INSTALL_CONFLICT ((HRESULT)0x80240019L)
+#define WU_E_POLICY_NOT_SET ((HRESULT)0x8024001AL)
+#define WU_E_SELFUPDATE_IN_PROGRESS ((HRESULT)0x8024001BL)
+#define WU_E_INVALID_UPDATE ((HRESULT)0x8024001DL)
+#define WU_E_SERVICE_STOP ((HRESULT)0x8024001EL)
+#define WU_E_NO_CONNECTION ((HRESULT)0x8024001FL)
+#define WU_E_NO_INTERACTIVE_USER ((HRESULT)0x80240020L)
+#define WU_E_TIME_OUT ((HRESULT)0x80240021L)
+#define WU_E_ALL_UPDATES_FAILED ((HRESULT)0x80240022L)
+#define WU_E_EULAS_DECLINED ((HRESULT)0x80240023L)
+#define WU_E_NO_UPDATE ((HRESULT)0x80240024L)
+#define WU_E_USER_ACCESS_DISABLED ((HRESULT)0x80240025L)
+#define WU_E_INVALID_UPDATE_TYPE ((HRESULT)0x80240026L)
+#define WU_E_URL_TOO_LONG ((HRESULT)0x80240027L)
+#define WU_E_UNINSTALL_NOT_ALLOWED ((HRESULT)0x80240028L)
+#define WU_E_INVALID_PRODUCT_LICENSE ((HRESULT)0x80240029L)
+#define WU_E_MISSING_HANDLER ((HRESULT)0x8024002AL)
+#define WU_E_LEGACYSERVER ((HRESULT)0x8024002BL)
+#define WU_E_BIN_SOURCE_ABSENT ((HRESULT)0x8024002CL)
+#define WU_E_SOURCE_ABSENT ((HRESULT)0x8024002DL)
+#define WU_E_WU_DISABLED ((HRESULT)0x8024002EL)
+#define WU_E_CALL_CANCELLED_BY_POLICY ((HRESULT)0x8024002FL)
+#define WU_E_INVALID_PROXY_SERVER ((HRESULT)0x80240030L)
+#define WU_E_INVALID_FILE ((HRESULT)0x80240031L)
+#define WU_E_INVALID_CRITERIA ((HRESULT)0x80240032L)
+#define WU_E_EULA_UNAVAILABLE ((HRESULT)0x80240033L)
+#define WU_E_DOWNLOAD_FAILED ((HRESULT)0x80240034L)
+#define WU_E_UPDATE_NOT_PROCESSED ((HRESULT)0x80240035L)
+#define WU_E_INVALID_OPERATION ((HRESULT)0x80240036L)
+#define WU_E_NOT_SUPPORTED ((HRESULT)0x80240037L)
+#define WU_E_WINHTTP_INVALID_FILE ((HRESULT)0x80240038L)
+#define WU_E_TOO_MANY_RESYNC ((HRESULT)0x80240039L)
+#define WU_E_NO_SERVER_CORE_SUPPORT ((HRESULT)0x80240040L)
+#define WU_E_SYSPREP_IN_PROGRESS ((HRESULT)0x80240041L)
+#define WU_E_UNKNOWN_SERVICE ((HRESULT)0x80240042L)
+#define WU_E_NO_UI_SUPPORT ((HRESULT)0x80240043L)
+#define WU_E_PER_MACHINE_UPDATE_ACCESS_DENIED ((HRESULT)0x80240044L)
+#define WU_E_UNSUPPORTED_SEARCHSCOPE ((HRESULT)0x80240045L)
+#define WU_E_BAD_FILE_URL ((HRESULT)0x80240046L)
+#define WU_E_INVALID_NOTIFICATION_INFO ((HRESULT)0x80240048L)
+#define WU_E_OUTOFRANGE ((HRESULT)0x80240049L)
+#define WU_E_SETUP_IN_PROGRESS ((HRESULT)0x8024004AL)
+#define WU_E_UNEXPECTED ((HRESULT)0x80240FFFL)
+#define WU_E_PT_SOAPCLIENT_SOAPFAULT ((HRESULT)0x80244007L)
+#define WU_E_PT_HTTP_STATUS_BAD_REQUEST ((HRESULT)0x80244016L)
+#define WU_E_PT_HTTP_STATUS_DENIED ((HRESULT)0x80244017L)
+#define WU_E_PT_HTTP_STATUS_FORBIDDEN ((HRESULT)0x80244018L)
+#define WU_E_PT_HTTP_STATUS_NOT_FOUND ((HRESULT)0x80244019L)
+#define WU_E_PT_HTTP_STATUS_BAD_METHOD ((HRESULT)0x8024401AL)
+#define WU_E_PT_HTTP_STATUS_PROXY_AUTH_REQ ((HRESULT)0x8024401BL)
+#define WU_E_PT_HTTP_STATUS_REQUEST_TIMEOUT ((HRESULT)0x8024401CL)
+#define WU_E_PT_HTTP_STATUS_CONFLICT ((HRESULT)0x8024401DL)
+#define WU_E_PT_HTTP_STATUS_GONE ((HRESULT)0x8024401EL)
+#define WU_E_PT_HTTP_STATUS_SERVER_ERROR ((HRESULT)0x8024401FL)
+#define WU_E_PT_HTTP_STATUS_NOT_SUPPORTED ((HRESULT)0x80244020L)
+#define WU_E_PT_HTTP_STATUS_BAD_GATEWAY ((HRESULT)0x80244021L)
+#define WU_E_PT_HTTP_STATUS_SERVICE_UNAVAIL ((HRESULT)0x80244022L)
+#define WU_E_PT_HTTP_STATUS_GATEWAY_TIMEOUT ((HRESULT)0x80244023L)
+#define WU_E_PT_HTTP_STATUS_VERSION_NOT_SUP ((HRESULT)0x80244024L)
+#define WU_E_PT_HTTP_STATUS_NOT_MAPPED ((HRESULT)0x8024402BL)
+#define WU_E_PT_WINHTTP_NAME_NOT_RESOLVED ((HRESULT)0x8024402CL)
+#define WU_E_PT_ECP_SUCCEEDED_WITH_ERRORS ((HRESULT)0x8024402FL)
+#define WU_E_UH_INVALIDMETADATA ((HRESULT)0x80242006L)
+#define WU_E_UH_POSTREBOOTSTILLPENDING ((HRESULT)0x80242014L)
+#define WU_E_DM_UNAUTHORIZED_LOCAL_USER ((HRESULT)0x80246017L)
+#define WU_E_SETUP_SKIP_UPDATE ((HRESULT)0x8024D009L)
+
+// wininet.h から
+#define WININET_E_TIMEOUT ((HRESULT)0x80072EE2L)
+#define WININET_E_CONNECTION_ABORTED ((HRESULT)0x80072EFEL)
+#define WININET_E_DECODING_FAILED ((HRESULT)0x80072F8FL)